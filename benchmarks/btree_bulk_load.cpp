@@ -0,0 +1,96 @@
+// Compares BTree::bulk_load against repeated insert() for sequential IDs.
+// Usage: bench_btree_bulk_load [entries] [fill_factor]
+#include "BTree.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void reset_file(const std::string &path)
+{
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    double fill_factor = argc > 2 ? std::atof(argv[2]) : 1.0;
+    const std::string path = "bench_btree_bulk_load.db";
+
+    std::vector<std::pair<BTreeKey, RecordLocation>> entries;
+    entries.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        entries.emplace_back(BTreeKey(i + 1), RecordLocation(i + 1, 0, 64));
+    }
+
+    double insert_ms, bulk_ms;
+    uint64_t insert_pages, bulk_pages;
+
+    // Repeated insert()
+    reset_file(path);
+    {
+        DatabaseEngine db(path, 1000);
+        db.initialize();
+        BTree tree(&db);
+        tree.initialize();
+
+        uint64_t before = db.get_total_pages();
+        auto start = std::chrono::steady_clock::now();
+        for (const auto &entry : entries)
+        {
+            tree.insert(entry.first, entry.second);
+        }
+        insert_ms = elapsed_ms(start);
+        insert_pages = db.get_total_pages() - before;
+        db.close();
+    }
+
+    // bulk_load()
+    reset_file(path);
+    {
+        DatabaseEngine db(path, 1000);
+        db.initialize();
+        BTree tree(&db);
+        tree.initialize();
+
+        uint64_t before = db.get_total_pages();
+        auto start = std::chrono::steady_clock::now();
+        if (!tree.bulk_load(entries, fill_factor))
+        {
+            std::cerr << "Bulk load failed" << std::endl;
+            return 1;
+        }
+        bulk_ms = elapsed_ms(start);
+        bulk_pages = db.get_total_pages() - before;
+
+        // Spot-check the loaded tree
+        bool found = false;
+        for (size_t i = 0; i < count; i += 997)
+        {
+            if (tree.search(entries[i].first, found).page_id != entries[i].second.page_id || !found)
+            {
+                std::cerr << "Missing key " << i + 1 << " after bulk load" << std::endl;
+                return 1;
+            }
+        }
+        db.close();
+    }
+    reset_file(path);
+
+    std::printf("entries      %zu (fill factor %.2f)\n", count, fill_factor);
+    std::printf("insert()     %10.1f ms  %8llu pages  %8.0f entries/s\n", insert_ms,
+                (unsigned long long)insert_pages, count / (insert_ms / 1000.0));
+    std::printf("bulk_load()  %10.1f ms  %8llu pages  %8.0f entries/s\n", bulk_ms,
+                (unsigned long long)bulk_pages, count / (bulk_ms / 1000.0));
+    std::printf("speedup      %10.1fx\n", insert_ms / bulk_ms);
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Inserts and looks up long byte-string keys that share most of their
+// prefix, the case front coding packs, and checks that a key longer than
+// BTREE_MAX_KEY_SIZE is refused instead of colliding with its prefix.
+// Usage: bench_btree_byte_keys [entries]
+#include "BTree.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void reset_file(const std::string &path)
+{
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+}
+
+// 55-byte keys; consecutive ones differ only in their last few bytes
+static std::string make_key(size_t i)
+{
+    char key[96];
+    std::snprintf(key, sizeof(key), "org/acme/meetings/2026/room-%06zu/participant-%08zu", i / 1000, i);
+    return key;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 50000;
+    const std::string path = "bench_btree_byte_keys.db";
+
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        keys.push_back(make_key(i));
+    }
+
+    reset_file(path);
+    DatabaseEngine db(path, 1000);
+    db.initialize();
+    BTree tree(&db, BTreeKeyDescriptor::bytes());
+    tree.initialize();
+
+    // Shuffled insert order, so leaves split in the middle as well
+    uint64_t before = db.get_total_pages();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t index = (i * 7919) % count;
+        tree.insert(BTreeKey::from_string(keys[index]), RecordLocation(index + 1, 0, 64));
+    }
+    double insert_ms = elapsed_ms(start);
+    uint64_t pages = db.get_total_pages() - before;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        bool found = false;
+        RecordLocation location = tree.search(BTreeKey::from_string(keys[i]), found);
+        if (!found || location.page_id != i + 1)
+        {
+            std::cerr << "Missing key " << keys[i] << std::endl;
+            return 1;
+        }
+    }
+    double search_ms = elapsed_ms(start);
+
+    // Same first 64 bytes as a stored key, one byte longer
+    std::string stored = keys[0] + std::string(BTREE_MAX_KEY_SIZE - keys[0].size(), 'x');
+    tree.insert(BTreeKey::from_string(stored), RecordLocation(1, 0, 64));
+    bool found = false;
+    if (tree.insert(BTreeKey::from_string(stored + "y"), RecordLocation(2, 0, 64)) ||
+        tree.search(BTreeKey::from_string(stored + "y"), found).page_id != 0 || found ||
+        tree.search(BTreeKey::from_string(stored), found).page_id != 1 || !found)
+    {
+        std::cerr << "A key longer than " << BTREE_MAX_KEY_SIZE << " bytes was not refused" << std::endl;
+        return 1;
+    }
+
+    db.close();
+    reset_file(path);
+
+    std::printf("entries   %zu keys of %zu bytes\n", count, keys[0].size());
+    std::printf("insert()  %10.1f ms  %8llu pages  %8.0f entries/s  %6.1f keys/page\n", insert_ms,
+                (unsigned long long)pages, count / (insert_ms / 1000.0), double(count) / pages);
+    std::printf("search()  %10.1f ms  %23.0f lookups/s\n", search_ms, count / (search_ms / 1000.0));
+    return 0;
+}
@@ -0,0 +1,180 @@
+// Page compression on a meeting history: chat messages in record heap pages
+// indexed by a B-Tree. Times the LZ4 codec on those pages, then compares
+// the space the database takes on disk and random reads through a small
+// pool (every miss decompresses) with compression off and on. The files
+// stay in the page cache, so the read column is the CPU cost of
+// decompressing; from a cold disk the bytes read shrink with the file.
+// Usage: bench_page_compression [messages] [reads]
+#include "DatabaseEngine.h"
+#include "BTree.h"
+#include "Lz4.h"
+#include "RecordHeap.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void reset_file(const std::string &path)
+{
+    for (const char *suffix : {"", ".wal", ".pagemap", ".extents"})
+    {
+        std::remove((path + suffix).c_str());
+    }
+}
+
+// Allocated bytes, so the holes left by compressed pages do not count
+static double disk_mb(const std::string &path)
+{
+    double bytes = 0;
+    for (const char *suffix : {"", ".pagemap", ".extents"})
+    {
+        struct stat st;
+        if (stat((path + suffix).c_str(), &st) == 0)
+        {
+            bytes += static_cast<double>(st.st_blocks) * 512;
+        }
+    }
+    return bytes / (1024.0 * 1024.0);
+}
+
+static std::string message(std::mt19937 &random, uint64_t id)
+{
+    static const char *words[] = {"meeting", "agenda", "the", "roadmap", "please", "review", "slides",
+                                  "tomorrow", "at", "10", "and", "we", "can", "discuss", "budget", "ok"};
+    std::string text = "{\"id\":" + std::to_string(id) + ",\"sender\":" + std::to_string(random() % 40) +
+                       ",\"text\":\"";
+    size_t count = 4 + random() % 30;
+    for (size_t i = 0; i < count; i++)
+    {
+        text += words[random() % 16];
+        text += ' ';
+    }
+    return text + "\"}";
+}
+
+static void build(const std::string &path, bool compress, size_t messages)
+{
+    reset_file(path);
+    DatabaseEngine db(path, 1000);
+    db.set_page_compression(compress);
+    db.initialize();
+    RecordHeap heap(&db);
+    BTree index(&db);
+    heap.initialize();
+    index.initialize();
+
+    std::mt19937 random(42);
+    for (uint64_t id = 0; id < messages; id++)
+    {
+        std::string text = message(random, id);
+        RecordLocation loc = heap.insert(reinterpret_cast<const uint8_t *>(text.data()), text.size());
+        index.insert(id, loc);
+    }
+    heap.flush();
+    db.update_header([&](DatabaseHeader &header)
+                     {
+                         header.messages_btree_root = index.get_root_page_id();
+                         header.record_heap_fsm_page = heap.get_fsm_page_id();
+                     });
+    db.write_header();
+    db.close();
+}
+
+static double random_reads(const std::string &path, bool compress, size_t messages, size_t reads)
+{
+    DatabaseEngine db(path, 32);
+    db.set_page_compression(compress);
+    db.open();
+    RecordHeap heap(&db);
+    BTree index(&db);
+    heap.load(db.get_header().record_heap_fsm_page);
+    index.load(db.get_header().messages_btree_root);
+
+    std::mt19937 random(7);
+    size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < reads; i++)
+    {
+        bool found;
+        RecordLocation loc = index.search(random() % messages, found);
+        RecordView view;
+        if (found && heap.read(loc, view))
+        {
+            bytes += view.size;
+        }
+    }
+    double ms = elapsed_ms(start);
+    db.close();
+    return bytes > 0 ? ms : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t messages = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    size_t reads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 50000;
+    const std::string path = "bench_page_compression.db";
+
+    // Codec alone, on the heap pages of a plain build
+    build(path, false, messages);
+    std::vector<Page> pages;
+    {
+        DatabaseEngine db(path, 1000);
+        db.open(true);
+        struct stat st;
+        stat(path.c_str(), &st);
+        for (uint64_t id = 1; id < static_cast<uint64_t>(st.st_size) / PAGE_SIZE; id++)
+        {
+            Page page = db.read_page(id);
+            if (page.header.type == RECORD_HEAP)
+            {
+                pages.push_back(page);
+            }
+        }
+        db.close();
+    }
+
+    std::vector<uint8_t> image(PAGE_SIZE);
+    std::vector<uint8_t> compressed(PAGE_SIZE);
+    std::vector<std::vector<uint8_t>> blocks;
+    size_t compressed_bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const Page &page : pages)
+    {
+        page.serialize(image.data());
+        size_t size = lz4_compress(image.data(), PAGE_SIZE, compressed.data(), compressed.size());
+        blocks.emplace_back(compressed.begin(), compressed.begin() + size);
+        compressed_bytes += size;
+    }
+    double compress_ms = elapsed_ms(start);
+    start = std::chrono::steady_clock::now();
+    for (const auto &block : blocks)
+    {
+        lz4_decompress(block.data(), block.size(), image.data(), PAGE_SIZE);
+    }
+    double decompress_ms = elapsed_ms(start);
+
+    double mb = static_cast<double>(pages.size()) * PAGE_SIZE / (1024.0 * 1024.0);
+    std::printf("%zu messages, %zu heap pages, compressed to %.1f%%\n", messages, pages.size(),
+                100.0 * compressed_bytes / (pages.size() * PAGE_SIZE));
+    std::printf("lz4 compress   %8.1f MB/s\nlz4 decompress %8.1f MB/s\n\n", mb / (compress_ms / 1000.0),
+                mb / (decompress_ms / 1000.0));
+
+    std::printf("%-12s %10s %12s %14s\n", "compression", "disk MB", "read ms", "reads/s");
+    for (bool compress : {false, true})
+    {
+        build(path, compress, messages);
+        double size = disk_mb(path);
+        double ms = random_reads(path, compress, messages, reads);
+        std::printf("%-12s %10.1f %12.1f %14.0f\n", compress ? "on" : "off", size, ms, reads / (ms / 1000.0));
+    }
+    reset_file(path);
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Cost of matching a request path as the route table grows: the server's
+// own routes, then the same with thousands of extra routes beside them.
+// Usage: bench_router [matches]
+#include "Router.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char *SERVER_ROUTES[][2] = {
+    {"POST", "/api/v1/auth/register"},
+    {"POST", "/api/v1/auth/login"},
+    {"GET", "/api/v1/users/me"},
+    {"POST", "/api/v1/meetings/create"},
+    {"GET", "/api/v1/meetings/my-meetings"},
+    {"GET", "/api/v1/meetings/:id<uint>/messages"},
+    {"POST", "/api/v1/meetings/:id<uint>/messages"},
+    {"GET", "/api/v1/meetings/:id<uint>/files"},
+    {"GET", "/api/v1/meetings/:id<uint>/files/:file_id<uint>/download"},
+    {"DELETE", "/api/v1/meetings/:id<uint>/files/:file_id<uint>"},
+    {"POST", "/api/v1/meetings/:id<uint>/whiteboard/draw"},
+    {"DELETE", "/api/v1/meetings/:id<uint>/whiteboard/elements/:element_id<uint>"},
+    {"GET", "/api/v1/meetings/:id<uint>/whiteboard/elements"},
+    {"GET", "/api/v1/meetings/:id<uint>/webrtc/signals"},
+    {"GET", "/api/v1/meetings/:id<uint>/participants"},
+    {"GET", "/health"},
+};
+
+static const char *PATHS[][2] = {
+    {"GET", "/api/v1/meetings/42/messages"},
+    {"GET", "/api/v1/meetings/42/files/7/download"},
+    {"DELETE", "/api/v1/meetings/42/whiteboard/elements/1234"},
+    {"GET", "/health"},
+};
+
+static void run(size_t extra_routes, size_t matches)
+{
+    Router router;
+    RouteHandler handler = [](HTTPRequest &, HTTPResponse &) {};
+    for (const auto &route : SERVER_ROUTES)
+    {
+        router.add(route[0], route[1], handler);
+    }
+    for (size_t i = 0; i < extra_routes; i++)
+    {
+        router.add("GET", "/api/v1/meetings/:id<uint>/extra" + std::to_string(i) + "/:item", handler);
+        router.add("POST", "/api/v2/resource" + std::to_string(i) + "/:id<uint>", handler);
+    }
+
+    size_t found = 0;
+    PathParams params;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < matches; i++)
+    {
+        const auto &path = PATHS[i % (sizeof(PATHS) / sizeof(PATHS[0]))];
+        found += router.match(path[0], path[1], params) != nullptr;
+    }
+    double ms = elapsed_ms(start);
+    std::printf("%8zu %10.1f %14.0f %10.1f   (%zu)\n", router.size(), ms, matches / (ms / 1000.0),
+                ms * 1e6 / matches, found);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t matches = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+
+    std::printf("%8s %10s %14s %10s\n", "routes", "ms", "matches/s", "ns/match");
+    run(0, matches);
+    run(500, matches);
+    run(5000, matches);
+    return 0;
+}
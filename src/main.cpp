@@ -55,6 +55,28 @@ std::string serialize_signal(const WebRTCSignal &sig)
     return json;
 }
 
+std::string serialize_element(const WhiteboardElement &elem)
+{
+    return JSON::build(
+        JSON::field("element_id", elem.element_id) + "," +
+        JSON::field("element_type", (int)elem.element_type) + "," +
+        JSON::field("x1", elem.x1) + "," +
+        JSON::field("y1", elem.y1) + "," +
+        JSON::field("x2", elem.x2) + "," +
+        JSON::field("y2", elem.y2) + "," +
+        JSON::field("color_r", (int)elem.color_r) + "," +
+        JSON::field("color_g", (int)elem.color_g) + "," +
+        JSON::field("color_b", (int)elem.color_b) + "," +
+        JSON::field("stroke_width", elem.stroke_width) + "," +
+        JSON::field("text", elem.text));
+}
+
+// A WebSocket push event: {"type":..., <payload>}
+std::string ws_event(const std::string &type, const std::string &payload = "")
+{
+    return JSON::build(JSON::field("type", type) + (payload.empty() ? "" : "," + payload));
+}
+
 // Global server pointer for signal handling
 HTTPServer *g_server = nullptr;
 
@@ -71,8 +93,41 @@ void signal_handler(int signal)
 std::map<uint64_t, std::vector<WebRTCSignal>> pending_signals;
 std::mutex signals_mutex;
 
+// meeting_server --scrub: verify every page checksum of the database file
+// and exit, 0 when all pages are intact
+int scrub_database(const std::string &filename)
+{
+    DatabaseEngine db(filename, DEFAULT_BUFFER_POOL_FRAMES, PAGE_IO_MMAP);
+
+    // Never read-write: a server may be running on the file, and replaying
+    // its log here would truncate it under the server. Nothing locks the
+    // file, so a pending log is the only sign and the operator has to act.
+    if (!db.open(true))
+    {
+        std::cerr << "Cannot open " << filename << " read-only for scrubbing. If the log is not empty, "
+                  << "stop the server (or start and stop it once to replay a crash's log) and retry" << std::endl;
+        return 2;
+    }
+
+    ScrubReport report = db.scrub();
+    db.close();
+
+    std::cout << "Scrubbed " << report.pages_checked << " pages of " << filename << ": "
+              << report.corrupt_pages.size() << " corrupt" << std::endl;
+    for (uint64_t page_id : report.corrupt_pages)
+    {
+        std::cout << "  page " << page_id << std::endl;
+    }
+    return report.corrupt_pages.empty() ? 0 : 1;
+}
+
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && std::string(argv[1]) == "--scrub")
+    {
+        return scrub_database("meeting_system.db");
+    }
+
     std::cout << "========================================" << std::endl;
     std::cout << "  Meeting System Server Starting...    " << std::endl;
     std::cout << "========================================" << std::endl;
@@ -88,7 +143,11 @@ int main(int argc, char *argv[])
     {
         // Initialize database
         std::cout << "\n[1/6] Initializing database..." << std::endl;
-        DatabaseEngine db("meeting_system.db");
+        // Pool misses, most of them the chat cache warm-up below, are served
+        // by copying out of a mapping of the file rather than a read call
+        DatabaseEngine db("meeting_system.db", DEFAULT_BUFFER_POOL_FRAMES, PAGE_IO_MMAP);
+        // Message, index leaf and file pages are mostly text and free space
+        db.set_page_compression(true);
 
         // Check if database exists
         bool db_exists = db.open();
@@ -112,8 +171,11 @@ int main(int argc, char *argv[])
             users_btree.initialize();
             meetings_btree.initialize();
 
-            db.get_header().users_btree_root = users_btree.get_root_page_id();
-            db.get_header().meetings_btree_root = meetings_btree.get_root_page_id();
+            db.update_header([&](DatabaseHeader &header)
+                             {
+                                 header.users_btree_root = users_btree.get_root_page_id();
+                                 header.meetings_btree_root = meetings_btree.get_root_page_id();
+                             });
             db.write_header();
         }
         else
@@ -134,8 +196,11 @@ int main(int argc, char *argv[])
             login_hash.initialize();
             meeting_code_hash.initialize();
 
-            db.get_header().login_hash_page = login_hash.get_header_page_id();
-            db.get_header().meeting_code_hash_page = meeting_code_hash.get_header_page_id();
+            db.update_header([&](DatabaseHeader &header)
+                             {
+                                 header.login_hash_page = login_hash.get_header_page_id();
+                                 header.meeting_code_hash_page = meeting_code_hash.get_header_page_id();
+                             });
             db.write_header();
         }
         else
@@ -151,7 +216,6 @@ int main(int argc, char *argv[])
         BTree messages_btree(&db);
         BTree files_btree(&db);
         BTree whiteboard_btree(&db);
-        HashTable chat_search_hash(&db);
         HashTable file_dedup_hash(&db);
 
         if (!db_exists)
@@ -159,14 +223,15 @@ int main(int argc, char *argv[])
             messages_btree.initialize();
             files_btree.initialize();
             whiteboard_btree.initialize();
-            chat_search_hash.initialize();
             file_dedup_hash.initialize();
 
-            db.get_header().messages_btree_root = messages_btree.get_root_page_id();
-            db.get_header().files_btree_root = files_btree.get_root_page_id();
-            db.get_header().whiteboard_btree_root = whiteboard_btree.get_root_page_id();
-            db.get_header().chat_search_hash_page = chat_search_hash.get_header_page_id();
-            db.get_header().file_dedup_hash_page = file_dedup_hash.get_header_page_id();
+            db.update_header([&](DatabaseHeader &header)
+                             {
+                                 header.messages_btree_root = messages_btree.get_root_page_id();
+                                 header.files_btree_root = files_btree.get_root_page_id();
+                                 header.whiteboard_btree_root = whiteboard_btree.get_root_page_id();
+                                 header.file_dedup_hash_page = file_dedup_hash.get_header_page_id();
+                             });
             db.write_header();
         }
         else
@@ -174,26 +239,158 @@ int main(int argc, char *argv[])
             messages_btree.load(db.get_header().messages_btree_root);
             files_btree.load(db.get_header().files_btree_root);
             whiteboard_btree.load(db.get_header().whiteboard_btree_root);
-            chat_search_hash.load(db.get_header().chat_search_hash_page);
             file_dedup_hash.load(db.get_header().file_dedup_hash_page);
         }
         std::cout << "  Messages B-Tree: root page " << messages_btree.get_root_page_id() << std::endl;
         std::cout << "  Files B-Tree: root page " << files_btree.get_root_page_id() << std::endl;
         std::cout << "  Whiteboard B-Tree: root page " << whiteboard_btree.get_root_page_id() << std::endl;
 
+        // Secondary indexes. Files created before an index existed get it
+        // backfilled once the managers are up; its root only goes into the
+        // header when the backfill is complete.
+        BTree messages_meeting_index(&db, BTreeKeyDescriptor::uint64(3));
+        BTree meetings_creator_index(&db, BTreeKeyDescriptor::uint64(2));
+        BTree files_meeting_index(&db, BTreeKeyDescriptor::uint64(2));
+        BTree whiteboard_meeting_index(&db, BTreeKeyDescriptor::uint64(3));
+
+        auto open_index = [](BTree &index, uint64_t root_page)
+        {
+            if (root_page == 0)
+            {
+                index.initialize();
+                return true;
+            }
+            index.load(root_page);
+            return false;
+        };
+        bool build_messages_index = open_index(messages_meeting_index, db.get_header().messages_meeting_index_root);
+        bool build_meetings_index = open_index(meetings_creator_index, db.get_header().meetings_creator_index_root);
+        bool build_files_index = open_index(files_meeting_index, db.get_header().files_meeting_index_root);
+        bool build_whiteboard_index = open_index(whiteboard_meeting_index, db.get_header().whiteboard_meeting_index_root);
+        std::cout << "  Secondary indexes: root pages " << messages_meeting_index.get_root_page_id() << ", "
+                  << meetings_creator_index.get_root_page_id() << ", "
+                  << files_meeting_index.get_root_page_id() << ", "
+                  << whiteboard_meeting_index.get_root_page_id() << std::endl;
+
+        // Keyword posting lists replace the old keyword -> latest message
+        // table, which is left as it was
+        HashTable chat_postings_hash(&db);
+        bool build_search_index = db.get_header().chat_postings_hash_page == 0;
+        if (build_search_index)
+        {
+            chat_postings_hash.initialize();
+        }
+        else
+        {
+            chat_postings_hash.load(db.get_header().chat_postings_hash_page);
+        }
+
+        // Initialize record heap (files created before it existed get one now)
+        RecordHeap record_heap(&db);
+        if (db.get_header().record_heap_fsm_page == 0)
+        {
+            record_heap.initialize();
+            db.update_header([&](DatabaseHeader &header)
+                             {
+                                 header.record_heap_fsm_page = record_heap.get_fsm_page_id();
+                             });
+            db.write_header();
+        }
+        else
+        {
+            record_heap.load(db.get_header().record_heap_fsm_page);
+        }
+        std::cout << "  Record Heap: free-space map page " << record_heap.get_fsm_page_id() << std::endl;
+
         // Initialize Managers
         std::cout << "\n[4/6] Initializing Managers..." << std::endl;
-        AuthManager auth_manager(&db, &users_btree, &login_hash);
-        MeetingManager meeting_manager(&db, &meetings_btree, &meeting_code_hash);
-        ChatManager chat_manager(&db, &messages_btree, &chat_search_hash);
-        FileManager file_manager(&db, &files_btree, &file_dedup_hash);
-        WhiteboardManager whiteboard_manager(&db, &whiteboard_btree);
+        AuthManager auth_manager(&db, &record_heap, &users_btree, &login_hash);
+        MeetingManager meeting_manager(&db, &record_heap, &meetings_btree, &meetings_creator_index, &meeting_code_hash);
+        ChatManager chat_manager(&db, &record_heap, &messages_btree, &messages_meeting_index, &chat_postings_hash);
+        FileManager file_manager(&db, &record_heap, &files_btree, &files_meeting_index, &file_dedup_hash);
+        WhiteboardManager whiteboard_manager(&db, &record_heap, &whiteboard_btree, &whiteboard_meeting_index);
         std::cout << "  All managers initialized (5 total)" << std::endl;
 
+        // Version-1 files: re-encode fixed-layout records in the compact format.
+        // Readers accept both layouts, so an interrupted run just resumes here.
+        if (db.get_header().version < DB_FORMAT_VERSION)
+        {
+            std::cout << "  Migrating records from format version " << db.get_header().version << "..." << std::endl;
+            size_t migrated = auth_manager.migrate_records() +
+                              meeting_manager.migrate_records() +
+                              chat_manager.migrate_records() +
+                              file_manager.migrate_records() +
+                              whiteboard_manager.migrate_records();
+
+            db.update_header([&](DatabaseHeader &header)
+                             {
+                                 header.version = DB_FORMAT_VERSION;
+                             });
+            db.write_header();
+            std::cout << "  Migrated " << migrated << " records" << std::endl;
+        }
+
+        if (build_messages_index || build_meetings_index || build_files_index || build_whiteboard_index ||
+            build_search_index)
+        {
+            size_t indexed = 0;
+            if (build_messages_index)
+            {
+                indexed += chat_manager.build_meeting_index();
+                db.update_header([&](DatabaseHeader &header)
+                                 {
+                                     header.messages_meeting_index_root = messages_meeting_index.get_root_page_id();
+                                 });
+            }
+            if (build_meetings_index)
+            {
+                indexed += meeting_manager.build_creator_index();
+                db.update_header([&](DatabaseHeader &header)
+                                 {
+                                     header.meetings_creator_index_root = meetings_creator_index.get_root_page_id();
+                                 });
+            }
+            if (build_files_index)
+            {
+                indexed += file_manager.build_meeting_index();
+                db.update_header([&](DatabaseHeader &header)
+                                 {
+                                     header.files_meeting_index_root = files_meeting_index.get_root_page_id();
+                                 });
+            }
+            if (build_whiteboard_index)
+            {
+                indexed += whiteboard_manager.build_meeting_index();
+                db.update_header([&](DatabaseHeader &header)
+                                 {
+                                     header.whiteboard_meeting_index_root = whiteboard_meeting_index.get_root_page_id();
+                                 });
+            }
+            if (build_search_index)
+            {
+                indexed += chat_manager.build_search_index();
+                db.update_header([&](DatabaseHeader &header)
+                                 {
+                                     header.chat_postings_hash_page = chat_postings_hash.get_header_page_id();
+                                 });
+            }
+            db.write_header();
+            std::cout << "  Built secondary indexes over " << indexed << " records" << std::endl;
+        }
+
+        // Reads every stored message once; with the mapped backend the
+        // pool misses are copies out of memory
+        chat_manager.warm_cache();
+
+        // Every structure is loaded and has its relocator registered; from
+        // here free space left by deletes is packed away in the background
+        db.start_vacuum();
+
         // Create HTTP Server
         std::cout << "\n[5/6] Setting up HTTP routes..." << std::endl;
         HTTPServer server(port);
         g_server = &server;
+        WebSocketManager &websockets = server.websocket_manager();
 
         // Register signal handler
         signal(SIGINT, signal_handler);
@@ -416,8 +613,8 @@ int main(int argc, char *argv[])
         // ============ CHAT ROUTES ============
 
         // POST /api/v1/meetings/:id/messages
-        server.add_route("POST", "/api/v1/meetings/:id/messages",
-                         [&auth_manager, &chat_manager](const HTTPRequest &req, HTTPResponse &res)
+        server.add_route("POST", "/api/v1/meetings/:id<uint>/messages",
+                         [&auth_manager, &chat_manager, &websockets](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
                              if (!auth_manager.verify_token(req.auth_token, user_id))
@@ -427,7 +624,7 @@ int main(int argc, char *argv[])
                                  return;
                              }
 
-                             uint64_t meeting_id = std::stoull(req.path_params.at("id"));
+                             uint64_t meeting_id = req.path_params.number("id");
 
                              User user;
                              auth_manager.get_user_by_id(user_id, user);
@@ -440,14 +637,17 @@ int main(int argc, char *argv[])
 
                              if (chat_manager.send_message(meeting_id, user_id, user.username, content, message, error))
                              {
+                                 std::string message_json = JSON::build(
+                                     JSON::field("message_id", message.message_id) + "," +
+                                     JSON::field("user_id", message.user_id) + "," +
+                                     JSON::field("username", message.username) + "," +
+                                     JSON::field("content", message.content) + "," +
+                                     JSON::field("timestamp", message.timestamp));
+                                 websockets.broadcast_to_room(meeting_id,
+                                                              ws_event("chat_message", JSON::raw_field("message", message_json)));
+
                                  res.set_status(201, "Created");
-                                 res.set_json_body(JSON::success(
-                                     JSON::field("message", JSON::build(
-                                                                JSON::field("message_id", message.message_id) + "," +
-                                                                JSON::field("user_id", message.user_id) + "," +
-                                                                JSON::field("username", message.username) + "," +
-                                                                JSON::field("content", message.content) + "," +
-                                                                JSON::field("timestamp", message.timestamp)))));
+                                 res.set_json_body(JSON::success(JSON::field("message", message_json)));
                              }
                              else
                              {
@@ -457,11 +657,11 @@ int main(int argc, char *argv[])
                          });
 
         // Helper function to parse meeting ID safely
-        auto parse_meeting_id = [](const std::map<std::string, std::string> &path_params, HTTPResponse &res) -> std::pair<bool, uint64_t>
+        auto parse_meeting_id = [](const PathParams &path_params, HTTPResponse &res) -> std::pair<bool, uint64_t>
         {
             try
             {
-                uint64_t meeting_id = std::stoull(path_params.at("id"));
+                uint64_t meeting_id = path_params.number("id");
                 return {true, meeting_id};
             }
             catch (const std::exception &e)
@@ -473,7 +673,7 @@ int main(int argc, char *argv[])
         };
 
         // Example: GET /api/v1/meetings/:id/messages
-        server.add_route("GET", "/api/v1/meetings/:id/messages",
+        server.add_route("GET", "/api/v1/meetings/:id<uint>/messages",
                          [&auth_manager, &chat_manager, parse_meeting_id](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
@@ -488,49 +688,71 @@ int main(int argc, char *argv[])
                              if (!success)
                                  return;
 
-                             // 🔥 LONG POLLING: Check for since parameter
-                             std::vector<Message> messages;
+                             auto messages_body = [](const std::vector<Message> &messages)
+                             {
+                                 std::vector<std::string> message_objects;
+                                 for (const auto &msg : messages)
+                                 {
+                                     message_objects.push_back(JSON::build(
+                                         JSON::field("message_id", msg.message_id) + "," +
+                                         JSON::field("username", msg.username) + "," +
+                                         JSON::field("content", msg.content) + "," +
+                                         JSON::field("timestamp", msg.timestamp)));
+                                 }
+                                 return JSON::success(JSON::field("messages", JSON::array(message_objects)));
+                             };
 
+                             // 🔥 LONG POLLING: Check for since parameter
                              auto since_it = req.query_params.find("since");
-                             if (since_it != req.query_params.end())
+                             if (since_it == req.query_params.end())
                              {
-                                 // Long polling mode
-                                 uint64_t since_timestamp = std::stoull(since_it->second);
-                                 int timeout = 20; // Default 20 seconds
+                                 // Normal mode
+                                 res.set_json_body(messages_body(chat_manager.get_messages(meeting_id, 50)));
+                                 return;
+                             }
 
+                             // Long polling mode: the connection is parked, not a thread
+                             uint64_t since_timestamp;
+                             int timeout = 20; // Default 20 seconds
+                             try
+                             {
+                                 since_timestamp = std::stoull(since_it->second);
                                  auto timeout_it = req.query_params.find("timeout");
                                  if (timeout_it != req.query_params.end())
                                  {
                                      timeout = std::stoi(timeout_it->second);
                                      timeout = std::min(30, std::max(1, timeout)); // Clamp 1-30s
                                  }
-
-                                 messages = chat_manager.wait_for_messages(meeting_id, since_timestamp, timeout);
-                             }
-                             else
-                             {
-                                 // Normal mode
-                                 messages = chat_manager.get_messages(meeting_id, 50);
                              }
-
-                             std::vector<std::string> message_objects;
-                             for (const auto &msg : messages)
+                             catch (const std::exception &e)
                              {
-                                 message_objects.push_back(JSON::build(
-                                     JSON::field("message_id", msg.message_id) + "," +
-                                     JSON::field("username", msg.username) + "," +
-                                     JSON::field("content", msg.content) + "," +
-                                     JSON::field("timestamp", msg.timestamp)));
+                                 res.set_status(400, "Bad Request");
+                                 res.set_json_body(JSON::error("Invalid since or timeout"));
+                                 return;
                              }
 
-                             res.set_json_body(JSON::success(
-                                 JSON::field("messages", JSON::array(message_objects))));
+                             auto waiter_id = std::make_shared<std::atomic<uint64_t>>(0);
+                             ResponseCallback respond = req.defer(timeout,
+                                 [&chat_manager, meeting_id, waiter_id, messages_body](const ResponseCallback &send)
+                                 {
+                                     chat_manager.cancel_wait(meeting_id, *waiter_id);
+                                     HTTPResponse timed_out;
+                                     timed_out.set_json_body(messages_body({}));
+                                     send(timed_out);
+                                 });
+                             *waiter_id = chat_manager.wait_for_messages(meeting_id, since_timestamp,
+                                 [respond, messages_body](const std::vector<Message> &messages)
+                                 {
+                                     HTTPResponse ready;
+                                     ready.set_json_body(messages_body(messages));
+                                     respond(ready);
+                                 });
                          });
 
         // ============ FILE ROUTES ============
 
         // GET /api/v1/meetings/:id/files
-        server.add_route("GET", "/api/v1/meetings/:id/files",
+        server.add_route("GET", "/api/v1/meetings/:id<uint>/files",
                          [&auth_manager, &file_manager, parse_meeting_id](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
@@ -562,7 +784,7 @@ int main(int argc, char *argv[])
                          });
 
         // POST /api/v1/meetings/:id/files/upload
-        server.add_route("POST", "/api/v1/meetings/:id/files/upload",
+        server.add_route("POST", "/api/v1/meetings/:id<uint>/files/upload",
                          [&auth_manager, &file_manager](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
@@ -573,18 +795,18 @@ int main(int argc, char *argv[])
                                  return;
                              }
 
-                             uint64_t meeting_id = std::stoull(req.path_params.at("id"));
+                             uint64_t meeting_id = req.path_params.number("id");
 
                              try
                              {
                                  std::cout << "DEBUG: upload handler received body size=" << req.body.size();
-                                 if (req.headers.find("Content-Type") != req.headers.end())
+                                 if (!req.header("Content-Type").empty())
                                  {
-                                     std::cout << ", Content-Type='" << req.headers.at("Content-Type") << "'";
+                                     std::cout << ", Content-Type='" << req.header("Content-Type") << "'";
                                  }
-                                 if (req.headers.find("Transfer-Encoding") != req.headers.end())
+                                 if (!req.header("Transfer-Encoding").empty())
                                  {
-                                     std::cout << ", Transfer-Encoding='" << req.headers.at("Transfer-Encoding") << "'";
+                                     std::cout << ", Transfer-Encoding='" << req.header("Transfer-Encoding") << "'";
                                  }
                                  std::cout << std::endl;
 
@@ -683,7 +905,7 @@ int main(int argc, char *argv[])
                          });
 
         // GET /api/v1/meetings/:id/files/:file_id/download
-        server.add_route("GET", "/api/v1/meetings/:id/files/:file_id/download",
+        server.add_route("GET", "/api/v1/meetings/:id<uint>/files/:file_id<uint>/download",
                          [&auth_manager, &file_manager](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
@@ -696,7 +918,7 @@ int main(int argc, char *argv[])
 
                              try
                              {
-                                 uint64_t file_id = std::stoull(req.path_params.at("file_id"));
+                                 uint64_t file_id = req.path_params.number("file_id");
 
                                  std::vector<uint8_t> file_data;
                                  FileRecord file;
@@ -726,7 +948,7 @@ int main(int argc, char *argv[])
                          });
 
         // DELETE /api/v1/meetings/:id/files/:file_id
-        server.add_route("DELETE", "/api/v1/meetings/:id/files/:file_id",
+        server.add_route("DELETE", "/api/v1/meetings/:id<uint>/files/:file_id<uint>",
                          [&auth_manager, &file_manager, &meeting_manager](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
@@ -739,8 +961,8 @@ int main(int argc, char *argv[])
 
                              try
                              {
-                                 uint64_t meeting_id = std::stoull(req.path_params.at("id"));
-                                 uint64_t file_id = std::stoull(req.path_params.at("file_id"));
+                                 uint64_t meeting_id = req.path_params.number("id");
+                                 uint64_t file_id = req.path_params.number("file_id");
 
                                  // Get meeting info to check creator
                                  Meeting meeting;
@@ -773,8 +995,8 @@ int main(int argc, char *argv[])
         // ============ WHITEBOARD ROUTES ============
 
         // POST /api/v1/meetings/:id/whiteboard/draw
-        server.add_route("POST", "/api/v1/meetings/:id/whiteboard/draw",
-                         [&auth_manager, &whiteboard_manager](const HTTPRequest &req, HTTPResponse &res)
+        server.add_route("POST", "/api/v1/meetings/:id<uint>/whiteboard/draw",
+                         [&auth_manager, &whiteboard_manager, &websockets](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
                              if (!auth_manager.verify_token(req.auth_token, user_id))
@@ -784,7 +1006,7 @@ int main(int argc, char *argv[])
                                  return;
                              }
 
-                             uint64_t meeting_id = std::stoull(req.path_params.at("id"));
+                             uint64_t meeting_id = req.path_params.number("id");
 
                              try
                              {
@@ -857,6 +1079,9 @@ int main(int argc, char *argv[])
                                  if (whiteboard_manager.draw_element(meeting_id, user_id, element_type, x1, y1, x2, y2,
                                                                      color_r, color_g, color_b, stroke_width, text, element, error))
                                  {
+                                     websockets.broadcast_to_room(meeting_id,
+                                                                  ws_event("whiteboard_element", JSON::raw_field("element", serialize_element(element))));
+
                                      res.set_status(201, "Created");
                                      res.set_json_body(JSON::success(
                                          JSON::field("element_id", element.element_id) + "," +
@@ -877,8 +1102,8 @@ int main(int argc, char *argv[])
                          });
 
         // DELETE /api/v1/meetings/:id/whiteboard/elements/:element_id
-        server.add_route("DELETE", "/api/v1/meetings/:id/whiteboard/elements/:element_id",
-                         [&auth_manager, &whiteboard_manager](const HTTPRequest &req, HTTPResponse &res)
+        server.add_route("DELETE", "/api/v1/meetings/:id<uint>/whiteboard/elements/:element_id<uint>",
+                         [&auth_manager, &whiteboard_manager, &websockets](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
                              if (!auth_manager.verify_token(req.auth_token, user_id))
@@ -888,12 +1113,14 @@ int main(int argc, char *argv[])
                                  return;
                              }
 
-                             uint64_t meeting_id = std::stoull(req.path_params.at("id"));
-                             uint64_t element_id = std::stoull(req.path_params.at("element_id"));
+                             uint64_t meeting_id = req.path_params.number("id");
+                             uint64_t element_id = req.path_params.number("element_id");
 
                              std::string error;
                              if (whiteboard_manager.delete_element(element_id, error))
                              {
+                                 websockets.broadcast_to_room(meeting_id,
+                                                              ws_event("whiteboard_element_deleted", JSON::field("element_id", element_id)));
                                  res.set_status(200, "OK");
                                  res.set_json_body(JSON::success(JSON::field("message", "Element deleted")));
                                  std::cout << "Deleted whiteboard element " << element_id << std::endl;
@@ -908,7 +1135,7 @@ int main(int argc, char *argv[])
         // In main.cpp, replace the GET whiteboard elements route:
 
         // GET /api/v1/meetings/:id/whiteboard/elements
-        server.add_route("GET", "/api/v1/meetings/:id/whiteboard/elements",
+        server.add_route("GET", "/api/v1/meetings/:id<uint>/whiteboard/elements",
                          [&auth_manager, &whiteboard_manager](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
@@ -919,7 +1146,7 @@ int main(int argc, char *argv[])
                                  return;
                              }
 
-                             uint64_t meeting_id = std::stoull(req.path_params.at("id"));
+                             uint64_t meeting_id = req.path_params.number("id");
 
                              auto elements = whiteboard_manager.get_meeting_elements(meeting_id);
 
@@ -927,18 +1154,7 @@ int main(int argc, char *argv[])
                              for (const auto &elem : elements)
                              {
                                  // ✅ INCLUDE ALL FIELDS including color, stroke_width, and text
-                                 element_objects.push_back(JSON::build(
-                                     JSON::field("element_id", elem.element_id) + "," +
-                                     JSON::field("element_type", (int)elem.element_type) + "," +
-                                     JSON::field("x1", elem.x1) + "," +
-                                     JSON::field("y1", elem.y1) + "," +
-                                     JSON::field("x2", elem.x2) + "," +
-                                     JSON::field("y2", elem.y2) + "," +
-                                     JSON::field("color_r", (int)elem.color_r) + "," +
-                                     JSON::field("color_g", (int)elem.color_g) + "," +
-                                     JSON::field("color_b", (int)elem.color_b) + "," +
-                                     JSON::field("stroke_width", elem.stroke_width) + "," +
-                                     JSON::field("text", elem.text)));
+                                 element_objects.push_back(serialize_element(elem));
                              }
 
                              res.set_json_body(JSON::success(
@@ -949,8 +1165,8 @@ int main(int argc, char *argv[])
 
         // POST /api/v1/meetings/:id/webrtc/signal
         // Send WebRTC signaling message (offer/answer/ICE candidate)
-        server.add_route("POST", "/api/v1/meetings/:id/webrtc/signal",
-                         [&auth_manager](const HTTPRequest &req, HTTPResponse &res)
+        server.add_route("POST", "/api/v1/meetings/:id<uint>/webrtc/signal",
+                         [&auth_manager, &websockets, parse_meeting_id](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
                              if (!auth_manager.verify_token(req.auth_token, user_id))
@@ -960,6 +1176,10 @@ int main(int argc, char *argv[])
                                  return;
                              }
 
+                             auto [success, meeting_id] = parse_meeting_id(req.path_params, res);
+                             if (!success)
+                                 return;
+
                              try
                              {
                                  auto data = JSON::parse(req.body);
@@ -1005,6 +1225,16 @@ int main(int argc, char *argv[])
                                      }
                                  }
 
+                                 // Pushed when the peer has this meeting's WebSocket open,
+                                 // otherwise kept for GET /webrtc/signals
+                                 if (websockets.send_to_user(meeting_id, signal.to_user_id,
+                                                             ws_event("webrtc_signal", JSON::raw_field("signal", serialize_signal(signal)))))
+                                 {
+                                     res.set_json_body(JSON::success(
+                                         JSON::field("message", "Signal delivered")));
+                                     return;
+                                 }
+
                                  {
                                      std::lock_guard<std::mutex> lock(signals_mutex);
                                      pending_signals[signal.to_user_id].push_back(signal);
@@ -1026,7 +1256,7 @@ int main(int argc, char *argv[])
 
         // GET /api/v1/meetings/:id/webrtc/signals
         // GET /api/v1/meetings/:id/webrtc/signals
-        server.add_route("GET", "/api/v1/meetings/:id/webrtc/signals",
+        server.add_route("GET", "/api/v1/meetings/:id<uint>/webrtc/signals",
                          [&auth_manager](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
@@ -1074,7 +1304,7 @@ int main(int argc, char *argv[])
 
         // GET /api/v1/meetings/:id/participants
         // Get list of participants for peer discovery
-        server.add_route("GET", "/api/v1/meetings/:id/participants",
+        server.add_route("GET", "/api/v1/meetings/:id<uint>/participants",
                          [&auth_manager, &meeting_manager](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
@@ -1085,7 +1315,7 @@ int main(int argc, char *argv[])
                                  return;
                              }
 
-                             uint64_t meeting_id = std::stoull(req.path_params.at("id"));
+                             uint64_t meeting_id = req.path_params.number("id");
 
                              auto participants = meeting_manager.get_participants(meeting_id);
 
@@ -1108,7 +1338,7 @@ int main(int argc, char *argv[])
 
         // DELETE /api/v1/meetings/:id
         // Delete a meeting and all associated data (messages, files, whiteboard, participants)
-        server.add_route("DELETE", "/api/v1/meetings/:id",
+        server.add_route("DELETE", "/api/v1/meetings/:id<uint>",
                          [&auth_manager, &meeting_manager, &chat_manager, &whiteboard_manager, &file_manager](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
@@ -1119,7 +1349,7 @@ int main(int argc, char *argv[])
                                  return;
                              }
 
-                             uint64_t meeting_id = std::stoull(req.path_params.at("id"));
+                             uint64_t meeting_id = req.path_params.number("id");
 
                              // Delete all associated data first
                              chat_manager.delete_meeting_messages(meeting_id);
@@ -1141,8 +1371,8 @@ int main(int argc, char *argv[])
                          });
 
         // DELETE /api/v1/meetings/:id/whiteboard/clear
-        server.add_route("DELETE", "/api/v1/meetings/:id/whiteboard/clear",
-                         [&auth_manager, &whiteboard_manager](const HTTPRequest &req, HTTPResponse &res)
+        server.add_route("DELETE", "/api/v1/meetings/:id<uint>/whiteboard/clear",
+                         [&auth_manager, &whiteboard_manager, &websockets](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
                              if (!auth_manager.verify_token(req.auth_token, user_id))
@@ -1152,11 +1382,12 @@ int main(int argc, char *argv[])
                                  return;
                              }
 
-                             uint64_t meeting_id = std::stoull(req.path_params.at("id"));
+                             uint64_t meeting_id = req.path_params.number("id");
 
                              std::string error;
                              if (whiteboard_manager.clear_whiteboard(meeting_id, error))
                              {
+                                 websockets.broadcast_to_room(meeting_id, ws_event("whiteboard_cleared"));
                                  res.set_json_body(JSON::success(
                                      JSON::field("message", "Whiteboard cleared")));
                              }
@@ -1168,8 +1399,8 @@ int main(int argc, char *argv[])
                          });
 
         // POST version for browsers that don't support DELETE
-        server.add_route("POST", "/api/v1/meetings/:id/whiteboard/clear",
-                         [&auth_manager, &whiteboard_manager](const HTTPRequest &req, HTTPResponse &res)
+        server.add_route("POST", "/api/v1/meetings/:id<uint>/whiteboard/clear",
+                         [&auth_manager, &whiteboard_manager, &websockets](const HTTPRequest &req, HTTPResponse &res)
                          {
                              uint64_t user_id;
                              if (!auth_manager.verify_token(req.auth_token, user_id))
@@ -1179,11 +1410,12 @@ int main(int argc, char *argv[])
                                  return;
                              }
 
-                             uint64_t meeting_id = std::stoull(req.path_params.at("id"));
+                             uint64_t meeting_id = req.path_params.number("id");
 
                              std::string error;
                              if (whiteboard_manager.clear_whiteboard(meeting_id, error))
                              {
+                                 websockets.broadcast_to_room(meeting_id, ws_event("whiteboard_cleared"));
                                  res.set_json_body(JSON::success(
                                      JSON::field("message", "Whiteboard cleared")));
                              }
@@ -1194,6 +1426,52 @@ int main(int argc, char *argv[])
                              }
                          });
 
+        // ============ WEBSOCKET ROUTE ============
+
+        // GET /api/v1/meetings/:id/ws
+        // Upgrade to a push channel for the meeting's chat messages, whiteboard
+        // changes and the WebRTC signals addressed to this user. Browsers
+        // cannot set headers on a WebSocket, so the token may come as ?token=
+        server.add_route("GET", "/api/v1/meetings/:id<uint>/ws",
+                         [&auth_manager, &meeting_manager, parse_meeting_id](const HTTPRequest &req, HTTPResponse &res)
+                         {
+                             std::string token = req.auth_token;
+                             auto token_it = req.query_params.find("token");
+                             if (token.empty() && token_it != req.query_params.end())
+                             {
+                                 token = token_it->second;
+                             }
+
+                             uint64_t user_id;
+                             if (!auth_manager.verify_token(token, user_id))
+                             {
+                                 res.set_status(401, "Unauthorized");
+                                 res.set_json_body(JSON::error("Invalid or expired token"));
+                                 return;
+                             }
+
+                             auto [success, meeting_id] = parse_meeting_id(req.path_params, res);
+                             if (!success)
+                                 return;
+
+                             Meeting meeting;
+                             if (!meeting_manager.get_meeting(meeting_id, meeting))
+                             {
+                                 res.set_status(404, "Not Found");
+                                 res.set_json_body(JSON::error("Meeting not found"));
+                                 return;
+                             }
+
+                             if (!req.upgrade)
+                             {
+                                 res.set_status(426, "Upgrade Required");
+                                 res.headers["Upgrade"] = "websocket";
+                                 res.set_json_body(JSON::error("Expected a WebSocket upgrade"));
+                                 return;
+                             }
+                             req.upgrade(meeting_id, user_id);
+                         });
+
         // Health check
         server.add_route("GET", "/health",
                          [](const HTTPRequest &req, HTTPResponse &res)
@@ -1201,7 +1479,7 @@ int main(int argc, char *argv[])
                              res.set_json_body("{\"status\":\"ok\",\"service\":\"MeetingSystem\"}");
                          });
 
-        std::cout << "  Registered " << 20 << " routes" << std::endl;
+        std::cout << "  Registered " << 21 << " routes" << std::endl;
 
         // Start server
         std::cout << "\n[6/6] Starting HTTP server on port " << port << "..." << std::endl;
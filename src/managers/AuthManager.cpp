@@ -41,26 +41,23 @@ bool AuthManager::is_token_expired(uint64_t expiry_time)
 
 bool AuthManager::store_user(const User &user)
 {
-    // Allocate page for user data
-    uint64_t data_page_id = db->allocate_page();
-
     // Serialize user
-    uint8_t buffer[User::serialized_size()];
-    user.serialize(buffer);
-
-    // Write to page
-    Page data_page;
-    memcpy(data_page.data, buffer, User::serialized_size());
-    db->write_page(data_page_id, data_page);
+    std::vector<uint8_t> buffer;
+    user.encode(buffer);
 
-    // Create record location
-    RecordLocation user_loc(data_page_id, 0, User::serialized_size());
+    // Pack into a shared heap page
+    RecordLocation user_loc = record_heap->insert(buffer.data(), buffer.size());
+    if (user_loc.page_id == 0)
+    {
+        std::cerr << "Failed to store user record" << std::endl;
+        return false;
+    }
 
     // Index in B-Tree by user_id
     if (!users_btree->insert(user.user_id, user_loc))
     {
         std::cerr << "Failed to insert user into B-Tree" << std::endl;
-        db->free_page(data_page_id);
+        record_heap->remove(user_loc);
         return false;
     }
 
@@ -113,7 +110,11 @@ bool AuthManager::register_user(const std::string &email, const std::string &use
         return false;
     }
 
-    db->write_header();
+    if (!db->write_header())
+    {
+        error = "Failed to commit user";
+        return false;
+    }
 
     out_user = user;
     std::cout << "User registered: " << username << " (ID: " << user.user_id << ")" << std::endl;
@@ -215,8 +216,11 @@ bool AuthManager::get_user_by_id(uint64_t user_id, User &out_user)
         return false;
     }
 
-    Page page = db->read_page(loc.page_id);
-    out_user.deserialize(page.data + loc.offset);
+    RecordView record;
+    if (!record_heap->read(loc, record) || !out_user.decode(record.data, record.size))
+    {
+        return false;
+    }
 
     return true;
 }
@@ -231,8 +235,16 @@ bool AuthManager::get_user_by_email(const std::string &email, User &out_user)
         return false;
     }
 
-    Page page = db->read_page(loc.page_id);
-    out_user.deserialize(page.data + loc.offset);
+    RecordView record;
+    if (!record_heap->read(loc, record) || !out_user.decode(record.data, record.size))
+    {
+        return false;
+    }
 
     return true;
-}
\ No newline at end of file
+}
+
+size_t AuthManager::migrate_records()
+{
+    return record_heap->reencode_legacy<User>(users_btree->range_search(1, UINT64_MAX));
+}
@@ -2,6 +2,7 @@
 #define AUTH_MANAGER_H
 
 #include "../storage/DatabaseEngine.h"
+#include "../storage/RecordHeap.h"
 #include "../storage/BTree.h"
 #include "../storage/HashTable.h"
 #include "../models/User.h"
@@ -15,6 +16,7 @@ class AuthManager
 {
 private:
     DatabaseEngine *db;
+    RecordHeap *record_heap;
     BTree *users_btree;
     HashTable *login_hash;
 
@@ -23,8 +25,8 @@ private:
     std::mutex sessions_mutex;
 
 public:
-    AuthManager(DatabaseEngine *database, BTree *users_tree, HashTable *login_table)
-        : db(database), users_btree(users_tree), login_hash(login_table) {}
+    AuthManager(DatabaseEngine *database, RecordHeap *heap, BTree *users_tree, HashTable *login_table)
+        : db(database), record_heap(heap), users_btree(users_tree), login_hash(login_table) {}
 
     // Register new user
     bool register_user(const std::string &email, const std::string &username,
@@ -46,6 +48,9 @@ public:
     // Get user by email
     bool get_user_by_email(const std::string &email, User &out_user);
 
+    // Rewrite version-1 records in the compact format; returns the count
+    size_t migrate_records();
+
 private:
     // Hash password (simple SHA-256-like hash)
     std::string hash_password(const std::string &password);
@@ -5,11 +5,14 @@
 #include <sstream>
 #include <cctype>
 
-ChatManager::ChatManager(DatabaseEngine *database, BTree *messages_tree, HashTable *search_hash)
-    : db(database), messages_btree(messages_tree), chat_search_hash(search_hash),
-      shutdown_flag(false)
+ChatManager::ChatManager(DatabaseEngine *database, RecordHeap *heap, BTree *messages_tree,
+                         BTree *meeting_tree, HashTable *search_hash)
+    : db(database), record_heap(heap), messages_btree(messages_tree), meeting_index(meeting_tree),
+      keyword_index(heap, search_hash),
+      shutdown_flag(false), next_waiter_id(0)
 {
     persistence_thread = std::thread(&ChatManager::persistence_worker, this);
+    indexing_thread = std::thread(&ChatManager::indexing_worker, this);
 }
 
 ChatManager::~ChatManager()
@@ -17,7 +20,6 @@ ChatManager::~ChatManager()
     shutdown_flag = true;
     queue_cv.notify_one();
     indexing_cv.notify_one();
-    message_notify_cv.notify_all();
 
     if (persistence_thread.joinable())
     {
@@ -33,9 +35,9 @@ void ChatManager::persistence_worker()
 {
     while (!shutdown_flag)
     {
-        Message msg;
+        std::queue<Message> batch;
 
-        // Wait for a message
+        // Wait for a message, then take everything queued so far
         {
             std::unique_lock<std::mutex> lock(queue_mutex);
             queue_cv.wait(lock, [this]
@@ -51,27 +53,36 @@ void ChatManager::persistence_worker()
                 continue;
             }
 
-            msg = persistence_queue.front();
-            persistence_queue.pop();
+            std::swap(batch, persistence_queue);
         }
 
         // Persist to disk (outside lock)
-        if (!store_message(msg))
+        while (!batch.empty())
         {
-            std::cerr << "Failed to persist message " << msg.message_id << std::endl;
+            const Message &msg = batch.front();
+            if (!store_message(msg))
+            {
+                std::cerr << "Failed to persist message " << msg.message_id << std::endl;
+            }
+            batch.pop();
         }
 
-        // Write header
-        db->write_header();
+        // Write header - this commits the whole batch with one WAL sync
+        if (!db->write_header())
+        {
+            std::cerr << "Failed to commit message batch" << std::endl;
+        }
     }
 }
 
 // 🔥 Separate indexing worker - doesn't block persistence
 void ChatManager::indexing_worker()
 {
-    while (!shutdown_flag)
+    // Runs until the queue is drained after shutdown, so every sent
+    // message ends up searchable
+    while (true)
     {
-        std::pair<uint64_t, std::string> item;
+        std::pair<Posting, std::string> item;
 
         // Wait for indexing work
         {
@@ -94,7 +105,7 @@ void ChatManager::indexing_worker()
         }
 
         // Index keywords (outside lock)
-        index_message_keywords(item.first, item.second);
+        index_message_keywords(item.first.group_id, item.first.doc_id, item.second);
     }
 }
 
@@ -111,9 +122,12 @@ void ChatManager::warm_cache()
 
     for (const auto &loc : locations)
     {
-        Page page = db->read_page(loc.page_id);
+        RecordView record;
         Message message;
-        message.deserialize(page.data + loc.offset);
+        if (!record_heap->read(loc, record) || !message.decode(record.data, record.size))
+        {
+            continue;
+        }
 
         temp_cache[message.meeting_id].push_back(message);
     }
@@ -149,32 +163,100 @@ void ChatManager::warm_cache()
 
 bool ChatManager::store_message(const Message &message)
 {
-    // Allocate page for message data
-    uint64_t data_page_id = db->allocate_page();
-
     // Serialize message
-    uint8_t buffer[Message::serialized_size()];
-    message.serialize(buffer);
-
-    // Write to page
-    Page data_page;
-    memcpy(data_page.data, buffer, Message::serialized_size());
-    db->write_page(data_page_id, data_page);
+    std::vector<uint8_t> buffer;
+    message.encode(buffer);
 
-    // Create record location
-    RecordLocation message_loc(data_page_id, 0, Message::serialized_size());
+    // Pack into a shared heap page
+    RecordLocation message_loc = record_heap->insert(buffer.data(), buffer.size());
+    if (message_loc.page_id == 0)
+    {
+        std::cerr << "Failed to store message record" << std::endl;
+        return false;
+    }
 
     // Index in B-Tree by message_id
     if (!messages_btree->insert(message.message_id, message_loc))
     {
         std::cerr << "Failed to insert message into B-Tree" << std::endl;
-        db->free_page(data_page_id);
+        record_heap->remove(message_loc);
+        return false;
+    }
+
+    if (!meeting_index->insert(BTreeKey(message.meeting_id, message.timestamp, message.message_id), message_loc))
+    {
+        std::cerr << "Failed to insert message into meeting index" << std::endl;
+        messages_btree->remove(message.message_id);
+        record_heap->remove(message_loc);
         return false;
     }
 
     return true;
 }
 
+std::vector<RecordLocation> ChatManager::meeting_locations(uint64_t meeting_id, uint64_t before_timestamp)
+{
+    if (before_timestamp == 0)
+    {
+        return {};
+    }
+
+    return meeting_index->range_search(BTreeKey(meeting_id, 0, 0),
+                                       BTreeKey(meeting_id, before_timestamp - 1, UINT64_MAX));
+}
+
+size_t ChatManager::build_meeting_index()
+{
+    std::vector<std::pair<BTreeKey, RecordLocation>> entries;
+
+    for (const auto &loc : messages_btree->range_search(1, UINT64_MAX))
+    {
+        RecordView record;
+        Message message;
+        if (!record_heap->read(loc, record) || !message.decode(record.data, record.size))
+        {
+            continue;
+        }
+
+        entries.emplace_back(BTreeKey(message.meeting_id, message.timestamp, message.message_id), loc);
+    }
+
+    // Sorted once, then built bottom-up instead of one insert per record
+    std::sort(entries.begin(), entries.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    if (!meeting_index->bulk_load(entries, BTREE_REBUILD_FILL_FACTOR))
+    {
+        return 0;
+    }
+
+    return entries.size();
+}
+
+size_t ChatManager::build_search_index()
+{
+    size_t indexed = 0;
+
+    // Message ids ascend, so each posting list is written append-only
+    for (const auto &loc : messages_btree->range_search(1, UINT64_MAX))
+    {
+        RecordView record;
+        Message message;
+        if (!record_heap->read(loc, record) || !message.decode(record.data, record.size))
+        {
+            continue;
+        }
+        record.page.release();
+
+        if (strcmp(message.content, "[deleted]") != 0)
+        {
+            index_message_keywords(message.meeting_id, message.message_id, message.content);
+            indexed++;
+        }
+    }
+
+    return indexed;
+}
+
 std::vector<std::string> ChatManager::extract_keywords(const std::string &text)
 {
     std::vector<std::string> keywords;
@@ -204,15 +286,19 @@ std::vector<std::string> ChatManager::extract_keywords(const std::string &text)
     return keywords;
 }
 
-void ChatManager::index_message_keywords(uint64_t message_id, const std::string &content)
+void ChatManager::index_message_keywords(uint64_t meeting_id, uint64_t message_id, const std::string &content)
 {
     auto keywords = extract_keywords(content);
+    std::sort(keywords.begin(), keywords.end());
+    keywords.erase(std::unique(keywords.begin(), keywords.end()), keywords.end());
 
     for (const auto &keyword : keywords)
     {
-        // Store message_id in hash table under keyword
-        RecordLocation loc(message_id, 0, 0); // Store just the ID
-        chat_search_hash->insert(keyword, loc);
+        // Append (meeting_id, message_id) to the keyword's posting list
+        if (!keyword_index.append(keyword, Posting(meeting_id, message_id)))
+        {
+            std::cerr << "Failed to index keyword for message " << message_id << std::endl;
+        }
     }
 }
 
@@ -269,48 +355,75 @@ bool ChatManager::send_message(uint64_t meeting_id, uint64_t user_id,
     // 🔥 ASYNC indexing - separate queue
     {
         std::lock_guard<std::mutex> lock(indexing_mutex);
-        indexing_queue.push({message.message_id, content});
+        indexing_queue.push({Posting(meeting_id, message.message_id), content});
     }
     indexing_cv.notify_one();
 
-    // 🔥 NOTIFY long-polling waiters
-    message_notify_cv.notify_all();
+    // 🔥 Complete the meeting's long polls
+    std::map<uint64_t, MessageWaiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(waiters_mutex);
+        auto it = message_waiters.find(meeting_id);
+        if (it != message_waiters.end())
+        {
+            waiters.swap(it->second);
+            message_waiters.erase(it);
+        }
+    }
+    if (!waiters.empty())
+    {
+        std::vector<Message> latest = get_messages(meeting_id, 50);
+        for (auto &waiter : waiters)
+        {
+            waiter.second(latest);
+        }
+    }
 
     out_message = message;
     std::cout << "Message sent in meeting " << meeting_id << " by " << username << std::endl;
     return true;
 }
 
-// 🔥 Long polling: wait for new messages after timestamp
-std::vector<Message> ChatManager::wait_for_messages(uint64_t meeting_id, uint64_t since_timestamp, int timeout_seconds)
+// 🔥 Long polling: park the waiter until a message after the timestamp
+uint64_t ChatManager::wait_for_messages(uint64_t meeting_id, uint64_t since_timestamp, MessageWaiter waiter)
 {
-    auto start_time = std::chrono::steady_clock::now();
-    auto timeout = std::chrono::seconds(timeout_seconds);
-
-    while (true)
+    bool ready;
+    uint64_t waiter_id;
     {
-        // Check for new messages
+        // send_message updates the timestamp before it takes the waiters, so
+        // a message either shows here or finds this waiter registered
+        std::lock_guard<std::mutex> lock(waiters_mutex);
         {
-            std::lock_guard<std::mutex> lock(cache_mutex);
+            std::lock_guard<std::mutex> cache_lock(cache_mutex);
             auto it = last_message_timestamp.find(meeting_id);
-
-            // If we have new messages, return them
-            if (it != last_message_timestamp.end() && it->second > since_timestamp)
-            {
-                return get_messages(meeting_id, 50);
-            }
+            ready = it != last_message_timestamp.end() && it->second > since_timestamp;
         }
-
-        // Check timeout
-        auto elapsed = std::chrono::steady_clock::now() - start_time;
-        if (elapsed >= timeout)
+        waiter_id = ++next_waiter_id;
+        if (!ready)
         {
-            return {}; 
+            message_waiters[meeting_id][waiter_id] = waiter;
         }
+    }
+
+    if (ready)
+    {
+        waiter(get_messages(meeting_id, 50));
+    }
+    return waiter_id;
+}
 
-        // Wait for notification or timeout
-        std::unique_lock<std::mutex> lock(notify_mutex);
-        message_notify_cv.wait_for(lock, std::chrono::milliseconds(100));
+void ChatManager::cancel_wait(uint64_t meeting_id, uint64_t waiter_id)
+{
+    std::lock_guard<std::mutex> lock(waiters_mutex);
+    auto it = message_waiters.find(meeting_id);
+    if (it == message_waiters.end())
+    {
+        return;
+    }
+    it->second.erase(waiter_id);
+    if (it->second.empty())
+    {
+        message_waiters.erase(it);
     }
 }
 
@@ -340,59 +453,71 @@ std::vector<Message> ChatManager::get_messages(uint64_t meeting_id, int limit,
         }
     }
 
-    auto locations = messages_btree->range_search(1, UINT64_MAX);
+    // The cache held only part of the range; start over from the index
+    messages.clear();
+    if (before_timestamp == 0)
+    {
+        return messages;
+    }
 
-    for (auto it = locations.rbegin(); it != locations.rend() && messages.size() < (size_t)limit; ++it)
+    // Walk the meeting's index range backwards from before_timestamp, so
+    // only the newest entries up to the limit are read
+    BTreeKey first_key(meeting_id, 0, 0);
+    BTreeCursor cursor(meeting_index);
+    for (bool more = cursor.seek_last(BTreeKey(meeting_id, before_timestamp - 1, UINT64_MAX));
+         more && cursor.key() >= first_key && messages.size() < (size_t)limit;
+         more = cursor.prev())
     {
-        Page page = db->read_page(it->page_id);
+        RecordView record;
         Message message;
-        message.deserialize(page.data + it->offset);
-
-        if (message.meeting_id == meeting_id && message.timestamp < before_timestamp)
+        if (!record_heap->read(cursor.record(), record) || !message.decode(record.data, record.size))
         {
-            messages.push_back(message);
+            continue;
         }
+
+        messages.push_back(message);
     }
 
     std::reverse(messages.begin(), messages.end());
     return messages;
 }
 
-std::vector<Message> ChatManager::search_messages(uint64_t meeting_id, const std::string &query)
+std::vector<Message> ChatManager::search_messages(uint64_t meeting_id, const std::string &query,
+                                                  bool match_all)
 {
     std::vector<Message> results;
-    std::map<uint64_t, bool> found_ids; // Avoid duplicates
 
     auto keywords = extract_keywords(query);
+    if (keywords.empty())
+    {
+        return results;
+    }
 
+    // Posting lists are filtered to the meeting as they are decoded, so
+    // only the final hits are fetched
+    std::vector<std::vector<uint64_t>> lists;
     for (const auto &keyword : keywords)
     {
-        bool found;
-        RecordLocation loc = chat_search_hash->search(keyword, found);
+        lists.push_back(keyword_index.lookup(keyword, meeting_id));
+    }
 
-        if (found)
-        {
-            uint64_t message_id = loc.page_id; 
+    std::vector<uint64_t> message_ids = match_all ? PostingIndex::intersect(std::move(lists))
+                                                  : PostingIndex::unite(lists);
 
-            if (found_ids.find(message_id) == found_ids.end())
-            {
-                Message message;
-                if (get_message(message_id, message))
-                {
-                    if (message.meeting_id == meeting_id)
-                    {
-                        results.push_back(message);
-                        found_ids[message_id] = true;
-                    }
-                }
-            }
+    for (uint64_t message_id : message_ids)
+    {
+        // Deleted messages keep their postings but lose their content
+        Message message;
+        if (get_message(message_id, message) && strcmp(message.content, "[deleted]") != 0)
+        {
+            results.push_back(message);
         }
     }
 
     // Sort by timestamp
-    std::sort(results.begin(), results.end(),
-              [](const Message &a, const Message &b)
-              { return a.timestamp < b.timestamp; });
+    std::stable_sort(results.begin(), results.end(),
+                     [](const Message &a, const Message &b)
+                     { return a.timestamp < b.timestamp; });
 
     return results;
 }
@@ -418,8 +543,11 @@ bool ChatManager::get_message(uint64_t message_id, Message &out_message)
         return false;
     }
 
-    Page page = db->read_page(loc.page_id);
-    out_message.deserialize(page.data + loc.offset);
+    RecordView record;
+    if (!record_heap->read(loc, record) || !out_message.decode(record.data, record.size))
+    {
+        return false;
+    }
 
     return true;
 }
@@ -446,35 +574,38 @@ bool ChatManager::delete_message(uint64_t message_id, std::string &error)
         return false;
     }
 
-    uint8_t buffer[Message::serialized_size()];
-    message.serialize(buffer);
+    std::vector<uint8_t> buffer;
+    message.encode(buffer);
 
-    Page page = db->read_page(loc.page_id);
-    memcpy(page.data + loc.offset, buffer, Message::serialized_size());
-    db->write_page(loc.page_id, page);
-
-    return true;
-}
-
-int ChatManager::get_message_count(uint64_t meeting_id)
-{
-    int count = 0;
-
-    auto locations = messages_btree->range_search(1, UINT64_MAX);
-
-    for (const auto &loc : locations)
+    if (!record_heap->update(loc, buffer.data(), buffer.size()))
     {
-        Page page = db->read_page(loc.page_id);
-        Message message;
-        message.deserialize(page.data + loc.offset);
+        error = "Failed to update message";
+        return false;
+    }
 
-        if (message.meeting_id == meeting_id)
+    // Keep cached copies in step, or search would still match the old text
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = message_by_id.find(message_id);
+        if (it != message_by_id.end())
         {
-            count++;
+            it->second = message;
+        }
+        for (auto &cached : meeting_messages[message.meeting_id])
+        {
+            if (cached.message_id == message_id)
+            {
+                cached = message;
+            }
         }
     }
 
-    return count;
+    return true;
+}
+
+int ChatManager::get_message_count(uint64_t meeting_id)
+{
+    return static_cast<int>(meeting_locations(meeting_id).size());
 }
 
 void ChatManager::delete_meeting_messages(uint64_t meeting_id)
@@ -497,19 +628,26 @@ void ChatManager::delete_meeting_messages(uint64_t meeting_id)
     }
 
     // Remove from database
-    auto locations = messages_btree->range_search(1, UINT64_MAX);
+    auto locations = meeting_locations(meeting_id);
     for (const auto &loc : locations)
     {
-        Page page = db->read_page(loc.page_id);
+        RecordView record;
         Message message;
-        message.deserialize(page.data + loc.offset);
-
-        if (message.meeting_id == meeting_id)
+        if (!record_heap->read(loc, record) || !message.decode(record.data, record.size))
         {
-            messages_btree->remove(message.message_id);
-            db->free_page(loc.page_id);
+            continue;
         }
+
+        record.page.release();  // Unpin before the heap rewrites the page
+        messages_btree->remove(message.message_id);
+        meeting_index->remove(BTreeKey(message.meeting_id, message.timestamp, message.message_id));
+        record_heap->remove(loc);
     }
 
     std::cout << "🗑️  Deleted all messages for meeting " << meeting_id << std::endl;
-}
\ No newline at end of file
+}
+
+size_t ChatManager::migrate_records()
+{
+    return record_heap->reencode_legacy<Message>(messages_btree->range_search(1, UINT64_MAX));
+}
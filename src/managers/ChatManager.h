@@ -2,8 +2,10 @@
 #define CHAT_MANAGER_H
 
 #include "../storage/DatabaseEngine.h"
+#include "../storage/RecordHeap.h"
 #include "../storage/BTree.h"
 #include "../storage/HashTable.h"
+#include "../storage/PostingList.h"
 #include "../models/Message.h"
 #include <string>
 #include <vector>
@@ -13,13 +15,19 @@
 #include <thread>
 #include <condition_variable>
 #include <atomic>
+#include <functional>
+
+// Called with a meeting's latest messages when a long poll completes
+using MessageWaiter = std::function<void(const std::vector<Message> &)>;
 
 class ChatManager
 {
 private:
     DatabaseEngine *db;
+    RecordHeap *record_heap;
     BTree *messages_btree;
-    HashTable *chat_search_hash;
+    BTree *meeting_index;   // (meeting_id, timestamp, message_id) -> location
+    PostingIndex keyword_index; // keyword -> (meeting_id, message_id) postings
 
     
     std::map<uint64_t, std::vector<Message>> meeting_messages; // meeting_id -> messages
@@ -32,17 +40,21 @@ private:
     std::thread persistence_thread;
     std::atomic<bool> shutdown_flag;
 
-    std::condition_variable message_notify_cv;
-    std::mutex notify_mutex;
     std::map<uint64_t, uint64_t> last_message_timestamp; 
 
-    std::queue<std::pair<uint64_t, std::string>> indexing_queue; 
+    // Long polls parked per meeting, by waiter id. Taken before cache_mutex.
+    std::mutex waiters_mutex;
+    std::map<uint64_t, std::map<uint64_t, MessageWaiter>> message_waiters;
+    uint64_t next_waiter_id;
+
+    std::queue<std::pair<Posting, std::string>> indexing_queue; // (meeting, message), content
     std::mutex indexing_mutex;
     std::condition_variable indexing_cv;
     std::thread indexing_thread;
 
 public:
-    ChatManager(DatabaseEngine *database, BTree *messages_tree, HashTable *search_hash);
+    ChatManager(DatabaseEngine *database, RecordHeap *heap, BTree *messages_tree,
+                BTree *meeting_tree, HashTable *search_hash);
     ~ChatManager();
 
     // Send message
@@ -53,11 +65,18 @@ public:
     std::vector<Message> get_messages(uint64_t meeting_id, int limit = 50,
                                       uint64_t before_timestamp = UINT64_MAX);
 
-    std::vector<Message> wait_for_messages(uint64_t meeting_id, uint64_t since_timestamp,
-                                           int timeout_seconds = 20);
+    // Long polling without holding a thread: waiter runs once, on the thread
+    // that sends the meeting's next message, or right away if a message is
+    // already newer than since_timestamp. Returns the id to cancel it with.
+    uint64_t wait_for_messages(uint64_t meeting_id, uint64_t since_timestamp, MessageWaiter waiter);
+
+    // Drop a waiter that timed out; nothing happens if it already ran
+    void cancel_wait(uint64_t meeting_id, uint64_t waiter_id);
 
-    // Search messages by keyword
-    std::vector<Message> search_messages(uint64_t meeting_id, const std::string &query);
+    // Search messages by keyword: any of the query's words, or all of them
+    // with match_all
+    std::vector<Message> search_messages(uint64_t meeting_id, const std::string &query,
+                                         bool match_all = false);
 
     // Get message by ID
     bool get_message(uint64_t message_id, Message &out_message);
@@ -70,20 +89,33 @@ public:
 
     void delete_meeting_messages(uint64_t meeting_id);
 
+    // Fill an empty meeting index from the message tree; returns the count
+    size_t build_meeting_index();
+
+    // Fill an empty keyword index from the message tree; returns the count
+    size_t build_search_index();
+
+    // Rewrite version-1 records in the compact format; returns the count
+    size_t migrate_records();
+
+    // Load the newest messages of every meeting into the cache on startup
+    void warm_cache();
+
 private:
     // Background persistence worker
     void persistence_worker();
 
     void indexing_worker();
 
-    // Warm cache on startup
-    void warm_cache();
-
     // Store message in database
     bool store_message(const Message &message);
 
+    // Index entries of one meeting, oldest first, with timestamp < before
+    std::vector<RecordLocation> meeting_locations(uint64_t meeting_id,
+                                                  uint64_t before_timestamp = UINT64_MAX);
+
     // Index message keywords for search
-    void index_message_keywords(uint64_t message_id, const std::string &content);
+    void index_message_keywords(uint64_t meeting_id, uint64_t message_id, const std::string &content);
 
     // Extract keywords from text
     std::vector<std::string> extract_keywords(const std::string &text);
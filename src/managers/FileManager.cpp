@@ -2,6 +2,8 @@
 #include <iostream>
 #include <ctime>
 #include <algorithm>
+#include <map>
+#include <unordered_map>
 
 std::string FileManager::calculate_file_hash(const uint8_t *data, size_t size)
 {
@@ -22,52 +24,63 @@ std::string FileManager::calculate_file_hash(const uint8_t *data, size_t size)
 
 uint64_t FileManager::store_file_data(const uint8_t *data, size_t size)
 {
-    const size_t CHUNK_SIZE = PAGE_DATA_SIZE - 16; 
-    size_t bytes_written = 0;
-    uint64_t first_page_id = 0;
-    uint64_t prev_page_id = 0;
+    size_t page_count = (size + FILE_CHUNK_SIZE - 1) / FILE_CHUNK_SIZE;
 
-    while (bytes_written < size)
+    // One contiguous run: each page's successor is known up front, and the
+    // chunks sit in file order for reading back
+    uint64_t first_page_id = db->allocate_pages(page_count);
+    if (first_page_id == 0)
     {
-        uint64_t page_id = db->allocate_page();
-
-        if (first_page_id == 0)
-        {
-            first_page_id = page_id;
-        }
+        return 0;
+    }
 
+    size_t bytes_written = 0;
+    for (size_t i = 0; i < page_count; i++)
+    {
         Page page;
         page.header.type = DATA_OVERFLOW;
 
         // Store next page ID in first 8 bytes
-        uint64_t next_page_id = 0;
+        uint64_t next_page_id = i + 1 < page_count ? first_page_id + i + 1 : 0;
         memcpy(page.data, &next_page_id, sizeof(uint64_t));
 
         // Store data
-        size_t chunk_size = std::min(CHUNK_SIZE, size - bytes_written);
+        size_t chunk_size = std::min(FILE_CHUNK_SIZE, size - bytes_written);
         memcpy(page.data + 8, data + bytes_written, chunk_size);
 
-        db->write_page(page_id, page);
-
-        // Link previous page to this one
-        if (prev_page_id != 0)
-        {
-            Page prev_page = db->read_page(prev_page_id);
-            memcpy(prev_page.data, &page_id, sizeof(uint64_t));
-            db->write_page(prev_page_id, prev_page);
-        }
-
-        prev_page_id = page_id;
+        db->write_page(first_page_id + i, page);
         bytes_written += chunk_size;
     }
 
     return first_page_id;
 }
 
+void FileManager::free_file_data(uint64_t first_page_id)
+{
+    // Files stored before runs were allocated may be chained in any order;
+    // consecutive pages are freed together either way
+    std::vector<uint64_t> pages;
+    for (uint64_t page_id = first_page_id; page_id != 0 && pages.size() < db->get_total_pages();)
+    {
+        PageHandle page = db->pin_page(page_id);
+        pages.push_back(page_id);
+        memcpy(&page_id, page->data, sizeof(uint64_t));
+    }
+
+    size_t run_start = 0;
+    for (size_t i = 1; i <= pages.size(); i++)
+    {
+        if (i == pages.size() || pages[i] != pages[i - 1] + 1)
+        {
+            db->free_pages(pages[run_start], i - run_start);
+            run_start = i;
+        }
+    }
+}
+
 bool FileManager::read_file_data(uint64_t first_page_id, size_t size,
                                  std::vector<uint8_t> &out_data)
 {
-    const size_t CHUNK_SIZE = PAGE_DATA_SIZE - 16;
     out_data.clear();
     out_data.reserve(size);
 
@@ -83,7 +96,7 @@ bool FileManager::read_file_data(uint64_t first_page_id, size_t size,
         memcpy(&next_page_id, page.data, sizeof(uint64_t));
 
         // Read data
-        size_t chunk_size = std::min(CHUNK_SIZE, size - bytes_read);
+        size_t chunk_size = std::min(FILE_CHUNK_SIZE, size - bytes_read);
         out_data.insert(out_data.end(),
                         page.data + 8,
                         page.data + 8 + chunk_size);
@@ -97,26 +110,31 @@ bool FileManager::read_file_data(uint64_t first_page_id, size_t size,
 
 bool FileManager::store_file_record(const FileRecord &file)
 {
-    
-    uint64_t data_page_id = db->allocate_page();
-
     // Serialize file record
-    uint8_t buffer[FileRecord::serialized_size()];
-    file.serialize(buffer);
+    std::vector<uint8_t> buffer;
+    file.encode(buffer);
 
-    // Write to page
-    Page data_page;
-    memcpy(data_page.data, buffer, FileRecord::serialized_size());
-    db->write_page(data_page_id, data_page);
-
-    // Create record location
-    RecordLocation file_loc(data_page_id, 0, FileRecord::serialized_size());
+    // Pack into a shared heap page
+    RecordLocation file_loc = record_heap->insert(buffer.data(), buffer.size());
+    if (file_loc.page_id == 0)
+    {
+        std::cerr << "Failed to store file record" << std::endl;
+        return false;
+    }
 
     // Index in B-Tree by file_id
     if (!files_btree->insert(file.file_id, file_loc))
     {
         std::cerr << "Failed to insert file into B-Tree" << std::endl;
-        db->free_page(data_page_id);
+        record_heap->remove(file_loc);
+        return false;
+    }
+
+    if (!meeting_index->insert(BTreeKey(file.meeting_id, file.file_id), file_loc))
+    {
+        std::cerr << "Failed to insert file into meeting index" << std::endl;
+        files_btree->remove(file.file_id);
+        record_heap->remove(file_loc);
         return false;
     }
 
@@ -158,6 +176,7 @@ bool FileManager::upload_file(uint64_t meeting_id, uint64_t uploader_id,
         return false;
     }
 
+    std::shared_lock<std::shared_mutex> lock(data_mutex);
     auto existing_files = get_meeting_files(meeting_id);
     size_t total_size = 0;
     for (const auto &f : existing_files)
@@ -196,13 +215,22 @@ bool FileManager::upload_file(uint64_t meeting_id, uint64_t uploader_id,
             return false;
         }
 
-        db->write_header();
+        if (!db->write_header())
+        {
+            error = "Failed to commit file record";
+            return false;
+        }
         out_file = file;
         return true;
     }
 
     // Store file data
     uint64_t data_page_id = store_file_data(data, data_size);
+    if (data_page_id == 0)
+    {
+        error = "Failed to store file data";
+        return false;
+    }
 
     // Create file record
     FileRecord file;
@@ -223,7 +251,11 @@ bool FileManager::upload_file(uint64_t meeting_id, uint64_t uploader_id,
     }
 
     // Save database header
-    db->write_header();
+    if (!db->write_header())
+    {
+        error = "Failed to commit file record";
+        return false;
+    }
 
     out_file = file;
     std::cout << "File uploaded: " << filename << " (" << data_size << " bytes)" << std::endl;
@@ -233,6 +265,8 @@ bool FileManager::upload_file(uint64_t meeting_id, uint64_t uploader_id,
 bool FileManager::download_file(uint64_t file_id, std::vector<uint8_t> &out_data,
                                 FileRecord &out_file, std::string &error)
 {
+    std::shared_lock<std::shared_mutex> lock(data_mutex);
+
     // Get file info
     if (!get_file_info(file_id, out_file))
     {
@@ -255,18 +289,18 @@ std::vector<FileRecord> FileManager::get_meeting_files(uint64_t meeting_id)
 {
     std::vector<FileRecord> files;
 
-    auto locations = files_btree->range_search(1, UINT64_MAX);
+    auto locations = meeting_index->range_search(BTreeKey(meeting_id, 0), BTreeKey(meeting_id, UINT64_MAX));
 
     for (const auto &loc : locations)
     {
-        Page page = db->read_page(loc.page_id);
+        RecordView record;
         FileRecord file;
-        file.deserialize(page.data + loc.offset);
-
-        if (file.meeting_id == meeting_id)
+        if (!record_heap->read(loc, record) || !file.decode(record.data, record.size))
         {
-            files.push_back(file);
+            continue;
         }
+
+        files.push_back(file);
     }
 
     // Sort by upload time
@@ -289,8 +323,11 @@ bool FileManager::get_file_info(uint64_t file_id, FileRecord &out_file)
         return false;
     }
 
-    Page page = db->read_page(loc.page_id);
-    out_file.deserialize(page.data + loc.offset);
+    RecordView record;
+    if (!record_heap->read(loc, record) || !out_file.decode(record.data, record.size))
+    {
+        return false;
+    }
 
     return true;
 }
@@ -298,6 +335,8 @@ bool FileManager::get_file_info(uint64_t file_id, FileRecord &out_file)
 bool FileManager::delete_file(uint64_t file_id, uint64_t user_id, uint64_t meeting_id,
                               uint64_t meeting_creator_id, std::string &error)
 {
+    std::unique_lock<std::shared_mutex> lock(data_mutex);
+
     // Get file info
     FileRecord file;
     if (!get_file_info(file_id, file))
@@ -328,15 +367,19 @@ bool FileManager::delete_file(uint64_t file_id, uint64_t user_id, uint64_t meeti
         error = "Failed to remove file from index";
         return false;
     }
+    meeting_index->remove(BTreeKey(file.meeting_id, file_id));
 
     int ref_count = 0;
     auto all_locations = files_btree->range_search(1, UINT64_MAX);
 
     for (const auto &loc : all_locations)
     {
-        Page page = db->read_page(loc.page_id);
+        RecordView record;
         FileRecord other_file;
-        other_file.deserialize(page.data + loc.offset);
+        if (!record_heap->read(loc, record) || !other_file.decode(record.data, record.size))
+        {
+            continue;
+        }
 
         if (other_file.data_page_id == data_page_id)
         {
@@ -347,23 +390,8 @@ bool FileManager::delete_file(uint64_t file_id, uint64_t user_id, uint64_t meeti
     
     if (ref_count == 0)
     {
-        // Free the linked list of data pages
-        uint64_t current_page_id = data_page_id;
-        const size_t CHUNK_SIZE = PAGE_DATA_SIZE - 16;
-
-        while (current_page_id != 0)
-        {
-            Page page = db->read_page(current_page_id);
-
-            // Read next page ID
-            uint64_t next_page_id;
-            memcpy(&next_page_id, page.data, sizeof(uint64_t));
-
-            // Free current page
-            db->free_page(current_page_id);
-
-            current_page_id = next_page_id;
-        }
+        free_file_data(data_page_id);
+        db->write_header();
 
         std::cout << "File deleted and data freed: " << file.filename << " (ID: " << file_id << ")" << std::endl;
     }
@@ -386,41 +414,225 @@ bool FileManager::file_exists_by_hash(const std::string &file_hash, FileRecord &
         return false;
     }
 
-    Page page = db->read_page(loc.page_id);
-    out_file.deserialize(page.data + loc.offset);
+    RecordView record;
+    if (!record_heap->read(loc, record) || !out_file.decode(record.data, record.size))
+    {
+        return false;
+    }
 
     return true;
 }
 
 void FileManager::delete_meeting_files(uint64_t meeting_id)
 {
-    auto locations = files_btree->range_search(1, UINT64_MAX);
+    std::unique_lock<std::shared_mutex> lock(data_mutex);
+    auto locations = meeting_index->range_search(BTreeKey(meeting_id, 0), BTreeKey(meeting_id, UINT64_MAX));
     for (const auto &loc : locations)
     {
-        Page page = db->read_page(loc.page_id);
+        RecordView record;
         FileRecord file;
-        file.deserialize(page.data + loc.offset);
+        if (!record_heap->read(loc, record) || !file.decode(record.data, record.size))
+        {
+            continue;
+        }
+
+        record.page.release();  // Unpin before the heap rewrites the page
+        files_btree->remove(file.file_id);
+        meeting_index->remove(BTreeKey(meeting_id, file.file_id));
+
+        // Free file data pages
+        free_file_data(file.data_page_id);
+
+        // Free the record
+        record_heap->remove(loc);
+    }
+
+    std::cout << "🗑️  Deleted all files for meeting " << meeting_id << std::endl;
+}
 
-        if (file.meeting_id == meeting_id)
+void FileManager::relocate_file_data(const RelocationSet &set)
+{
+    if (!set.has_type(DATA_OVERFLOW))
+    {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(data_mutex);
+
+    // Files sharing data through deduplication point at the same chain
+    std::map<uint64_t, std::vector<std::pair<RecordLocation, FileRecord>>> owners;
+    std::map<uint64_t, uint64_t> chain_pages;
+    for (const auto &loc : files_btree->range_search(1, UINT64_MAX))
+    {
+        RecordView record;
+        FileRecord file;
+        if (!record_heap->read(loc, record) || !file.decode(record.data, record.size) || file.data_page_id == 0)
+        {
+            continue;
+        }
+        owners[file.data_page_id].emplace_back(loc, file);
+        uint64_t pages = (file.file_size + FILE_CHUNK_SIZE - 1) / FILE_CHUNK_SIZE;
+        chain_pages[file.data_page_id] = std::max(chain_pages[file.data_page_id], pages);
+    }
+
+    uint64_t lowest = UINT64_MAX;
+    size_t wanted = 0;
+    for (const auto &entry : set.pages)
+    {
+        if (entry.second == DATA_OVERFLOW)
+        {
+            lowest = std::min(lowest, entry.first);
+            wanted++;
+        }
+    }
+
+    // Data stored as one run can only reach the set if its run does; older
+    // files may be chained anywhere, so every chain is walked when pages of
+    // the set are still unaccounted for
+    std::map<uint64_t, std::vector<uint64_t>> chains;
+    std::unordered_map<uint64_t, int> chain_count;
+    size_t found = 0;
+    uint64_t total_pages = db->get_total_pages();
+    auto walk = [&](uint64_t first_page_id, uint64_t page_count)
+    {
+        std::vector<uint64_t> &chain = chains[first_page_id];
+        for (uint64_t page_id = first_page_id; page_id != 0 && page_id < total_pages && chain.size() < page_count;)
+        {
+            PageHandle page = db->pin_page(page_id);
+            if (page->header.type != DATA_OVERFLOW)
+            {
+                break;
+            }
+            chain.push_back(page_id);
+            if (chain_count[page_id]++ == 0 && set.contains(page_id))
+            {
+                found++;
+            }
+            memcpy(&page_id, page->data, sizeof(uint64_t));
+        }
+    };
+    for (const auto &entry : chain_pages)
+    {
+        if (entry.first + entry.second > lowest)
+        {
+            walk(entry.first, entry.second);
+        }
+    }
+    if (found < wanted)
+    {
+        for (const auto &entry : chain_pages)
+        {
+            if (chains.count(entry.first) == 0)
+            {
+                walk(entry.first, entry.second);
+            }
+        }
+    }
+
+    // A page reached from two chains is left alone
+    auto movable = [&](uint64_t page_id)
+    {
+        auto it = set.pages.find(page_id);
+        return it != set.pages.end() && it->second == DATA_OVERFLOW && chain_count[page_id] == 1;
+    };
+
+    for (auto &entry : chains)
+    {
+        std::vector<uint64_t> &chain = entry.second;
+        for (size_t i = 0; i < chain.size();)
         {
-            files_btree->remove(file.file_id);
+            if (!movable(chain[i]))
+            {
+                i++;
+                continue;
+            }
+
+            // A run of consecutive pages moves together, so it stays one
+            // run; one page at a time when there is no room for it
+            size_t end = i + 1;
+            while (end < chain.size() && chain[end] == chain[end - 1] + 1 && movable(chain[end]))
+            {
+                end++;
+            }
+            uint64_t first_page_id = chain[i];
+            uint64_t run_length = end - i;
+            uint64_t copied = 0;
+            auto relink = [first_page_id, run_length, &copied](uint64_t new_page_id, Page &page)
+            {
+                // Links inside the run follow it; the copies are made in order
+                uint64_t next_page_id;
+                memcpy(&next_page_id, page.data, sizeof(uint64_t));
+                if (next_page_id > first_page_id && next_page_id < first_page_id + run_length)
+                {
+                    next_page_id = new_page_id - copied + (next_page_id - first_page_id);
+                    memcpy(page.data, &next_page_id, sizeof(uint64_t));
+                }
+                copied++;
+            };
+            uint64_t moved = db->relocate_pages(first_page_id, run_length, relink);
+            if (moved == 0 && end - i > 1)
+            {
+                end = i + 1;
+                moved = db->relocate_pages(first_page_id, 1);
+            }
+            if (moved == 0)
+            {
+                return;  // Nothing more fits below the step's window
+            }
+
+            if (i == 0)
+            {
+                for (auto &owner : owners[entry.first])
+                {
+                    owner.second.data_page_id = moved;
+                    std::vector<uint8_t> buffer;
+                    owner.second.encode(buffer);
+                    record_heap->update(owner.first, buffer.data(), buffer.size());
+                }
+            }
+            else
+            {
+                Page prev = db->read_page(chain[i - 1]);
+                memcpy(prev.data, &moved, sizeof(uint64_t));
+                db->write_page(chain[i - 1], prev);
+            }
 
-            // Free file data pages
-            uint64_t current_page = file.data_page_id;
-            size_t remaining = file.file_size;
-            while (current_page != 0 && remaining > 0)
+            for (size_t k = i; k < end; k++)
             {
-                Page data_page = db->read_page(current_page);
-                uint64_t next_page = *reinterpret_cast<uint64_t *>(data_page.data);
-                db->free_page(current_page);
-                current_page = next_page;
-                remaining = (remaining > 4000) ? remaining - 4000 : 0;
+                chain[k] = moved + (k - i);
             }
+            i = end;
+        }
+    }
+}
 
-            // Free record page
-            db->free_page(loc.page_id);
+size_t FileManager::migrate_records()
+{
+    return record_heap->reencode_legacy<FileRecord>(files_btree->range_search(1, UINT64_MAX));
+}
+
+size_t FileManager::build_meeting_index()
+{
+    std::vector<std::pair<BTreeKey, RecordLocation>> entries;
+
+    for (const auto &loc : files_btree->range_search(1, UINT64_MAX))
+    {
+        RecordView record;
+        FileRecord file;
+        if (!record_heap->read(loc, record) || !file.decode(record.data, record.size))
+        {
+            continue;
         }
+
+        entries.emplace_back(BTreeKey(file.meeting_id, file.file_id), loc);
     }
 
-    std::cout << "🗑️  Deleted all files for meeting " << meeting_id << std::endl;
-}
\ No newline at end of file
+    // Sorted once, then built bottom-up instead of one insert per record
+    std::sort(entries.begin(), entries.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    if (!meeting_index->bulk_load(entries, BTREE_REBUILD_FILL_FACTOR))
+    {
+        return 0;
+    }
+
+    return entries.size();
+}
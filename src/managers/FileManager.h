@@ -2,23 +2,44 @@
 #define FILE_MANAGER_H
 
 #include "../storage/DatabaseEngine.h"
+#include "../storage/RecordHeap.h"
 #include "../storage/BTree.h"
 #include "../storage/HashTable.h"
 #include "../models/File.h"
+#include <shared_mutex>
 #include <string>
 #include <vector>
 #include <cstring>
 
+// Bytes of file data per page, after the next-page link
+const size_t FILE_CHUNK_SIZE = PAGE_DATA_SIZE - 16;
+
 class FileManager
 {
 private:
     DatabaseEngine *db;
+    RecordHeap *record_heap;
     BTree *files_btree;
+    BTree *meeting_index;   // (meeting_id, file_id) -> location
     HashTable *file_dedup_hash;
 
+    // Uploads and downloads share it; deletes and the vacuum moving data
+    // pages, which rewrite data_page_id links, hold it exclusively
+    std::shared_mutex data_mutex;
+
 public:
-    FileManager(DatabaseEngine *database, BTree *files_tree, HashTable *dedup_hash)
-        : db(database), files_btree(files_tree), file_dedup_hash(dedup_hash) {}
+    FileManager(DatabaseEngine *database, RecordHeap *heap, BTree *files_tree,
+                BTree *meeting_tree, HashTable *dedup_hash)
+        : db(database), record_heap(heap), files_btree(files_tree), meeting_index(meeting_tree),
+          file_dedup_hash(dedup_hash)
+    {
+        db->add_relocator(this, [this](const RelocationSet &set) { relocate_file_data(set); });
+    }
+
+    ~FileManager()
+    {
+        db->remove_relocator(this);
+    }
 
     // Upload file
     bool upload_file(uint64_t meeting_id, uint64_t uploader_id,
@@ -45,6 +66,12 @@ public:
     
     void delete_meeting_files(uint64_t meeting_id);
 
+    // Fill an empty meeting index from the file tree; returns the count
+    size_t build_meeting_index();
+
+    // Rewrite version-1 records in the compact format; returns the count
+    size_t migrate_records();
+
 private:
     
     std::string calculate_file_hash(const uint8_t *data, size_t size);
@@ -52,11 +79,19 @@ private:
     // Store file data across multiple pages
     uint64_t store_file_data(const uint8_t *data, size_t size);
 
+    // Free a file's chain of data pages
+    void free_file_data(uint64_t first_page_id);
+
     // Read file data from pages
     bool read_file_data(uint64_t first_page_id, size_t size, std::vector<uint8_t> &out_data);
 
     // Store file record
     bool store_file_record(const FileRecord &file);
+
+    // Vacuum relocator: moves data pages in set a run at a time, relinking
+    // the page before each run or, for a chain's first page, the records of
+    // every file sharing the chain
+    void relocate_file_data(const RelocationSet &set);
 };
 
 #endif // FILE_MANAGER_H
\ No newline at end of file
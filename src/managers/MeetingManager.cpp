@@ -29,26 +29,31 @@ std::string MeetingManager::generate_meeting_code()
 
 bool MeetingManager::store_meeting(const Meeting &meeting)
 {
-    
-    uint64_t data_page_id = db->allocate_page();
-
     // Serialize meeting
-    uint8_t buffer[Meeting::serialized_size()];
-    meeting.serialize(buffer);
-
-    // Write to page
-    Page data_page;
-    memcpy(data_page.data, buffer, Meeting::serialized_size());
-    db->write_page(data_page_id, data_page);
+    std::vector<uint8_t> buffer;
+    meeting.encode(buffer);
 
-    // Create record location
-    RecordLocation meeting_loc(data_page_id, 0, Meeting::serialized_size());
+    // Pack into a shared heap page
+    RecordLocation meeting_loc = record_heap->insert(buffer.data(), buffer.size());
+    if (meeting_loc.page_id == 0)
+    {
+        std::cerr << "Failed to store meeting record" << std::endl;
+        return false;
+    }
 
     
     if (!meetings_btree->insert(meeting.meeting_id, meeting_loc))
     {
         std::cerr << "Failed to insert meeting into B-Tree" << std::endl;
-        db->free_page(data_page_id);
+        record_heap->remove(meeting_loc);
+        return false;
+    }
+
+    if (!creator_index->insert(BTreeKey(meeting.creator_id, meeting.meeting_id), meeting_loc))
+    {
+        std::cerr << "Failed to insert meeting into creator index" << std::endl;
+        meetings_btree->remove(meeting.meeting_id);
+        record_heap->remove(meeting_loc);
         return false;
     }
 
@@ -73,15 +78,11 @@ bool MeetingManager::update_meeting(const Meeting &meeting)
     }
 
     // Serialize meeting
-    uint8_t buffer[Meeting::serialized_size()];
-    meeting.serialize(buffer);
-
-    // Read page, update data, write back
-    Page page = db->read_page(loc.page_id);
-    memcpy(page.data + loc.offset, buffer, Meeting::serialized_size());
-    db->write_page(loc.page_id, page);
+    std::vector<uint8_t> buffer;
+    meeting.encode(buffer);
 
-    return true;
+    // Rewrite the record in its heap slot
+    return record_heap->update(loc, buffer.data(), buffer.size());
 }
 
 bool MeetingManager::create_meeting(uint64_t creator_id, const std::string &title,
@@ -127,7 +128,11 @@ bool MeetingManager::create_meeting(uint64_t creator_id, const std::string &titl
     }
 
     // Save database header
-    db->write_header();
+    if (!db->write_header())
+    {
+        error = "Failed to commit meeting";
+        return false;
+    }
 
     out_meeting = meeting;
     std::cout << "Meeting created: " << meeting.title << " (Code: " << meeting.meeting_code << ")" << std::endl;
@@ -167,8 +172,11 @@ bool MeetingManager::get_meeting(uint64_t meeting_id, Meeting &out_meeting)
         return false;
     }
 
-    Page page = db->read_page(loc.page_id);
-    out_meeting.deserialize(page.data + loc.offset);
+    RecordView record;
+    if (!record_heap->read(loc, record) || !out_meeting.decode(record.data, record.size))
+    {
+        return false;
+    }
 
     return true;
 }
@@ -183,8 +191,11 @@ bool MeetingManager::get_meeting_by_code(const std::string &code, Meeting &out_m
         return false;
     }
 
-    Page page = db->read_page(loc.page_id);
-    out_meeting.deserialize(page.data + loc.offset);
+    RecordView record;
+    if (!record_heap->read(loc, record) || !out_meeting.decode(record.data, record.size))
+    {
+        return false;
+    }
 
     return true;
 }
@@ -249,18 +260,16 @@ std::vector<Meeting> MeetingManager::get_user_meetings(uint64_t user_id)
 {
     std::vector<Meeting> user_meetings;
 
-    // For simplicity, we'll scan all meetings
-    // In production, you'd want a separate index for creator_id
-    // This is acceptable for a DSA project with limited data
-
-    // Range search from meeting_id 1 to max
-    auto locations = meetings_btree->range_search(1, UINT64_MAX);
+    auto locations = creator_index->range_search(BTreeKey(user_id, 0), BTreeKey(user_id, UINT64_MAX));
 
     for (const auto &loc : locations)
     {
-        Page page = db->read_page(loc.page_id);
+        RecordView record;
         Meeting meeting;
-        meeting.deserialize(page.data + loc.offset);
+        if (!record_heap->read(loc, record) || !meeting.decode(record.data, record.size))
+        {
+            continue;
+        }
 
         if (meeting.creator_id == user_id)
         {
@@ -358,8 +367,9 @@ bool MeetingManager::delete_meeting(uint64_t meeting_id, uint64_t user_id, std::
     if (found)
     {
         meetings_btree->remove(meeting_id);
-        // Free the page
-        db->free_page(meeting_loc.page_id);
+        creator_index->remove(BTreeKey(meeting.creator_id, meeting_id));
+        // Free the record
+        record_heap->remove(meeting_loc);
     }
 
     // Remove from hash table (meeting code)
@@ -377,4 +387,36 @@ bool MeetingManager::delete_meeting(uint64_t meeting_id, uint64_t user_id, std::
 
     std::cout << "🗑️  Deleted meeting " << meeting_id << " (" << meeting.title << ")" << std::endl;
     return true;
-}
\ No newline at end of file
+}
+
+size_t MeetingManager::migrate_records()
+{
+    return record_heap->reencode_legacy<Meeting>(meetings_btree->range_search(1, UINT64_MAX));
+}
+
+size_t MeetingManager::build_creator_index()
+{
+    std::vector<std::pair<BTreeKey, RecordLocation>> entries;
+
+    for (const auto &loc : meetings_btree->range_search(1, UINT64_MAX))
+    {
+        RecordView record;
+        Meeting meeting;
+        if (!record_heap->read(loc, record) || !meeting.decode(record.data, record.size))
+        {
+            continue;
+        }
+
+        entries.emplace_back(BTreeKey(meeting.creator_id, meeting.meeting_id), loc);
+    }
+
+    // Sorted once, then built bottom-up instead of one insert per record
+    std::sort(entries.begin(), entries.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    if (!creator_index->bulk_load(entries, BTREE_REBUILD_FILL_FACTOR))
+    {
+        return 0;
+    }
+
+    return entries.size();
+}
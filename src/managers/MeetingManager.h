@@ -2,6 +2,7 @@
 #define MEETING_MANAGER_H
 
 #include "../storage/DatabaseEngine.h"
+#include "../storage/RecordHeap.h"
 #include "../storage/BTree.h"
 #include "../storage/HashTable.h"
 #include "../models/Meeting.h"
@@ -23,14 +24,18 @@ class MeetingManager
 {
 private:
     DatabaseEngine *db;
+    RecordHeap *record_heap;
     BTree *meetings_btree;
+    BTree *creator_index;   // (creator_id, meeting_id) -> location
     HashTable *meeting_code_hash;
 
     std::mutex participants_mutex;
 
 public:
-    MeetingManager(DatabaseEngine *database, BTree *meetings_tree, HashTable *code_hash)
-        : db(database), meetings_btree(meetings_tree), meeting_code_hash(code_hash) {}
+    MeetingManager(DatabaseEngine *database, RecordHeap *heap, BTree *meetings_tree,
+                   BTree *creator_tree, HashTable *code_hash)
+        : db(database), record_heap(heap), meetings_btree(meetings_tree), creator_index(creator_tree),
+          meeting_code_hash(code_hash) {}
 
     // Create new meeting
     bool create_meeting(uint64_t creator_id, const std::string &title,
@@ -67,6 +72,12 @@ public:
     // Get all participants in meeting
     std::vector<MeetingParticipant> get_participants(uint64_t meeting_id);
 
+    // Fill an empty creator index from the meeting tree; returns the count
+    size_t build_creator_index();
+
+    // Rewrite version-1 records in the compact format; returns the count
+    size_t migrate_records();
+
 private:
     std::map<uint64_t, std::vector<MeetingParticipant>> meeting_participants;
     
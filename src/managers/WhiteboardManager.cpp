@@ -41,26 +41,31 @@ void WhiteboardManager::persistence_worker()
 
 bool WhiteboardManager::store_element(const WhiteboardElement &element)
 {
-    // Allocate page for element
-    uint64_t data_page_id = db->allocate_page();
-
     // Serialize element
-    uint8_t buffer[WhiteboardElement::serialized_size()];
-    element.serialize(buffer);
-
-    // Write to page
-    Page data_page;
-    memcpy(data_page.data, buffer, WhiteboardElement::serialized_size());
-    db->write_page(data_page_id, data_page);
+    std::vector<uint8_t> buffer;
+    element.encode(buffer);
 
-    // Create record location
-    RecordLocation element_loc(data_page_id, 0, WhiteboardElement::serialized_size());
+    // Pack into a shared heap page
+    RecordLocation element_loc = record_heap->insert(buffer.data(), buffer.size());
+    if (element_loc.page_id == 0)
+    {
+        std::cerr << "Failed to store element record" << std::endl;
+        return false;
+    }
 
     // Index in B-Tree by element_id
     if (!whiteboard_btree->insert(element.element_id, element_loc))
     {
         std::cerr << "Failed to insert whiteboard element into B-Tree" << std::endl;
-        db->free_page(data_page_id);
+        record_heap->remove(element_loc);
+        return false;
+    }
+
+    if (!meeting_index->insert(BTreeKey(element.meeting_id, element.timestamp, element.element_id), element_loc))
+    {
+        std::cerr << "Failed to insert whiteboard element into meeting index" << std::endl;
+        whiteboard_btree->remove(element.element_id);
+        record_heap->remove(element_loc);
         return false;
     }
 
@@ -159,30 +164,27 @@ std::vector<WhiteboardElement> WhiteboardManager::get_meeting_elements(uint64_t
         }
     }
 
-    // Cache miss - load from disk
+    // Cache miss - load from disk, already in timestamp order
     std::vector<WhiteboardElement> elements;
 
-    auto locations = whiteboard_btree->range_search(1, UINT64_MAX);
+    auto locations = meeting_index->range_search(BTreeKey(meeting_id, 0, 0),
+                                                 BTreeKey(meeting_id, UINT64_MAX, UINT64_MAX));
 
     for (const auto &loc : locations)
     {
-        Page page = db->read_page(loc.page_id);
+        RecordView record;
         WhiteboardElement element;
-        element.deserialize(page.data + loc.offset);
+        if (!record_heap->read(loc, record) || !element.decode(record.data, record.size))
+        {
+            continue;
+        }
 
-        if (element.meeting_id == meeting_id && element.element_type != 255)
+        if (element.element_type != 255)
         {
             elements.push_back(element);
         }
     }
 
-    // Sort by timestamp
-    std::sort(elements.begin(), elements.end(),
-              [](const WhiteboardElement &a, const WhiteboardElement &b)
-              {
-                  return a.timestamp < b.timestamp;
-              });
-
     // Update cache
     {
         std::lock_guard<std::mutex> lock(cache_mutex);
@@ -197,26 +199,25 @@ std::vector<WhiteboardElement> WhiteboardManager::get_elements_since(uint64_t me
 {
     std::vector<WhiteboardElement> elements;
 
-    auto locations = whiteboard_btree->range_search(1, UINT64_MAX);
+    if (since_timestamp == UINT64_MAX)
+    {
+        return elements;
+    }
+
+    auto locations = meeting_index->range_search(BTreeKey(meeting_id, since_timestamp + 1, 0),
+                                                 BTreeKey(meeting_id, UINT64_MAX, UINT64_MAX));
 
     for (const auto &loc : locations)
     {
-        Page page = db->read_page(loc.page_id);
+        RecordView record;
         WhiteboardElement element;
-        element.deserialize(page.data + loc.offset);
-
-        if (element.meeting_id == meeting_id && element.timestamp > since_timestamp)
+        if (!record_heap->read(loc, record) || !element.decode(record.data, record.size))
         {
-            elements.push_back(element);
+            continue;
         }
-    }
 
-    // Sort by timestamp
-    std::sort(elements.begin(), elements.end(),
-              [](const WhiteboardElement &a, const WhiteboardElement &b)
-              {
-                  return a.timestamp < b.timestamp;
-              });
+        elements.push_back(element);
+    }
 
     return elements;
 }
@@ -280,12 +281,14 @@ bool WhiteboardManager::delete_element(uint64_t element_id, std::string &error)
         return false;
     }
 
-    uint8_t buffer[WhiteboardElement::serialized_size()];
-    element.serialize(buffer);
+    std::vector<uint8_t> buffer;
+    element.encode(buffer);
 
-    Page page = db->read_page(loc.page_id);
-    memcpy(page.data + loc.offset, buffer, WhiteboardElement::serialized_size());
-    db->write_page(loc.page_id, page);
+    if (!record_heap->update(loc, buffer.data(), buffer.size()))
+    {
+        error = "Failed to update element";
+        return false;
+    }
 
     return true;
 }
@@ -300,8 +303,11 @@ bool WhiteboardManager::get_element(uint64_t element_id, WhiteboardElement &out_
         return false;
     }
 
-    Page page = db->read_page(loc.page_id);
-    out_element.deserialize(page.data + loc.offset);
+    RecordView record;
+    if (!record_heap->read(loc, record) || !out_element.decode(record.data, record.size))
+    {
+        return false;
+    }
 
     return true;
 }
@@ -314,19 +320,54 @@ void WhiteboardManager::delete_meeting_elements(uint64_t meeting_id)
     meeting_elements_cache.erase(meeting_id);
 
     // Remove from database
-    auto locations = whiteboard_btree->range_search(1, UINT64_MAX);
+    auto locations = meeting_index->range_search(BTreeKey(meeting_id, 0, 0),
+                                                 BTreeKey(meeting_id, UINT64_MAX, UINT64_MAX));
     for (const auto &loc : locations)
     {
-        Page page = db->read_page(loc.page_id);
+        RecordView record;
         WhiteboardElement element;
-        element.deserialize(page.data + loc.offset);
-
-        if (element.meeting_id == meeting_id)
+        if (!record_heap->read(loc, record) || !element.decode(record.data, record.size))
         {
-            whiteboard_btree->remove(element.element_id);
-            db->free_page(loc.page_id);
+            continue;
         }
+
+        record.page.release();  // Unpin before the heap rewrites the page
+        whiteboard_btree->remove(element.element_id);
+        meeting_index->remove(BTreeKey(meeting_id, element.timestamp, element.element_id));
+        record_heap->remove(loc);
     }
 
     std::cout << "🗑️  Deleted all whiteboard elements for meeting " << meeting_id << std::endl;
-}
\ No newline at end of file
+}
+
+size_t WhiteboardManager::migrate_records()
+{
+    return record_heap->reencode_legacy<WhiteboardElement>(whiteboard_btree->range_search(1, UINT64_MAX));
+}
+
+size_t WhiteboardManager::build_meeting_index()
+{
+    std::vector<std::pair<BTreeKey, RecordLocation>> entries;
+
+    for (const auto &loc : whiteboard_btree->range_search(1, UINT64_MAX))
+    {
+        RecordView record;
+        WhiteboardElement element;
+        if (!record_heap->read(loc, record) || !element.decode(record.data, record.size))
+        {
+            continue;
+        }
+
+        entries.emplace_back(BTreeKey(element.meeting_id, element.timestamp, element.element_id), loc);
+    }
+
+    // Sorted once, then built bottom-up instead of one insert per record
+    std::sort(entries.begin(), entries.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    if (!meeting_index->bulk_load(entries, BTREE_REBUILD_FILL_FACTOR))
+    {
+        return 0;
+    }
+
+    return entries.size();
+}
@@ -2,6 +2,7 @@
 #define WHITEBOARD_MANAGER_H
 
 #include "../storage/DatabaseEngine.h"
+#include "../storage/RecordHeap.h"
 #include "../storage/BTree.h"
 #include "../models/WhiteboardElement.h"
 #include <string>
@@ -17,7 +18,9 @@ class WhiteboardManager
 {
 private:
     DatabaseEngine *db;
+    RecordHeap *record_heap;
     BTree *whiteboard_btree;
+    BTree *meeting_index;   // (meeting_id, timestamp, element_id) -> location
 
     // Cache: meeting_id -> elements (up to 500 per meeting)
     std::map<uint64_t, std::vector<WhiteboardElement>> meeting_elements_cache;
@@ -34,8 +37,9 @@ private:
     void persistence_worker();
 
 public:
-    WhiteboardManager(DatabaseEngine *database, BTree *whiteboard_tree)
-        : db(database), whiteboard_btree(whiteboard_tree), stop_persistence_thread(false)
+    WhiteboardManager(DatabaseEngine *database, RecordHeap *heap, BTree *whiteboard_tree, BTree *meeting_tree)
+        : db(database), record_heap(heap), whiteboard_btree(whiteboard_tree), meeting_index(meeting_tree),
+          stop_persistence_thread(false)
     {
         persistence_thread = std::thread(&WhiteboardManager::persistence_worker, this);
     }
@@ -73,6 +77,12 @@ public:
 
     void delete_meeting_elements(uint64_t meeting_id);
 
+    // Fill an empty meeting index from the element tree; returns the count
+    size_t build_meeting_index();
+
+    // Rewrite version-1 records in the compact format; returns the count
+    size_t migrate_records();
+
 private:
     // Store whiteboard element
     bool store_element(const WhiteboardElement &element);
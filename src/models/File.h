@@ -1,6 +1,8 @@
 #pragma once
 #include <cstdint>
 #include <cstring>
+#include <vector>
+#include "../utils/RecordCodec.h"
 
 
 
@@ -21,19 +23,8 @@ struct FileRecord {
         memset(file_hash, 0, sizeof(file_hash));
     }
     
-    void serialize(uint8_t* buffer) const {
-        size_t offset = 0;
-        memcpy(buffer + offset, &file_id, sizeof(file_id)); offset += sizeof(file_id);
-        memcpy(buffer + offset, &meeting_id, sizeof(meeting_id)); offset += sizeof(meeting_id);
-        memcpy(buffer + offset, &uploader_id, sizeof(uploader_id)); offset += sizeof(uploader_id);
-        memcpy(buffer + offset, filename, sizeof(filename)); offset += sizeof(filename);
-        memcpy(buffer + offset, file_hash, sizeof(file_hash)); offset += sizeof(file_hash);
-        memcpy(buffer + offset, &file_size, sizeof(file_size)); offset += sizeof(file_size);
-        memcpy(buffer + offset, &uploaded_at, sizeof(uploaded_at)); offset += sizeof(uploaded_at);
-        memcpy(buffer + offset, &data_page_id, sizeof(data_page_id)); offset += sizeof(data_page_id);
-    }
-    
-    void deserialize(const uint8_t* buffer) {
+    // Version-1 fixed layout, still read from files written before version 2
+    void deserialize_legacy(const uint8_t* buffer) {
         size_t offset = 0;
         memcpy(&file_id, buffer + offset, sizeof(file_id)); offset += sizeof(file_id);
         memcpy(&meeting_id, buffer + offset, sizeof(meeting_id)); offset += sizeof(meeting_id);
@@ -45,9 +36,42 @@ struct FileRecord {
         memcpy(&data_page_id, buffer + offset, sizeof(data_page_id)); offset += sizeof(data_page_id);
     }
     
-    static size_t serialized_size() {
+    static size_t legacy_size() {
         return sizeof(file_id) + sizeof(meeting_id) + sizeof(uploader_id) + 
                sizeof(filename) + sizeof(file_hash) + sizeof(file_size) + 
                sizeof(uploaded_at) + sizeof(data_page_id);
     }
-};
\ No newline at end of file
+    
+    // Compact encoding (see RecordCodec.h), appended to out
+    void encode(std::vector<uint8_t>& out) const {
+        RecordWriter writer(out);
+        writer.put_uint(file_id);
+        writer.put_uint(meeting_id);
+        writer.put_uint(uploader_id);
+        writer.put_string(filename, sizeof(filename));
+        writer.put_string(file_hash, sizeof(file_hash));
+        writer.put_uint(file_size);
+        writer.put_uint(uploaded_at);
+        writer.put_uint(data_page_id);
+        writer.finish(legacy_size());
+    }
+    
+    // Decode either format; version-1 records are recognised by their size
+    bool decode(const uint8_t* data, size_t size) {
+        if (size == legacy_size()) {
+            deserialize_legacy(data);
+            return true;
+        }
+        
+        RecordReader reader(data, size);
+        reader.get_uint(file_id);
+        reader.get_uint(meeting_id);
+        reader.get_uint(uploader_id);
+        reader.get_string(filename, sizeof(filename));
+        reader.get_string(file_hash, sizeof(file_hash));
+        reader.get_uint(file_size);
+        reader.get_uint(uploaded_at);
+        reader.get_uint(data_page_id);
+        return reader.ok();
+    }
+};
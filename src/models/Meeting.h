@@ -2,6 +2,8 @@
 
 #include <cstdint>
 #include <cstring>
+#include <vector>
+#include "../utils/RecordCodec.h"
 
 // Meeting model
 struct Meeting {
@@ -20,19 +22,8 @@ struct Meeting {
         memset(title, 0, sizeof(title));
     }
     
-    void serialize(uint8_t* buffer) const {
-        size_t offset = 0;
-        memcpy(buffer + offset, &meeting_id, sizeof(meeting_id)); offset += sizeof(meeting_id);
-        memcpy(buffer + offset, meeting_code, sizeof(meeting_code)); offset += sizeof(meeting_code);
-        memcpy(buffer + offset, title, sizeof(title)); offset += sizeof(title);
-        memcpy(buffer + offset, &creator_id, sizeof(creator_id)); offset += sizeof(creator_id);
-        memcpy(buffer + offset, &created_at, sizeof(created_at)); offset += sizeof(created_at);
-        memcpy(buffer + offset, &started_at, sizeof(started_at)); offset += sizeof(started_at);
-        memcpy(buffer + offset, &ended_at, sizeof(ended_at)); offset += sizeof(ended_at);
-        buffer[offset++] = is_active ? 1 : 0;
-    }
-    
-    void deserialize(const uint8_t* buffer) {
+    // Version-1 fixed layout, still read from files written before version 2
+    void deserialize_legacy(const uint8_t* buffer) {
         size_t offset = 0;
         memcpy(&meeting_id, buffer + offset, sizeof(meeting_id)); offset += sizeof(meeting_id);
         memcpy(meeting_code, buffer + offset, sizeof(meeting_code)); offset += sizeof(meeting_code);
@@ -44,9 +35,44 @@ struct Meeting {
         is_active = (buffer[offset++] == 1);
     }
     
-    static size_t serialized_size() {
+    static size_t legacy_size() {
         return sizeof(meeting_id) + sizeof(meeting_code) + sizeof(title) + 
                sizeof(creator_id) + sizeof(created_at) + sizeof(started_at) + 
                sizeof(ended_at) + 1;
     }
+    
+    // Compact encoding (see RecordCodec.h), appended to out
+    void encode(std::vector<uint8_t>& out) const {
+        RecordWriter writer(out);
+        writer.put_uint(meeting_id);
+        writer.put_string(meeting_code, sizeof(meeting_code));
+        writer.put_string(title, sizeof(title));
+        writer.put_uint(creator_id);
+        writer.put_uint(created_at);
+        writer.put_uint(started_at);
+        writer.put_uint(ended_at);
+        writer.put_uint(is_active ? 1 : 0);
+        writer.finish(legacy_size());
+    }
+    
+    // Decode either format; version-1 records are recognised by their size
+    bool decode(const uint8_t* data, size_t size) {
+        if (size == legacy_size()) {
+            deserialize_legacy(data);
+            return true;
+        }
+        
+        RecordReader reader(data, size);
+        reader.get_uint(meeting_id);
+        reader.get_string(meeting_code, sizeof(meeting_code));
+        reader.get_string(title, sizeof(title));
+        reader.get_uint(creator_id);
+        reader.get_uint(created_at);
+        reader.get_uint(started_at);
+        reader.get_uint(ended_at);
+        uint8_t active;
+        reader.get_uint(active);
+        is_active = (active == 1);
+        return reader.ok();
+    }
 };
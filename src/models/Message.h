@@ -1,6 +1,8 @@
 #pragma once
 #include <cstdint>
 #include <cstring>
+#include <vector>
+#include "../utils/RecordCodec.h"
 
 struct Message
 {
@@ -17,24 +19,8 @@ struct Message
         memset(content, 0, sizeof(content));
     }
 
-    void serialize(uint8_t *buffer) const
-    {
-        size_t offset = 0;
-        memcpy(buffer + offset, &message_id, sizeof(message_id));
-        offset += sizeof(message_id);
-        memcpy(buffer + offset, &meeting_id, sizeof(meeting_id));
-        offset += sizeof(meeting_id);
-        memcpy(buffer + offset, &user_id, sizeof(user_id));
-        offset += sizeof(user_id);
-        memcpy(buffer + offset, username, sizeof(username));
-        offset += sizeof(username);
-        memcpy(buffer + offset, content, sizeof(content));
-        offset += sizeof(content);
-        memcpy(buffer + offset, &timestamp, sizeof(timestamp));
-        offset += sizeof(timestamp);
-    }
-
-    void deserialize(const uint8_t *buffer)
+    // Version-1 fixed layout, still read from files written before version 2
+    void deserialize_legacy(const uint8_t *buffer)
     {
         size_t offset = 0;
         memcpy(&message_id, buffer + offset, sizeof(message_id));
@@ -51,9 +37,41 @@ struct Message
         offset += sizeof(timestamp);
     }
 
-    static size_t serialized_size()
+    static size_t legacy_size()
     {
         return sizeof(message_id) + sizeof(meeting_id) + sizeof(user_id) +
                sizeof(username) + sizeof(content) + sizeof(timestamp);
     }
-};
\ No newline at end of file
+
+    // Compact encoding (see RecordCodec.h), appended to out
+    void encode(std::vector<uint8_t> &out) const
+    {
+        RecordWriter writer(out);
+        writer.put_uint(message_id);
+        writer.put_uint(meeting_id);
+        writer.put_uint(user_id);
+        writer.put_string(username, sizeof(username));
+        writer.put_string(content, sizeof(content));
+        writer.put_uint(timestamp);
+        writer.finish(legacy_size());
+    }
+
+    // Decode either format; version-1 records are recognised by their size
+    bool decode(const uint8_t *data, size_t size)
+    {
+        if (size == legacy_size())
+        {
+            deserialize_legacy(data);
+            return true;
+        }
+
+        RecordReader reader(data, size);
+        reader.get_uint(message_id);
+        reader.get_uint(meeting_id);
+        reader.get_uint(user_id);
+        reader.get_string(username, sizeof(username));
+        reader.get_string(content, sizeof(content));
+        reader.get_uint(timestamp);
+        return reader.ok();
+    }
+};
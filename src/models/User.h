@@ -3,6 +3,7 @@
 #include <cstring>
 #include <string>
 #include <vector>
+#include "../utils/RecordCodec.h"
 
 // User model
 struct User {
@@ -18,16 +19,8 @@ struct User {
         memset(username, 0, sizeof(username));
     }
     
-    void serialize(uint8_t* buffer) const {
-        size_t offset = 0;
-        memcpy(buffer + offset, &user_id, sizeof(user_id)); offset += sizeof(user_id);
-        memcpy(buffer + offset, email, sizeof(email)); offset += sizeof(email);
-        memcpy(buffer + offset, password_hash, sizeof(password_hash)); offset += sizeof(password_hash);
-        memcpy(buffer + offset, username, sizeof(username)); offset += sizeof(username);
-        memcpy(buffer + offset, &created_at, sizeof(created_at)); offset += sizeof(created_at);
-    }
-    
-    void deserialize(const uint8_t* buffer) {
+    // Version-1 fixed layout, still read from files written before version 2
+    void deserialize_legacy(const uint8_t* buffer) {
         size_t offset = 0;
         memcpy(&user_id, buffer + offset, sizeof(user_id)); offset += sizeof(user_id);
         memcpy(email, buffer + offset, sizeof(email)); offset += sizeof(email);
@@ -36,14 +29,35 @@ struct User {
         memcpy(&created_at, buffer + offset, sizeof(created_at)); offset += sizeof(created_at);
     }
     
-    static size_t serialized_size() {
+    static size_t legacy_size() {
         return sizeof(user_id) + sizeof(email) + sizeof(password_hash) + 
                sizeof(username) + sizeof(created_at);
     }
+    
+    // Compact encoding (see RecordCodec.h), appended to out
+    void encode(std::vector<uint8_t>& out) const {
+        RecordWriter writer(out);
+        writer.put_uint(user_id);
+        writer.put_string(email, sizeof(email));
+        writer.put_string(password_hash, sizeof(password_hash));
+        writer.put_string(username, sizeof(username));
+        writer.put_uint(created_at);
+        writer.finish(legacy_size());
+    }
+    
+    // Decode either format; version-1 records are recognised by their size
+    bool decode(const uint8_t* data, size_t size) {
+        if (size == legacy_size()) {
+            deserialize_legacy(data);
+            return true;
+        }
+        
+        RecordReader reader(data, size);
+        reader.get_uint(user_id);
+        reader.get_string(email, sizeof(email));
+        reader.get_string(password_hash, sizeof(password_hash));
+        reader.get_string(username, sizeof(username));
+        reader.get_uint(created_at);
+        return reader.ok();
+    }
 };
-
-
-
-
-
-
@@ -1,6 +1,8 @@
 #pragma once
 #include <cstdint>
 #include <cstring>
+#include <vector>
+#include "../utils/RecordCodec.h"
 
 
 
@@ -22,25 +24,8 @@ struct WhiteboardElement {
         memset(text, 0, sizeof(text));
     }
     
-    void serialize(uint8_t* buffer) const {
-        size_t offset = 0;
-        memcpy(buffer + offset, &element_id, sizeof(element_id)); offset += sizeof(element_id);
-        memcpy(buffer + offset, &meeting_id, sizeof(meeting_id)); offset += sizeof(meeting_id);
-        memcpy(buffer + offset, &user_id, sizeof(user_id)); offset += sizeof(user_id);
-        buffer[offset++] = element_type;
-        memcpy(buffer + offset, &x1, sizeof(x1)); offset += sizeof(x1);
-        memcpy(buffer + offset, &y1, sizeof(y1)); offset += sizeof(y1);
-        memcpy(buffer + offset, &x2, sizeof(x2)); offset += sizeof(x2);
-        memcpy(buffer + offset, &y2, sizeof(y2)); offset += sizeof(y2);
-        buffer[offset++] = color_r;
-        buffer[offset++] = color_g;
-        buffer[offset++] = color_b;
-        memcpy(buffer + offset, &stroke_width, sizeof(stroke_width)); offset += sizeof(stroke_width);
-        memcpy(buffer + offset, text, sizeof(text)); offset += sizeof(text);
-        memcpy(buffer + offset, &timestamp, sizeof(timestamp)); offset += sizeof(timestamp);
-    }
-    
-    void deserialize(const uint8_t* buffer) {
+    // Version-1 fixed layout, still read from files written before version 2
+    void deserialize_legacy(const uint8_t* buffer) {
         size_t offset = 0;
         memcpy(&element_id, buffer + offset, sizeof(element_id)); offset += sizeof(element_id);
         memcpy(&meeting_id, buffer + offset, sizeof(meeting_id)); offset += sizeof(meeting_id);
@@ -58,9 +43,54 @@ struct WhiteboardElement {
         memcpy(&timestamp, buffer + offset, sizeof(timestamp)); offset += sizeof(timestamp);
     }
     
-    static size_t serialized_size() {
+    static size_t legacy_size() {
         return sizeof(element_id) + sizeof(meeting_id) + sizeof(user_id) + 1 +
                sizeof(x1) + sizeof(y1) + sizeof(x2) + sizeof(y2) + 3 +
                sizeof(stroke_width) + sizeof(text) + sizeof(timestamp);
     }
+    
+    // Compact encoding (see RecordCodec.h), appended to out
+    void encode(std::vector<uint8_t>& out) const {
+        RecordWriter writer(out);
+        writer.put_uint(element_id);
+        writer.put_uint(meeting_id);
+        writer.put_uint(user_id);
+        writer.put_uint(element_type);
+        writer.put_int(x1);
+        writer.put_int(y1);
+        writer.put_int(x2);
+        writer.put_int(y2);
+        writer.put_uint(color_r);
+        writer.put_uint(color_g);
+        writer.put_uint(color_b);
+        writer.put_uint(stroke_width);
+        writer.put_string(text, sizeof(text));
+        writer.put_uint(timestamp);
+        writer.finish(legacy_size());
+    }
+    
+    // Decode either format; version-1 records are recognised by their size
+    bool decode(const uint8_t* data, size_t size) {
+        if (size == legacy_size()) {
+            deserialize_legacy(data);
+            return true;
+        }
+        
+        RecordReader reader(data, size);
+        reader.get_uint(element_id);
+        reader.get_uint(meeting_id);
+        reader.get_uint(user_id);
+        reader.get_uint(element_type);
+        reader.get_int(x1);
+        reader.get_int(y1);
+        reader.get_int(x2);
+        reader.get_int(y2);
+        reader.get_uint(color_r);
+        reader.get_uint(color_g);
+        reader.get_uint(color_b);
+        reader.get_uint(stroke_width);
+        reader.get_string(text, sizeof(text));
+        reader.get_uint(timestamp);
+        return reader.ok();
+    }
 };
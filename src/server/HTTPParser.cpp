@@ -0,0 +1,201 @@
+#include "server/HTTPParser.h"
+#include <algorithm>
+#include <cctype>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define HTTP_PARSER_HAVE_SSE42 1
+#endif
+
+namespace {
+
+// [low, high] byte pairs a scan stops at, padded to the 16 bytes pcmpestri
+// loads. Names end at ':', space or a control byte; the method and target
+// at a space or control byte; values (and the version) at a control byte
+// other than tab.
+alignas(16) const char NAME_STOP[16] = "\x00\x20::\x7f\xff";
+const int NAME_STOP_SIZE = 6;
+alignas(16) const char TOKEN_STOP[16] = "\x00\x20\x7f\x7f";
+const int TOKEN_STOP_SIZE = 4;
+alignas(16) const char VALUE_STOP[16] = "\x00\x08\x0a\x1f\x7f\x7f";
+const int VALUE_STOP_SIZE = 6;
+
+bool in_ranges(unsigned char c, const char* ranges, int ranges_size) {
+    for (int i = 0; i < ranges_size; i += 2) {
+        if (c >= static_cast<unsigned char>(ranges[i]) && c <= static_cast<unsigned char>(ranges[i + 1])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef HTTP_PARSER_HAVE_SSE42
+// Built for SSE4.2 on its own, like crc32c_sse42; stops short of the last
+// 16 bytes, which the scalar loop finishes
+__attribute__((target("sse4.2")))
+const char* find_in_ranges_sse42(const char* p, const char* end, const char* ranges, int ranges_size) {
+    __m128i stop = _mm_load_si128(reinterpret_cast<const __m128i*>(ranges));
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int index = _mm_cmpestri(stop, ranges_size, bytes, 16,
+                                 _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (index != 16) {
+            return p + index;
+        }
+        p += 16;
+    }
+    return p;
+}
+#endif
+
+// First byte from p on that falls in ranges, or end
+const char* find_in_ranges(const char* p, const char* end, const char* ranges, int ranges_size) {
+#ifdef HTTP_PARSER_HAVE_SSE42
+    static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+    if (has_sse42) {
+        p = find_in_ranges_sse42(p, end, ranges, ranges_size);
+    }
+#endif
+    while (p < end && !in_ranges(static_cast<unsigned char>(*p), ranges, ranges_size)) {
+        p++;
+    }
+    return p;
+}
+
+// Step p over the CRLF or LF it is at; p < end
+int skip_line_end(const char*& p, const char* end) {
+    if (*p == '\n') {
+        p++;
+        return 0;
+    }
+    if (*p == '\r') {
+        if (p + 1 == end) {
+            return HTTP_PARSE_INCOMPLETE;
+        }
+        if (p[1] == '\n') {
+            p += 2;
+            return 0;
+        }
+    }
+    return HTTP_PARSE_ERROR;
+}
+
+bool parse_content_length(std::string_view value, size_t& length) {
+    if (value.empty() || value.size() > 18) {
+        return false;
+    }
+    length = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        length = length * 10 + (c - '0');
+    }
+    return true;
+}
+
+// Scan a token ending in a single space, as the method and target do
+int parse_token(const char*& p, const char* end, std::string_view& token) {
+    const char* start = p;
+    p = find_in_ranges(p, end, TOKEN_STOP, TOKEN_STOP_SIZE);
+    if (p == end) {
+        return HTTP_PARSE_INCOMPLETE;
+    }
+    if (*p != ' ' || p == start) {
+        return HTTP_PARSE_ERROR;
+    }
+    token = std::string_view(start, p - start);
+    p++;
+    return 0;
+}
+
+}  // namespace
+
+bool equals_ignore_case(std::string_view a, std::string_view b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+int parse_http_request(const char* data, size_t size, ParsedRequest& out) {
+    const char* p = data;
+    const char* end = data + size;
+    out.header_count = 0;
+    out.content_length = 0;
+
+    // Blank lines before the request line are ignored
+    while (p < end && (*p == '\r' || *p == '\n')) {
+        p++;
+    }
+
+    // Request line
+    int status = parse_token(p, end, out.method);
+    if (status == 0) {
+        status = parse_token(p, end, out.target);
+    }
+    if (status != 0) {
+        return status;
+    }
+    const char* start = p;
+    p = find_in_ranges(p, end, VALUE_STOP, VALUE_STOP_SIZE);
+    if (p == end) {
+        return HTTP_PARSE_INCOMPLETE;
+    }
+    out.version = std::string_view(start, p - start);
+    if (out.version.substr(0, 5) != "HTTP/") {
+        return HTTP_PARSE_ERROR;
+    }
+    if ((status = skip_line_end(p, end)) != 0) {
+        return status;
+    }
+
+    // Headers, up to the blank line
+    for (;;) {
+        if (p == end) {
+            return HTTP_PARSE_INCOMPLETE;
+        }
+        if (*p == '\r' || *p == '\n') {
+            if ((status = skip_line_end(p, end)) != 0) {
+                return status;
+            }
+            return static_cast<int>(p - data);
+        }
+        if (out.header_count == HTTP_MAX_HEADERS) {
+            return HTTP_PARSE_ERROR;
+        }
+
+        start = p;
+        p = find_in_ranges(p, end, NAME_STOP, NAME_STOP_SIZE);
+        if (p == end) {
+            return HTTP_PARSE_INCOMPLETE;
+        }
+        if (*p != ':' || p == start) {
+            return HTTP_PARSE_ERROR;
+        }
+        std::string_view name(start, p - start);
+        p++;
+
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        start = p;
+        p = find_in_ranges(p, end, VALUE_STOP, VALUE_STOP_SIZE);
+        if (p == end) {
+            return HTTP_PARSE_INCOMPLETE;
+        }
+        const char* value_end = p;
+        while (value_end > start && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+            value_end--;
+        }
+        std::string_view value(start, value_end - start);
+        if ((status = skip_line_end(p, end)) != 0) {
+            return status;
+        }
+
+        if (equals_ignore_case(name, "Content-Length") && !parse_content_length(value, out.content_length)) {
+            return HTTP_PARSE_ERROR;
+        }
+        out.headers[out.header_count++] = HTTPHeaderView{name, value};
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <cstddef>
+#include <string_view>
+
+// A request may carry at most this many headers, and its request line and
+// headers together may take at most this many bytes
+const size_t HTTP_MAX_HEADERS = 64;
+const size_t HTTP_MAX_HEADER_BYTES = 64 * 1024;
+
+const int HTTP_PARSE_ERROR = -1;
+const int HTTP_PARSE_INCOMPLETE = -2;
+
+struct HTTPHeaderView {
+    std::string_view name;
+    std::string_view value;  // Without surrounding spaces and tabs
+};
+
+// Views into the buffer the request was parsed from; valid while it is
+struct ParsedRequest {
+    std::string_view method;
+    std::string_view target;   // Path and query string
+    std::string_view version;
+    HTTPHeaderView headers[HTTP_MAX_HEADERS];
+    size_t header_count;
+    size_t content_length;     // 0 without a Content-Length header
+
+    ParsedRequest() : header_count(0), content_length(0) {}
+};
+
+// Parse the request line and headers at the start of data in one pass,
+// without allocating. Returns their length including the blank line, so the
+// body starts there; HTTP_PARSE_INCOMPLETE when more bytes are needed, or
+// HTTP_PARSE_ERROR. Lines may end in CRLF or a bare LF. The scans for the
+// end of a token or value take 16 bytes per SSE4.2 pcmpestri when the CPU
+// has it (checked once at runtime).
+int parse_http_request(const char* data, size_t size, ParsedRequest& out);
+
+// Case-insensitive ASCII comparison, as header names need
+bool equals_ignore_case(std::string_view a, std::string_view b);
+
+#endif // HTTP_PARSER_H
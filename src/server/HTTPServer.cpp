@@ -1,232 +1,308 @@
 #include "server/HTTPServer.h"
 #include <iostream>
-#include <sstream>
-#include <algorithm>
-#include <iterator>
+#include <stdexcept>
+#include <atomic>
 
 // HTTPConnection implementation
+namespace
+{
+    // The peer closing an idle connection, or the idle timer closing it
+    bool is_disconnect(const boost::system::error_code &ec)
+    {
+        return ec == boost::asio::error::eof || ec == boost::asio::error::operation_aborted ||
+               ec == boost::asio::error::connection_reset;
+    }
+
+    beast::string_view to_beast(std::string_view view)
+    {
+        return beast::string_view(view.data(), view.size());
+    }
+}
+
 void HTTPConnection::read_request()
 {
     auto self = shared_from_this();
-    boost::asio::async_read_until(socket, buffer, "\r\n\r\n",
-                                  [this, self](boost::system::error_code ec, std::size_t bytes)
-                                  {
-                                      if (!ec)
-                                      {
-                                          // Read and parse request line + headers
-                                          std::istream stream(&buffer);
-                                          std::string request_line;
-                                          if (!std::getline(stream, request_line))
-                                          {
-                                              std::cerr << "Failed to read request line" << std::endl;
-                                              return;
-                                          }
-
-                                          // Read header lines
-                                          std::vector<std::string> header_lines;
-                                          std::string line;
-                                          while (std::getline(stream, line) && line != "\r" && !line.empty())
-                                          {
-                                              header_lines.push_back(line);
-                                          }
-
-                                          
-                                          std::map<std::string, std::string> temp_headers;
-                                          int content_length = 0;
-                                          for (const auto &hl : header_lines)
-                                          {
-                                              size_t colon_pos = hl.find(':');
-                                              if (colon_pos != std::string::npos)
-                                              {
-                                                  std::string key = hl.substr(0, colon_pos);
-                                                  std::string value = hl.substr(colon_pos + 1);
-                                                  // trim
-                                                  value.erase(0, value.find_first_not_of(" \t\r\n"));
-                                                  value.erase(value.find_last_not_of(" \t\r\n") + 1);
-                                                  temp_headers[key] = value;
-                                                  if (key == "Content-Length")
-                                                  {
-                                                      try
-                                                      {
-                                                          content_length = std::stoi(value);
-                                                      }
-                                                      catch (...)
-                                                      {
-                                                          content_length = 0;
-                                                      }
-                                                  }
-                                              }
-                                          }
-
-                                          std::string body_so_far((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
-
-                                          // Lambda to process the complete request
-                                          auto process_request = [this, request_line, header_lines](const std::string &full_body)
-                                          {
-                                              // Build raw request string
-                                              std::string raw_request = request_line + "\n";
-                                              for (const auto &hl : header_lines)
-                                              {
-                                                  raw_request += hl + "\n";
-                                              }
-                                              raw_request += "\n";
-                                              raw_request += full_body;
-
-                                              HTTPRequest request = parse_request(raw_request);
-                                              HTTPResponse response;
-                                              request_handler(request, response);
-                                              write_response(response);
-                                          };
-
-                                          if (content_length > 0 && (int)body_so_far.size() < content_length)
-                                          {
-                                              // Need to read more bytes
-                                              std::size_t bytes_needed = content_length - body_so_far.size();
-
-                                              // Create a new buffer for remaining data
-                                              auto remaining_buffer = std::make_shared<std::vector<char>>(bytes_needed);
-
-                                              boost::asio::async_read(socket,
-                                                                      boost::asio::buffer(*remaining_buffer),
-                                                                      boost::asio::transfer_exactly(bytes_needed),
-                                                                      [this, self, body_so_far, remaining_buffer, process_request](boost::system::error_code ec2, std::size_t bytes_read) mutable
-                                                                      {
-                                                                          if (!ec2)
-                                                                          {
-                                                                              // Append remaining bytes to body
-                                                                              body_so_far.append(remaining_buffer->begin(), remaining_buffer->end());
-                                                                              process_request(body_so_far);
-                                                                          }
-                                                                          else
-                                                                          {
-                                                                              std::cerr << "Error reading request body: " << ec2.message() << std::endl;
-                                                                          }
-                                                                      });
-                                          }
-                                          else
-                                          {
-                                              process_request(body_so_far);
-                                          }
-                                      }
-                                      else
-                                      {
-                                          std::cerr << "Error reading request: " << ec.message() << std::endl;
-                                      }
-                                  });
+
+    // Covers both the wait for the next request and a client that sends
+    // one slowly
+    idle_timer.expires_after(std::chrono::seconds(HTTP_IDLE_TIMEOUT_SECONDS));
+    idle_timer.async_wait([this, self](boost::system::error_code ec)
+                          {
+                              // Ignore an expiry that raced with a request arriving
+                              if (!ec && idle_timer.expiry() <= std::chrono::steady_clock::now())
+                              {
+                                  close();
+                              }
+                          });
+
+    // A pipelined request may already be in the buffer
+    parse_buffered();
 }
 
-void HTTPConnection::write_response(const HTTPResponse &response)
+// Parse what the buffer holds, in place. A request whose headers or body
+// have not all arrived is parsed again from the start once more bytes do.
+void HTTPConnection::parse_buffered()
+{
+    const char *data = static_cast<const char *>(buffer.data().data());
+    size_t size = buffer.size();
+
+    ParsedRequest parsed;
+    int header_bytes = parse_http_request(data, size, parsed);
+    if (header_bytes == HTTP_PARSE_INCOMPLETE)
+    {
+        if (size >= HTTP_MAX_HEADER_BYTES)
+        {
+            std::cerr << "Request headers exceed " << HTTP_MAX_HEADER_BYTES << " bytes" << std::endl;
+            close();
+            return;
+        }
+        read_more(1);
+        return;
+    }
+    if (header_bytes == HTTP_PARSE_ERROR)
+    {
+        std::cerr << "Malformed request" << std::endl;
+        close();
+        return;
+    }
+
+    size_t request_bytes = header_bytes + parsed.content_length;
+    if (size < request_bytes)
+    {
+        // Read the rest of the body into the same buffer in one go
+        read_more(request_bytes - size);
+        return;
+    }
+
+    process_request(parsed, data + header_bytes);
+    // The request's views are dead now; any requests after it stay
+    buffer.consume(request_bytes);
+}
+
+void HTTPConnection::read_more(size_t bytes)
 {
     auto self = shared_from_this();
-    auto response_str = std::make_shared<std::string>(response.to_string());
 
-    boost::asio::async_write(socket, boost::asio::buffer(*response_str),
-                             [this, self, response_str](boost::system::error_code ec, std::size_t)
-                             {
-                                 if (ec)
-                                 {
-                                     std::cerr << "Error writing response: " << ec.message() << std::endl;
-                                 }
-                                 socket.close();
-                             });
+    // Bytes past the request are kept for the next one
+    boost::asio::async_read(socket, buffer, boost::asio::transfer_at_least(bytes),
+                            [this, self](boost::system::error_code ec, std::size_t)
+                            {
+                                if (ec)
+                                {
+                                    if (!is_disconnect(ec))
+                                    {
+                                        std::cerr << "Error reading request: " << ec.message() << std::endl;
+                                    }
+                                    close();
+                                    return;
+                                }
+                                parse_buffered();
+                            });
 }
 
-HTTPRequest HTTPConnection::parse_request(const std::string &raw_request)
+void HTTPConnection::process_request(const ParsedRequest &parsed, const char *body)
 {
+    idle_timer.expires_at(boost::asio::steady_timer::time_point::max());
+
     HTTPRequest request;
-    std::istringstream stream(raw_request);
-    std::string line;
+    request.method = parsed.method;
+    request.version = parsed.version;
+    request.header_views = parsed.headers;
+    request.header_count = parsed.header_count;
+    request.body.assign(body, parsed.content_length);
+
+    size_t query_pos = parsed.target.find('?');
+    request.path = parsed.target.substr(0, query_pos);
+    if (query_pos != std::string_view::npos)
+    {
+        request.query_params = parse_query_string(parsed.target.substr(query_pos + 1));
+    }
 
-    // Parse request line
-    if (std::getline(stream, line))
+    std::string_view auth = request.header("Authorization");
+    if (auth.substr(0, 7) == "Bearer ")
     {
-        std::istringstream line_stream(line);
-        std::string path_with_query;
-        line_stream >> request.method >> path_with_query >> request.version;
+        request.auth_token = std::string(auth.substr(7));
+    }
 
-        size_t query_pos = path_with_query.find('?');
-        if (query_pos != std::string::npos)
-        {
-            request.path = path_with_query.substr(0, query_pos);
-            std::string query = path_with_query.substr(query_pos + 1);
-            request.query_params = parse_query_string(query);
-        }
-        else
+    keep_alive = wants_keep_alive(request) && ++requests_served < HTTP_MAX_REQUESTS_PER_CONNECTION;
+
+    auto self = shared_from_this();
+    request.defer = [this, self](int timeout_seconds, std::function<void(const ResponseCallback &)> on_timeout)
+    {
+        return defer_response(timeout_seconds, on_timeout);
+    };
+    if (wants_websocket(request))
+    {
+        request.upgrade = [this](uint64_t meeting_id, uint64_t user_id)
         {
-            request.path = path_with_query;
-        }
+            upgraded = true;
+            upgrade_meeting_id = meeting_id;
+            upgrade_user_id = user_id;
+        };
     }
 
-    // Parse headers
-    int content_length = 0;
-    while (std::getline(stream, line) && line != "\r" && !line.empty())
+    HTTPResponse response;
+    deferred = false;
+    request_handler(request, response);
+    if (upgraded)
     {
-        size_t colon_pos = line.find(':');
-        if (colon_pos != std::string::npos)
-        {
-            std::string key = line.substr(0, colon_pos);
-            std::string value = line.substr(colon_pos + 1);
-
-            // Trim whitespace
-            value.erase(0, value.find_first_not_of(" \t\r\n"));
-            value.erase(value.find_last_not_of(" \t\r\n") + 1);
-
-            request.headers[key] = value;
-
-            if (key == "Content-Length")
-            {
-                try
-                {
-                    content_length = std::stoi(value);
-                }
-                catch (...)
-                {
-                    content_length = 0;
-                }
-            }
-        }
+        hand_off_to_websocket(request);
+        return;
     }
+    if (deferred)
+    {
+        deferred_headers = response.headers;
+        return;
+    }
+    finish_response(response);
+}
 
-    // Parse Authorization header
-    auto auth_it = request.headers.find("Authorization");
-    if (auth_it != request.headers.end())
+ResponseCallback HTTPConnection::defer_response(int timeout_seconds,
+                                                std::function<void(const ResponseCallback &)> on_timeout)
+{
+    deferred = true;
+    auto self = shared_from_this();
+    auto answered = std::make_shared<std::atomic<bool>>(false);
+
+    // Whoever holds the callback does not keep the connection alive: the
+    // pending timer does, until the connection answers or is torn down
+    std::weak_ptr<HTTPConnection> weak_self = self;
+    ResponseCallback respond = [this, weak_self, answered](HTTPResponse &response)
     {
-        std::string auth = auth_it->second;
-        if (auth.substr(0, 7) == "Bearer ")
+        auto self = weak_self.lock();
+        if (!self || answered->exchange(true))
         {
-            request.auth_token = auth.substr(7);
+            return;
         }
+        boost::asio::post(socket.get_executor(), [this, self, response]() mutable
+                          {
+                              idle_timer.expires_at(boost::asio::steady_timer::time_point::max());
+                              // The CORS and other headers the server added before the handler ran
+                              for (const auto &header : deferred_headers)
+                              {
+                                  response.headers.insert(header);
+                              }
+                              finish_response(response);
+                          });
+    };
+
+    // The idle timer is free until the response is written
+    idle_timer.expires_after(std::chrono::seconds(timeout_seconds));
+    idle_timer.async_wait([this, self, answered, respond, on_timeout](boost::system::error_code ec)
+                          {
+                              if (!ec && !*answered)
+                              {
+                                  on_timeout(respond);
+                              }
+                          });
+    return respond;
+}
+
+void HTTPConnection::finish_response(HTTPResponse &response)
+{
+    // Without a length the client could not tell where the response ends
+    response.headers["Content-Length"] = std::to_string(response.body.size());
+    if (keep_alive)
+    {
+        response.headers["Connection"] = "keep-alive";
+        response.headers["Keep-Alive"] = "timeout=" + std::to_string(HTTP_IDLE_TIMEOUT_SECONDS) +
+                                         ", max=" + std::to_string(HTTP_MAX_REQUESTS_PER_CONNECTION - requests_served);
+    }
+    else
+    {
+        response.headers["Connection"] = "close";
     }
+    write_response(response);
+}
 
-    std::string remaining_body((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+// Rebuild the upgrade request for Beast, which answers the handshake, and
+// give the socket to the session. The client waits for that answer before
+// sending frames, so nothing it sent is left in the buffer.
+void HTTPConnection::hand_off_to_websocket(const HTTPRequest &request)
+{
+    WebSocketUpgradeRequest upgrade_request;
+    upgrade_request.method(beast::http::verb::get);
+    upgrade_request.target(to_beast(request.path));
+    upgrade_request.version(11);
+    for (size_t i = 0; i < request.header_count; i++)
+    {
+        upgrade_request.set(to_beast(request.header_views[i].name), to_beast(request.header_views[i].value));
+    }
 
-    if (content_length > 0)
+    auto session = std::make_shared<WebSocketSession>(std::move(socket), websockets,
+                                                      upgrade_meeting_id, upgrade_user_id);
+    session->start(std::move(upgrade_request));
+}
+
+// HTTP/1.1 keeps the connection unless asked not to; 1.0 only when asked
+bool HTTPConnection::wants_keep_alive(const HTTPRequest &request) const
+{
+    std::string_view connection = request.header("Connection");
+    if (request.version == "HTTP/1.1")
     {
-        request.body = remaining_body.substr(0, std::min((size_t)content_length, remaining_body.size()));
+        return !equals_ignore_case(connection, "close");
     }
-    else
+    return equals_ignore_case(connection, "keep-alive");
+}
+
+bool HTTPConnection::wants_websocket(const HTTPRequest &request) const
+{
+    if (request.method != "GET" || request.version != "HTTP/1.1")
     {
-        // No Content-Length, take everything
-        request.body = remaining_body;
+        return false;
     }
+    return equals_ignore_case(request.header("Upgrade"), "websocket");
+}
 
-    return request;
+void HTTPConnection::write_response(const HTTPResponse &response)
+{
+    auto self = shared_from_this();
+    auto response_str = std::make_shared<std::string>(response.to_string());
+
+    boost::asio::async_write(socket, boost::asio::buffer(*response_str),
+                             [this, self, response_str](boost::system::error_code ec, std::size_t)
+                             {
+                                 if (ec)
+                                 {
+                                     if (!is_disconnect(ec))
+                                     {
+                                         std::cerr << "Error writing response: " << ec.message() << std::endl;
+                                     }
+                                     close();
+                                     return;
+                                 }
+                                 if (keep_alive)
+                                 {
+                                     read_request();
+                                 }
+                                 else
+                                 {
+                                     close();
+                                 }
+                             });
 }
 
-std::map<std::string, std::string> HTTPConnection::parse_query_string(const std::string &query)
+void HTTPConnection::close()
 {
-    std::map<std::string, std::string> params;
-    std::istringstream stream(query);
-    std::string pair;
+    boost::system::error_code ignored;
+    idle_timer.cancel();
+    socket.shutdown(tcp::socket::shutdown_both, ignored);
+    socket.close(ignored);
+}
 
-    while (std::getline(stream, pair, '&'))
+std::map<std::string, std::string> HTTPConnection::parse_query_string(std::string_view query)
+{
+    std::map<std::string, std::string> params;
+    while (!query.empty())
     {
+        size_t amp_pos = query.find('&');
+        std::string_view pair = query.substr(0, amp_pos);
+        query = amp_pos == std::string_view::npos ? std::string_view() : query.substr(amp_pos + 1);
+
         size_t eq_pos = pair.find('=');
-        if (eq_pos != std::string::npos)
+        if (eq_pos != std::string_view::npos)
         {
-            std::string key = pair.substr(0, eq_pos);
-            std::string value = pair.substr(eq_pos + 1);
-            params[key] = value;
+            params[std::string(pair.substr(0, eq_pos))] = std::string(pair.substr(eq_pos + 1));
         }
     }
 
@@ -248,7 +324,7 @@ HTTPServer::~HTTPServer()
 
 void HTTPServer::add_route(const std::string &method, const std::string &path, RouteHandler handler)
 {
-    routes[method][path] = handler;
+    router.add(method, path, handler);
     std::cout << "Route registered: " << method << " " << path << std::endl;
 }
 
@@ -286,14 +362,17 @@ void HTTPServer::stop()
 
 void HTTPServer::accept_connections()
 {
-    acceptor.async_accept([this](boost::system::error_code ec, tcp::socket socket)
+    // Each connection's socket runs on its own strand, so its read, write
+    // and timer handlers never run at once
+    acceptor.async_accept(boost::asio::make_strand(io_context), [this](boost::system::error_code ec, tcp::socket socket)
                           {
         if (!ec) {
             auto connection = std::make_shared<HTTPConnection>(
                 std::move(socket),
                 [this](HTTPRequest& req, HTTPResponse& res) {
                     handle_request(req, res);
-                }
+                },
+                websockets
             );
             connection->start();
         } else {
@@ -322,95 +401,37 @@ void HTTPServer::handle_request(HTTPRequest &req, HTTPResponse &res)
 
     std::cout << req.method << " " << req.path << std::endl;
 
-    RouteHandler handler;
-    std::map<std::string, std::string> path_params;
-    if (match_route(req.method, req.path, path_params, handler))
-    {
-        req.path_params = path_params;
-        handler(req, res);
-    }
-    else
+    const RouteHandler *handler = router.match(req.method, req.path, req.path_params);
+    if (!handler)
     {
         res.set_status(404, "Not Found");
         res.set_json_body("{\"error\":\"Route not found\"}");
+        return;
     }
-}
 
-bool HTTPServer::match_route(const std::string &method, const std::string &path,
-                             std::map<std::string, std::string> &path_params,
-                             RouteHandler &handler)
-{
-    auto method_routes = routes.find(method);
-    if (method_routes == routes.end())
+    // An exception must not take the server down with it. Path captures
+    // that overflow or are not numbers (PathParams::number) are the
+    // client's fault; anything else, such as a page the storage engine
+    // could not read, is ours. A handler that deferred its response or
+    // accepted an upgrade before throwing keeps that.
+    try
     {
-        return false;
+        (*handler)(req, res);
     }
-
-    // First try exact match
-    auto exact_match = method_routes->second.find(path);
-    if (exact_match != method_routes->second.end())
+    catch (const std::invalid_argument &e)
     {
-        handler = exact_match->second;
-        return true;
+        res.set_status(400, "Bad Request");
+        res.set_json_body("{\"error\":\"Invalid request\"}");
     }
-
-    // Try pattern matching with path parameters
-    for (const auto &route_pair : method_routes->second)
+    catch (const std::out_of_range &e)
     {
-        const std::string &route_pattern = route_pair.first;
-
-        // Split both paths into segments
-        std::vector<std::string> pattern_segments, path_segments;
-
-        // Simple split by '/'
-        std::istringstream pattern_stream(route_pattern);
-        std::istringstream path_stream(path);
-        std::string segment;
-
-        while (std::getline(pattern_stream, segment, '/'))
-        {
-            if (!segment.empty())
-                pattern_segments.push_back(segment);
-        }
-
-        while (std::getline(path_stream, segment, '/'))
-        {
-            if (!segment.empty())
-                path_segments.push_back(segment);
-        }
-
-        // Must have same number of segments
-        if (pattern_segments.size() != path_segments.size())
-        {
-            continue;
-        }
-
-        // Match each segment
-        bool matches = true;
-        path_params.clear();
-
-        for (size_t i = 0; i < pattern_segments.size(); i++)
-        {
-            if (pattern_segments[i][0] == ':')
-            {
-                // This is a path parameter
-                std::string param_name = pattern_segments[i].substr(1);
-                path_params[param_name] = path_segments[i];
-            }
-            else if (pattern_segments[i] != path_segments[i])
-            {
-                // Static segment doesn't match
-                matches = false;
-                break;
-            }
-        }
-
-        if (matches)
-        {
-            handler = route_pair.second;
-            return true;
-        }
+        res.set_status(400, "Bad Request");
+        res.set_json_body("{\"error\":\"Invalid request\"}");
     }
-
-    return false;
-}
\ No newline at end of file
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error handling " << req.method << " " << req.path << ": " << e.what() << std::endl;
+        res.set_status(500, "Internal Server Error");
+        res.set_json_body("{\"error\":\"Internal server error\"}");
+    }
+}
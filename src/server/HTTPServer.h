@@ -2,7 +2,11 @@
 #define HTTP_SERVER_H
 
 #include <boost/asio.hpp>
+#include "server/WebSocketServer.h"
+#include "server/HTTPParser.h"
+#include "server/Router.h"
 #include <string>
+#include <string_view>
 #include <map>
 #include <functional>
 #include <memory>
@@ -11,19 +15,63 @@
 
 using boost::asio::ip::tcp;
 
-// HTTP Request structure
+struct HTTPResponse;
+
+// Sends a deferred response; safe to call from any thread, and only the
+// first call for a request counts
+using ResponseCallback = std::function<void(HTTPResponse&)>;
+
+// HTTP Request structure. The request line and headers are views into the
+// connection's receive buffer, valid until the handler returns.
 struct HTTPRequest {
-    std::string method;
-    std::string path;
-    std::string version;
-    std::map<std::string, std::string> headers;
+    std::string_view method;
+    std::string_view path;
+    std::string_view version;
+    const HTTPHeaderView* header_views;
+    size_t header_count;
     std::map<std::string, std::string> query_params;
-    std::map<std::string, std::string> path_params;  
+    PathParams path_params;
     std::string body;
     
     std::string auth_token;
+
+    // A handler that cannot answer yet calls defer instead of filling in
+    // its response, and answers later through the callback it returns. No
+    // thread waits meanwhile. If nothing answered within timeout_seconds,
+    // on_timeout runs with the same callback.
+    std::function<ResponseCallback(int timeout_seconds, std::function<void(const ResponseCallback&)> on_timeout)> defer;
+
+    // Set only on a WebSocket upgrade request. A handler accepting it calls
+    // upgrade instead of filling in its response; once the handler returns
+    // the connection leaves HTTP and joins the meeting's room.
+    std::function<void(uint64_t meeting_id, uint64_t user_id)> upgrade;
     
-    HTTPRequest() {}
+    HTTPRequest() : header_views(nullptr), header_count(0), header_map_built(false) {}
+
+    // Value of the named header in any case, empty when it is absent
+    std::string_view header(std::string_view name) const {
+        for (size_t i = 0; i < header_count; i++) {
+            if (equals_ignore_case(header_views[i].name, name)) {
+                return header_views[i].value;
+            }
+        }
+        return std::string_view();
+    }
+
+    // Every header as a map, built the first time a handler asks for it
+    const std::map<std::string, std::string>& headers() const {
+        if (!header_map_built) {
+            for (size_t i = 0; i < header_count; i++) {
+                header_map[std::string(header_views[i].name)] = std::string(header_views[i].value);
+            }
+            header_map_built = true;
+        }
+        return header_map;
+    }
+
+private:
+    mutable std::map<std::string, std::string> header_map;
+    mutable bool header_map_built;
 };
 
 struct HTTPResponse {
@@ -62,19 +110,35 @@ struct HTTPResponse {
     }
 };
 
-// Route handler function type
-using RouteHandler = std::function<void(HTTPRequest&, HTTPResponse&)>;
+// Persistent connections: an idle connection is closed after this long, and
+// any connection after this many requests
+const int HTTP_IDLE_TIMEOUT_SECONDS = 15;
+const int HTTP_MAX_REQUESTS_PER_CONNECTION = 1000;
 
-// HTTP Connection handler
+// HTTP Connection handler. Requests on one connection are served in order;
+// pipelined ones wait in the buffer until the response before them is sent.
 class HTTPConnection : public std::enable_shared_from_this<HTTPConnection> {
 private:
     tcp::socket socket;
     boost::asio::streambuf buffer;
+    boost::asio::steady_timer idle_timer;
     std::function<void(HTTPRequest&, HTTPResponse&)> request_handler;
+    int requests_served;
+    bool keep_alive;                 // Read another request after this response
+    bool deferred;                   // The handler will answer through a callback
+    std::map<std::string, std::string> deferred_headers;  // Set before the handler ran
+    WebSocketManager& websockets;
+    bool upgraded;                   // The handler accepted a WebSocket upgrade
+    uint64_t upgrade_meeting_id;
+    uint64_t upgrade_user_id;
     
 public:
-    HTTPConnection(tcp::socket sock, std::function<void(HTTPRequest&, HTTPResponse&)> handler)
-        : socket(std::move(sock)), request_handler(handler) {}
+    // The socket's executor should be a strand: the timer shares it
+    HTTPConnection(tcp::socket sock, std::function<void(HTTPRequest&, HTTPResponse&)> handler,
+                   WebSocketManager& ws_manager)
+        : socket(std::move(sock)), idle_timer(socket.get_executor()), request_handler(handler),
+          requests_served(0), keep_alive(false), deferred(false), websockets(ws_manager), upgraded(false),
+          upgrade_meeting_id(0), upgrade_user_id(0) {}
     
     void start() {
         read_request();
@@ -82,9 +146,17 @@ public:
     
 private:
     void read_request();
+    void parse_buffered();
+    void read_more(size_t bytes);    // At least this many more
+    void process_request(const ParsedRequest& parsed, const char* body);
+    ResponseCallback defer_response(int timeout_seconds, std::function<void(const ResponseCallback&)> on_timeout);
+    void finish_response(HTTPResponse& response);
+    void hand_off_to_websocket(const HTTPRequest& request);
     void write_response(const HTTPResponse& response);
-    HTTPRequest parse_request(const std::string& raw_request);
-    std::map<std::string, std::string> parse_query_string(const std::string& query);
+    void close();
+    bool wants_keep_alive(const HTTPRequest& request) const;
+    bool wants_websocket(const HTTPRequest& request) const;
+    std::map<std::string, std::string> parse_query_string(std::string_view query);
 };
 
 // Main HTTP Server
@@ -92,7 +164,8 @@ class HTTPServer {
 private:
     boost::asio::io_context io_context;
     tcp::acceptor acceptor;
-    std::map<std::string, std::map<std::string, RouteHandler>> routes; 
+    Router router;
+    WebSocketManager websockets;     // Upgraded connections, by meeting
     std::vector<std::thread> thread_pool;
     int thread_count;
     
@@ -103,6 +176,9 @@ public:
     // Register routes
     void add_route(const std::string& method, const std::string& path, RouteHandler handler);
     
+    // Rooms of the connections upgraded to WebSockets, for pushing events
+    WebSocketManager& websocket_manager() { return websockets; }
+    
     // Start server
     void start();
     void stop();
@@ -110,9 +186,6 @@ public:
 private:
     void accept_connections();
     void handle_request(HTTPRequest& req, HTTPResponse& res);
-    bool match_route(const std::string& method, const std::string& path, 
-                             std::map<std::string, std::string>& path_params, 
-                             RouteHandler& handler);
 };
 
 #endif // HTTP_SERVER_H
@@ -0,0 +1,175 @@
+#include "server/Router.h"
+#include <charconv>
+#include <stdexcept>
+
+// PathParams implementation
+std::string_view PathParams::at(std::string_view name) const
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (params[i].name == name)
+        {
+            return params[i].value;
+        }
+    }
+    throw std::out_of_range("No path parameter " + std::string(name));
+}
+
+uint64_t PathParams::number(std::string_view name) const
+{
+    std::string_view value = at(name);
+    uint64_t result = 0;
+    auto parsed = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (parsed.ec == std::errc::result_out_of_range)
+    {
+        throw std::out_of_range("Path parameter " + std::string(name) + " is too large");
+    }
+    if (parsed.ec != std::errc() || parsed.ptr != value.data() + value.size())
+    {
+        throw std::invalid_argument("Path parameter " + std::string(name) + " is not a number");
+    }
+    return result;
+}
+
+// Router implementation
+
+// Split the next non-empty segment off the front of path; false at the end
+bool Router::next_segment(std::string_view &path, std::string_view &segment)
+{
+    size_t start = path.find_first_not_of('/');
+    if (start == std::string_view::npos)
+    {
+        return false;
+    }
+    size_t end = path.find('/', start);
+    if (end == std::string_view::npos)
+    {
+        end = path.size();
+    }
+    segment = path.substr(start, end - start);
+    path.remove_prefix(end);
+    return true;
+}
+
+bool Router::accepts(ParamType type, std::string_view segment)
+{
+    if (type == PARAM_UINT)
+    {
+        for (char c : segment)
+        {
+            if (c < '0' || c > '9')
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void Router::add(const std::string &method, const std::string &pattern, RouteHandler handler)
+{
+    Node *node = &root;
+    size_t captures = 0;
+    std::string_view rest = pattern;
+    std::string_view segment;
+
+    while (next_segment(rest, segment))
+    {
+        if (segment[0] != ':')
+        {
+            auto it = node->literals.find(segment);
+            if (it == node->literals.end())
+            {
+                it = node->literals.emplace(std::string(segment), std::make_unique<Node>()).first;
+            }
+            node = it->second.get();
+            continue;
+        }
+
+        if (++captures > ROUTER_MAX_PARAMS)
+        {
+            throw std::invalid_argument("Too many path parameters in " + pattern);
+        }
+
+        std::string_view name = segment.substr(1);
+        ParamType type = PARAM_ANY;
+        size_t type_pos = name.find('<');
+        if (type_pos != std::string_view::npos)
+        {
+            std::string_view type_name = name.substr(type_pos);
+            if (type_name != "<uint>")
+            {
+                throw std::invalid_argument("Unknown path parameter type " + std::string(type_name) +
+                                            " in " + pattern);
+            }
+            type = PARAM_UINT;
+            name = name.substr(0, type_pos);
+        }
+
+        ParamEdge *edge = nullptr;
+        for (auto &param : node->params)
+        {
+            if (param.type == type && param.name == name)
+            {
+                edge = &param;
+            }
+        }
+        if (!edge)
+        {
+            ParamEdge added{std::string(name), type, std::make_unique<Node>()};
+            auto position = type == PARAM_UINT ? node->params.begin() : node->params.end();
+            edge = &*node->params.insert(position, std::move(added));
+        }
+        node = edge->child.get();
+    }
+
+    if (node->handlers.find(method) == node->handlers.end())
+    {
+        route_count++;
+    }
+    node->handlers[method] = handler;
+}
+
+const RouteHandler *Router::match(std::string_view method, std::string_view path, PathParams &params) const
+{
+    params.count = 0;
+    return match(root, method, path, params);
+}
+
+const RouteHandler *Router::match(const Node &node, std::string_view method, std::string_view path,
+                                  PathParams &params) const
+{
+    std::string_view segment;
+    if (!next_segment(path, segment))
+    {
+        auto handler = node.handlers.find(method);
+        return handler == node.handlers.end() ? nullptr : &handler->second;
+    }
+
+    auto literal = node.literals.find(segment);
+    if (literal != node.literals.end())
+    {
+        const RouteHandler *handler = match(*literal->second, method, path, params);
+        if (handler)
+        {
+            return handler;
+        }
+    }
+
+    for (const auto &param : node.params)
+    {
+        if (!accepts(param.type, segment))
+        {
+            continue;
+        }
+        size_t captured = params.count;
+        params.params[params.count++] = PathParam{param.name, segment};
+        const RouteHandler *handler = match(*param.child, method, path, params);
+        if (handler)
+        {
+            return handler;
+        }
+        params.count = captured;
+    }
+    return nullptr;
+}
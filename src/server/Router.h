@@ -0,0 +1,100 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct HTTPRequest;
+struct HTTPResponse;
+
+// Route handler function type
+using RouteHandler = std::function<void(HTTPRequest&, HTTPResponse&)>;
+
+// A route pattern may capture at most this many :param segments
+const size_t ROUTER_MAX_PARAMS = 8;
+
+// What a :param segment accepts. ":name" takes any segment, ":name<uint>"
+// only decimal digits, so "/meetings/abc" does not reach an id route.
+enum ParamType {
+    PARAM_ANY,
+    PARAM_UINT
+};
+
+struct PathParam {
+    std::string_view name;   // Into the route's pattern
+    std::string_view value;  // Into the request path
+};
+
+// The captures of a matched route, without allocating
+class PathParams {
+private:
+    PathParam params[ROUTER_MAX_PARAMS];
+    size_t count;
+
+    friend class Router;
+
+public:
+    PathParams() : count(0) {}
+
+    // Value of the named capture; throws std::out_of_range when there is none
+    std::string_view at(std::string_view name) const;
+
+    // The named capture as a number; throws std::out_of_range when there is
+    // none or it overflows, std::invalid_argument when it is not a number
+    uint64_t number(std::string_view name) const;
+
+    size_t size() const { return count; }
+    const PathParam* begin() const { return params; }
+    const PathParam* end() const { return params + count; }
+};
+
+// Routes compiled into a trie of path segments when they are added. A match
+// walks the request path once, trying literal segments before captures and
+// typed captures before untyped ones, so its cost follows the path's length
+// rather than the number of routes. Routes are added before the server
+// starts; matching never changes the trie and may run on any thread.
+class Router {
+private:
+    struct Node;
+
+    struct ParamEdge {
+        std::string name;
+        ParamType type;
+        std::unique_ptr<Node> child;
+    };
+
+    struct Node {
+        std::map<std::string, std::unique_ptr<Node>, std::less<>> literals;
+        std::vector<ParamEdge> params;                             // PARAM_UINT first
+        std::map<std::string, RouteHandler, std::less<>> handlers; // By method
+    };
+
+    Node root;
+    size_t route_count;
+
+    static bool next_segment(std::string_view& path, std::string_view& segment);
+    static bool accepts(ParamType type, std::string_view segment);
+    const RouteHandler* match(const Node& node, std::string_view method, std::string_view path,
+                              PathParams& params) const;
+
+public:
+    Router() : route_count(0) {}
+
+    // Compile a pattern like "/api/v1/meetings/:id<uint>/files". Empty
+    // segments are ignored, as in request paths. Throws std::invalid_argument
+    // on an unknown capture type or too many captures.
+    void add(const std::string& method, const std::string& pattern, RouteHandler handler);
+
+    // The handler for method and path, or nullptr; fills params on a match
+    const RouteHandler* match(std::string_view method, std::string_view path, PathParams& params) const;
+
+    size_t size() const { return route_count; }
+};
+
+#endif // ROUTER_H
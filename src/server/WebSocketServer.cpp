@@ -0,0 +1,180 @@
+#include "server/WebSocketServer.h"
+#include <iostream>
+
+// WebSocketSession implementation
+void WebSocketSession::start(WebSocketUpgradeRequest request)
+{
+    ws.set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+    ws.set_option(websocket::stream_base::decorator([](websocket::response_type &res)
+                                                    { res.set(beast::http::field::server, "MeetingSystem/1.0"); }));
+
+    auto self = shared_from_this();
+    auto upgrade = std::make_shared<WebSocketUpgradeRequest>(std::move(request));
+    ws.async_accept(*upgrade, [this, self, upgrade](beast::error_code ec)
+                    {
+                        if (ec)
+                        {
+                            std::cerr << "WebSocket handshake failed: " << ec.message() << std::endl;
+                            drop();
+                            return;
+                        }
+                        manager.add_to_room(self);
+                        do_read();
+                    });
+}
+
+void WebSocketSession::do_read()
+{
+    auto self = shared_from_this();
+    ws.async_read(buffer, [this, self](beast::error_code ec, std::size_t)
+                  {
+                      if (ec)
+                      {
+                          if (ec != websocket::error::closed && ec != boost::asio::error::operation_aborted &&
+                              ec != boost::asio::error::eof && ec != boost::asio::error::connection_reset)
+                          {
+                              std::cerr << "WebSocket read error: " << ec.message() << std::endl;
+                          }
+                          drop();
+                          return;
+                      }
+                      buffer.consume(buffer.size());
+                      do_read();
+                  });
+}
+
+void WebSocketSession::send(std::shared_ptr<const std::string> message)
+{
+    auto self = shared_from_this();
+    boost::asio::post(ws.get_executor(), [this, self, message]()
+                      { queue_message(message); });
+}
+
+void WebSocketSession::queue_message(std::shared_ptr<const std::string> message)
+{
+    if (closed)
+    {
+        return;
+    }
+    if (send_queue.size() >= WS_MAX_QUEUED_MESSAGES)
+    {
+        std::cerr << "WebSocket client of user " << user_id << " fell " << send_queue.size()
+                  << " messages behind; disconnecting" << std::endl;
+        drop();
+        return;
+    }
+
+    send_queue.push_back(message);
+    if (send_queue.size() == 1)
+    {
+        do_write();
+    }
+}
+
+void WebSocketSession::do_write()
+{
+    auto self = shared_from_this();
+    ws.text(true);
+    ws.async_write(boost::asio::buffer(*send_queue.front()), [this, self](beast::error_code ec, std::size_t)
+                   {
+                       if (ec || closed)
+                       {
+                           drop();
+                           return;
+                       }
+                       send_queue.pop_front();
+                       if (!send_queue.empty())
+                       {
+                           do_write();
+                       }
+                   });
+}
+
+void WebSocketSession::drop()
+{
+    if (closed)
+    {
+        return;
+    }
+    closed = true;
+    manager.remove_from_room(shared_from_this());
+
+    // Fails any read or write still pending; the queue stays until then
+    // since a write may be reading its front
+    beast::error_code ignored;
+    ws.next_layer().shutdown(tcp::socket::shutdown_both, ignored);
+    ws.next_layer().close(ignored);
+}
+
+// WebSocketManager implementation
+void WebSocketManager::add_to_room(const std::shared_ptr<WebSocketSession> &session)
+{
+    std::lock_guard<std::mutex> lock(rooms_mutex);
+    meeting_rooms[session->get_meeting_id()].insert(session);
+    std::cout << "WebSocket: user " << session->get_user_id() << " joined meeting "
+              << session->get_meeting_id() << std::endl;
+}
+
+void WebSocketManager::remove_from_room(const std::shared_ptr<WebSocketSession> &session)
+{
+    std::lock_guard<std::mutex> lock(rooms_mutex);
+    auto it = meeting_rooms.find(session->get_meeting_id());
+    if (it == meeting_rooms.end())
+    {
+        return;
+    }
+    it->second.erase(session);
+    if (it->second.empty())
+    {
+        meeting_rooms.erase(it);
+    }
+}
+
+void WebSocketManager::broadcast_to_room(uint64_t meeting_id, const std::string &message,
+                                         uint64_t exclude_user_id)
+{
+    auto shared_message = std::make_shared<const std::string>(message);
+
+    std::lock_guard<std::mutex> lock(rooms_mutex);
+    auto it = meeting_rooms.find(meeting_id);
+    if (it == meeting_rooms.end())
+    {
+        return;
+    }
+    for (const auto &session : it->second)
+    {
+        if (exclude_user_id == 0 || session->get_user_id() != exclude_user_id)
+        {
+            session->send(shared_message);
+        }
+    }
+}
+
+bool WebSocketManager::send_to_user(uint64_t meeting_id, uint64_t user_id, const std::string &message)
+{
+    auto shared_message = std::make_shared<const std::string>(message);
+    bool sent = false;
+
+    std::lock_guard<std::mutex> lock(rooms_mutex);
+    auto it = meeting_rooms.find(meeting_id);
+    if (it == meeting_rooms.end())
+    {
+        return false;
+    }
+    for (const auto &session : it->second)
+    {
+        if (session->get_user_id() == user_id)
+        {
+            session->send(shared_message);
+            sent = true;
+        }
+    }
+    return sent;
+}
+
+size_t WebSocketManager::get_room_size(uint64_t meeting_id)
+{
+    std::lock_guard<std::mutex> lock(rooms_mutex);
+    auto it = meeting_rooms.find(meeting_id);
+    return it == meeting_rooms.end() ? 0 : it->second.size();
+}
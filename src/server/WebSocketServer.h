@@ -0,0 +1,85 @@
+#ifndef WEBSOCKET_SERVER_H
+#define WEBSOCKET_SERVER_H
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/websocket.hpp>
+#include <string>
+#include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+using tcp = boost::asio::ip::tcp;
+
+// The upgrade request HTTPConnection has already read off the socket
+using WebSocketUpgradeRequest = beast::http::request<beast::http::empty_body>;
+
+// Messages a session may have waiting to be written. A client that falls
+// further behind is disconnected and has to resync over HTTP.
+const size_t WS_MAX_QUEUED_MESSAGES = 256;
+
+class WebSocketManager;
+
+// WebSocket session (one per client). Push-only: what the client sends is
+// read and discarded, which keeps pings and the close handshake working.
+class WebSocketSession : public std::enable_shared_from_this<WebSocketSession> {
+private:
+    websocket::stream<tcp::socket> ws;
+    beast::flat_buffer buffer;
+    WebSocketManager& manager;
+    uint64_t meeting_id;
+    uint64_t user_id;
+
+    // Touched only on the socket's strand; the front one is being written
+    std::deque<std::shared_ptr<const std::string>> send_queue;
+    bool closed;
+
+public:
+    // The socket's executor should be a strand
+    WebSocketSession(tcp::socket socket, WebSocketManager& mgr, uint64_t mid, uint64_t uid)
+        : ws(std::move(socket)), manager(mgr), meeting_id(mid), user_id(uid), closed(false) {}
+
+    // Answer the handshake, then join the meeting's room
+    void start(WebSocketUpgradeRequest request);
+
+    // Queue a message; safe to call from any thread
+    void send(std::shared_ptr<const std::string> message);
+
+    uint64_t get_meeting_id() const { return meeting_id; }
+    uint64_t get_user_id() const { return user_id; }
+
+private:
+    void do_read();
+    void queue_message(std::shared_ptr<const std::string> message);
+    void do_write();
+    void drop();
+};
+
+// Per-meeting rooms of connected sessions
+class WebSocketManager {
+private:
+    std::map<uint64_t, std::set<std::shared_ptr<WebSocketSession>>> meeting_rooms;
+    std::mutex rooms_mutex;
+
+public:
+    void add_to_room(const std::shared_ptr<WebSocketSession>& session);
+    void remove_from_room(const std::shared_ptr<WebSocketSession>& session);
+
+    // Broadcast message to all clients in a meeting room. The text is copied
+    // once and that copy is shared by every session's queue.
+    void broadcast_to_room(uint64_t meeting_id, const std::string& message,
+                           uint64_t exclude_user_id = 0);
+
+    // Send to every session the user has open in the meeting; false when
+    // there is none
+    bool send_to_user(uint64_t meeting_id, uint64_t user_id, const std::string& message);
+
+    size_t get_room_size(uint64_t meeting_id);
+};
+
+#endif // WEBSOCKET_SERVER_H
@@ -0,0 +1,315 @@
+#include "AsyncPageIO.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+int ring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+// Synchronous fallbacks, same result convention as a completion
+int read_at(int fd, uint8_t* data, size_t size, off_t offset) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t got = ::pread(fd, data + total, size - total, offset + total);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            return -errno;
+        }
+        if (got == 0) {
+            break;
+        }
+        total += got;
+    }
+    return static_cast<int>(total);
+}
+
+int write_at(int fd, const uint8_t* data, size_t size, off_t offset) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t written = ::pwrite(fd, data + total, size - total, offset + total);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return written < 0 ? -errno : static_cast<int>(total);
+        }
+        total += written;
+    }
+    return static_cast<int>(total);
+}
+
+}
+
+AsyncPageIO::AsyncPageIO()
+    : file_fd(-1), ring_fd(-1),
+      sq_ring(nullptr), sq_ring_size(0), cq_ring(nullptr), cq_ring_size(0),
+      sqes(nullptr), sqes_size(0),
+      sq_tail(nullptr), sq_mask(nullptr), sq_array(nullptr),
+      cq_head(nullptr), cq_tail(nullptr), cq_mask(nullptr), cqes(nullptr),
+      ring_entries(0), queued(0), in_flight(0), stopping(false) {
+}
+
+AsyncPageIO::~AsyncPageIO() {
+    close();
+}
+
+bool AsyncPageIO::setup_ring(unsigned depth) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = ring_setup(depth, &params);
+    if (ring_fd < 0) {
+        return false;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+
+    sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                     IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+        sq_ring = nullptr;
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring = sq_ring;
+    } else {
+        cq_ring = ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                         IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) {
+            cq_ring = nullptr;
+            return false;
+        }
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqe_memory = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                              IORING_OFF_SQES);
+    if (sqe_memory == MAP_FAILED) {
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(sqe_memory);
+
+    uint8_t* sq = static_cast<uint8_t*>(sq_ring);
+    uint8_t* cq = static_cast<uint8_t*>(cq_ring);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    ring_entries = params.sq_entries;
+    return true;
+}
+
+void AsyncPageIO::unmap_ring() {
+    if (sqes != nullptr) {
+        ::munmap(sqes, sqes_size);
+        sqes = nullptr;
+    }
+    if (cq_ring != nullptr && cq_ring != sq_ring) {
+        ::munmap(cq_ring, cq_ring_size);
+    }
+    if (sq_ring != nullptr) {
+        ::munmap(sq_ring, sq_ring_size);
+    }
+    sq_ring = cq_ring = nullptr;
+    if (ring_fd >= 0) {
+        ::close(ring_fd);
+        ring_fd = -1;
+    }
+}
+
+bool AsyncPageIO::open(int fd, unsigned depth) {
+    close();
+    file_fd = fd;
+
+    if (!setup_ring(depth)) {
+        std::cerr << "io_uring unavailable (" << strerror(errno) << "), using synchronous page I/O" << std::endl;
+        unmap_ring();
+        return false;
+    }
+
+    stopping = false;
+    completion_thread = std::thread(&AsyncPageIO::completion_worker, this);
+    return true;
+}
+
+void AsyncPageIO::close() {
+    if (ring_fd >= 0) {
+        {
+            // A no-op completion wakes the worker so it can see stopping
+            std::unique_lock<std::mutex> lock(submit_mutex);
+            stopping = true;
+            queue_locked(lock, IORING_OP_NOP, 0, 0, nullptr, 0, nullptr);
+            submit_locked();
+        }
+        if (completion_thread.joinable()) {
+            completion_thread.join();
+        }
+        unmap_ring();
+    }
+    file_fd = -1;
+}
+
+void AsyncPageIO::queue_locked(std::unique_lock<std::mutex>& lock, uint8_t opcode, uint8_t flags,
+                               uint64_t offset, void* buffer, size_t size, Completion* done) {
+    // A full ring is pushed out and waited on until completions free a slot
+    while (queued + in_flight >= ring_entries) {
+        submit_locked();
+        completed_cv.wait(lock, [this] { return queued + in_flight < ring_entries; });
+    }
+
+    // Only this side writes the submission tail
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    io_uring_sqe& sqe = sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.flags = flags;
+    sqe.fd = file_fd;
+    sqe.off = offset;
+    sqe.addr = reinterpret_cast<uint64_t>(buffer);
+    sqe.len = static_cast<uint32_t>(size);
+    sqe.user_data = reinterpret_cast<uint64_t>(done);
+    sq_array[index] = index;
+
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    queued++;
+}
+
+void AsyncPageIO::submit_locked() {
+    while (queued > 0) {
+        int submitted = ring_enter(ring_fd, queued, 0, 0);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            std::cerr << "io_uring submit failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        queued -= submitted;
+        in_flight += submitted;
+    }
+}
+
+void AsyncPageIO::read(uint64_t offset, void* buffer, size_t size, Completion done) {
+    if (ring_fd < 0) {
+        int result = file_fd < 0 ? -EBADF : read_at(file_fd, static_cast<uint8_t*>(buffer), size, offset);
+        done(result);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(submit_mutex);
+    queue_locked(lock, IORING_OP_READ, 0, offset, buffer, size, new Completion(std::move(done)));
+}
+
+void AsyncPageIO::write(uint64_t offset, const void* buffer, size_t size, Completion done) {
+    if (ring_fd < 0) {
+        int result = file_fd < 0 ? -EBADF : write_at(file_fd, static_cast<const uint8_t*>(buffer), size, offset);
+        done(result);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(submit_mutex);
+    queue_locked(lock, IORING_OP_WRITE, 0, offset, const_cast<void*>(buffer), size,
+                 new Completion(std::move(done)));
+}
+
+void AsyncPageIO::fsync(Completion done) {
+    if (ring_fd < 0) {
+        int result = file_fd < 0 ? -EBADF : (::fsync(file_fd) == 0 ? 0 : -errno);
+        done(result);
+        return;
+    }
+
+    // IO_DRAIN holds the fsync back until earlier operations are done
+    std::unique_lock<std::mutex> lock(submit_mutex);
+    queue_locked(lock, IORING_OP_FSYNC, IOSQE_IO_DRAIN, 0, nullptr, 0, new Completion(std::move(done)));
+}
+
+void AsyncPageIO::submit() {
+    if (ring_fd < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(submit_mutex);
+    submit_locked();
+}
+
+void AsyncPageIO::drain() {
+    if (ring_fd < 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(submit_mutex);
+    submit_locked();
+    completed_cv.wait(lock, [this] { return queued == 0 && in_flight == 0; });
+}
+
+void AsyncPageIO::completion_worker() {
+    std::vector<std::pair<Completion*, int>> finished;
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(submit_mutex);
+            if (stopping && queued == 0 && in_flight == 0) {
+                break;
+            }
+        }
+
+        if (ring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            std::cerr << "io_uring wait failed: " << strerror(errno) << std::endl;
+        }
+
+        // The kernel publishes the tail; only this thread moves the head
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        finished.clear();
+        for (; head != tail; head++) {
+            const io_uring_cqe& cqe = cqes[head & *cq_mask];
+            finished.emplace_back(reinterpret_cast<Completion*>(cqe.user_data), cqe.res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+        // Every reaped operation was submitted under submit_mutex; taking
+        // it orders the submitter's writes (callbacks, buffers) before ours
+        // in C++ terms, not only through the kernel
+        if (!finished.empty()) {
+            std::lock_guard<std::mutex> lock(submit_mutex);
+        }
+
+        // Callbacks run before the count drops, so drain() returning means
+        // they have all finished
+        for (auto& entry : finished) {
+            if (entry.first != nullptr) {
+                (*entry.first)(entry.second);
+                delete entry.first;
+            }
+        }
+
+        if (!finished.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(submit_mutex);
+                in_flight -= static_cast<unsigned>(finished.size());
+            }
+            completed_cv.notify_all();
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef ASYNC_PAGE_IO_H
+#define ASYNC_PAGE_IO_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Ring entries: the most operations queued or in flight at once
+const unsigned ASYNC_IO_DEPTH = 128;
+
+// Batched I/O on one file through io_uring, driven with raw system calls.
+// Operations are queued, handed to the kernel together by submit() and
+// completed on a background thread, which runs each callback with the byte
+// count transferred or -errno. Callbacks must not wait on this object.
+//
+// Without io_uring (old kernel, seccomp filter, ...) every operation runs
+// synchronously in the call that queues it, callback included, so callers
+// behave the same either way.
+class AsyncPageIO {
+public:
+    using Completion = std::function<void(int result)>;
+
+private:
+    int file_fd;
+    int ring_fd;
+
+    // Rings shared with the kernel
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+    unsigned ring_entries;
+
+    std::mutex submit_mutex;
+    std::condition_variable completed_cv;
+    unsigned queued;     // In the ring, not yet submitted
+    unsigned in_flight;  // Submitted, not yet completed
+    bool stopping;
+    std::thread completion_thread;
+
+    bool setup_ring(unsigned depth);
+    void unmap_ring();
+
+    // Caller holds submit_mutex
+    void queue_locked(std::unique_lock<std::mutex>& lock, uint8_t opcode, uint8_t flags, uint64_t offset,
+                      void* buffer, size_t size, Completion* done);
+    void submit_locked();
+
+    void completion_worker();
+
+public:
+    AsyncPageIO();
+    ~AsyncPageIO();
+
+    AsyncPageIO(const AsyncPageIO&) = delete;
+    AsyncPageIO& operator=(const AsyncPageIO&) = delete;
+
+    // Attach to fd. Returns false, leaving the synchronous fallback in
+    // place, when no ring could be set up.
+    bool open(int fd, unsigned depth = ASYNC_IO_DEPTH);
+
+    // Waits for everything in flight, then detaches
+    void close();
+
+    bool is_open() const { return file_fd >= 0; }
+    bool uses_io_uring() const { return ring_fd >= 0; }
+
+    // Queue an operation; nothing reaches the kernel before submit(). A
+    // full ring is submitted and waited on to make room. buffer must stay
+    // valid until the callback runs.
+    void read(uint64_t offset, void* buffer, size_t size, Completion done);
+    void write(uint64_t offset, const void* buffer, size_t size, Completion done);
+
+    // Starts only after every operation queued before it has finished
+    void fsync(Completion done);
+
+    // Hand queued operations to the kernel in one system call
+    void submit();
+
+    // Submit, then block until every operation so far has completed
+    void drain();
+};
+
+#endif // ASYNC_PAGE_IO_H
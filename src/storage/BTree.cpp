@@ -1,583 +1,1548 @@
 #include "BTree.h"
 #include <iostream>
 #include <algorithm>
+#include <thread>
+#include <type_traits>
 
-BTree::BTree(DatabaseEngine *engine)
-    : db_engine(engine), root_page_id(0)
+// Bytes a front-coded key shares with the key before it
+static uint8_t shared_prefix(const BTreeKey &previous, const BTreeKey &key)
 {
+    size_t limit = std::min<size_t>({previous.length, key.length, 255});
+    uint8_t shared = 0;
+    while (shared < limit && previous.bytes[shared] == key.bytes[shared])
+    {
+        shared++;
+    }
+    return shared;
+}
+
+size_t BTreeNode::encoded_size(const BTreeKeyDescriptor &desc) const
+{
+    if (desc.type == BTREE_KEY_UINT64)
+    {
+        return BTREE_NODE_HEADER_SIZE + MAX_KEYS * desc.parts * sizeof(uint64_t) +
+               (is_leaf ? MAX_KEYS * sizeof(RecordLocation) : BTREE_ORDER * sizeof(uint64_t));
+    }
+
+    size_t size = BTREE_NODE_HEADER_SIZE;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        size += 2 + keys[i].length - (i > 0 ? shared_prefix(keys[i - 1], keys[i]) : 0);
+    }
+
+    return size + (is_leaf ? keys.size() * BTREE_PACKED_RECORD_SIZE
+                           : (keys.size() + 1) * sizeof(uint64_t));
+}
+
+void BTreeNode::serialize(uint8_t *buffer, const BTreeKeyDescriptor &desc) const
+{
+    size_t offset = 0;
+    uint16_t count = static_cast<uint16_t>(keys.size());
+    uint64_t unused = 0;
+
+    buffer[offset++] = is_leaf ? 1 : 0;
+    memcpy(buffer + offset, &count, sizeof(count));
+    offset += sizeof(count);
+    memcpy(buffer + offset, &unused, sizeof(unused));
+    offset += sizeof(unused);
+    memcpy(buffer + offset, &next_leaf, sizeof(next_leaf));
+    offset += sizeof(next_leaf);
+
+    if (desc.type == BTREE_KEY_UINT64)
+    {
+        // Fixed slots: unused ones stay zero
+        size_t key_size = desc.parts * sizeof(uint64_t);
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            for (int p = 0; p < desc.parts; p++)
+            {
+                uint64_t word = keys[i].part(p);
+                memcpy(buffer + offset + i * key_size + p * sizeof(uint64_t), &word, sizeof(word));
+            }
+        }
+        offset += MAX_KEYS * key_size;
+
+        if (is_leaf)
+        {
+            for (size_t i = 0; i < records.size(); i++)
+            {
+                uint8_t *slot = buffer + offset + i * sizeof(RecordLocation);
+                memcpy(slot, &records[i].page_id, sizeof(uint64_t));
+                memcpy(slot + 8, &records[i].offset, sizeof(uint16_t));
+                memcpy(slot + 10, &records[i].size, sizeof(uint16_t));
+            }
+        }
+        else
+        {
+            memcpy(buffer + offset, children.data(), children.size() * sizeof(uint64_t));
+        }
+        return;
+    }
+
+    // Front-coded keys
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        uint8_t shared = i > 0 ? shared_prefix(keys[i - 1], keys[i]) : 0;
+        buffer[offset++] = shared;
+        buffer[offset++] = static_cast<uint8_t>(keys[i].length - shared);
+        memcpy(buffer + offset, keys[i].bytes + shared, keys[i].length - shared);
+        offset += keys[i].length - shared;
+    }
+
+    if (is_leaf)
+    {
+        for (const auto &record : records)
+        {
+            memcpy(buffer + offset, &record.page_id, sizeof(record.page_id));
+            memcpy(buffer + offset + 8, &record.offset, sizeof(record.offset));
+            memcpy(buffer + offset + 10, &record.size, sizeof(record.size));
+            offset += BTREE_PACKED_RECORD_SIZE;
+        }
+    }
+    else
+    {
+        memcpy(buffer + offset, children.data(), children.size() * sizeof(uint64_t));
+    }
+}
+
+void BTreeNode::deserialize(const uint8_t *buffer, const BTreeKeyDescriptor &desc)
+{
+    size_t offset = 0;
+    uint16_t count;
+
+    is_leaf = (buffer[offset++] == 1);
+    memcpy(&count, buffer + offset, sizeof(count));
+    offset += sizeof(count);
+    offset += sizeof(uint64_t); // unused
+    memcpy(&next_leaf, buffer + offset, sizeof(next_leaf));
+    offset += sizeof(next_leaf);
+
+    keys.clear();
+    records.clear();
+    children.clear();
+
+    if (desc.type == BTREE_KEY_UINT64)
+    {
+        count = std::min<uint16_t>(count, MAX_KEYS);
+        size_t key_size = desc.parts * sizeof(uint64_t);
+        keys.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            for (int p = 0; p < desc.parts; p++)
+            {
+                uint64_t word;
+                memcpy(&word, buffer + offset + i * key_size + p * sizeof(uint64_t), sizeof(word));
+                keys[i].append(word);
+            }
+        }
+        offset += MAX_KEYS * key_size;
+
+        if (is_leaf)
+        {
+            records.resize(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                const uint8_t *slot = buffer + offset + i * sizeof(RecordLocation);
+                memcpy(&records[i].page_id, slot, sizeof(uint64_t));
+                memcpy(&records[i].offset, slot + 8, sizeof(uint16_t));
+                memcpy(&records[i].size, slot + 10, sizeof(uint16_t));
+            }
+        }
+        else
+        {
+            children.resize(count + 1);
+            memcpy(children.data(), buffer + offset, children.size() * sizeof(uint64_t));
+        }
+        return;
+    }
+
+    count = std::min<uint16_t>(count, BTREE_MAX_BYTE_KEYS + 1);
+    keys.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t shared = buffer[offset++];
+        uint8_t suffix = buffer[offset++];
+        if (i > 0)
+        {
+            keys[i].append_bytes(keys[i - 1].bytes, std::min<size_t>(shared, keys[i - 1].length));
+        }
+        keys[i].append_bytes(buffer + offset, suffix);
+        offset += suffix;
+    }
+
+    if (is_leaf)
+    {
+        records.resize(count);
+        for (auto &record : records)
+        {
+            memcpy(&record.page_id, buffer + offset, sizeof(record.page_id));
+            memcpy(&record.offset, buffer + offset + 8, sizeof(record.offset));
+            memcpy(&record.size, buffer + offset + 10, sizeof(record.size));
+            offset += BTREE_PACKED_RECORD_SIZE;
+        }
+    }
+    else
+    {
+        children.resize(count + 1);
+        memcpy(children.data(), buffer + offset, children.size() * sizeof(uint64_t));
+    }
+}
+
+std::shared_mutex &PageLatchTable::get(uint64_t page_id)
+{
+    Shard &shard = shards[page_id % PAGE_LATCH_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Latch &entry = shard.latches[page_id];
+    entry.users++;
+    return entry.latch;
+}
+
+void PageLatchTable::put(uint64_t page_id)
+{
+    Shard &shard = shards[page_id % PAGE_LATCH_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.latches.find(page_id);
+    if (--it->second.users == 0)
+    {
+        shard.latches.erase(it);
+    }
+}
+
+void PageLatchPath::unlock(const Held &entry)
+{
+    if (entry.exclusive)
+    {
+        entry.latch->unlock();
+    }
+    else
+    {
+        entry.latch->unlock_shared();
+    }
+    table.put(entry.page_id);
+}
+
+void PageLatchPath::acquire(uint64_t page_id, bool exclusive)
+{
+    if (holds(page_id))
+    {
+        return;
+    }
+
+    std::shared_mutex &latch = table.get(page_id);
+    if (exclusive)
+    {
+        latch.lock();
+    }
+    else
+    {
+        latch.lock_shared();
+    }
+    held.push_back(Held{page_id, &latch, exclusive});
+}
+
+bool PageLatchPath::holds(uint64_t page_id) const
+{
+    for (const auto &entry : held)
+    {
+        if (entry.page_id == page_id)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PageLatchPath::release_ancestors()
+{
+    if (held.size() <= 1)
+    {
+        return;
+    }
+    for (size_t i = 0; i + 1 < held.size(); i++)
+    {
+        unlock(held[i]);
+    }
+    held.erase(held.begin(), held.end() - 1);
+}
+
+void PageLatchPath::release_last()
+{
+    if (!held.empty())
+    {
+        unlock(held.back());
+        held.pop_back();
+    }
+}
+
+void PageLatchPath::release_all()
+{
+    for (const auto &entry : held)
+    {
+        unlock(entry);
+    }
+    held.clear();
+}
+
+BTree::BTree(DatabaseEngine *engine, BTreeKeyDescriptor desc)
+    : db_engine(engine), root_page_id(0), descriptor(desc), structure_version(0), rightmost_leaf(0)
+{
+    db_engine->add_relocator(this, [this](const RelocationSet &set) { relocate(set); });
+}
+
+BTree::~BTree()
+{
+    db_engine->remove_relocator(this);
 }
 
 void BTree::initialize()
 {
-    root_page_id = db_engine->allocate_page();
+    root_page_id = db_engine->allocate_page();
+    rightmost_leaf = 0;
+
+    BTreeNode root;
+    root.is_leaf = true;
+
+    save_node(root_page_id, root);
+
+    std::cout << "B-Tree initialized with root page: " << root_page_id << std::endl;
+}
+
+void BTree::load(uint64_t root_id)
+{
+    root_page_id = root_id;
+    rightmost_leaf = 0;
+
+    // Trees that predate descriptors keep the one given to the constructor
+    PageHandle root = db_engine->pin_page(root_page_id);
+    const uint8_t *stored = root->data + BTREE_DESCRIPTOR_OFFSET;
+    if (stored[0] == BTREE_DESCRIPTOR_MAGIC)
+    {
+        descriptor.type = static_cast<BTreeKeyType>(stored[1]);
+        descriptor.parts = stored[2];
+    }
+
+    std::cout << "B-Tree loaded with root page: " << root_page_id << std::endl;
+}
+
+BTreeNode BTree::load_node(uint64_t page_id)
+{
+    // Deserialize straight out of the pinned frame
+    PageHandle page = db_engine->pin_page(page_id);
+    BTreeNode node;
+    node.deserialize(page->data, descriptor);
+    return node;
+}
+
+void BTree::save_node(uint64_t page_id, const BTreeNode &node)
+{
+    Page page;
+    page.header.type = node.is_leaf ? BTREE_LEAF : BTREE_INTERNAL;
+    node.serialize(page.data, descriptor);
+
+    if (page_id == root_page_id)
+    {
+        uint8_t *stored = page.data + BTREE_DESCRIPTOR_OFFSET;
+        stored[0] = BTREE_DESCRIPTOR_MAGIC;
+        stored[1] = descriptor.type;
+        stored[2] = descriptor.parts;
+    }
+
+    db_engine->write_page(page_id, page);
+}
+
+void BTree::free_node(uint64_t page_id)
+{
+    // Drop the cache before the version moves on, so an appender that read
+    // the old version cannot pick up the freed page afterwards
+    rightmost_leaf = 0;
+    db_engine->free_page(page_id);
+    structure_version++;
+}
+
+void BTree::relocate(const RelocationSet &set)
+{
+    if (root_page_id == 0 || (!set.has_type(BTREE_INTERNAL) && !set.has_type(BTREE_LEAF)))
+    {
+        return;
+    }
+
+    // Operations already past the root are waited out child by child.
+    // Cursors and appenders holding page ids see the version move.
+    PageLatchPath path(latches);
+    path.acquire(root_page_id, true);
+    rightmost_leaf = 0;
+    structure_version++;
+
+    BTreeNode root = load_node(root_page_id);
+    if (root.is_leaf)
+    {
+        return;
+    }
+
+    // Every leaf is at the same depth
+    int levels_below = 0;
+    {
+        PageLatchPath probe(latches);
+        uint64_t page_id = root.children[0];
+        while (true)
+        {
+            probe.acquire(page_id, false);
+            probe.release_ancestors();
+            levels_below++;
+            BTreeNode node = load_node(page_id);
+            if (node.is_leaf)
+            {
+                break;
+            }
+            page_id = node.children[0];
+        }
+    }
+
+    uint64_t prev_leaf = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> links;
+    if (relocate_children(set, root, levels_below, path, prev_leaf, links))
+    {
+        save_node(root_page_id, root);
+    }
+
+    for (const auto &link : links)
+    {
+        path.acquire(link.first, true);
+        BTreeNode leaf = load_node(link.first);
+        leaf.next_leaf = link.second;
+        save_node(link.first, leaf);
+        path.release_last();
+    }
+
+    rightmost_leaf = 0;
+    structure_version++;
+}
+
+bool BTree::relocate_children(const RelocationSet &set, BTreeNode &node, int levels_below, PageLatchPath &path,
+                              uint64_t &prev_leaf, std::vector<std::pair<uint64_t, uint64_t>> &links)
+{
+    bool changed = false;
+    for (size_t i = 0; i < node.children.size(); i++)
+    {
+        uint64_t child = node.children[i];
+        if (levels_below == 1 && !set.contains(child))
+        {
+            prev_leaf = child;
+            continue;
+        }
+
+        path.acquire(child, true);
+        uint64_t moved = set.contains(child) ? db_engine->relocate_pages(child) : 0;
+        if (moved != 0)
+        {
+            node.children[i] = moved;
+            changed = true;
+        }
+        uint64_t current = moved != 0 ? moved : child;
+
+        if (levels_below > 1)
+        {
+            BTreeNode child_node = load_node(current);
+            if (relocate_children(set, child_node, levels_below - 1, path, prev_leaf, links))
+            {
+                save_node(current, child_node);
+            }
+        }
+        else
+        {
+            if (moved != 0 && prev_leaf != 0)
+            {
+                links.emplace_back(prev_leaf, moved);
+            }
+            prev_leaf = current;
+        }
+        path.release_last();
+    }
+    return changed;
+}
+
+bool BTree::read_node(uint64_t page_id, uint64_t version, BTreeNode &node)
+{
+    PageLatchPath path(latches);
+    path.acquire(page_id, false);
+    if (structure_version != version)
+    {
+        return false;
+    }
+    node = load_node(page_id);
+    return true;
+}
+
+BTreeKey BTree::normalize(const BTreeKey &key) const
+{
+    if (descriptor.type != BTREE_KEY_UINT64)
+    {
+        return key;
+    }
+
+    // (m) becomes (m, 0, 0) in a three-part tree
+    BTreeKey fixed;
+    for (int p = 0; p < descriptor.parts; p++)
+    {
+        fixed.append(key.part(p));
+    }
+    return fixed;
+}
+
+bool BTree::overflows(const BTreeNode &node) const
+{
+    if (descriptor.type == BTREE_KEY_UINT64)
+    {
+        return node.num_keys() > MAX_KEYS;
+    }
+    return node.num_keys() > BTREE_MAX_BYTE_KEYS || node.encoded_size(descriptor) > BTREE_NODE_CAPACITY;
+}
+
+bool BTree::underflows(const BTreeNode &node) const
+{
+    if (descriptor.type == BTREE_KEY_UINT64)
+    {
+        return node.num_keys() < MIN_KEYS;
+    }
+    return node.encoded_size(descriptor) < BTREE_NODE_CAPACITY / 4;
+}
+
+bool BTree::insert_safe(const BTreeNode &node) const
+{
+    if (descriptor.type == BTREE_KEY_UINT64)
+    {
+        return node.num_keys() < MAX_KEYS;
+    }
+
+    // A new key never lengthens the encoding of the key after it
+    size_t largest_entry = 2 + BTREE_MAX_KEY_SIZE + std::max(BTREE_PACKED_RECORD_SIZE, sizeof(uint64_t));
+    return node.num_keys() < BTREE_MAX_BYTE_KEYS &&
+           node.encoded_size(descriptor) + largest_entry <= BTREE_NODE_CAPACITY;
+}
+
+bool BTree::remove_safe(const BTreeNode &node) const
+{
+    if (descriptor.type == BTREE_KEY_UINT64)
+    {
+        return node.num_keys() > MIN_KEYS;
+    }
+
+    // Covers losing an entry as well as a borrow shortening a separator
+    size_t largest_entry = 2 + BTREE_MAX_KEY_SIZE + BTREE_PACKED_RECORD_SIZE;
+    return node.encoded_size(descriptor) >= BTREE_NODE_CAPACITY / 4 + largest_entry;
+}
+
+int BTree::lower_bound(const BTreeNode &node, const BTreeKey &key) const
+{
+    return std::lower_bound(node.keys.begin(), node.keys.end(), key) - node.keys.begin();
+}
+
+int BTree::child_index(const BTreeNode &node, const BTreeKey &key) const
+{
+    // Separator keys[i] is the smallest key in children[i + 1]
+    return std::upper_bound(node.keys.begin(), node.keys.end(), key) - node.keys.begin();
+}
+
+uint64_t BTree::latch_leaf(const BTreeKey &key, bool rightmost, PageLatchPath &path, BTreeNode &leaf)
+{
+    uint64_t page_id = root_page_id;
+    path.acquire(page_id, false);
+    BTreeNode node = load_node(page_id);
+
+    while (!node.is_leaf)
+    {
+        uint64_t child = rightmost ? node.children.back() : node.children[child_index(node, key)];
+        path.acquire(child, false);
+        node = load_node(child);
+
+        // Keep the parent until the leaf is relatched, so the leaf cannot
+        // split or merge in between
+        if (!node.is_leaf)
+        {
+            path.release_ancestors();
+        }
+        page_id = child;
+    }
+
+    path.release_last();
+    path.acquire(page_id, true);
+    leaf = load_node(page_id);
+    if (!leaf.is_leaf)
+    {
+        path.release_all();
+        return 0;
+    }
+    return page_id;
+}
+
+bool BTree::append_rightmost(const BTreeKey &key, const RecordLocation &record)
+{
+    // Version first: a leaf freed after this read moves it on
+    uint64_t version = structure_version;
+    uint64_t page_id = rightmost_leaf;
+
+    PageLatchPath path(latches);
+    BTreeNode leaf;
+    if (page_id != 0)
+    {
+        path.acquire(page_id, true);
+        if (structure_version == version)
+        {
+            leaf = load_node(page_id);
+        }
+
+        // A split leaves the old rightmost leaf with a successor
+        if (structure_version != version || !leaf.is_leaf || leaf.next_leaf != 0)
+        {
+            path.release_all();
+            page_id = 0;
+        }
+    }
+
+    if (page_id == 0)
+    {
+        page_id = latch_leaf(key, true, path, leaf);
+        if (page_id == 0)
+        {
+            return false;
+        }
+        rightmost_leaf = page_id;
+    }
+
+    // Every key above the last one in the rightmost leaf belongs there
+    if (leaf.keys.empty() || !(leaf.keys.back() < key))
+    {
+        return false;
+    }
+
+    leaf.keys.push_back(key);
+    leaf.records.push_back(record);
+    if (overflows(leaf))
+    {
+        return false;
+    }
+
+    save_node(page_id, leaf);
+    return true;
+}
+
+bool BTree::insert_in_leaf(const BTreeKey &key, const RecordLocation &record)
+{
+    PageLatchPath path(latches);
+    BTreeNode leaf;
+    uint64_t page_id = latch_leaf(key, false, path, leaf);
+    if (page_id == 0)
+    {
+        return false;
+    }
+
+    int pos = lower_bound(leaf, key);
+    if (pos < (int)leaf.num_keys() && leaf.keys[pos] == key)
+    {
+        leaf.records[pos] = record;
+    }
+    else
+    {
+        leaf.keys.insert(leaf.keys.begin() + pos, key);
+        leaf.records.insert(leaf.records.begin() + pos, record);
+        if (overflows(leaf))
+        {
+            return false;
+        }
+    }
+
+    save_node(page_id, leaf);
+    return true;
+}
+
+bool BTree::remove_in_leaf(const BTreeKey &key, bool &found)
+{
+    PageLatchPath path(latches);
+    BTreeNode leaf;
+    uint64_t page_id = latch_leaf(key, false, path, leaf);
+    if (page_id == 0)
+    {
+        return false;
+    }
+
+    int pos = lower_bound(leaf, key);
+    if (pos >= (int)leaf.num_keys() || leaf.keys[pos] != key)
+    {
+        return true;
+    }
+
+    leaf.keys.erase(leaf.keys.begin() + pos);
+    leaf.records.erase(leaf.records.begin() + pos);
+
+    // A root leaf has no minimum fill
+    if (page_id != root_page_id && underflows(leaf))
+    {
+        return false;
+    }
+
+    found = true;
+    save_node(page_id, leaf);
+    return true;
+}
+
+RecordLocation BTree::search(const BTreeKey &key, bool &found)
+{
+    found = false;
+    if (root_page_id == 0 || !key.fits())
+    {
+        return RecordLocation();
+    }
+
+    BTreeKey target = normalize(key);
+
+    // Crab down: latch the child, then let go of the parent
+    PageLatchPath path(latches);
+    uint64_t page_id = root_page_id;
+    path.acquire(page_id, false);
+    BTreeNode node = load_node(page_id);
+    while (!node.is_leaf)
+    {
+        page_id = node.children[child_index(node, target)];
+        path.acquire(page_id, false);
+        path.release_ancestors();
+        node = load_node(page_id);
+    }
+
+    int pos = lower_bound(node, target);
+    if (pos < (int)node.num_keys() && node.keys[pos] == target)
+    {
+        found = true;
+        return node.records[pos];
+    }
+
+    return RecordLocation();
+}
+
+BTreeKey BTree::split_node(BTreeNode &node, BTreeNode &right, bool right_edge)
+{
+    int count = node.num_keys();
+    int mid = right_edge ? count * 9 / 10 : count / 2;
+
+    if (descriptor.type == BTREE_KEY_BYTES)
+    {
+        // Split at the byte midpoint so both halves fit their pages
+        size_t total = 0;
+        for (const auto &key : node.keys)
+        {
+            total += 2 + key.length;
+        }
+        size_t running = 0;
+        mid = 0;
+        while (mid < count - 1 && (right_edge ? running * 10 < total * 9 : running * 2 < total))
+        {
+            running += 2 + node.keys[mid].length;
+            mid++;
+        }
+        mid = std::max(mid, 1);
+    }
+
+    right = BTreeNode();
+    right.is_leaf = node.is_leaf;
+    BTreeKey separator;
+
+    if (node.is_leaf)
+    {
+        // Leaves keep every key: the upper half moves over and its first
+        // key is copied up as the separator
+        right.keys.assign(node.keys.begin() + mid, node.keys.end());
+        right.records.assign(node.records.begin() + mid, node.records.end());
+        node.keys.resize(mid);
+        node.records.resize(mid);
+        separator = right.keys[0];
+    }
+    else
+    {
+        // Internal nodes push the middle key up
+        mid = std::min(mid, count - 1);
+        separator = node.keys[mid];
+        right.keys.assign(node.keys.begin() + mid + 1, node.keys.end());
+        right.children.assign(node.children.begin() + mid + 1, node.children.end());
+        node.keys.resize(mid);
+        node.children.resize(mid + 1);
+    }
+
+    return separator;
+}
+
+bool BTree::insert_internal(uint64_t node_page_id, BTreeNode &node, const BTreeKey &key,
+                            const RecordLocation &record, bool rightmost, PageLatchPath &path,
+                            BTreeKey &separator, uint64_t &right_page)
+{
+    bool right_edge = false;
+
+    if (node.is_leaf)
+    {
+        int pos = lower_bound(node, key);
+        if (pos < (int)node.num_keys() && node.keys[pos] == key)
+        {
+            node.records[pos] = record;
+            save_node(node_page_id, node);
+            return false;
+        }
+        right_edge = rightmost && pos == (int)node.num_keys();
+        node.keys.insert(node.keys.begin() + pos, key);
+        node.records.insert(node.records.begin() + pos, record);
+    }
+    else
+    {
+        int idx = child_index(node, key);
+        uint64_t child_page_id = node.children[idx];
+        path.acquire(child_page_id, true);
+        BTreeNode child = load_node(child_page_id);
+
+        // Nothing above a child that cannot split will change
+        if (insert_safe(child))
+        {
+            path.release_ancestors();
+        }
+
+        BTreeKey child_separator;
+        uint64_t child_right;
+        right_edge = rightmost && idx == (int)node.num_keys();
+        if (!insert_internal(child_page_id, child, key, record, right_edge, path, child_separator, child_right))
+        {
+            return false;
+        }
+        node.keys.insert(node.keys.begin() + idx, child_separator);
+        node.children.insert(node.children.begin() + idx + 1, child_right);
+    }
+
+    if (!overflows(node))
+    {
+        save_node(node_page_id, node);
+        return false;
+    }
+
+    BTreeNode right;
+    separator = split_node(node, right, right_edge);
+    right_page = db_engine->allocate_page();
+
+    if (node.is_leaf)
+    {
+        // Link leaves
+        right.next_leaf = node.next_leaf;
+        node.next_leaf = right_page;
+    }
+
+    save_node(right_page, right);
+    save_node(node_page_id, node);
+    structure_version++;
+    return true;
+}
+
+void BTree::grow_root(const BTreeKey &separator, uint64_t right_page)
+{
+    // Move the left half off the root page so the root keeps its id
+    uint64_t left_page = db_engine->allocate_page();
+    save_node(left_page, load_node(root_page_id));
+
+    BTreeNode root;
+    root.is_leaf = false;
+    root.keys.push_back(separator);
+    root.children.push_back(left_page);
+    root.children.push_back(right_page);
+    save_node(root_page_id, root);
+    structure_version++;
+}
+
+bool BTree::insert(const BTreeKey &key, const RecordLocation &record)
+{
+    if (!key.fits())
+    {
+        return false;
+    }
+    if (root_page_id == 0)
+    {
+        initialize();
+    }
 
-    BTreeNode root;
-    root.is_leaf = true;
-    root.num_keys = 0;
+    BTreeKey target = normalize(key);
+    if (append_rightmost(target, record) || insert_in_leaf(target, record))
+    {
+        return true;
+    }
 
-    save_node(root_page_id, root);
+    // The leaf has to split: latch exclusively from the root down
+    PageLatchPath path(latches);
+    path.acquire(root_page_id, true);
+    BTreeNode root = load_node(root_page_id);
 
-    std::cout << "B-Tree initialized with root page: " << root_page_id << std::endl;
+    BTreeKey separator;
+    uint64_t right_page;
+    if (insert_internal(root_page_id, root, target, record, true, path, separator, right_page))
+    {
+        grow_root(separator, right_page);
+    }
+
+    return true;
 }
 
-void BTree::load(uint64_t root_id)
+size_t BTree::bulk_entry_size(const BulkNode &bulk, const BTreeKey &key) const
 {
-    root_page_id = root_id;
-    std::cout << "B-Tree loaded with root page: " << root_page_id << std::endl;
+    if (descriptor.type == BTREE_KEY_UINT64)
+    {
+        return 0; // Fixed layout, bounded by key count alone
+    }
+    if (!bulk.node.is_leaf && bulk.node.children.empty())
+    {
+        return sizeof(uint64_t); // First child carries no key
+    }
+
+    size_t shared = bulk.node.keys.empty() ? 0 : shared_prefix(bulk.node.keys.back(), key);
+    return 2 + key.length - shared + (bulk.node.is_leaf ? BTREE_PACKED_RECORD_SIZE : sizeof(uint64_t));
 }
 
-BTreeNode BTree::load_node(uint64_t page_id)
+void BTree::bulk_push(BulkNode &bulk, const BTreeKey &key, const RecordLocation &record)
 {
-    Page page = db_engine->read_page(page_id);
-    BTreeNode node;
-    node.deserialize(page.data);
-    return node;
+    bulk.size += bulk_entry_size(bulk, key);
+    bulk.node.keys.push_back(key);
+    bulk.node.records.push_back(record);
 }
 
-void BTree::save_node(uint64_t page_id, const BTreeNode &node)
+void BTree::bulk_push(BulkNode &bulk, const BTreeKey &key, uint64_t child)
 {
-    Page page;
-    page.header.type = node.is_leaf ? BTREE_LEAF : BTREE_INTERNAL;
-    node.serialize(page.data);
-    db_engine->write_page(page_id, page);
+    bulk.size += bulk_entry_size(bulk, key);
+    if (!bulk.node.children.empty())
+    {
+        bulk.node.keys.push_back(key);
+    }
+    bulk.node.children.push_back(child);
 }
 
-int BTree::search_key_position(const BTreeNode &node, uint64_t key)
+void BTree::bulk_finish_level(BulkNode &prev, BulkNode &last)
 {
-    // Binary search for key position
-    int left = 0;
-    int right = node.num_keys - 1;
-
-    while (left <= right)
+    if (prev.page_id != 0 && underflows(last.node))
     {
-        int mid = left + (right - left) / 2;
-        if (node.keys[mid] == key)
+        // Fold a short last node into its neighbour, or even the two out
+        BTreeNode merged = prev.node;
+        if (merged.is_leaf)
+        {
+            merged.keys.insert(merged.keys.end(), last.node.keys.begin(), last.node.keys.end());
+            merged.records.insert(merged.records.end(), last.node.records.begin(), last.node.records.end());
+            merged.next_leaf = last.node.next_leaf;
+        }
+        else
         {
-            return mid;
+            merged.keys.push_back(last.first_key);
+            merged.keys.insert(merged.keys.end(), last.node.keys.begin(), last.node.keys.end());
+            merged.children.insert(merged.children.end(), last.node.children.begin(), last.node.children.end());
         }
-        else if (node.keys[mid] < key)
+
+        if (!overflows(merged))
         {
-            left = mid + 1;
+            prev.node = std::move(merged);
+            free_node(last.page_id);
+            last.page_id = 0;
         }
         else
         {
-            right = mid - 1;
+            while (underflows(last.node) && prev.node.num_keys() > 1 && !underflows(prev.node))
+            {
+                if (last.node.is_leaf)
+                {
+                    last.node.keys.insert(last.node.keys.begin(), prev.node.keys.back());
+                    last.node.records.insert(last.node.records.begin(), prev.node.records.back());
+                    last.first_key = prev.node.keys.back();
+                    prev.node.records.pop_back();
+                }
+                else
+                {
+                    last.node.keys.insert(last.node.keys.begin(), last.first_key);
+                    last.node.children.insert(last.node.children.begin(), prev.node.children.back());
+                    last.first_key = prev.node.keys.back();
+                    prev.node.children.pop_back();
+                }
+                prev.node.keys.pop_back();
+            }
         }
     }
 
-    return left; // Insert position
+    if (prev.page_id != 0)
+    {
+        save_node(prev.page_id, prev.node);
+    }
+    if (last.page_id != 0)
+    {
+        save_node(last.page_id, last.node);
+    }
 }
 
-RecordLocation BTree::search_internal(uint64_t node_page_id, uint64_t key, bool &found)
+template <typename Value>
+std::vector<std::pair<BTreeKey, uint64_t>> BTree::bulk_level(const std::vector<std::pair<BTreeKey, Value>> &items,
+                                                             double fill_factor)
 {
-    BTreeNode node = load_node(node_page_id);
+    const bool leaf = std::is_same<Value, RecordLocation>::value;
+    size_t key_limit = descriptor.type == BTREE_KEY_UINT64 ? static_cast<size_t>(fill_factor * MAX_KEYS)
+                                                           : BTREE_MAX_BYTE_KEYS;
+    size_t byte_limit = static_cast<size_t>(fill_factor * BTREE_NODE_CAPACITY);
 
-    int pos = search_key_position(node, key);
+    std::vector<std::pair<BTreeKey, uint64_t>> built;
+    BulkNode prev{0, BTreeKey(), BTreeNode(), 0};
+    BulkNode last{0, BTreeKey(), BTreeNode(), 0};
 
-    if (node.is_leaf)
+    for (const auto &item : items)
     {
-        if (pos < node.num_keys && node.keys[pos] == key)
+        BTreeKey key = normalize(item.first);
+        bool full = last.page_id != 0 &&
+                    (last.node.num_keys() >= key_limit || last.size + bulk_entry_size(last, key) > byte_limit);
+
+        if (last.page_id == 0 || full)
         {
-            found = true;
-            return node.records[pos];
+            uint64_t page_id = db_engine->allocate_page();
+            if (last.page_id != 0)
+            {
+                if (leaf)
+                {
+                    last.node.next_leaf = page_id;
+                }
+                if (prev.page_id != 0)
+                {
+                    save_node(prev.page_id, prev.node);
+                    built.emplace_back(prev.first_key, prev.page_id);
+                }
+                prev = std::move(last);
+            }
+
+            last = BulkNode{page_id, key, BTreeNode(), BTREE_NODE_HEADER_SIZE};
+            last.node.is_leaf = leaf;
         }
 
-        found = false;
-        return RecordLocation();
+        bulk_push(last, key, item.second);
     }
 
-    if (pos < node.num_keys && node.keys[pos] == key)
+    bulk_finish_level(prev, last);
+    if (prev.page_id != 0)
     {
-        return search_internal(node.children[pos + 1], key, found);
+        built.emplace_back(prev.first_key, prev.page_id);
     }
-
-    return search_internal(node.children[pos], key, found);
+    if (last.page_id != 0)
+    {
+        built.emplace_back(last.first_key, last.page_id);
+    }
+    return built;
 }
 
-RecordLocation BTree::search(uint64_t key, bool &found)
+bool BTree::bulk_load(const std::vector<std::pair<BTreeKey, RecordLocation>> &entries, double fill_factor)
 {
     if (root_page_id == 0)
     {
-        found = false;
-        return RecordLocation();
+        initialize();
     }
 
-    return search_internal(root_page_id, key, found);
-}
-
-void BTree::split_child(uint64_t parent_page_id, int child_index, uint64_t child_page_id)
-{
-    // Load parent and child nodes from disk
-    BTreeNode parent = load_node(parent_page_id);
-    BTreeNode child = load_node(child_page_id);
-
-    // Create new node
-    uint64_t new_page_id = db_engine->allocate_page();
-    BTreeNode new_node;
-    new_node.is_leaf = child.is_leaf;
-    new_node.parent_page = parent_page_id;
-
-    int mid = MAX_KEYS / 2;
-
-    // Copy second half of keys to new node
-    new_node.num_keys = MAX_KEYS - mid - 1;
-    for (int i = 0; i < new_node.num_keys; i++)
+    BTreeNode root = load_node(root_page_id);
+    if (!root.is_leaf || root.num_keys() != 0)
     {
-        new_node.keys[i] = child.keys[mid + 1 + i];
+        std::cerr << "Bulk load needs an empty tree" << std::endl;
+        return false;
     }
 
-    if (child.is_leaf)
+    for (size_t i = 0; i < entries.size(); i++)
     {
-        // Copy records
-        for (int i = 0; i < new_node.num_keys; i++)
+        if (!entries[i].first.fits())
         {
-            new_node.records[i] = child.records[mid + 1 + i];
+            std::cerr << "Bulk load key at entry " << i << " is longer than " << BTREE_MAX_KEY_SIZE << " bytes"
+                      << std::endl;
+            return false;
         }
-        // Link leaves
-        new_node.next_leaf = child.next_leaf;
-        child.next_leaf = new_page_id;
-    }
-    else
-    {
-        // Copy children
-        for (int i = 0; i <= new_node.num_keys; i++)
+        if (i > 0 && !(normalize(entries[i - 1].first) < normalize(entries[i].first)))
         {
-            new_node.children[i] = child.children[mid + 1 + i];
+            std::cerr << "Bulk load input is not sorted at entry " << i << std::endl;
+            return false;
         }
     }
 
-    // Update child node size
-    child.num_keys = mid;
-
-    for (int i = parent.num_keys; i > child_index; i--)
+    if (entries.empty())
     {
-        parent.keys[i] = parent.keys[i - 1];
-        parent.children[i + 1] = parent.children[i];
+        return true;
     }
 
-    parent.keys[child_index] = child.keys[mid];
-    parent.children[child_index + 1] = new_page_id;
-    parent.num_keys++;
+    // Below half full the nodes would be born underflowing
+    fill_factor = std::min(1.0, std::max(0.5, fill_factor));
 
-    // Save all modified nodes
-    save_node(child_page_id, child);
-    save_node(new_page_id, new_node);
-    save_node(parent_page_id, parent);
+    std::vector<std::pair<BTreeKey, uint64_t>> level = bulk_level(entries, fill_factor);
+    while (level.size() > 1)
+    {
+        level = bulk_level(level, fill_factor);
+    }
+
+    // The top node moves onto the root page so the root keeps its id
+    uint64_t top_page_id = level[0].second;
+    save_node(root_page_id, load_node(top_page_id));
+    free_node(top_page_id);
+    return true;
 }
 
-void BTree::insert_non_full(uint64_t node_page_id, uint64_t key, const RecordLocation &record)
+std::vector<RecordLocation> BTree::range_search(const BTreeKey &start_key, const BTreeKey &end_key,
+                                                size_t limit)
 {
-    BTreeNode node = load_node(node_page_id);
-
-    int pos = search_key_position(node, key);
+    std::vector<RecordLocation> results;
+    BTreeKey end = normalize(end_key);
 
-    if (node.is_leaf)
+    BTreeCursor cursor(this);
+    cursor.set_prefetch(BTREE_PREFETCH_LEAVES);
+    for (bool more = cursor.seek(start_key); more && results.size() < limit; more = cursor.next())
     {
-        // Insert into leaf
-        for (int i = node.num_keys; i > pos; i--)
+        if (cursor.key() > end)
         {
-            node.keys[i] = node.keys[i - 1];
-            node.records[i] = node.records[i - 1];
+            break;
         }
-
-        node.keys[pos] = key;
-        node.records[pos] = record;
-        node.num_keys++;
-
-        save_node(node_page_id, node);
+        results.push_back(cursor.record());
     }
-    else
-    {
-        // Internal node - find child
-        uint64_t child_page_id = node.children[pos];
-        BTreeNode child = load_node(child_page_id);
 
-        if (child.num_keys == MAX_KEYS)
-        {
-            split_child(node_page_id, pos, child_page_id);
+    return results;
+}
 
-            
-            node = load_node(node_page_id);
+std::vector<RecordLocation> BTree::reverse_range_search(const BTreeKey &start_key, const BTreeKey &end_key,
+                                                        size_t limit)
+{
+    std::vector<RecordLocation> results;
+    BTreeKey start = normalize(start_key);
 
-            if (key > node.keys[pos])
-            {
-                pos++;
-            }
+    BTreeCursor cursor(this);
+    cursor.set_prefetch(BTREE_PREFETCH_LEAVES);
+    for (bool more = cursor.seek_last(end_key); more && results.size() < limit; more = cursor.prev())
+    {
+        if (cursor.key() < start)
+        {
+            break;
         }
-
-        insert_non_full(node.children[pos], key, record);
+        results.push_back(cursor.record());
     }
+
+    return results;
 }
 
-bool BTree::insert(uint64_t key, const RecordLocation &record)
+bool BTree::merge_children(BTreeNode &node, int left_idx, PageLatchPath &path)
 {
-    if (root_page_id == 0)
+    uint64_t left_page_id = node.children[left_idx];
+    uint64_t right_page_id = node.children[left_idx + 1];
+    path.acquire(left_page_id, true);
+    path.acquire(right_page_id, true);
+    BTreeNode left = load_node(left_page_id);
+    BTreeNode right = load_node(right_page_id);
+
+    if (left.is_leaf)
     {
-        initialize();
+        left.keys.insert(left.keys.end(), right.keys.begin(), right.keys.end());
+        left.records.insert(left.records.end(), right.records.begin(), right.records.end());
+        left.next_leaf = right.next_leaf;
     }
-
-    BTreeNode root = load_node(root_page_id);
-
-    if (root.num_keys == MAX_KEYS)
+    else
     {
-        // Root is full, split it
-        uint64_t new_root_id = db_engine->allocate_page();
-        BTreeNode new_root;
-        new_root.is_leaf = false;
-        new_root.num_keys = 0;
-        new_root.children[0] = root_page_id;
-
-        save_node(new_root_id, new_root);
-
-        split_child(new_root_id, 0, root_page_id);
-
-        root_page_id = new_root_id;
-
-        insert_non_full(new_root_id, key, record);
+        // The separator comes back down between the two halves
+        left.keys.push_back(node.keys[left_idx]);
+        left.keys.insert(left.keys.end(), right.keys.begin(), right.keys.end());
+        left.children.insert(left.children.end(), right.children.begin(), right.children.end());
     }
-    else
+
+    if (overflows(left))
     {
-        insert_non_full(root_page_id, key, record);
+        return false;
     }
 
+    // Remove separator and right child from the parent
+    node.keys.erase(node.keys.begin() + left_idx);
+    node.children.erase(node.children.begin() + left_idx + 1);
+
+    save_node(left_page_id, left);
+    free_node(right_page_id);
     return true;
 }
 
-std::vector<RecordLocation> BTree::range_search(uint64_t start_key, uint64_t end_key)
+void BTree::rebalance_child(BTreeNode &node, int child_idx, PageLatchPath &path)
 {
-    std::vector<RecordLocation> results;
-
-    if (root_page_id == 0)
+    // Merge with a neighbour when the two fit in one node
+    if (child_idx > 0 && merge_children(node, child_idx - 1, path))
+    {
+        return;
+    }
+    if (child_idx < (int)node.num_keys() && merge_children(node, child_idx, path))
     {
-        return results;
+        return;
     }
 
-    // Find start leaf
-    uint64_t current_page = root_page_id;
-    BTreeNode node = load_node(current_page);
+    // Otherwise borrow the nearest entry of a sibling that can spare one.
+    // Work on copies so a sibling that would underflow is left untouched.
+    uint64_t child_page_id = node.children[child_idx];
+    BTreeNode child = load_node(child_page_id);
 
-    while (!node.is_leaf)
+    if (child_idx > 0)
     {
-        int pos = search_key_position(node, start_key);
-        current_page = node.children[pos];
-        node = load_node(current_page);
+        uint64_t left_page_id = node.children[child_idx - 1];
+        path.acquire(left_page_id, true);
+        BTreeNode left = load_node(left_page_id);
+        BTreeNode new_child = child;
+        BTreeKey new_separator;
+
+        if (child.is_leaf)
+        {
+            new_child.keys.insert(new_child.keys.begin(), left.keys.back());
+            new_child.records.insert(new_child.records.begin(), left.records.back());
+            left.records.pop_back();
+            new_separator = new_child.keys[0];
+        }
+        else
+        {
+            new_child.keys.insert(new_child.keys.begin(), node.keys[child_idx - 1]);
+            new_child.children.insert(new_child.children.begin(), left.children.back());
+            left.children.pop_back();
+            new_separator = left.keys.back();
+        }
+        left.keys.pop_back();
+
+        if (!left.keys.empty() && !underflows(left))
+        {
+            node.keys[child_idx - 1] = new_separator;
+            save_node(left_page_id, left);
+            save_node(child_page_id, new_child);
+            structure_version++;
+            return;
+        }
     }
 
-    // Scan leaves
-    while (current_page != 0)
+    if (child_idx < (int)node.num_keys())
     {
-        node = load_node(current_page);
+        uint64_t right_page_id = node.children[child_idx + 1];
+        path.acquire(right_page_id, true);
+        BTreeNode right = load_node(right_page_id);
+        BTreeKey new_separator;
 
-        for (int i = 0; i < node.num_keys; i++)
+        if (child.is_leaf)
         {
-            if (node.keys[i] >= start_key && node.keys[i] <= end_key)
-            {
-                results.push_back(node.records[i]);
-            }
-            else if (node.keys[i] > end_key)
+            child.keys.push_back(right.keys.front());
+            child.records.push_back(right.records.front());
+            right.keys.erase(right.keys.begin());
+            right.records.erase(right.records.begin());
+            if (!right.keys.empty())
             {
-                return results; // Done
+                new_separator = right.keys.front();
             }
         }
+        else
+        {
+            child.keys.push_back(node.keys[child_idx]);
+            child.children.push_back(right.children.front());
+            new_separator = right.keys.front();
+            right.keys.erase(right.keys.begin());
+            right.children.erase(right.children.begin());
+        }
 
-        current_page = node.next_leaf;
+        if (!right.keys.empty() && !underflows(right))
+        {
+            node.keys[child_idx] = new_separator;
+            save_node(right_page_id, right);
+            save_node(child_page_id, child);
+            structure_version++;
+        }
     }
-
-    return results;
 }
 
-void BTree::borrow_from_prev(uint64_t node_page_id, int child_idx)
+bool BTree::remove_internal(uint64_t node_page_id, BTreeNode &node, const BTreeKey &key, PageLatchPath &path,
+                            bool &found)
 {
-    BTreeNode node = load_node(node_page_id);
-    BTreeNode child = load_node(node.children[child_idx]);
-    BTreeNode sibling = load_node(node.children[child_idx - 1]);
-
-    // Move a key from parent to child
-    for (int i = child.num_keys; i > 0; i--)
-    {
-        child.keys[i] = child.keys[i - 1];
-    }
-
-    if (!child.is_leaf)
+    if (node.is_leaf)
     {
-        for (int i = child.num_keys + 1; i > 0; i--)
+        int pos = lower_bound(node, key);
+        if (pos >= (int)node.num_keys() || node.keys[pos] != key)
         {
-            child.children[i] = child.children[i - 1];
+            return false;
         }
-        child.children[0] = sibling.children[sibling.num_keys];
+
+        node.keys.erase(node.keys.begin() + pos);
+        node.records.erase(node.records.begin() + pos);
+        found = true;
+
+        save_node(node_page_id, node);
+        return underflows(node);
     }
-    else
+
+    int idx = child_index(node, key);
+    uint64_t child_page_id = node.children[idx];
+    path.acquire(child_page_id, true);
+    BTreeNode child = load_node(child_page_id);
+
+    // Nothing above a child that cannot underflow will change
+    if (remove_safe(child))
     {
-        for (int i = child.num_keys; i > 0; i--)
-        {
-            child.records[i] = child.records[i - 1];
-        }
-        child.records[0] = sibling.records[sibling.num_keys - 1];
+        path.release_ancestors();
     }
 
-    child.keys[0] = node.keys[child_idx - 1];
-    node.keys[child_idx - 1] = sibling.keys[sibling.num_keys - 1];
-
-    child.num_keys++;
-    sibling.num_keys--;
+    if (!remove_internal(child_page_id, child, key, path, found))
+    {
+        return false;
+    }
 
-    save_node(node.children[child_idx - 1], sibling);
-    save_node(node.children[child_idx], child);
+    rebalance_child(node, idx, path);
     save_node(node_page_id, node);
+    return underflows(node);
 }
 
-void BTree::borrow_from_next(uint64_t node_page_id, int child_idx)
+bool BTree::remove(const BTreeKey &key)
 {
-    BTreeNode node = load_node(node_page_id);
-    BTreeNode child = load_node(node.children[child_idx]);
-    BTreeNode sibling = load_node(node.children[child_idx + 1]);
-
-    child.keys[child.num_keys] = node.keys[child_idx];
-
-    if (!child.is_leaf)
+    if (root_page_id == 0 || !key.fits())
     {
-        child.children[child.num_keys + 1] = sibling.children[0];
-        for (int i = 0; i < sibling.num_keys; i++)
-        {
-            sibling.children[i] = sibling.children[i + 1];
-        }
+        return false;
     }
-    else
+
+    bool found = false;
+    BTreeKey target = normalize(key);
+    if (remove_in_leaf(target, found))
     {
-        child.records[child.num_keys] = sibling.records[0];
-        for (int i = 0; i < sibling.num_keys - 1; i++)
-        {
-            sibling.records[i] = sibling.records[i + 1];
-        }
+        return found;
     }
 
-    node.keys[child_idx] = sibling.keys[0];
+    // The leaf would underflow: latch exclusively from the root down
+    PageLatchPath path(latches);
+    path.acquire(root_page_id, true);
+    BTreeNode root = load_node(root_page_id);
+    remove_internal(root_page_id, root, target, path, found);
 
-    for (int i = 0; i < sibling.num_keys - 1; i++)
+    // An internal root left with a single child absorbs that child. A root
+    // let go of on the way down was not changed.
+    if (path.holds(root_page_id) && root.num_keys() == 0 && !root.is_leaf)
     {
-        sibling.keys[i] = sibling.keys[i + 1];
+        uint64_t child_page_id = root.children[0];
+        path.acquire(child_page_id, true);
+        save_node(root_page_id, load_node(child_page_id));
+        free_node(child_page_id);
     }
 
-    child.num_keys++;
-    sibling.num_keys--;
-
-    save_node(node.children[child_idx], child);
-    save_node(node.children[child_idx + 1], sibling);
-    save_node(node_page_id, node);
+    return found;
 }
 
-void BTree::merge(uint64_t node_page_id, int child_idx)
+BTreeCursor::BTreeCursor(BTree *btree)
+    : tree(btree), pos(0), is_valid(false), version(0), prefetch_leaves(0)
 {
-    BTreeNode node = load_node(node_page_id);
-    BTreeNode child = load_node(node.children[child_idx]);
-    BTreeNode sibling = load_node(node.children[child_idx + 1]);
+}
 
-    
-    child.keys[child.num_keys] = node.keys[child_idx];
+bool BTreeCursor::descend_to(const BTreeKey &target)
+{
+    path.clear();
+    version = tree->structure_version;
 
-    // Copy keys from sibling
-    for (int i = 0; i < sibling.num_keys; i++)
+    BTreeNode node;
+    if (!tree->read_node(tree->root_page_id, version, node))
     {
-        child.keys[child.num_keys + 1 + i] = sibling.keys[i];
+        return false;
     }
-
-    if (!child.is_leaf)
+    while (!node.is_leaf)
     {
-        for (int i = 0; i <= sibling.num_keys; i++)
+        int idx = tree->child_index(node, target);
+        uint64_t child = node.children[idx];
+        path.push_back(Level{std::move(node), idx});
+        if (!tree->read_node(child, version, node))
         {
-            child.children[child.num_keys + 1 + i] = sibling.children[i];
+            return false;
         }
     }
-    else
+    leaf = std::move(node);
+    return true;
+}
+
+void BTreeCursor::find_leaf(const BTreeKey &target)
+{
+    for (int attempt = 0; attempt < BTREE_CURSOR_RETRIES; attempt++)
     {
-        for (int i = 0; i < sibling.num_keys; i++)
+        if (descend_to(target))
         {
-            child.records[child.num_keys + 1 + i] = sibling.records[i];
+            return;
         }
-        child.next_leaf = sibling.next_leaf;
+        std::this_thread::yield();
     }
 
-    child.num_keys += sibling.num_keys + 1;
-
-    // Remove key from parent
-    for (int i = child_idx; i < node.num_keys - 1; i++)
+    // A shape change during the descent leaves version stale, so the next
+    // step looks its key up again instead of trusting the path
+    path.clear();
+    version = tree->structure_version;
+    PageLatchPath latched(tree->latches);
+    uint64_t page_id = tree->root_page_id;
+    latched.acquire(page_id, false);
+    BTreeNode node = tree->load_node(page_id);
+    while (!node.is_leaf)
     {
-        node.keys[i] = node.keys[i + 1];
-        node.children[i + 1] = node.children[i + 2];
+        int idx = tree->child_index(node, target);
+        page_id = node.children[idx];
+        latched.acquire(page_id, false);
+        latched.release_ancestors();
+        path.push_back(Level{std::move(node), idx});
+        node = tree->load_node(page_id);
     }
-    node.num_keys--;
-
-    save_node(node.children[child_idx], child);
-    save_node(node_page_id, node);
-
-    // Free the sibling page
-    db_engine->free_page(node.children[child_idx + 1]);
+    leaf = std::move(node);
 }
 
-void BTree::remove_from_leaf(BTreeNode &node, int idx)
+bool BTreeCursor::descend(uint64_t page_id, bool forward)
 {
-    for (int i = idx; i < node.num_keys - 1; i++)
+    BTreeNode node;
+    if (!tree->read_node(page_id, version, node))
+    {
+        return false;
+    }
+    while (!node.is_leaf)
     {
-        node.keys[i] = node.keys[i + 1];
-        node.records[i] = node.records[i + 1];
+        int idx = forward ? 0 : node.num_keys();
+        uint64_t child = node.children[idx];
+        path.push_back(Level{std::move(node), idx});
+        if (!tree->read_node(child, version, node))
+        {
+            return false;
+        }
     }
-    node.num_keys--;
+    leaf = std::move(node);
+    return true;
 }
 
-void BTree::remove_from_non_leaf(uint64_t node_page_id, int idx)
+bool BTreeCursor::step_leaf(bool forward, const BTreeKey &bound, bool inclusive)
 {
-    BTreeNode node = load_node(node_page_id);
-    uint64_t key = node.keys[idx];
-
-    BTreeNode left_child = load_node(node.children[idx]);
-    BTreeNode right_child = load_node(node.children[idx + 1]);
-
-    int min_keys = MAX_KEYS / 2;
-
-    if (left_child.num_keys > min_keys)
+    // Climb to the first ancestor with a sibling subtree in this direction
+    // and go down its near edge; empty leaves are skipped the same way
+    while (!path.empty() && tree->structure_version == version)
     {
-        // Get predecessor
-        uint64_t pred_page = node.children[idx];
-        BTreeNode pred_node = load_node(pred_page);
-        while (!pred_node.is_leaf)
+        Level &level = path.back();
+        int next = level.index + (forward ? 1 : -1);
+        if (next < 0 || next > (int)level.node.num_keys())
         {
-            pred_page = pred_node.children[pred_node.num_keys];
-            pred_node = load_node(pred_page);
+            path.pop_back();
+            continue;
         }
-        uint64_t pred_key = pred_node.keys[pred_node.num_keys - 1];
 
-        remove_internal(node.children[idx], pred_key);
-        node = load_node(node_page_id);
-        node.keys[idx] = pred_key;
-        save_node(node_page_id, node);
-    }
-    else if (right_child.num_keys > min_keys)
-    {
-        // Get successor
-        uint64_t succ_page = node.children[idx + 1];
-        BTreeNode succ_node = load_node(succ_page);
-        while (!succ_node.is_leaf)
+        level.index = next;
+        if (!descend(level.node.children[next], forward))
         {
-            succ_page = succ_node.children[0];
-            succ_node = load_node(succ_page);
+            break;
         }
-        uint64_t succ_key = succ_node.keys[0];
+        if (!leaf.keys.empty())
+        {
+            pos = forward ? 0 : leaf.num_keys() - 1;
+            prefetch(forward);
+            return true;
+        }
+    }
 
-        remove_internal(node.children[idx + 1], succ_key);
-        node = load_node(node_page_id);
-        node.keys[idx] = succ_key;
-        save_node(node_page_id, node);
+    if (tree->structure_version == version)
+    {
+        return false;
     }
-    else
+
+    // The tree changed shape under the copied path: look the neighbouring
+    // key up from the root again
+    if (!(forward ? seek(bound) : seek_last(bound)))
     {
-        // Merge with right sibling
-        merge(node_page_id, idx);
-        remove_internal(node.children[idx], key);
+        return false;
+    }
+    if (!inclusive && key() == bound)
+    {
+        return forward ? next() : prev();
     }
+    return true;
 }
 
-void BTree::fill_child(uint64_t node_page_id, int child_idx)
+void BTreeCursor::prefetch(bool forward)
 {
-    BTreeNode node = load_node(node_page_id);
-
-    if (child_idx != 0)
+    // Only siblings under the same parent; the window slides one leaf per
+    // step, and pages already cached or on their way are skipped
+    if (prefetch_leaves <= 0 || path.empty())
     {
-        BTreeNode prev_sibling = load_node(node.children[child_idx - 1]);
-        if (prev_sibling.num_keys > MAX_KEYS / 2)
-        {
-            borrow_from_prev(node_page_id, child_idx);
-            return;
-        }
+        return;
     }
 
-    // Borrow from next sibling if possible
-    if (child_idx != node.num_keys)
+    const Level &parent = path.back();
+    std::vector<uint64_t> pages;
+    for (int i = 1; i <= prefetch_leaves; i++)
     {
-        BTreeNode next_sibling = load_node(node.children[child_idx + 1]);
-        if (next_sibling.num_keys > MAX_KEYS / 2)
+        int idx = parent.index + (forward ? i : -i);
+        if (idx < 0 || idx > (int)parent.node.num_keys())
         {
-            borrow_from_next(node_page_id, child_idx);
-            return;
+            break;
         }
+        pages.push_back(parent.node.children[idx]);
     }
-
-    // Merge with sibling
-    if (child_idx != node.num_keys)
-    {
-        merge(node_page_id, child_idx);
-    }
-    else
+    if (!pages.empty())
     {
-        merge(node_page_id, child_idx - 1);
+        tree->db_engine->prefetch_pages(pages);
     }
 }
 
-void BTree::remove_internal(uint64_t node_page_id, uint64_t key)
+bool BTreeCursor::seek(const BTreeKey &key)
 {
-    BTreeNode node = load_node(node_page_id);
-    int idx = search_key_position(node, key);
-
-    if (node.is_leaf)
+    path.clear();
+    is_valid = false;
+    if (tree->root_page_id == 0)
     {
-        if (idx < node.num_keys && node.keys[idx] == key)
-        {
-            remove_from_leaf(node, idx);
-            save_node(node_page_id, node);
-        }
-        return;
+        return false;
     }
 
-    bool found_in_node = (idx < node.num_keys && node.keys[idx] == key);
+    BTreeKey target = tree->normalize(key);
+    find_leaf(target);
+
+    pos = tree->lower_bound(leaf, target);
+    is_valid = pos < (int)leaf.num_keys() || step_leaf(true, target, true);
+    return is_valid;
+}
 
-    if (found_in_node)
+bool BTreeCursor::seek_last(const BTreeKey &key)
+{
+    path.clear();
+    is_valid = false;
+    if (tree->root_page_id == 0)
     {
-        remove_from_non_leaf(node_page_id, idx);
-        return;
+        return false;
     }
 
-    // Key is in subtree
-    BTreeNode child = load_node(node.children[idx]);
-    bool is_in_subtree = (idx == node.num_keys || key < node.keys[idx]);
+    BTreeKey target = tree->normalize(key);
+    find_leaf(target);
 
-    if (child.num_keys <= MAX_KEYS / 2)
-    {
-        fill_child(node_page_id, idx);
-        node = load_node(node_page_id);
+    // Last entry <= target
+    pos = tree->child_index(leaf, target) - 1;
+    is_valid = pos >= 0 || step_leaf(false, target, true);
+    return is_valid;
+}
 
-        if (idx > node.num_keys)
-        {
-            idx = node.num_keys;
-        }
+bool BTreeCursor::seek_first()
+{
+    // The empty key sorts before every other key
+    return seek(BTreeKey());
+}
 
-        if (idx < node.num_keys && node.keys[idx] == key)
-        {
-            remove_from_non_leaf(node_page_id, idx);
-            return;
-        }
+bool BTreeCursor::seek_end()
+{
+    uint8_t highest[BTREE_MAX_KEY_SIZE];
+    memset(highest, 0xFF, sizeof(highest));
+    return seek_last(BTreeKey::from_bytes(highest, sizeof(highest)));
+}
 
-        // Recalculate position
-        idx = search_key_position(node, key);
+bool BTreeCursor::next()
+{
+    if (!is_valid)
+    {
+        return false;
     }
 
-    remove_internal(node.children[idx], key);
+    if (++pos < (int)leaf.num_keys())
+    {
+        return true;
+    }
+    BTreeKey last = leaf.keys.back(); // leaf is replaced by the step
+    is_valid = step_leaf(true, last, false);
+    return is_valid;
 }
 
-bool BTree::remove(uint64_t key)
+bool BTreeCursor::prev()
 {
-    if (root_page_id == 0)
+    if (!is_valid)
     {
         return false;
     }
 
-    remove_internal(root_page_id, key);
-
-    BTreeNode root = load_node(root_page_id);
-    if (root.num_keys == 0 && !root.is_leaf)
+    if (--pos >= 0)
     {
-        uint64_t old_root = root_page_id;
-        root_page_id = root.children[0];
-        db_engine->free_page(old_root);
+        return true;
     }
-
-    return true;
-}
\ No newline at end of file
+    BTreeKey first = leaf.keys.front(); // leaf is replaced by the step
+    is_valid = step_leaf(false, first, false);
+    return is_valid;
+}
@@ -2,6 +2,11 @@
 #define BTREE_H
 
 #include "DatabaseEngine.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 #include <string>
 
@@ -10,6 +15,17 @@ const int BTREE_ORDER = 64; // Maximum 63 keys, 64 children
 const int MAX_KEYS = BTREE_ORDER - 1;
 const int MIN_KEYS = (BTREE_ORDER / 2) - 1;
 
+// Leaves a range scan asks the engine to read ahead of the one it is on
+const int BTREE_PREFETCH_LEAVES = 8;
+
+// Unlatched descents a cursor seek tries before latching its way down
+const int BTREE_CURSOR_RETRIES = 8;
+
+// Keys are byte strings compared with memcmp, the shorter one first on a
+// tie. Integer parts are appended big-endian, so byte order matches numeric
+// order and a composite key sorts like the tuple of its parts.
+const int BTREE_MAX_KEY_SIZE = 64;
+const int BTREE_KEY_PARTS = 3; // Most uint64 parts in a fixed-width key
 
 struct RecordLocation
 {
@@ -22,121 +38,345 @@ struct RecordLocation
         : page_id(pid), offset(off), size(sz) {}
 };
 
-
-struct BTreeNode
+struct BTreeKey
 {
-    bool is_leaf;
-    uint16_t num_keys;
-    uint64_t parent_page;
-    uint64_t next_leaf; // For leaf nodes, links to next leaf
+    uint8_t bytes[BTREE_MAX_KEY_SIZE];
+    uint16_t length;
+    bool oversized; // Something appended did not fit; bytes holds a prefix
 
-    // Keys and values
-    uint64_t keys[MAX_KEYS];
+    BTreeKey() : length(0), oversized(false) {}
+    BTreeKey(uint64_t first) : length(0), oversized(false) { append(first); }
+    BTreeKey(uint64_t first, uint64_t second) : length(0), oversized(false) { append(first).append(second); }
+    BTreeKey(uint64_t first, uint64_t second, uint64_t third) : length(0), oversized(false)
+    {
+        append(first).append(second).append(third);
+    }
 
-    
-    union
+    // A key longer than BTREE_MAX_KEY_SIZE does not fit: the tree rejects
+    // it rather than store a prefix that other keys may share
+    static BTreeKey from_bytes(const void *data, size_t size)
     {
-        uint64_t children[BTREE_ORDER];   // Internal nodes
-        RecordLocation records[MAX_KEYS]; // Leaf nodes
-    };
+        BTreeKey key;
+        key.append_bytes(data, size);
+        return key;
+    }
 
-    BTreeNode() : is_leaf(true), num_keys(0), parent_page(0), next_leaf(0)
+    static BTreeKey from_string(const std::string &value)
     {
-        for (int i = 0; i < MAX_KEYS; i++)
-        {
-            keys[i] = 0;
-        }
-        for (int i = 0; i < BTREE_ORDER; i++)
-        {
-            children[i] = 0;
-        }
+        return from_bytes(value.data(), value.size());
     }
 
-    // Serialize node to page data
-    void serialize(uint8_t *buffer) const
+    BTreeKey &append(uint64_t part)
     {
-        size_t offset = 0;
-
-        buffer[offset++] = is_leaf ? 1 : 0;
-        memcpy(buffer + offset, &num_keys, sizeof(num_keys));
-        offset += sizeof(num_keys);
-        memcpy(buffer + offset, &parent_page, sizeof(parent_page));
-        offset += sizeof(parent_page);
-        memcpy(buffer + offset, &next_leaf, sizeof(next_leaf));
-        offset += sizeof(next_leaf);
-
-        // Write keys
-        memcpy(buffer + offset, keys, sizeof(keys));
-        offset += sizeof(keys);
-
-        // Write children/records based on node type
-        if (is_leaf)
+        uint8_t encoded[sizeof(uint64_t)];
+        for (int i = 0; i < 8; i++)
         {
-            memcpy(buffer + offset, records, sizeof(RecordLocation) * MAX_KEYS);
-        }
-        else
-        {
-            memcpy(buffer + offset, children, sizeof(children));
+            encoded[i] = static_cast<uint8_t>(part >> (56 - 8 * i));
         }
+        return append_bytes(encoded, sizeof(encoded));
     }
 
-    // Deserialize node from page data
-    void deserialize(const uint8_t *buffer)
+    BTreeKey &append_bytes(const void *data, size_t size)
     {
-        size_t offset = 0;
-
-        is_leaf = (buffer[offset++] == 1);
-        memcpy(&num_keys, buffer + offset, sizeof(num_keys));
-        offset += sizeof(num_keys);
-        memcpy(&parent_page, buffer + offset, sizeof(parent_page));
-        offset += sizeof(parent_page);
-        memcpy(&next_leaf, buffer + offset, sizeof(next_leaf));
-        offset += sizeof(next_leaf);
-
-        // Read keys
-        memcpy(keys, buffer + offset, sizeof(keys));
-        offset += sizeof(keys);
-
-        // Read children/records based on node type
-        if (is_leaf)
+        size_t room = BTREE_MAX_KEY_SIZE - length;
+        size_t count = size < room ? size : room;
+        memcpy(bytes + length, data, count);
+        length += static_cast<uint16_t>(count);
+        oversized = oversized || count < size;
+        return *this;
+    }
+
+    bool fits() const { return !oversized; }
+
+    // uint64 part at index, 0 past the end of the key
+    uint64_t part(int index) const
+    {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; i++)
         {
-            memcpy(records, buffer + offset, sizeof(RecordLocation) * MAX_KEYS);
+            int pos = index * 8 + i;
+            value = (value << 8) | (pos < length ? bytes[pos] : 0);
         }
-        else
+        return value;
+    }
+
+    int compare(const BTreeKey &other) const
+    {
+        int common = length < other.length ? length : other.length;
+        int result = memcmp(bytes, other.bytes, common);
+        if (result != 0)
         {
-            memcpy(children, buffer + offset, sizeof(children));
+            return result;
         }
+        return static_cast<int>(length) - static_cast<int>(other.length);
     }
+
+    bool operator<(const BTreeKey &other) const { return compare(other) < 0; }
+    bool operator==(const BTreeKey &other) const { return compare(other) == 0; }
+    bool operator!=(const BTreeKey &other) const { return compare(other) != 0; }
+    bool operator>(const BTreeKey &other) const { return compare(other) > 0; }
+    bool operator<=(const BTreeKey &other) const { return compare(other) <= 0; }
+    bool operator>=(const BTreeKey &other) const { return compare(other) >= 0; }
+};
+
+enum BTreeKeyType : uint8_t
+{
+    BTREE_KEY_UINT64 = 1, // Fixed-width: parts uint64 words per key
+    BTREE_KEY_BYTES = 2   // Variable-length, prefix-compressed
+};
+
+// Chosen when a tree is created and stored in its root page
+struct BTreeKeyDescriptor
+{
+    BTreeKeyType type;
+    uint8_t parts;
+
+    static BTreeKeyDescriptor uint64(int parts = 1)
+    {
+        return BTreeKeyDescriptor{BTREE_KEY_UINT64, static_cast<uint8_t>(parts)};
+    }
+
+    static BTreeKeyDescriptor bytes()
+    {
+        return BTreeKeyDescriptor{BTREE_KEY_BYTES, 0};
+    }
+};
+
+// The descriptor sits in the last bytes of the root page's data. Trees
+// written before descriptors existed have zeros there and keep the one
+// passed to the constructor.
+const size_t BTREE_NODE_CAPACITY = PAGE_DATA_SIZE - 8;
+const size_t BTREE_DESCRIPTOR_OFFSET = BTREE_NODE_CAPACITY;
+const uint8_t BTREE_DESCRIPTOR_MAGIC = 0xB7;
+
+const size_t BTREE_NODE_HEADER_SIZE = 1 + sizeof(uint16_t) + 2 * sizeof(uint64_t);
+const size_t BTREE_PACKED_RECORD_SIZE = sizeof(uint64_t) + 2 * sizeof(uint16_t);
+const int BTREE_MAX_BYTE_KEYS = 255; // Count cap for byte-string nodes
+
+// Fill factor for indexes rebuilt with bulk_load; leaves room for inserts
+// landing between existing keys
+const double BTREE_REBUILD_FILL_FACTOR = 0.8;
+
+// Node layouts (inside Page::data), after a header of
+// [is_leaf u8][num_keys u16][unused u64][next_leaf u64]:
+//   uint64 trees: MAX_KEYS key slots of parts words each, then MAX_KEYS
+//                 16-byte records or BTREE_ORDER children (the original
+//                 fixed layout)
+//   byte trees:   each key front-coded against the one before it as
+//                 [shared u8][suffix length u8][suffix], then num_keys
+//                 packed 12-byte records or num_keys + 1 children. Nodes
+//                 split when the encoding outgrows the page, so fanout
+//                 grows as keys share longer prefixes.
+struct BTreeNode
+{
+    bool is_leaf;
+    uint64_t next_leaf; // For leaf nodes, links to next leaf
+
+    std::vector<BTreeKey> keys;
+    std::vector<RecordLocation> records; // Leaf nodes, one per key
+    std::vector<uint64_t> children;      // Internal nodes, keys + 1
+
+    BTreeNode() : is_leaf(true), next_leaf(0) {}
+
+    size_t num_keys() const { return keys.size(); }
+
+    size_t encoded_size(const BTreeKeyDescriptor &desc) const;
+    void serialize(uint8_t *buffer, const BTreeKeyDescriptor &desc) const;
+    void deserialize(const uint8_t *buffer, const BTreeKeyDescriptor &desc);
+};
+
+// Reader/writer latches for a tree's pages. A page has an entry only while
+// some thread holds or waits for its latch, so the table stays as small as
+// the set of pages in use. Sharded so looking a latch up does not serialize
+// threads working on unrelated pages.
+const size_t PAGE_LATCH_SHARDS = 64;
+
+class PageLatchTable
+{
+private:
+    struct Latch
+    {
+        std::shared_mutex latch;
+        size_t users = 0;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, Latch> latches;
+    };
+
+    Shard shards[PAGE_LATCH_SHARDS];
+
+public:
+    // The page's latch, which stays in the table until the matching put()
+    std::shared_mutex &get(uint64_t page_id);
+    void put(uint64_t page_id);
 };
 
-// B-Tree class
+// Latches held by one operation, in the order taken (root first). Anything
+// still held is released on destruction.
+class PageLatchPath
+{
+private:
+    struct Held
+    {
+        uint64_t page_id;
+        std::shared_mutex *latch;
+        bool exclusive;
+    };
+
+    PageLatchTable &table;
+    std::vector<Held> held;
+
+    void unlock(const Held &entry);
+
+public:
+    explicit PageLatchPath(PageLatchTable &latches) : table(latches) {}
+    ~PageLatchPath() { release_all(); }
+
+    PageLatchPath(const PageLatchPath &) = delete;
+    PageLatchPath &operator=(const PageLatchPath &) = delete;
+
+    // No-op for a page already held
+    void acquire(uint64_t page_id, bool exclusive);
+    bool holds(uint64_t page_id) const;
+
+    // Drop every latch but the last one taken (crabbing past a safe node)
+    void release_ancestors();
+    void release_last();
+    void release_all();
+};
+
+class BTreeCursor;
+
+// B+ tree: every record lives in a leaf and leaves are chained for range
+// scans. The root stays on the same page for the life of the tree (a root
+// split moves the old contents out), so the root id saved in the database
+// header never goes stale.
+//
+// Concurrency: every page has a reader/writer latch, taken root to leaf.
+// Lookups crab down with shared latches, holding at most a parent and a
+// child. Writers first try with shared latches and only the leaf exclusive;
+// an insert that would split or a delete that would underflow retries with
+// exclusive latches, releasing the ancestors of every node that cannot
+// split (or underflow) in turn. Splits, merges and borrows bump
+// structure_version before letting go of their latches, which cursors use
+// to tell whether the path they copied is still current.
+//
+// initialize(), load() and bulk_load() expect no other thread on the tree.
 class BTree
 {
+    friend class BTreeCursor;
+
 private:
     DatabaseEngine *db_engine;
     uint64_t root_page_id;
+    BTreeKeyDescriptor descriptor;
+
+    PageLatchTable latches;
+    std::atomic<uint64_t> structure_version;
+
+    // Rightmost leaf, so appends of increasing keys skip the descent.
+    // 0 = not known; checked against structure_version before use.
+    std::atomic<uint64_t> rightmost_leaf;
 
-    // Helper functions
+    // Helper functions. Callers hold the page's latch.
     BTreeNode load_node(uint64_t page_id);
     void save_node(uint64_t page_id, const BTreeNode &node);
 
-    int search_key_position(const BTreeNode &node, uint64_t key);
-    void split_child(uint64_t parent_page_id, int child_index, uint64_t child_page_id);
-    void insert_non_full(uint64_t node_page_id, uint64_t key, const RecordLocation &record);
+    // Frees a node that was unlinked from the tree; its latch is held
+    void free_node(uint64_t page_id);
+
+    // Shared-latched read that fails once the tree's shape has changed
+    // since version, without touching a page that may have been freed
+    bool read_node(uint64_t page_id, uint64_t version, BTreeNode &node);
+
+    // Pads or trims uint64 keys to the tree's width
+    BTreeKey normalize(const BTreeKey &key) const;
+
+    bool overflows(const BTreeNode &node) const;
+    bool underflows(const BTreeNode &node) const;
+
+    // Whether one more entry cannot split the node, or one fewer cannot
+    // make it underflow; the latches above such a node can be let go
+    bool insert_safe(const BTreeNode &node) const;
+    bool remove_safe(const BTreeNode &node) const;
+
+    // First key >= key, and the child whose subtree holds key
+    int lower_bound(const BTreeNode &node, const BTreeKey &key) const;
+    int child_index(const BTreeNode &node, const BTreeKey &key) const;
+
+    // Descends with shared latches to the leaf for key (or the rightmost
+    // leaf) and latches it exclusively, keeping its parent shared. Returns
+    // 0, holding nothing, when a root leaf grew while being relatched.
+    uint64_t latch_leaf(const BTreeKey &key, bool rightmost, PageLatchPath &path, BTreeNode &leaf);
+
+    // Appends past the last key of the rightmost leaf without descending.
+    // Returns false when the insert needs the regular path.
+    bool append_rightmost(const BTreeKey &key, const RecordLocation &record);
 
-    RecordLocation search_internal(uint64_t node_page_id, uint64_t key, bool &found);
+    // Leaf-only insert / delete under a single exclusive latch. Return false,
+    // having changed nothing, when the leaf would split or underflow.
+    bool insert_in_leaf(const BTreeKey &key, const RecordLocation &record);
+    bool remove_in_leaf(const BTreeKey &key, bool &found);
 
-    // Delete helper functions
-    void remove_internal(uint64_t node_page_id, uint64_t key);
-    void remove_from_leaf(BTreeNode &node, int idx);
-    void remove_from_non_leaf(uint64_t node_page_id, int idx);
-    void borrow_from_prev(uint64_t node_page_id, int child_idx);
-    void borrow_from_next(uint64_t node_page_id, int child_idx);
-    void merge(uint64_t node_page_id, int child_idx);
-    void fill_child(uint64_t node_page_id, int child_idx);
+    // Moves the upper part of an overflowing node to right and returns the
+    // separator for the parent. A split caused by an append at the right
+    // edge keeps 90% on the left, so sequential keys leave full nodes behind.
+    BTreeKey split_node(BTreeNode &node, BTreeNode &right, bool right_edge);
+
+    // Returns true when the node split; the parent then needs separator
+    // and right_page. rightmost is set for nodes on the tree's right edge.
+    // node is the loaded copy of node_page_id, latched exclusively in path.
+    bool insert_internal(uint64_t node_page_id, BTreeNode &node, const BTreeKey &key,
+                         const RecordLocation &record, bool rightmost, PageLatchPath &path,
+                         BTreeKey &separator, uint64_t &right_page);
+    void grow_root(const BTreeKey &separator, uint64_t right_page);
+
+    // Delete helpers. remove_internal returns true when the node it removed
+    // from underflowed and the parent has to rebalance it. Siblings are
+    // latched into path as they are needed.
+    bool remove_internal(uint64_t node_page_id, BTreeNode &node, const BTreeKey &key, PageLatchPath &path,
+                         bool &found);
+    void rebalance_child(BTreeNode &node, int child_idx, PageLatchPath &path);
+    bool merge_children(BTreeNode &node, int left_idx, PageLatchPath &path);
+
+    // Bulk loading packs each level left to right. A node is written once
+    // the next one on its level starts, so the last two can still be evened
+    // out when the level ends.
+    struct BulkNode
+    {
+        uint64_t page_id;
+        BTreeKey first_key; // Smallest key in the node's subtree
+        BTreeNode node;
+        size_t size; // Encoded bytes, tracked for byte trees
+    };
+
+    size_t bulk_entry_size(const BulkNode &bulk, const BTreeKey &key) const;
+    void bulk_push(BulkNode &bulk, const BTreeKey &key, const RecordLocation &record);
+    void bulk_push(BulkNode &bulk, const BTreeKey &key, uint64_t child);
+    void bulk_finish_level(BulkNode &prev, BulkNode &last);
+
+    // Returns the (first key, page id) of every node built
+    template <typename Value>
+    std::vector<std::pair<BTreeKey, uint64_t>> bulk_level(const std::vector<std::pair<BTreeKey, Value>> &items,
+                                                          double fill_factor);
+
+    // Vacuum relocator: moves the tree's pages in set with the root held
+    // exclusively, so nothing descends meanwhile. The root itself stays.
+    void relocate(const RelocationSet &set);
+
+    // Moves the children of node (latched in path) that are in set, left to
+    // right, recursing while levels_below > 1. prev_leaf is the last leaf
+    // passed; (leaf, moved successor) pairs whose next_leaf needs fixing go
+    // to links. Returns true when node's children changed.
+    bool relocate_children(const RelocationSet &set, BTreeNode &node, int levels_below, PageLatchPath &path,
+                           uint64_t &prev_leaf, std::vector<std::pair<uint64_t, uint64_t>> &links);
 
 public:
-    BTree(DatabaseEngine *engine);
+    BTree(DatabaseEngine *engine, BTreeKeyDescriptor desc = BTreeKeyDescriptor::uint64());
+    ~BTree();
 
     // Initialize empty tree
     void initialize();
@@ -144,16 +384,90 @@ public:
     // Load existing tree
     void load(uint64_t root_id);
 
-    // Core operations
-    bool insert(uint64_t key, const RecordLocation &record);
-    RecordLocation search(uint64_t key, bool &found);
-    bool remove(uint64_t key);
+    // Core operations. Inserting an existing key replaces its record. Keys
+    // that do not fit are never found, and insert() and bulk_load() refuse
+    // them.
+    bool insert(const BTreeKey &key, const RecordLocation &record);
+    RecordLocation search(const BTreeKey &key, bool &found);
+    bool remove(const BTreeKey &key);
 
-    // Range query
-    std::vector<RecordLocation> range_search(uint64_t start_key, uint64_t end_key);
+    // Builds an empty tree bottom-up from entries in strictly increasing key
+    // order, filling each node to fill_factor (0.5 - 1.0) of its capacity.
+    // Much cheaper than repeated insert() for restores and backfills.
+    bool bulk_load(const std::vector<std::pair<BTreeKey, RecordLocation>> &entries, double fill_factor = 1.0);
+
+    // Range queries, both ends inclusive, stopping after limit results.
+    // The reverse form returns the largest keys first.
+    std::vector<RecordLocation> range_search(const BTreeKey &start_key, const BTreeKey &end_key,
+                                             size_t limit = SIZE_MAX);
+    std::vector<RecordLocation> reverse_range_search(const BTreeKey &start_key, const BTreeKey &end_key,
+                                                     size_t limit = SIZE_MAX);
 
     // Getters
     uint64_t get_root_page_id() const { return root_page_id; }
+    const BTreeKeyDescriptor &get_descriptor() const { return descriptor; }
+};
+
+// Lazy iterator over a tree's entries in key order. It keeps the path from
+// the root to its leaf, so stepping to either neighbouring leaf only reloads
+// the nodes that change. No pages stay pinned or latched between calls. If
+// the tree changed shape in the meantime the copied path is dropped and the
+// step finds the neighbouring key from the root again; entries added to a
+// leaf after it was read may be missed.
+class BTreeCursor
+{
+private:
+    struct Level
+    {
+        BTreeNode node;
+        int index; // Child currently descended into
+    };
+
+    BTree *tree;
+    std::vector<Level> path; // Internal nodes from the root down
+    BTreeNode leaf;
+    int pos;
+    bool is_valid;
+    uint64_t version; // Tree structure_version the path was read at
+    int prefetch_leaves;
+
+    // Descend from the root towards target, or from page to its leftmost
+    // (forward) or rightmost leaf. False when the tree changed shape.
+    bool descend_to(const BTreeKey &target);
+    bool descend(uint64_t page_id, bool forward);
+
+    // Copies the path to target's leaf. While writers keep changing the
+    // tree's shape, gives up on descend_to after BTREE_CURSOR_RETRIES tries
+    // and crabs down with shared latches like BTree::search.
+    void find_leaf(const BTreeKey &target);
+
+    // Moves to the next leaf with entries. bound is the key the step
+    // starts from (inclusive for seeks) for when the path went stale.
+    bool step_leaf(bool forward, const BTreeKey &bound, bool inclusive);
+
+    // Asks the engine for the next prefetch_leaves siblings of the leaf
+    void prefetch(bool forward);
+
+public:
+    explicit BTreeCursor(BTree *btree);
+
+    // Read ahead this many leaves once a scan moves past its first leaf
+    void set_prefetch(int leaves) { prefetch_leaves = leaves; }
+
+    // Position on the first entry >= key / the last entry <= key
+    bool seek(const BTreeKey &key);
+    bool seek_last(const BTreeKey &key);
+
+    // Whole-tree ends
+    bool seek_first();
+    bool seek_end();
+
+    bool next();
+    bool prev();
+
+    bool valid() const { return is_valid; }
+    const BTreeKey &key() const { return leaf.keys[pos]; }
+    const RecordLocation &record() const { return leaf.records[pos]; }
 };
 
-#endif // BTREE_H
\ No newline at end of file
+#endif // BTREE_H
@@ -0,0 +1,371 @@
+#include "BufferPool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+void PageHandle::release() {
+    if (pool != nullptr) {
+        pool->frames[frame_index].latch.unlock_shared();
+        pool->unpin(frame_index);
+    }
+    pool = nullptr;
+    page_ptr = nullptr;
+}
+
+BufferPool::BufferPool(size_t frame_count, PageReader reader, PageWriter writer, PageBatchWriter batch_writer)
+    : num_frames(frame_count > 0 ? frame_count : 1),
+      frame_pages(new FramePage[frame_count > 0 ? frame_count : 1]),
+      frames(new Frame[frame_count > 0 ? frame_count : 1]),
+      clock_hand(0),
+      loading_frames(0),
+      read_page_from_disk(reader),
+      write_page_to_disk(writer),
+      write_pages_to_disk(batch_writer),
+      hit_count(0), miss_count(0), eviction_count(0), writeback_count(0), prefetch_count(0) {
+    for (size_t i = 0; i < num_frames; i++) {
+        frames[i].page = &frame_pages[i].page;
+    }
+    page_table.reserve(num_frames);
+}
+
+size_t BufferPool::find_victim() {
+    // Two sweeps: the first may only clear reference bits
+    for (size_t scanned = 0; scanned < 2 * num_frames; scanned++) {
+        size_t index = clock_hand;
+        clock_hand = (clock_hand + 1) % num_frames;
+
+        // A frame can be pinned after it is dropped, by a flush still
+        // holding it, so pins are checked first
+        Frame& frame = frames[index];
+        if (frame.pin_count > 0) {
+            continue;
+        }
+        if (!frame.valid) {
+            return index;
+        }
+        if (frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+        return index;
+    }
+
+    throw std::runtime_error("Buffer pool exhausted: all frames are pinned");
+}
+
+size_t BufferPool::pin_frame(uint64_t page_id, bool& needs_load, std::unique_lock<std::mutex>& lock) {
+    for (;;) {
+        // A failed read leaves the page uncached, so look it up again
+        auto it = page_table.find(page_id);
+        if (it != page_table.end() && frames[it->second].loading) {
+            load_cv.wait(lock);
+            continue;
+        }
+        if (it != page_table.end()) {
+            Frame& frame = frames[it->second];
+            frame.pin_count++;
+            frame.referenced = true;
+            needs_load = false;
+            return it->second;
+        }
+
+        size_t index = find_victim();
+        Frame& frame = frames[index];
+        if (!frame.valid || !frame.dirty) {
+            if (frame.valid) {
+                page_table.erase(frame.page_id);
+                eviction_count++;
+            }
+            return claim_frame(index, page_id, needs_load);
+        }
+
+        // The write-back waits for the log to be durable, so it runs
+        // without pool_mutex. Pinners of the victim's page wait for loading
+        // to clear; the pin keeps other sweeps off the frame.
+        frame.loading = true;
+        frame.pin_count++;
+        lock.unlock();
+        try {
+            write_page_to_disk(frame.page_id, *frame.page);
+        } catch (...) {
+            // The page stays cached and dirty
+            lock.lock();
+            frame.loading = false;
+            frame.pin_count--;
+            load_cv.notify_all();
+            throw;
+        }
+        lock.lock();
+
+        frame.dirty = false;
+        writeback_count++;
+        frame.loading = false;
+        frame.pin_count--;
+        page_table.erase(frame.page_id);
+        frame.valid = false;
+        eviction_count++;
+        load_cv.notify_all();
+
+        // Someone may have cached page_id meanwhile; start over
+    }
+}
+
+size_t BufferPool::claim_frame(size_t index, uint64_t page_id, bool& needs_load) {
+    Frame& frame = frames[index];
+
+    frame.page_id = page_id;
+    frame.valid = true;
+    frame.pin_count = 1;
+    frame.referenced = true;
+    page_table[page_id] = index;
+
+    needs_load = true;
+    return index;
+}
+
+void BufferPool::unpin(size_t frame_index) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    frames[frame_index].pin_count--;
+}
+
+PageHandle BufferPool::pin(uint64_t page_id) {
+    size_t index;
+    bool needs_load;
+    {
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        index = pin_frame(page_id, needs_load, lock);
+
+        // Concurrent pinners of the same page wait in pin_frame until the
+        // read is done, as they do for a prefetch
+        if (needs_load) {
+            frames[index].loading = true;
+        }
+    }
+
+    Frame& frame = frames[index];
+    if (needs_load) {
+        miss_count++;
+        *frame.page = Page();
+        bool ok = read_page_from_disk(page_id, *frame.page);
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            if (!ok) {
+                page_table.erase(page_id);
+                frame.valid = false;
+                frame.pin_count--;
+            }
+            frame.loading = false;
+        }
+        load_cv.notify_all();
+        if (!ok) {
+            throw std::runtime_error("Failed to read page " + std::to_string(page_id));
+        }
+    } else {
+        hit_count++;
+    }
+
+    frame.latch.lock_shared();
+    return PageHandle(this, index, frame.page);
+}
+
+void BufferPool::write(uint64_t page_id, const Page& page, const WriteHook& on_install) {
+    size_t index;
+    bool needs_load;
+    {
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        index = pin_frame(page_id, needs_load, lock);
+        // Latched before the page is published to other pinners. Nobody
+        // holds the latch of a frame that was just claimed, so this never
+        // blocks under the pool lock.
+        if (needs_load) {
+            frames[index].latch.lock();
+        }
+    }
+
+    // The whole page is replaced, so a miss never has to read from disk
+    Frame& frame = frames[index];
+    if (!needs_load) {
+        frame.latch.lock();
+    }
+
+    *frame.page = page;
+    if (on_install) {
+        on_install(*frame.page);
+    }
+    frame.dirty = true;
+
+    frame.latch.unlock();
+    unpin(index);
+}
+
+void BufferPool::prefetch(const std::vector<uint64_t>& page_ids, const PageLoader& load) {
+    std::vector<size_t> claimed;
+    {
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        for (uint64_t page_id : page_ids) {
+            if (loading_frames >= num_frames / 4) {
+                break;
+            }
+            if (page_table.count(page_id) != 0) {
+                continue;
+            }
+
+            // The frame stays pinned and marked until finish_load, which
+            // keeps it from eviction and pinners out
+            bool needs_load;
+            size_t index;
+            try {
+                index = pin_frame(page_id, needs_load, lock);
+            } catch (const std::runtime_error&) {
+                break;  // Every frame is pinned; a prefetch is only a hint
+            }
+            if (!needs_load) {
+                // Cached by someone else while a victim was written back
+                frames[index].pin_count--;
+                continue;
+            }
+            frames[index].loading = true;
+            loading_frames++;
+            claimed.push_back(index);
+        }
+    }
+
+    for (size_t index : claimed) {
+        prefetch_count++;
+        load(index, frames[index].page_id, *frames[index].page);
+    }
+}
+
+void BufferPool::finish_load(size_t frame_index, bool ok) {
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        Frame& frame = frames[frame_index];
+        if (!ok) {
+            page_table.erase(frame.page_id);
+            frame.valid = false;
+        }
+        frame.loading = false;
+        frame.pin_count--;
+        loading_frames--;
+    }
+    load_cv.notify_all();
+}
+
+void BufferPool::flush_all() {
+    std::vector<size_t> dirty_frames;
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        for (size_t i = 0; i < num_frames; i++) {
+            if (frames[i].valid && frames[i].dirty) {
+                frames[i].pin_count++;
+                dirty_frames.push_back(i);
+            }
+        }
+    }
+
+    if (write_pages_to_disk) {
+        // Pages stay latched for reading until their batch is on disk
+        for (size_t start = 0; start < dirty_frames.size(); start += FLUSH_BATCH_PAGES) {
+            size_t end = std::min(start + FLUSH_BATCH_PAGES, dirty_frames.size());
+            PageBatch batch;
+            std::vector<size_t> written;
+            for (size_t i = start; i < end; i++) {
+                Frame& frame = frames[dirty_frames[i]];
+                frame.latch.lock_shared();
+                if (frame.dirty) {
+                    batch.emplace_back(frame.page_id, frame.page);
+                    written.push_back(dirty_frames[i]);
+                }
+            }
+
+            if (!batch.empty()) {
+                try {
+                    write_pages_to_disk(batch);
+                } catch (...) {
+                    // Nothing in the batch was marked clean; let go of the
+                    // frames this flush still holds
+                    for (size_t i = start; i < end; i++) {
+                        frames[dirty_frames[i]].latch.unlock_shared();
+                    }
+                    for (size_t i = start; i < dirty_frames.size(); i++) {
+                        unpin(dirty_frames[i]);
+                    }
+                    throw;
+                }
+            }
+            for (size_t index : written) {
+                frames[index].dirty = false;
+                writeback_count++;
+            }
+            for (size_t i = start; i < end; i++) {
+                frames[dirty_frames[i]].latch.unlock_shared();
+                unpin(dirty_frames[i]);
+            }
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < dirty_frames.size(); i++) {
+        Frame& frame = frames[dirty_frames[i]];
+        frame.latch.lock_shared();
+        if (frame.dirty) {
+            try {
+                write_page_to_disk(frame.page_id, *frame.page);
+            } catch (...) {
+                frame.latch.unlock_shared();
+                for (size_t rest = i; rest < dirty_frames.size(); rest++) {
+                    unpin(dirty_frames[rest]);
+                }
+                throw;
+            }
+            frame.dirty = false;
+            writeback_count++;
+        }
+        frame.latch.unlock_shared();
+        unpin(dirty_frames[i]);
+    }
+}
+
+void BufferPool::clear() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    for (size_t i = 0; i < num_frames; i++) {
+        frames[i].valid = false;
+        frames[i].dirty = false;
+        frames[i].referenced = false;
+    }
+    page_table.clear();
+    clock_hand = 0;
+}
+
+bool BufferPool::discard_from(uint64_t first_page) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    // A pinned frame would outlive the cut and later be written back or
+    // read as a page of the shorter file, so nothing is dropped then
+    for (size_t i = 0; i < num_frames; i++) {
+        if (frames[i].valid && frames[i].page_id >= first_page && frames[i].pin_count > 0) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < num_frames; i++) {
+        Frame& frame = frames[i];
+        if (!frame.valid || frame.page_id < first_page) {
+            continue;
+        }
+        page_table.erase(frame.page_id);
+        frame.valid = false;
+        frame.dirty = false;
+        frame.referenced = false;
+    }
+    return true;
+}
+
+BufferPoolStats BufferPool::get_stats() const {
+    BufferPoolStats stats;
+    stats.hits = hit_count.load();
+    stats.misses = miss_count.load();
+    stats.evictions = eviction_count.load();
+    stats.writebacks = writeback_count.load();
+    stats.prefetches = prefetch_count.load();
+    return stats;
+}
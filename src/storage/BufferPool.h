@@ -0,0 +1,205 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include "Page.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+// Default pool size: 1024 frames = 4 MB of cached pages
+const size_t DEFAULT_BUFFER_POOL_FRAMES = 1024;
+
+// Dirty pages handed to the batch writer at once by flush_all
+const size_t FLUSH_BATCH_PAGES = 64;
+
+struct BufferPoolStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+    uint64_t prefetches;
+
+    BufferPoolStats() : hits(0), misses(0), evictions(0), writebacks(0), prefetches(0) {}
+};
+
+class BufferPool;
+
+// Pinned reference to a cached page. While the handle is alive the frame
+// cannot be evicted and is latched for shared reading, so callers read the
+// page in place instead of copying it. Release the handle before writing
+// the same page back through DatabaseEngine::write_page.
+//
+// A handle without a pool points straight into a read-only mapping of the
+// data file, which outlives it; releasing it only forgets the pointer.
+class PageHandle {
+private:
+    friend class BufferPool;
+    friend class DatabaseEngine;
+
+    BufferPool* pool;
+    size_t frame_index;
+    const Page* page_ptr;
+
+    PageHandle(BufferPool* owner, size_t index, const Page* page)
+        : pool(owner), frame_index(index), page_ptr(page) {}
+
+public:
+    PageHandle() : pool(nullptr), frame_index(0), page_ptr(nullptr) {}
+    ~PageHandle() { release(); }
+
+    PageHandle(const PageHandle&) = delete;
+    PageHandle& operator=(const PageHandle&) = delete;
+
+    PageHandle(PageHandle&& other) noexcept
+        : pool(other.pool), frame_index(other.frame_index), page_ptr(other.page_ptr) {
+        other.pool = nullptr;
+        other.page_ptr = nullptr;
+    }
+
+    PageHandle& operator=(PageHandle&& other) noexcept {
+        if (this != &other) {
+            release();
+            pool = other.pool;
+            frame_index = other.frame_index;
+            page_ptr = other.page_ptr;
+            other.pool = nullptr;
+            other.page_ptr = nullptr;
+        }
+        return *this;
+    }
+
+    bool valid() const { return page_ptr != nullptr; }
+    const Page& page() const { return *page_ptr; }
+    const Page* operator->() const { return page_ptr; }
+    const Page& operator*() const { return *page_ptr; }
+
+    // Unlatch and unpin early (also done by the destructor)
+    void release();
+};
+
+// Fixed-size page cache with CLOCK replacement. Frames are pinned while in
+// use and carry a reader/writer latch and a dirty bit; dirty victims are
+// written back through the page writer before their frame is reused.
+class BufferPool {
+public:
+    // Disk callbacks supplied by the owner. The reader returns false (and
+    // leaves a zeroed page) when the page could not be read. The writers
+    // may throw, e.g. once the log has failed; the page then stays cached
+    // and dirty and the exception reaches the caller.
+    using PageReader = std::function<bool(uint64_t page_id, Page& page)>;
+    using PageWriter = std::function<void(uint64_t page_id, const Page& page)>;
+
+    // Runs while the frame is latched exclusively, right after a new image
+    // has been copied in, so per-page work (e.g. logging) happens in the
+    // same order the images become visible
+    using WriteHook = std::function<void(Page& page)>;
+
+    // Optional: writes several pages and returns once all are on disk.
+    // flush_all uses it instead of the page writer.
+    using PageBatch = std::vector<std::pair<uint64_t, const Page*>>;
+    using PageBatchWriter = std::function<void(const PageBatch& pages)>;
+
+    // Starts reading page_id into page (a frame claimed by prefetch); the
+    // read may finish on any thread, which then calls finish_load(frame)
+    using PageLoader = std::function<void(size_t frame, uint64_t page_id, Page& page)>;
+
+private:
+    friend class PageHandle;
+
+    // Frame images sit apart from the bookkeeping, each on its own
+    // PAGE_SIZE boundary, so O_DIRECT and io_uring transfers use them as is
+    struct alignas(PAGE_SIZE) FramePage {
+        Page page;
+    };
+
+    struct Frame {
+        Page* page;
+        uint64_t page_id;
+        uint32_t pin_count;
+        bool valid;
+        std::atomic<bool> dirty;
+        bool referenced;    // CLOCK second-chance bit
+        bool loading;       // Read or write-back in flight; pinned meanwhile
+        std::shared_mutex latch;
+
+        Frame() : page(nullptr), page_id(0), pin_count(0), valid(false), dirty(false), referenced(false),
+                  loading(false) {}
+    };
+
+    size_t num_frames;
+    std::unique_ptr<FramePage[]> frame_pages;
+    std::unique_ptr<Frame[]> frames;
+    std::unordered_map<uint64_t, size_t> page_table;  // page_id -> frame index
+    size_t clock_hand;
+    std::mutex pool_mutex;
+    std::condition_variable load_cv;  // A read or write-back finished
+    size_t loading_frames;
+
+    PageReader read_page_from_disk;
+    PageWriter write_page_to_disk;
+    PageBatchWriter write_pages_to_disk;
+
+    std::atomic<uint64_t> hit_count;
+    std::atomic<uint64_t> miss_count;
+    std::atomic<uint64_t> eviction_count;
+    std::atomic<uint64_t> writeback_count;
+    std::atomic<uint64_t> prefetch_count;
+
+    // Pin the frame holding page_id, claiming a victim frame on a miss.
+    // Sets needs_load when the frame does not hold the page contents yet.
+    // Waits out a read of the page in flight. Caller holds pool_mutex in
+    // lock, which is dropped while a dirty victim is written back.
+    size_t pin_frame(uint64_t page_id, bool& needs_load, std::unique_lock<std::mutex>& lock);
+
+    // Give the free frame at index to page_id. Caller holds pool_mutex.
+    size_t claim_frame(size_t index, uint64_t page_id, bool& needs_load);
+
+    // CLOCK sweep for an unpinned frame. Caller must hold pool_mutex.
+    size_t find_victim();
+
+    void unpin(size_t frame_index);
+
+public:
+    BufferPool(size_t frame_count, PageReader reader, PageWriter writer,
+               PageBatchWriter batch_writer = PageBatchWriter());
+
+    // Pin a page for reading, loading it from disk on a miss. Throws
+    // std::runtime_error when the page cannot be read (or fails its
+    // checksum); nothing is cached then, so a later pin reads it again.
+    PageHandle pin(uint64_t page_id);
+
+    // Install a full page image and mark the frame dirty; it is written
+    // back on eviction or flush
+    void write(uint64_t page_id, const Page& page, const WriteHook& on_install);
+
+    // Start loading the pages not cached yet without waiting for them. A
+    // pin of one of them waits for its read only. At most a quarter of the
+    // frames are held by prefetches at once; the rest of page_ids is skipped.
+    void prefetch(const std::vector<uint64_t>& page_ids, const PageLoader& load);
+
+    // Ends a prefetch read. A failed one drops the frame, so the next pin
+    // reads the page itself.
+    void finish_load(size_t frame_index, bool ok);
+
+    // Write back all dirty frames, FLUSH_BATCH_PAGES at a time through the
+    // batch writer when there is one
+    void flush_all();
+
+    // Drop every cached page without writing anything back
+    void clear();
+
+    // Drop the frames of pages from first_page on, unwritten; for pages cut
+    // off the end of the file. Returns false, dropping nothing, while any
+    // of them is pinned.
+    bool discard_from(uint64_t first_page);
+
+    BufferPoolStats get_stats() const;
+    size_t get_frame_count() const { return num_frames; }
+};
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,197 @@
+#include "Checksum.h"
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+namespace {
+
+const uint32_t CRC32C_POLY = 0x82F63B78;  // Castagnoli, bit-reflected
+
+// The hardware path runs three independent streams of this many bytes and
+// merges them, so the crc32 instruction's 3-cycle latency overlaps
+const size_t CRC32C_STREAM_BYTES = 256;
+
+// GF(2) 32x32 matrices, one column per word, for the operator that feeds
+// zero bytes through a CRC
+uint32_t gf2_matrix_times(const uint32_t* matrix, uint32_t vector) {
+    uint32_t sum = 0;
+    while (vector != 0) {
+        if (vector & 1) {
+            sum ^= *matrix;
+        }
+        vector >>= 1;
+        matrix++;
+    }
+    return sum;
+}
+
+void gf2_matrix_square(uint32_t* square, const uint32_t* matrix) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times(matrix, matrix[n]);
+    }
+}
+
+// Operator for appending length zero bytes; length is a power of two
+void zeros_operator(uint32_t* even, size_t length) {
+    uint32_t odd[32];
+    odd[0] = CRC32C_POLY;
+    uint32_t row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    gf2_matrix_square(even, odd);  // 2 zero bits
+    gf2_matrix_square(odd, even);  // 4 zero bits
+    for (;;) {
+        gf2_matrix_square(even, odd);
+        length >>= 1;
+        if (length == 0) {
+            return;
+        }
+        gf2_matrix_square(odd, even);
+        length >>= 1;
+        if (length == 0) {
+            memcpy(even, odd, sizeof(odd));
+            return;
+        }
+    }
+}
+
+struct Crc32cTables {
+    uint32_t slice[8][256];         // slice[n]: a byte followed by n more
+    uint32_t stream_shift[4][256];  // Appends CRC32C_STREAM_BYTES zeros
+
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+            }
+            slice[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int t = 1; t < 8; t++) {
+                slice[t][i] = (slice[t - 1][i] >> 8) ^ slice[0][slice[t - 1][i] & 0xFF];
+            }
+        }
+
+        uint32_t op[32];
+        zeros_operator(op, CRC32C_STREAM_BYTES);
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int t = 0; t < 4; t++) {
+                stream_shift[t][i] = gf2_matrix_times(op, i << (8 * t));
+            }
+        }
+    }
+};
+
+const Crc32cTables& tables() {
+    static const Crc32cTables instance;
+    return instance;
+}
+
+uint32_t crc32c_slicing(uint32_t crc, const uint8_t* data, size_t size) {
+    const Crc32cTables& t = tables();
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        word ^= crc;
+        crc = t.slice[7][word & 0xFF] ^ t.slice[6][(word >> 8) & 0xFF] ^
+              t.slice[5][(word >> 16) & 0xFF] ^ t.slice[4][(word >> 24) & 0xFF] ^
+              t.slice[3][(word >> 32) & 0xFF] ^ t.slice[2][(word >> 40) & 0xFF] ^
+              t.slice[1][(word >> 48) & 0xFF] ^ t.slice[0][word >> 56];
+        data += 8;
+        size -= 8;
+    }
+#endif
+    while (size > 0) {
+        crc = (crc >> 8) ^ t.slice[0][(crc ^ *data) & 0xFF];
+        data++;
+        size--;
+    }
+    return crc;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+// Built for SSE4.2 on its own, so the rest of the tree keeps running on
+// CPUs without it; only called once the CPU is known to have it
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t* data, size_t size) {
+    const Crc32cTables& t = tables();
+    uint64_t crc0 = crc;
+
+    while (size >= 3 * CRC32C_STREAM_BYTES) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        const uint8_t* end = data + CRC32C_STREAM_BYTES;
+        do {
+            uint64_t word0, word1, word2;
+            memcpy(&word0, data, sizeof(word0));
+            memcpy(&word1, data + CRC32C_STREAM_BYTES, sizeof(word1));
+            memcpy(&word2, data + 2 * CRC32C_STREAM_BYTES, sizeof(word2));
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+            data += 8;
+        } while (data < end);
+
+        // CRC(A B) = CRC(A) shifted past B's length, xor CRC(B) from zero
+        uint32_t merged = static_cast<uint32_t>(crc0);
+        merged = t.stream_shift[0][merged & 0xFF] ^ t.stream_shift[1][(merged >> 8) & 0xFF] ^
+                 t.stream_shift[2][(merged >> 16) & 0xFF] ^ t.stream_shift[3][merged >> 24] ^
+                 static_cast<uint32_t>(crc1);
+        merged = t.stream_shift[0][merged & 0xFF] ^ t.stream_shift[1][(merged >> 8) & 0xFF] ^
+                 t.stream_shift[2][(merged >> 16) & 0xFF] ^ t.stream_shift[3][merged >> 24] ^
+                 static_cast<uint32_t>(crc2);
+        crc0 = merged;
+        data += 2 * CRC32C_STREAM_BYTES;
+        size -= 3 * CRC32C_STREAM_BYTES;
+    }
+
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc0 = _mm_crc32_u64(crc0, word);
+        data += 8;
+        size -= 8;
+    }
+    uint32_t crc32 = static_cast<uint32_t>(crc0);
+    while (size > 0) {
+        crc32 = _mm_crc32_u8(crc32, *data);
+        data++;
+        size--;
+    }
+    return crc32;
+}
+#endif
+
+using Crc32cFunction = uint32_t (*)(uint32_t crc, const uint8_t* data, size_t size);
+
+Crc32cFunction select_crc32c() {
+#ifdef CRC32C_HAVE_SSE42
+    if (__builtin_cpu_supports("sse4.2")) {
+        return crc32c_sse42;
+    }
+#endif
+    return crc32c_slicing;
+}
+
+}
+
+uint32_t crc32c(const void* data, size_t size, uint32_t crc) {
+    static const Crc32cFunction update = select_crc32c();
+    return ~update(~crc, static_cast<const uint8_t*>(data), size);
+}
+
+uint32_t crc32c_portable(const void* data, size_t size, uint32_t crc) {
+    return ~crc32c_slicing(~crc, static_cast<const uint8_t*>(data), size);
+}
+
+bool crc32c_hardware() {
+    return select_crc32c() != crc32c_slicing;
+}
@@ -0,0 +1,16 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli). crc chains calls: pass the previous result to
+// continue over more bytes. Runs on the SSE4.2 crc32 instruction when the
+// CPU has it (checked once at runtime), else on slicing-by-8 tables.
+uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0);
+
+// The table-driven version alone, and whether crc32c uses the instruction
+uint32_t crc32c_portable(const void* data, size_t size, uint32_t crc = 0);
+bool crc32c_hardware();
+
+#endif // CHECKSUM_H
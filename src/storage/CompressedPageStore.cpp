@@ -0,0 +1,471 @@
+#include "CompressedPageStore.h"
+#include "Lz4.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const uint64_t ENTRY_SIZE_BITS = 12;
+const uint64_t ENTRY_SIZE_MASK = (1u << ENTRY_SIZE_BITS) - 1;
+const size_t MAX_COMPRESSED_SIZE = PAGE_STORE_MAX_SECTORS * PAGE_STORE_SECTOR_SIZE;
+
+uint64_t entry_sectors(uint64_t entry) {
+    return ((entry & ENTRY_SIZE_MASK) + PAGE_STORE_SECTOR_SIZE - 1) / PAGE_STORE_SECTOR_SIZE;
+}
+
+// A damaged map entry names no extent; reading its page fails instead
+bool entry_names_extent(uint64_t entry) {
+    uint64_t size = entry & ENTRY_SIZE_MASK;
+    return size != 0 && size <= MAX_COMPRESSED_SIZE;
+}
+
+bool pread_all(int fd, void* data, size_t size, off_t offset) {
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    size_t total = 0;
+    while (total < size) {
+        ssize_t got = ::pread(fd, bytes + total, size - total, offset + total);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        total += got;
+    }
+    return true;
+}
+
+bool pwrite_all(int fd, const void* data, size_t size, off_t offset) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    size_t total = 0;
+    while (total < size) {
+        ssize_t written = ::pwrite(fd, bytes + total, size - total, offset + total);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        total += written;
+    }
+    return true;
+}
+
+}
+
+CompressedPageStore::CompressedPageStore(const std::string& db_filename)
+    : map_filename(db_filename + ".pagemap"),
+      extent_filename(db_filename + ".extents"),
+      map_fd(-1),
+      extent_fd(-1),
+      compress_writes(false),
+      read_only(false),
+      map_file_entries(0),
+      compressed_count(0),
+      end_sector(0),
+      extent_file_sectors(0) {
+}
+
+CompressedPageStore::~CompressedPageStore() {
+    close();
+}
+
+bool CompressedPageStore::open_files(bool truncate) {
+    int flags = read_only ? O_RDONLY : O_RDWR | O_CREAT;
+    if (truncate) {
+        flags |= O_TRUNC;
+    }
+    map_fd = ::open(map_filename.c_str(), flags, 0644);
+    extent_fd = ::open(extent_filename.c_str(), flags, 0644);
+    if (map_fd < 0 || extent_fd < 0) {
+        std::cerr << "Failed to open " << map_filename << " / " << extent_filename << ": " << strerror(errno)
+                  << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool CompressedPageStore::create(bool compress) {
+    close();
+    ::unlink(map_filename.c_str());
+    ::unlink(extent_filename.c_str());
+    read_only = false;
+    compress_writes = compress;
+    return !compress || open_files(true);
+}
+
+bool CompressedPageStore::open(bool compress, bool read_only_mode) {
+    close();
+    read_only = read_only_mode;
+    compress_writes = compress && !read_only;
+
+    struct stat map_stat;
+    if (::stat(map_filename.c_str(), &map_stat) != 0) {
+        return !compress_writes || open_files(true);
+    }
+    if (!open_files(false)) {
+        return false;
+    }
+
+    // A partly written map (a crash mid-commit) mixes entries of the two
+    // commits; either names an extent still intact, and recovery rewrites
+    // every page that differs
+    std::vector<uint64_t> loaded(map_stat.st_size / sizeof(uint64_t));
+    if (!loaded.empty() && !pread_all(map_fd, loaded.data(), loaded.size() * sizeof(uint64_t), 0)) {
+        std::cerr << "Failed to read " << map_filename << std::endl;
+        close();
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(store_mutex);
+    entries.swap(loaded);
+    map_file_entries = entries.size();
+    dirty_chunks.assign((entries.size() + PAGE_STORE_MAP_CHUNK - 1) / PAGE_STORE_MAP_CHUNK, false);
+
+    // Whatever the map does not name is free
+    std::vector<std::pair<uint64_t, uint64_t>> used;
+    for (uint64_t entry : entries) {
+        if (entry != 0) {
+            compressed_count++;
+        }
+        if (entry_names_extent(entry)) {
+            used.emplace_back(entry >> ENTRY_SIZE_BITS, entry_sectors(entry));
+        }
+    }
+    std::sort(used.begin(), used.end());
+    for (const auto& run : used) {
+        if (run.first > end_sector) {
+            free_runs[end_sector] = run.first - end_sector;
+            free_by_length.insert({run.first - end_sector, end_sector});
+        }
+        end_sector = std::max(end_sector, run.first + run.second);
+    }
+
+    struct stat extent_stat;
+    if (::fstat(extent_fd, &extent_stat) == 0) {
+        extent_file_sectors = extent_stat.st_size / PAGE_STORE_SECTOR_SIZE;
+    }
+    return true;
+}
+
+void CompressedPageStore::close() {
+    if (map_fd >= 0) {
+        ::close(map_fd);
+        map_fd = -1;
+    }
+    if (extent_fd >= 0) {
+        ::close(extent_fd);
+        extent_fd = -1;
+    }
+
+    std::lock_guard<std::mutex> lock(store_mutex);
+    entries.clear();
+    dirty_chunks.clear();
+    free_runs.clear();
+    free_by_length.clear();
+    pending_free.clear();
+    map_file_entries = 0;
+    compressed_count = 0;
+    end_sector = 0;
+    extent_file_sectors = 0;
+}
+
+void CompressedPageStore::set_entry(uint64_t page_id, uint64_t entry) {
+    if (page_id >= entries.size()) {
+        if (entry == 0) {
+            return;
+        }
+        entries.resize(page_id + 1, 0);
+        dirty_chunks.resize((entries.size() + PAGE_STORE_MAP_CHUNK - 1) / PAGE_STORE_MAP_CHUNK, false);
+    }
+
+    uint64_t old = entries[page_id];
+    if (old != 0) {
+        if (entry_names_extent(old)) {
+            pending_free.emplace_back(old >> ENTRY_SIZE_BITS, entry_sectors(old));
+        }
+        compressed_count--;
+    }
+    if (entry != 0) {
+        compressed_count++;
+    }
+    entries[page_id] = entry;
+    dirty_chunks[page_id / PAGE_STORE_MAP_CHUNK] = true;
+}
+
+uint64_t CompressedPageStore::allocate_sectors(uint64_t count) {
+    // Best fit, else grow the file
+    auto it = free_by_length.lower_bound({count, 0});
+    if (it == free_by_length.end()) {
+        uint64_t start = end_sector;
+        end_sector += count;
+        return start;
+    }
+
+    uint64_t length = it->first;
+    uint64_t start = it->second;
+    free_by_length.erase(it);
+    free_runs.erase(start);
+    if (length > count) {
+        free_runs[start + count] = length - count;
+        free_by_length.insert({length - count, start + count});
+    }
+    return start;
+}
+
+void CompressedPageStore::release_sectors(uint64_t start, uint64_t count) {
+    auto next = free_runs.find(start + count);
+    if (next != free_runs.end()) {
+        count += next->second;
+        free_by_length.erase({next->second, next->first});
+        free_runs.erase(next);
+    }
+    auto prev = free_runs.lower_bound(start);
+    if (prev != free_runs.begin()) {
+        --prev;
+        if (prev->first + prev->second == start) {
+            start = prev->first;
+            count += prev->second;
+            free_by_length.erase({prev->second, prev->first});
+            free_runs.erase(prev);
+        }
+    }
+
+    if (start + count == end_sector) {
+        end_sector = start;
+        return;
+    }
+    free_runs[start] = count;
+    free_by_length.insert({count, start});
+}
+
+bool CompressedPageStore::write(uint64_t page_id, const uint8_t* image, bool& home_was_used) {
+    if (!compress_writes || map_fd < 0 || !is_compressible_page(static_cast<PageType>(image[0]))) {
+        return false;
+    }
+
+    uint8_t buffer[MAX_COMPRESSED_SIZE];
+    size_t size = lz4_compress(image, PAGE_SIZE, buffer, sizeof(buffer));
+    if (size == 0) {
+        return false;
+    }
+    uint64_t sectors = (size + PAGE_STORE_SECTOR_SIZE - 1) / PAGE_STORE_SECTOR_SIZE;
+    memset(buffer + size, 0, sectors * PAGE_STORE_SECTOR_SIZE - size);
+
+    uint64_t start;
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        start = allocate_sectors(sectors);
+        extent_file_sectors = std::max(extent_file_sectors, start + sectors);
+    }
+
+    if (!pwrite_all(extent_fd, buffer, sectors * PAGE_STORE_SECTOR_SIZE, start * PAGE_STORE_SECTOR_SIZE)) {
+        std::cerr << "Error writing compressed page " << page_id << std::endl;
+        std::lock_guard<std::mutex> lock(store_mutex);
+        release_sectors(start, sectors);  // Nothing names it yet
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(store_mutex);
+    home_was_used = page_id >= entries.size() || entries[page_id] == 0;
+    set_entry(page_id, (start << ENTRY_SIZE_BITS) | size);
+    return true;
+}
+
+void CompressedPageStore::clear(uint64_t page_id) {
+    if (map_fd < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(store_mutex);
+    if (page_id < entries.size() && entries[page_id] != 0) {
+        set_entry(page_id, 0);
+    }
+}
+
+bool CompressedPageStore::is_compressed(uint64_t page_id) {
+    if (map_fd < 0) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(store_mutex, std::defer_lock);
+    if (!read_only) {
+        lock.lock();
+    }
+    return page_id < entries.size() && entries[page_id] != 0;
+}
+
+CompressedPageStore::ReadResult CompressedPageStore::read(uint64_t page_id, uint8_t* image) {
+    if (map_fd < 0) {
+        return NOT_COMPRESSED;
+    }
+
+    uint64_t entry;
+    {
+        std::unique_lock<std::mutex> lock(store_mutex, std::defer_lock);
+        if (!read_only) {
+            lock.lock();
+        }
+        if (page_id >= entries.size() || entries[page_id] == 0) {
+            return NOT_COMPRESSED;
+        }
+        entry = entries[page_id];
+    }
+
+    uint8_t buffer[MAX_COMPRESSED_SIZE];
+    size_t size = entry & ENTRY_SIZE_MASK;
+    if (!entry_names_extent(entry) ||
+        !pread_all(extent_fd, buffer, size, (entry >> ENTRY_SIZE_BITS) * PAGE_STORE_SECTOR_SIZE) ||
+        !lz4_decompress(buffer, size, image, PAGE_SIZE)) {
+        return READ_FAILED;
+    }
+    return READ_OK;
+}
+
+void CompressedPageStore::truncate(uint64_t total_pages) {
+    if (map_fd < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(store_mutex);
+    for (uint64_t page_id = total_pages; page_id < entries.size(); page_id++) {
+        if (entries[page_id] != 0) {
+            set_entry(page_id, 0);
+        }
+    }
+    if (entries.size() > total_pages) {
+        entries.resize(total_pages);
+        dirty_chunks.resize((entries.size() + PAGE_STORE_MAP_CHUNK - 1) / PAGE_STORE_MAP_CHUNK);
+        if (!dirty_chunks.empty()) {
+            dirty_chunks.back() = true;
+        }
+    }
+}
+
+uint64_t CompressedPageStore::repack() {
+    if (map_fd < 0 || read_only) {
+        return 0;
+    }
+
+    // Extents past the sectors all live ones would fill, highest first
+    std::lock_guard<std::mutex> lock(store_mutex);
+    uint64_t live_sectors = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> outside;
+    for (uint64_t entry : entries) {
+        if (entry_names_extent(entry)) {
+            live_sectors += entry_sectors(entry);
+        }
+    }
+    for (uint64_t page_id = 0; page_id < entries.size(); page_id++) {
+        if (entry_names_extent(entries[page_id]) && (entries[page_id] >> ENTRY_SIZE_BITS) >= live_sectors) {
+            outside.emplace_back(entries[page_id] >> ENTRY_SIZE_BITS, page_id);
+        }
+    }
+    std::sort(outside.rbegin(), outside.rend());
+
+    // Copied under the lock, so no write of the page can slip in between;
+    // the old extent stays on the pending list until the next commit
+    uint64_t moved = 0;
+    uint8_t buffer[MAX_COMPRESSED_SIZE];
+    for (const auto& candidate : outside) {
+        uint64_t entry = entries[candidate.second];
+        uint64_t old_start = entry >> ENTRY_SIZE_BITS;
+        uint64_t sectors = entry_sectors(entry);
+
+        auto it = free_by_length.lower_bound({sectors, 0});
+        while (it != free_by_length.end() && it->second >= old_start) {
+            ++it;
+        }
+        if (it == free_by_length.end()) {
+            continue;
+        }
+        uint64_t length = it->first;
+        uint64_t start = it->second;
+        free_by_length.erase(it);
+        free_runs.erase(start);
+        if (length > sectors) {
+            free_runs[start + sectors] = length - sectors;
+            free_by_length.insert({length - sectors, start + sectors});
+        }
+
+        size_t bytes = sectors * PAGE_STORE_SECTOR_SIZE;
+        if (!pread_all(extent_fd, buffer, bytes, old_start * PAGE_STORE_SECTOR_SIZE) ||
+            !pwrite_all(extent_fd, buffer, bytes, start * PAGE_STORE_SECTOR_SIZE)) {
+            std::cerr << "Error moving compressed page " << candidate.second << std::endl;
+            release_sectors(start, sectors);
+            break;
+        }
+        set_entry(candidate.second, (start << ENTRY_SIZE_BITS) | (entry & ENTRY_SIZE_MASK));
+        moved++;
+    }
+    return moved;
+}
+
+bool CompressedPageStore::commit() {
+    if (map_fd < 0) {
+        return true;
+    }
+
+    // Snapshot what changed; pages written meanwhile are left for the next
+    // commit, along with the extents they give up
+    std::vector<std::pair<size_t, std::vector<uint64_t>>> chunks;
+    std::vector<std::pair<uint64_t, uint64_t>> released;
+    uint64_t entry_count;
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        for (size_t chunk = 0; chunk < dirty_chunks.size(); chunk++) {
+            if (!dirty_chunks[chunk]) {
+                continue;
+            }
+            size_t first = chunk * PAGE_STORE_MAP_CHUNK;
+            size_t last = std::min(entries.size(), first + PAGE_STORE_MAP_CHUNK);
+            chunks.emplace_back(chunk, std::vector<uint64_t>(entries.begin() + first, entries.begin() + last));
+            dirty_chunks[chunk] = false;
+        }
+        released.swap(pending_free);
+        entry_count = entries.size();
+    }
+    if (chunks.empty() && released.empty() && entry_count == map_file_entries) {
+        return true;
+    }
+
+    // Extents first: the new map must never name one that is not on disk
+    bool ok = ::fsync(extent_fd) == 0;
+    for (size_t i = 0; ok && i < chunks.size(); i++) {
+        ok = pwrite_all(map_fd, chunks[i].second.data(), chunks[i].second.size() * sizeof(uint64_t),
+                        chunks[i].first * PAGE_STORE_MAP_CHUNK * sizeof(uint64_t));
+    }
+    if (ok && entry_count < map_file_entries) {
+        ok = ::ftruncate(map_fd, entry_count * sizeof(uint64_t)) == 0;
+    }
+    ok = ok && ::fsync(map_fd) == 0;
+
+    std::lock_guard<std::mutex> lock(store_mutex);
+    if (!ok) {
+        std::cerr << "Failed to write " << map_filename << ": " << strerror(errno) << std::endl;
+        for (const auto& chunk : chunks) {
+            if (chunk.first < dirty_chunks.size()) {
+                dirty_chunks[chunk.first] = true;
+            }
+        }
+        pending_free.insert(pending_free.end(), released.begin(), released.end());
+        return false;
+    }
+
+    map_file_entries = entry_count;
+    for (const auto& run : released) {
+        release_sectors(run.first, run.second);
+    }
+    if (extent_file_sectors > end_sector && ::ftruncate(extent_fd, end_sector * PAGE_STORE_SECTOR_SIZE) == 0) {
+        extent_file_sectors = end_sector;
+    }
+    return true;
+}
+
+uint64_t CompressedPageStore::get_compressed_count() {
+    std::lock_guard<std::mutex> lock(store_mutex);
+    return compressed_count;
+}
@@ -0,0 +1,109 @@
+#ifndef COMPRESSED_PAGE_STORE_H
+#define COMPRESSED_PAGE_STORE_H
+
+#include "Page.h"
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+// Compressed images live in an extent file in whole sectors; a page that
+// does not fit in PAGE_STORE_MAX_SECTORS is not worth compressing
+const uint32_t PAGE_STORE_SECTOR_SIZE = 512;
+const uint32_t PAGE_STORE_MAX_SECTORS = PAGE_SIZE / PAGE_STORE_SECTOR_SIZE - 1;
+
+// Map entries are written back in chunks of this many
+const size_t PAGE_STORE_MAP_CHUNK = PAGE_SIZE / sizeof(uint64_t);
+
+inline bool is_compressible_page(PageType type) {
+    return type == DATA_OVERFLOW || type == BTREE_LEAF || type == RECORD_HEAP;
+}
+
+// LZ4-compressed page images beside the data file. <db>.extents holds
+// variable-size extents; <db>.pagemap holds one entry per page id:
+// 0 = the page is in its own slot of the data file, else
+// (first_sector << 12) | compressed_size. The data file slot of a
+// compressed page is a hole.
+//
+// The map on disk changes only in commit(), which the engine runs at a
+// checkpoint, after the data file is synced and before the WAL is reset.
+// Every page whose entry changed since the previous commit is in that WAL,
+// so recovery rewrites it. Until the next commit, the extents the map on
+// disk still names are kept: the ones a page leaves go on a pending list.
+//
+// Thread-safe. Reads and writes of one page id are serialized by the
+// buffer pool, the only caller besides recovery and scrub.
+class CompressedPageStore {
+private:
+    std::string map_filename;
+    std::string extent_filename;
+    int map_fd;
+    int extent_fd;
+    bool compress_writes;
+    bool read_only;                  // Entries never change: no locking
+
+    std::mutex store_mutex;
+    std::vector<uint64_t> entries;
+    std::vector<bool> dirty_chunks;
+    uint64_t map_file_entries;       // Entries in the map file
+    uint64_t compressed_count;       // Non-zero entries
+
+    // Free sectors of the extent file, by start and by (length, start)
+    std::map<uint64_t, uint64_t> free_runs;
+    std::set<std::pair<uint64_t, uint64_t>> free_by_length;
+    uint64_t end_sector;             // Sectors in use up to here
+    uint64_t extent_file_sectors;
+    std::vector<std::pair<uint64_t, uint64_t>> pending_free;
+
+    bool open_files(bool truncate);
+    void set_entry(uint64_t page_id, uint64_t entry);
+    uint64_t allocate_sectors(uint64_t count);
+    void release_sectors(uint64_t start, uint64_t count);
+
+public:
+    enum ReadResult { NOT_COMPRESSED, READ_OK, READ_FAILED };
+
+    CompressedPageStore(const std::string& db_filename);
+    ~CompressedPageStore();
+
+    // New database: drop any files of an older one; with compression on,
+    // start empty ones
+    bool create(bool compress);
+
+    // Load the map of an existing database if it has one. With compression
+    // on and writable, files are created when missing.
+    bool open(bool compress, bool read_only_mode);
+    void close();
+
+    bool is_active() const { return map_fd >= 0; }
+
+    // Store a serialized page image compressed, if compression is on, its
+    // type compresses, and it shrinks by at least a sector. True when it
+    // was; home_was_used then says whether the data file slot may still
+    // hold an older image to punch out.
+    bool write(uint64_t page_id, const uint8_t* image, bool& home_was_used);
+
+    // The page was just written to its data file slot
+    void clear(uint64_t page_id);
+
+    bool is_compressed(uint64_t page_id);
+
+    // Decompress a stored page into a PAGE_SIZE buffer
+    ReadResult read(uint64_t page_id, uint8_t* image);
+
+    // Drop the entries of pages at or past total_pages
+    void truncate(uint64_t total_pages);
+
+    // Move extents into free space nearer the start of the extent file, so
+    // the next commit can cut its tail. Returns how many moved.
+    uint64_t repack();
+
+    // Make the extents and the map durable, then reuse what the old map
+    // named. False if a write failed (the old map then stays in force).
+    bool commit();
+
+    uint64_t get_compressed_count();
+};
+
+#endif // COMPRESSED_PAGE_STORE_H
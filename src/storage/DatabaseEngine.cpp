@@ -1,9 +1,83 @@
 #include "DatabaseEngine.h"
 #include <iostream>
 #include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-DatabaseEngine::DatabaseEngine(const std::string& filename) 
-    : db_filename(filename) {
+// Mapped pages are used as Page objects directly
+static_assert(sizeof(Page) == PAGE_SIZE, "Page must match its on-disk layout");
+
+namespace {
+
+size_t pread_fully(int fd, uint8_t* data, size_t size, off_t offset) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t got = ::pread(fd, data + total, size - total, offset + total);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        total += got;
+    }
+    return total;
+}
+
+bool pwrite_fully(int fd, const uint8_t* data, size_t size, off_t offset) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t written = ::pwrite(fd, data + total, size - total, offset + total);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        total += written;
+    }
+    return true;
+}
+
+}
+
+DatabaseEngine::DatabaseEngine(const std::string& filename, size_t buffer_pool_frames, PageIOBackend backend)
+    : db_filename(filename),
+      io_backend(backend == PAGE_IO_PREAD && buffer_pool_frames >= DIRECT_IO_MIN_FRAMES ? PAGE_IO_DIRECT
+                                                                                         : backend),
+      db_fd(-1),
+      read_only(false),
+      map_base(nullptr),
+      map_size(0),
+      page_store(filename),
+      page_compression(false),
+      buffer_pool(buffer_pool_frames,
+                  [this](uint64_t page_id, Page& page) { return read_page_from_disk(page_id, page); },
+                  [this](uint64_t page_id, const Page& page) {
+                      // WAL rule: the log record must be durable before the
+                      // page overwrites its old image in the data file
+                      if (!wal.flush_to(page.header.page_lsn)) {
+                          throw std::runtime_error("Write-ahead log failed; page " + std::to_string(page_id) +
+                                                   " not written");
+                      }
+                      if (!write_page_to_disk(page_id, page)) {
+                          throw std::runtime_error("Failed to write page " + std::to_string(page_id));
+                      }
+                  },
+                  [this](const BufferPool::PageBatch& pages) { write_pages_to_disk(pages); }),
+      wal(filename + ".wal"),
+      stop_checkpointer(false),
+      vacuum_set(nullptr),
+      vacuum_boundary(0),
+      stop_vacuum(false),
+      data_sync_failed(false),
+      checksum_failures(0) {
 }
 
 DatabaseEngine::~DatabaseEngine() {
@@ -11,227 +85,1047 @@ DatabaseEngine::~DatabaseEngine() {
 }
 
 bool DatabaseEngine::initialize() {
+    read_only = false;
+
+    // Drop any pages cached from a previous file
+    buffer_pool.clear();
+
     // Create new database file
-    db_file.open(db_filename, std::ios::binary | std::ios::out | std::ios::trunc);
-    if (!db_file.is_open()) {
+    if (!open_data_file(true)) {
         std::cerr << "Failed to create database file: " << db_filename << std::endl;
         return false;
     }
-    db_file.close();
-    
-    // Reopen in read/write mode
-    db_file.open(db_filename, std::ios::binary | std::ios::in | std::ios::out);
-    if (!db_file.is_open()) {
-        std::cerr << "Failed to reopen database file" << std::endl;
+
+    // A log left over from an older file must never be replayed onto this one
+    if (!wal.open(true)) {
+        close_data_file();
+        return false;
+    }
+    if (!page_store.create(page_compression)) {
+        wal.close();
+        close_data_file();
         return false;
     }
-    
-    // Initialize header
+
+    // Initialize header and the allocation bitmap right behind it
     header = DatabaseHeader();
-    
+    allocator.create(header.total_pages, {});
+    bool written = true;
+    allocator.flush([this, &written](uint64_t page_id, const Page& page) {
+        written = write_page_to_disk(page_id, page) && written;
+    });
+    header.total_pages = allocator.get_page_count();
+    header.allocation_bitmap_page = allocator.first_bitmap_page();
+
     // Write header to page 0
     Page header_page;
     header_page.header.type = FREE_PAGE;  // Header page
     header.serialize(header_page.data);
     header_page.update_checksum();
-    
-    uint8_t buffer[PAGE_SIZE];
-    header_page.serialize(buffer);
-    
-    db_file.seekp(0);
-    db_file.write(reinterpret_cast<char*>(buffer), PAGE_SIZE);
-    db_file.flush();
-    
+    if (!written || !write_page_to_disk(0, header_page) || !sync_db_file()) {
+        std::cerr << "Failed to write the new database file: " << db_filename << std::endl;
+        wal.close();
+        close_data_file();
+        return false;
+    }
+
+    start_checkpointer();
+
     std::cout << "Database initialized: " << db_filename << std::endl;
     return true;
 }
 
-bool DatabaseEngine::open() {
-    db_file.open(db_filename, std::ios::binary | std::ios::in | std::ios::out);
-    if (!db_file.is_open()) {
+bool DatabaseEngine::open(bool read_only_mode) {
+    read_only = read_only_mode;
+    if (!open_data_file(false)) {
         std::cerr << "Failed to open database file: " << db_filename << std::endl;
         return false;
     }
-    
+
+    if (read_only) {
+        // Recovery would have to write the data file
+        struct stat log_stat;
+        if (::stat((db_filename + ".wal").c_str(), &log_stat) == 0 && log_stat.st_size > 0) {
+            std::cerr << "Database has unreplayed log records; open it read-write first" << std::endl;
+            close_data_file();
+            return false;
+        }
+    } else if (!wal.open(false)) {
+        close_data_file();
+        return false;
+    }
+    if (!page_store.open(page_compression, read_only)) {
+        if (!read_only) {
+            wal.close();
+        }
+        close_data_file();
+        return false;
+    }
+
+    // Crash recovery: redo every intact page image, then start a fresh log
+    if (!read_only) {
+        bool written = true;
+        size_t replayed = wal.replay([this, &written](uint64_t page_id, const Page& page) {
+            written = write_page_to_disk(page_id, page) && written;
+        });
+        if (!written || (replayed > 0 && !sync_db_file())) {
+            // The log stays as it is for the next attempt
+            std::cerr << "Failed to write recovered pages to " << db_filename << std::endl;
+            wal.close();
+            close_data_file();
+            return false;
+        }
+        if (replayed > 0) {
+            std::cout << "Recovered " << replayed << " page writes from the write-ahead log" << std::endl;
+        }
+        if (!page_store.commit() || !wal.reset()) {
+            wal.close();
+            close_data_file();
+            return false;
+        }
+    }
+
     // Read header from page 0
-    uint8_t buffer[PAGE_SIZE];
-    db_file.seekg(0);
-    db_file.read(reinterpret_cast<char*>(buffer), PAGE_SIZE);
-    
     Page header_page;
-    header_page.deserialize(buffer);
-    
+    read_page_from_disk(0, header_page);
+
     if (!header_page.verify_checksum()) {
         std::cerr << "Database header checksum failed!" << std::endl;
+        wal.close();
+        close_data_file();
         return false;
     }
-    
+
     header.deserialize(header_page.data);
-    
+
     // Verify magic number
     if (strncmp(header.magic, "MTDB", 4) != 0) {
         std::cerr << "Invalid database file format" << std::endl;
+        wal.close();
+        close_data_file();
         return false;
     }
-    
-    std::cout << "Database opened: " << db_filename << std::endl;
+
+    if (!read_only) {
+        // Compressed pages a vacuum cut off before a crash
+        page_store.truncate(header.total_pages);
+        if (!load_allocator()) {
+            wal.close();
+            close_data_file();
+            return false;
+        }
+        start_checkpointer();
+    }
+
+    std::cout << "Database opened: " << db_filename << (read_only ? " (read-only)" : "") << std::endl;
     std::cout << "Total pages: " << header.total_pages << std::endl;
     return true;
 }
 
 void DatabaseEngine::close() {
-    if (db_file.is_open()) {
-        write_header();  // Save header before closing
-        db_file.close();
+    if (is_open()) {
+        if (!read_only) {
+            stop_vacuum_thread();
+            stop_checkpoint_thread();
+            checkpoint();  // Leaves the data file current and the log empty
+            wal.close();
+        }
+        close_data_file();
+        buffer_pool.clear();
         std::cout << "Database closed" << std::endl;
     }
 }
 
 uint64_t DatabaseEngine::allocate_page() {
-    uint64_t page_id;
+    if (read_only) {
+        std::cerr << "Cannot allocate a page: database is read-only" << std::endl;
+        return 0;
+    }
 
-    // Protect header access and raw file reads with the mutex, but avoid
-    // calling other methods that also lock the same mutex while holding it
-    // (to prevent deadlocks). We'll do the minimal work under the lock,
-    // then persist the header afterwards.
-    {
-        std::lock_guard<std::mutex> lock(file_mutex);
+    std::shared_lock<std::shared_mutex> checkpoint_guard(checkpoint_mutex);
+    std::lock_guard<std::mutex> lock(header_mutex);
 
-        // Check free list first
-        if (header.free_list_head != 0) {
-            page_id = header.free_list_head;
+    // Mostly served from the reserve without logging anything. A refill
+    // has to be logged before the caller writes a page pointing here.
+    uint64_t page_id = allocator.allocate();
+    if (allocator.has_dirty()) {
+        log_header_locked();
+    }
+    return page_id;
+}
 
-            // Read the free page directly from disk (we hold the mutex so it's safe)
-            uint8_t buffer[PAGE_SIZE];
-            db_file.seekg(page_id * PAGE_SIZE);
-            db_file.read(reinterpret_cast<char*>(buffer), PAGE_SIZE);
+uint64_t DatabaseEngine::allocate_pages(uint64_t count) {
+    if (read_only) {
+        std::cerr << "Cannot allocate pages: database is read-only" << std::endl;
+        return 0;
+    }
 
-            Page free_page;
-            free_page.deserialize(buffer);
+    std::shared_lock<std::shared_mutex> checkpoint_guard(checkpoint_mutex);
+    std::lock_guard<std::mutex> lock(header_mutex);
 
-            header.free_list_head = free_page.header.next_free_page;
-        } else {
-            // Allocate new page at end
-            page_id = header.total_pages;
-            header.total_pages++;
-        }
+    uint64_t first_page = allocator.allocate_run(count);
+    if (first_page != 0) {
+        log_header_locked();
     }
-
-    // Persist header (acquires mutex internally)
-    write_header();
-    return page_id;
+    return first_page;
 }
 
 void DatabaseEngine::free_page(uint64_t page_id) {
-    // We'll update the in-memory header under lock, but perform the page write
-    // and header persistence outside that lock to avoid nested locking.
-    uint64_t prev_head;
-    {
-        std::lock_guard<std::mutex> lock(file_mutex);
-        prev_head = header.free_list_head;
-        // Reserve this page as new head in memory
-        header.free_list_head = page_id;
-    }
+    free_pages(page_id, 1);
+}
 
-    // Prepare free page (no locks needed for constructing the object)
-    Page free_page;
-    free_page.header.type = FREE_PAGE;
-    free_page.header.next_free_page = prev_head;
+void DatabaseEngine::free_pages(uint64_t first_page, uint64_t count) {
+    if (read_only) {
+        std::cerr << "Cannot free page " << first_page << ": database is read-only" << std::endl;
+        return;
+    }
 
-    // Write the free page to disk (will lock internally)
-    write_page(page_id, free_page);
+    // Only the cached bitmap changes; the next commit or allocation logs it
+    std::shared_lock<std::shared_mutex> checkpoint_guard(checkpoint_mutex);
+    std::lock_guard<std::mutex> lock(header_mutex);
+    allocator.free_run(first_page, count);
+}
 
-    // Persist updated header (will lock internally)
-    write_header();
+uint64_t DatabaseEngine::get_free_page_count() {
+    std::lock_guard<std::mutex> lock(header_mutex);
+    return allocator.get_free_count();
 }
 
 Page DatabaseEngine::read_page(uint64_t page_id) {
-    std::lock_guard<std::mutex> lock(file_mutex);
-    
-    // Check cache first
-    auto it = page_cache.find(page_id);
-    if (it != page_cache.end()) {
-        return it->second;
-    }
-    
-    // Read from disk
-    uint8_t buffer[PAGE_SIZE];
-    db_file.seekg(page_id * PAGE_SIZE);
-    db_file.read(reinterpret_cast<char*>(buffer), PAGE_SIZE);
-    
-    if (!db_file.good()) {
-        std::cerr << "Error reading page " << page_id << std::endl;
-        return Page();
+    PageHandle handle = pin_page(page_id);
+    return handle.page();
+}
+
+PageHandle DatabaseEngine::pin_page(uint64_t page_id) {
+    // Nothing writes a read-only file, so its mapping neither changes nor
+    // moves under a reader: hand the page out in place, skipping the pool.
+    // Such pages are not checksummed on the way; scrub() covers them.
+    // Compressed pages have only a hole here and go through the pool.
+    if (read_only && io_backend == PAGE_IO_MMAP && (page_id + 1) * PAGE_SIZE <= map_size &&
+        !page_store.is_compressed(page_id)) {
+        return PageHandle(nullptr, 0, reinterpret_cast<const Page*>(map_base + page_id * PAGE_SIZE));
     }
-    
-    Page page;
-    page.deserialize(buffer);
-    
-    // Add to cache
-    if (page_cache.size() >= MAX_CACHE_SIZE) {
-        // Simple eviction: remove first element (can be improved with LRU)
-        page_cache.erase(page_cache.begin());
+    return buffer_pool.pin(page_id);
+}
+
+void DatabaseEngine::prefetch_pages(const std::vector<uint64_t>& page_ids) {
+    // Without a ring a prefetch would be the same synchronous read the pin
+    // does anyway, and read-only mapped pages need no reading
+    if (!async_io.uses_io_uring() || (read_only && io_backend == PAGE_IO_MMAP)) {
+        return;
     }
-    page_cache[page_id] = page;
-    
-    return page;
+
+    // A page is read straight into its frame: Page is its on-disk layout
+    uint64_t total_pages;
+    {
+        std::lock_guard<std::mutex> lock(header_mutex);
+        total_pages = header.total_pages;
+    }
+    std::vector<uint64_t> wanted;
+    for (uint64_t page_id : page_ids) {
+        if (page_id != 0 && page_id < total_pages && !page_store.is_compressed(page_id)) {
+            wanted.push_back(page_id);
+        }
+    }
+    buffer_pool.prefetch(wanted, [this](size_t frame, uint64_t page_id, Page& page) {
+        // A page failing its checksum is dropped; the pin that wants it
+        // reads it again and reports the mismatch
+        async_io.read(page_id * PAGE_SIZE, &page, PAGE_SIZE, [this, frame, &page](int result) {
+            buffer_pool.finish_load(frame, result == static_cast<int>(PAGE_SIZE) && page.verify_checksum());
+        });
+    });
+    async_io.submit();
 }
 
 void DatabaseEngine::write_page(uint64_t page_id, const Page& page) {
-    std::lock_guard<std::mutex> lock(file_mutex);
-    
+    if (read_only) {
+        std::cerr << "Cannot write page " << page_id << ": database is read-only" << std::endl;
+        return;
+    }
+
     // Update checksum before writing
     Page writable_page = page;
     writable_page.update_checksum();
-    
-    uint8_t buffer[PAGE_SIZE];
-    writable_page.serialize(buffer);
-    
-    db_file.seekp(page_id * PAGE_SIZE);
-    db_file.write(reinterpret_cast<char*>(buffer), PAGE_SIZE);
-    db_file.flush();
-    
-    // Update cache
-    page_cache[page_id] = writable_page;
-}
-
-void DatabaseEngine::write_header() {
-    std::lock_guard<std::mutex> lock(file_mutex);
-    
+
+    {
+        std::shared_lock<std::shared_mutex> checkpoint_guard(checkpoint_mutex);
+
+        // Log the image while the frame is latched so the log order of two
+        // writes to the same page matches the order they land in the cache
+        buffer_pool.write(page_id, writable_page, [this, page_id](Page& frame_page) {
+            wal.append(page_id, frame_page);
+        });
+    }
+
+    if (wal.get_log_size() >= WAL_CHECKPOINT_BYTES) {
+        checkpoint_cv.notify_one();
+    }
+}
+
+bool DatabaseEngine::open_data_file(bool truncate) {
+    int flags = read_only ? O_RDONLY : O_RDWR;
+    if (truncate) {
+        flags |= O_CREAT | O_TRUNC;
+    }
+
+    if (io_backend == PAGE_IO_DIRECT) {
+        db_fd = ::open(db_filename.c_str(), flags | O_DIRECT, 0644);
+        if (db_fd < 0 && errno == EINVAL) {
+            // tmpfs and a few other filesystems refuse O_DIRECT
+            std::cerr << "O_DIRECT not supported for " << db_filename << ", using buffered I/O" << std::endl;
+            io_backend = PAGE_IO_PREAD;
+        }
+    }
+    if (db_fd < 0) {
+        db_fd = ::open(db_filename.c_str(), flags, 0644);
+    }
+    if (db_fd < 0) {
+        return false;
+    }
+
+    if (io_backend == PAGE_IO_STREAM) {
+        db_file.open(db_filename, read_only ? std::ios::binary | std::ios::in
+                                            : std::ios::binary | std::ios::in | std::ios::out);
+        if (!db_file.is_open()) {
+            close_data_file();
+            return false;
+        }
+    }
+
+    // An empty file is mapped once pages reach it
+    if (io_backend == PAGE_IO_MMAP && !grow_mapping(0)) {
+        close_data_file();
+        return false;
+    }
+
+    if (io_backend != PAGE_IO_STREAM) {
+        async_io.open(db_fd);
+    }
+    return true;
+}
+
+void DatabaseEngine::close_data_file() {
+    // Waits for prefetch reads still landing in the pool
+    async_io.close();
+    page_store.close();
+    if (map_base != nullptr) {
+        ::munmap(map_base, map_size);
+        map_base = nullptr;
+        map_size = 0;
+    }
+    if (db_file.is_open()) {
+        db_file.close();
+    }
+    if (db_fd >= 0) {
+        ::close(db_fd);
+        db_fd = -1;
+    }
+}
+
+bool DatabaseEngine::grow_mapping(size_t size) {
+    std::unique_lock<std::shared_mutex> lock(map_mutex);
+    if (map_size >= size && map_base != nullptr) {
+        return true;
+    }
+
+    // Read-only pages are handed out in place, so that mapping never moves
+    if (read_only && map_base != nullptr) {
+        return false;
+    }
+
+    // Only whole pages the file already holds: touching a mapped page past
+    // the end of the file would fault
+    struct stat file_stat;
+    if (::fstat(db_fd, &file_stat) != 0) {
+        return false;
+    }
+    size_t file_size = static_cast<size_t>(file_stat.st_size) / PAGE_SIZE * PAGE_SIZE;
+    if (file_size <= map_size) {
+        return map_size >= size;
+    }
+
+    void* mapped = map_base == nullptr
+                       ? ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, db_fd, 0)
+                       : ::mremap(map_base, map_size, file_size, MREMAP_MAYMOVE);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map " << db_filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    map_base = static_cast<uint8_t*>(mapped);
+    map_size = file_size;
+    return map_size >= size;
+}
+
+bool DatabaseEngine::read_page_from_disk(uint64_t page_id, Page& page) {
+    if (!read_page_image(page_id, page)) {
+        return false;
+    }
+
+    // Every cold read is checked; pages already cached are trusted
+    if (!page.verify_checksum()) {
+        checksum_failures++;
+        std::cerr << "Checksum mismatch on page " << page_id << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseEngine::read_page_image(uint64_t page_id, Page& page) {
+    // O_DIRECT transfers need a block-aligned buffer
+    alignas(PAGE_SIZE) uint8_t buffer[PAGE_SIZE];
+    bool ok;
+
+    CompressedPageStore::ReadResult stored = page_store.read(page_id, buffer);
+    if (stored != CompressedPageStore::NOT_COMPRESSED) {
+        ok = stored == CompressedPageStore::READ_OK;
+    } else if (io_backend == PAGE_IO_STREAM) {
+        std::lock_guard<std::mutex> lock(file_mutex);
+        db_file.seekg(page_id * PAGE_SIZE);
+        db_file.read(reinterpret_cast<char*>(buffer), PAGE_SIZE);
+        ok = db_file.good();
+        if (!ok) {
+            db_file.clear();  // Keep the stream usable for later pages
+        }
+    } else if (io_backend == PAGE_IO_MMAP) {
+        // A plain memory copy; pages written since the mapping was last
+        // sized are picked up by growing it
+        size_t end = (page_id + 1) * PAGE_SIZE;
+        std::shared_lock<std::shared_mutex> lock(map_mutex);
+        if (end > map_size) {
+            lock.unlock();
+            grow_mapping(end);
+            lock.lock();
+        }
+        ok = end <= map_size;
+        if (ok) {
+            memcpy(buffer, map_base + page_id * PAGE_SIZE, PAGE_SIZE);
+        }
+    } else {
+        // The offset travels with the call, so concurrent misses need no
+        // lock and reach the OS page cache in parallel
+        ok = pread_fully(db_fd, buffer, PAGE_SIZE, page_id * PAGE_SIZE) == PAGE_SIZE;
+    }
+
+    if (!ok && stored == CompressedPageStore::NOT_COMPRESSED && is_unwritten(page_id)) {
+        page = Page();
+        return true;
+    }
+    if (!ok) {
+        std::cerr << "Error reading page " << page_id << std::endl;
+        return false;
+    }
+
+    page.deserialize(buffer);
+    return true;
+}
+
+bool DatabaseEngine::is_unwritten(uint64_t page_id) {
+    uint64_t total_pages;
+    {
+        std::lock_guard<std::mutex> lock(header_mutex);
+        total_pages = header.total_pages;
+    }
+    struct stat file_stat;
+    return page_id < total_pages && ::fstat(db_fd, &file_stat) == 0 &&
+           (page_id + 1) * PAGE_SIZE > static_cast<uint64_t>(file_stat.st_size);
+}
+
+bool DatabaseEngine::write_page_to_disk(uint64_t page_id, const Page& page) {
+    alignas(PAGE_SIZE) uint8_t buffer[PAGE_SIZE];
+    page.serialize(buffer);
+    if (write_compressed(page_id, buffer)) {
+        return true;
+    }
+
+    bool ok;
+    if (io_backend == PAGE_IO_STREAM) {
+        std::lock_guard<std::mutex> lock(file_mutex);
+        db_file.seekp(page_id * PAGE_SIZE);
+        db_file.write(reinterpret_cast<char*>(buffer), PAGE_SIZE);
+        ok = db_file.good();
+        if (!ok) {
+            db_file.clear();
+        }
+    } else {
+        ok = pwrite_fully(db_fd, buffer, PAGE_SIZE, page_id * PAGE_SIZE);
+    }
+    if (!ok) {
+        std::cerr << "Error writing page " << page_id << std::endl;
+        return false;
+    }
+
+    // Written in full here, so an older compressed copy is dropped
+    page_store.clear(page_id);
+    return true;
+}
+
+bool DatabaseEngine::write_compressed(uint64_t page_id, const uint8_t* image) {
+    bool home_was_used;
+    if (!page_store.write(page_id, image, home_was_used)) {
+        return false;
+    }
+    if (home_was_used) {
+        release_data_slot(page_id);
+    }
+    return true;
+}
+
+void DatabaseEngine::release_data_slot(uint64_t page_id) {
+    if (io_backend == PAGE_IO_STREAM) {
+        // An older image may still sit in the stream buffer
+        std::lock_guard<std::mutex> lock(file_mutex);
+        db_file.flush();
+    }
+
+    // Where the filesystem cannot punch holes the slot keeps a stale
+    // image, which nothing reads while the page is compressed
+#ifdef FALLOC_FL_PUNCH_HOLE
+    ::fallocate(db_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, page_id * PAGE_SIZE, PAGE_SIZE);
+#else
+    (void)page_id;
+#endif
+}
+
+void DatabaseEngine::write_pages_to_disk(const BufferPool::PageBatch& pages) {
+    // WAL rule, once for the whole batch
+    uint64_t last_lsn = 0;
+    for (const auto& entry : pages) {
+        last_lsn = std::max(last_lsn, entry.second->header.page_lsn);
+    }
+    if (!wal.flush_to(last_lsn)) {
+        throw std::runtime_error("Write-ahead log failed; page batch not written");
+    }
+
+    // A buffered write is a copy into the page cache that the ring would
+    // only hand to a kernel worker; O_DIRECT writes reach the device, where
+    // a deep queue overlaps them
+    if (io_backend != PAGE_IO_DIRECT || !async_io.uses_io_uring()) {
+        for (const auto& entry : pages) {
+            if (!write_page_to_disk(entry.first, *entry.second)) {
+                throw std::runtime_error("Failed to write page " + std::to_string(entry.first));
+            }
+        }
+        return;
+    }
+
+    // One submission for the batch; the aligned frames are written in place
+    std::vector<uint64_t> written;
+    bool failed = false;
+    for (const auto& entry : pages) {
+        uint64_t page_id = entry.first;
+        if (write_compressed(page_id, reinterpret_cast<const uint8_t*>(entry.second))) {
+            continue;
+        }
+        async_io.write(page_id * PAGE_SIZE, entry.second, PAGE_SIZE, [page_id, &failed](int result) {
+            if (result != static_cast<int>(PAGE_SIZE)) {
+                std::cerr << "Error writing page " << page_id << std::endl;
+                failed = true;
+            }
+        });
+        written.push_back(page_id);
+    }
+    async_io.drain();
+    if (failed) {
+        throw std::runtime_error("Failed to write a page batch");
+    }
+    for (uint64_t page_id : written) {
+        page_store.clear(page_id);
+    }
+}
+
+bool DatabaseEngine::sync_db_file() {
+    bool ok = true;
+    if (io_backend == PAGE_IO_STREAM) {
+        std::lock_guard<std::mutex> lock(file_mutex);
+        db_file.flush();
+        ok = db_file.good();
+        db_file.clear();
+    }
+    if (::fsync(db_fd) != 0 || !ok) {
+        // The kernel may have dropped pages the pool now counts as clean,
+        // and a later fsync can succeed without them
+        std::cerr << "Error syncing " << db_filename << ": " << strerror(errno) << std::endl;
+        data_sync_failed = true;
+        return false;
+    }
+    return true;
+}
+
+uint64_t DatabaseEngine::log_header() {
+    // Serialize and append under one lock so header images reach the log
+    // in the same order the header changed
+    std::lock_guard<std::mutex> lock(header_mutex);
+    return log_header_locked();
+}
+
+uint64_t DatabaseEngine::log_header_locked() {
+    log_allocation_bitmap();
+    header.total_pages = allocator.get_page_count();
+    header.allocation_bitmap_page = allocator.first_bitmap_page();
+
     Page header_page;
     header_page.header.type = FREE_PAGE;  // Special type for header
     header.serialize(header_page.data);
     header_page.update_checksum();
-    
-    uint8_t buffer[PAGE_SIZE];
-    header_page.serialize(buffer);
-    
-    db_file.seekp(0);
-    db_file.write(reinterpret_cast<char*>(buffer), PAGE_SIZE);
-    db_file.flush();
+    return wal.append(0, header_page);
+}
+
+void DatabaseEngine::log_allocation_bitmap() {
+    allocator.flush([this](uint64_t page_id, const Page& page) {
+        buffer_pool.write(page_id, page, [this, page_id](Page& frame_page) {
+            wal.append(page_id, frame_page);
+        });
+    });
+}
+
+bool DatabaseEngine::load_allocator() {
+    if (header.allocation_bitmap_page != 0) {
+        return allocator.load(header.allocation_bitmap_page, header.total_pages,
+                              [this](uint64_t page_id, Page& page) { return read_page_from_disk(page_id, page); });
+    }
+
+    // A file from before the bitmap: every page is taken except those on
+    // its free list, whose links are read one last time
+    std::vector<uint64_t> free_list;
+    uint64_t page_id = header.free_list_head;
+    while (page_id != 0 && free_list.size() < header.total_pages) {
+        Page page;
+        if (!read_page_from_disk(page_id, page)) {
+            break;
+        }
+        free_list.push_back(page_id);
+        page_id = page.header.next_free_page;
+    }
+
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lock(header_mutex);
+        allocator.create(header.total_pages, free_list);
+        header.free_list_head = 0;
+        lsn = log_header_locked();
+    }
+    if (!wal.flush_to(lsn)) {
+        std::cerr << "Failed to log the allocation bitmap" << std::endl;
+        return false;
+    }
+
+    std::cout << "Built allocation bitmap (" << free_list.size() << " free pages)" << std::endl;
+    return true;
+}
+
+void DatabaseEngine::update_header(const std::function<void(DatabaseHeader&)>& update) {
+    std::lock_guard<std::mutex> lock(header_mutex);
+    update(header);
+}
+
+bool DatabaseEngine::write_header() {
+    if (read_only) {
+        return true;
+    }
+
+    uint64_t lsn;
+    {
+        std::shared_lock<std::shared_mutex> checkpoint_guard(checkpoint_mutex);
+        lsn = log_header();
+    }
+
+    // Group commit: wait for the flusher to fsync up to our record
+    return wal.flush_to(lsn);
+}
+
+void DatabaseEngine::checkpoint() {
+    std::unique_lock<std::shared_mutex> checkpoint_guard(checkpoint_mutex);
+    if (!is_open() || read_only) {
+        return;
+    }
+
+    // Unused reserved pages go back, so a crash after the checkpoint leaks
+    // none of them; the bitmap pages are then written back with the rest
+    {
+        std::lock_guard<std::mutex> lock(header_mutex);
+        allocator.release_reserved();
+        log_allocation_bitmap();
+    }
+
+    // Everything logged must be durable before pages are written back
+    if (!wal.flush_all()) {
+        std::cerr << "Checkpoint skipped: the write-ahead log has failed" << std::endl;
+        return;
+    }
+    try {
+        buffer_pool.flush_all();
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Checkpoint failed: " << e.what() << std::endl;
+        return;
+    }
+
+    Page header_page;
+    header_page.header.type = FREE_PAGE;
+    {
+        std::lock_guard<std::mutex> lock(header_mutex);
+        header.serialize(header_page.data);
+    }
+    header_page.update_checksum();
+    if (!write_page_to_disk(0, header_page)) {
+        std::cerr << "Checkpoint failed: the header was not written" << std::endl;
+        return;
+    }
+
+    // Only once the data file and the page map are synced can the log be
+    // thrown away; until then it covers every page that moved. After a
+    // failed sync it is kept for good: recovery replays it on the next open.
+    if (!sync_db_file() || data_sync_failed) {
+        std::cerr << "Checkpoint failed: the data file is not synced; keeping the write-ahead log" << std::endl;
+        return;
+    }
+    if (!page_store.commit() || !wal.reset()) {
+        return;
+    }
+
+    // Pages a vacuum dropped off the end; the header on disk no longer
+    // covers them
+    truncate_data_file();
+}
+
+void DatabaseEngine::truncate_data_file() {
+    uint64_t size;
+    {
+        std::lock_guard<std::mutex> lock(header_mutex);
+        size = header.total_pages * PAGE_SIZE;
+    }
+    page_store.truncate(size / PAGE_SIZE);
+
+    struct stat file_stat;
+    if (::fstat(db_fd, &file_stat) != 0 || static_cast<uint64_t>(file_stat.st_size) <= size) {
+        return;
+    }
+
+    // Everything is clean after the checkpoint; cached copies of the cut
+    // pages just must not come back as stale reads once the file regrows.
+    // While one is pinned the file keeps its length until the next checkpoint.
+    if (!buffer_pool.discard_from(size / PAGE_SIZE)) {
+        return;
+    }
+
+    // The mapping shrinks first, under a lock held until the file is cut,
+    // so no read touches a mapped page past the new end
+    std::unique_lock<std::shared_mutex> map_lock(map_mutex, std::defer_lock);
+    if (io_backend == PAGE_IO_MMAP) {
+        map_lock.lock();
+        if (map_base != nullptr && map_size > size) {
+            if (::mremap(map_base, map_size, size, 0) == MAP_FAILED) {
+                std::cerr << "Failed to shrink the mapping of " << db_filename << ": " << strerror(errno) << std::endl;
+                return;
+            }
+            map_size = size;
+        }
+    } else if (io_backend == PAGE_IO_STREAM) {
+        std::lock_guard<std::mutex> lock(file_mutex);
+        db_file.flush();
+    }
+
+    if (::ftruncate(db_fd, size) != 0) {
+        std::cerr << "Failed to truncate " << db_filename << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    ::fsync(db_fd);
+}
+
+void DatabaseEngine::add_relocator(const void* owner, PageRelocator relocator) {
+    std::lock_guard<std::mutex> lock(vacuum_mutex);
+    relocators.emplace_back(owner, std::move(relocator));
+}
+
+void DatabaseEngine::remove_relocator(const void* owner) {
+    std::lock_guard<std::mutex> lock(vacuum_mutex);
+    relocators.erase(std::remove_if(relocators.begin(), relocators.end(),
+                                    [owner](const std::pair<const void*, PageRelocator>& entry) {
+                                        return entry.first == owner;
+                                    }),
+                     relocators.end());
+}
+
+uint64_t DatabaseEngine::relocate_pages(uint64_t first_page, uint64_t count, const PageRewrite& rewrite) {
+    // Only relocators call this, on the thread running the step
+    if (vacuum_set == nullptr || count == 0) {
+        return 0;
+    }
+    for (uint64_t page_id = first_page; page_id < first_page + count; page_id++) {
+        if (!vacuum_set->contains(page_id)) {
+            return 0;
+        }
+    }
+
+    uint64_t new_first;
+    {
+        std::shared_lock<std::shared_mutex> checkpoint_guard(checkpoint_mutex);
+        std::lock_guard<std::mutex> lock(header_mutex);
+        new_first = allocator.allocate_run_below(count, vacuum_boundary);
+        if (new_first == 0) {
+            return 0;
+        }
+        log_header_locked();
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        Page page = read_page(first_page + i);
+        if (rewrite) {
+            rewrite(new_first + i, page);
+        }
+        write_page(new_first + i, page);
+    }
+    relocated_runs.emplace_back(first_page, count);
+    return new_first;
+}
+
+uint64_t DatabaseEngine::vacuum_step(uint64_t max_pages) {
+    if (!is_open() || read_only) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> vacuum_lock(vacuum_mutex);
+
+    // The window: the last max_pages of the file, but never further down
+    // than the live pages would reach if the file were packed
+    uint64_t boundary;
+    std::vector<uint64_t> candidates;
+    {
+        std::shared_lock<std::shared_mutex> checkpoint_guard(checkpoint_mutex);
+        std::lock_guard<std::mutex> lock(header_mutex);
+        allocator.release_reserved();
+        uint64_t page_count = allocator.get_page_count();
+        uint64_t used = page_count - allocator.get_free_count();
+        boundary = std::max(used, page_count > max_pages ? page_count - max_pages : 0);
+        candidates = allocator.allocated_pages(boundary);
+    }
+
+    RelocationSet set;
+    for (uint64_t page_id : candidates) {
+        PageHandle handle = pin_page(page_id);
+        PageType type = handle.page().header.type;
+        set.pages[page_id] = type;
+        set.types |= 1u << type;
+    }
+
+    if (!set.pages.empty()) {
+        vacuum_set = &set;
+        vacuum_boundary = boundary;
+        try {
+            for (const auto& entry : relocators) {
+                entry.second(set);
+            }
+        } catch (...) {
+            // A relocator may have copied a run without repointing its
+            // references yet; keeping both copies leaks pages, freeing the
+            // old one could lose data
+            vacuum_set = nullptr;
+            relocated_runs.clear();
+            throw;
+        }
+        vacuum_set = nullptr;
+    }
+
+    // The moved pages' new references are logged ahead of the bitmap
+    // freeing their old copies, so recovery never sees one without the other
+    uint64_t moved = 0;
+    uint64_t cut;
+    uint64_t lsn;
+    {
+        std::shared_lock<std::shared_mutex> checkpoint_guard(checkpoint_mutex);
+        std::lock_guard<std::mutex> lock(header_mutex);
+        for (const auto& run : relocated_runs) {
+            allocator.free_run(run.first, run.second);
+            moved += run.second;
+        }
+        relocated_runs.clear();
+        cut = allocator.truncate();
+        lsn = log_header_locked();
+    }
+    if (!wal.flush_to(lsn)) {
+        return 0;
+    }
+    return moved + cut;
+}
+
+uint64_t DatabaseEngine::vacuum() {
+    if (!is_open() || read_only) {
+        return 0;
+    }
+
+    uint64_t pages_before;
+    {
+        std::lock_guard<std::mutex> lock(header_mutex);
+        pages_before = header.total_pages;
+    }
+    while (vacuum_step() > 0) {
+    }
+    checkpoint();
+
+    // The extents of pages cut off the end are free once the next commit
+    // is on disk; then pack the rest down and commit again to shrink the
+    // extent file
+    if (page_store.is_active()) {
+        checkpoint();
+        if (page_store.repack() > 0) {
+            checkpoint();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(header_mutex);
+    return pages_before > header.total_pages ? pages_before - header.total_pages : 0;
+}
+
+void DatabaseEngine::start_vacuum() {
+    if (!is_open() || read_only || vacuum_thread.joinable()) {
+        return;
+    }
+    stop_vacuum = false;
+    vacuum_thread = std::thread(&DatabaseEngine::vacuum_worker, this);
+}
+
+void DatabaseEngine::stop_vacuum_thread() {
+    {
+        std::lock_guard<std::mutex> lock(vacuum_thread_mutex);
+        stop_vacuum = true;
+    }
+    vacuum_cv.notify_one();
+    if (vacuum_thread.joinable()) {
+        vacuum_thread.join();
+    }
+}
+
+void DatabaseEngine::vacuum_worker() {
+    // After a step that found nothing to move, wait for this many free
+    // pages before looking again
+    uint64_t retry_free = 0;
+
+    std::unique_lock<std::mutex> lock(vacuum_thread_mutex);
+    while (!stop_vacuum) {
+        vacuum_cv.wait_for(lock, std::chrono::milliseconds(VACUUM_INTERVAL_MS), [this] { return stop_vacuum; });
+        if (stop_vacuum) {
+            break;
+        }
+
+        lock.unlock();
+        uint64_t free_count;
+        uint64_t page_count;
+        {
+            std::lock_guard<std::mutex> header_lock(header_mutex);
+            free_count = allocator.get_free_count();
+            page_count = allocator.get_page_count();
+        }
+        if (free_count >= VACUUM_MIN_FREE_PAGES && free_count * 10 >= page_count && free_count >= retry_free) {
+            try {
+                retry_free = vacuum_step() == 0 ? free_count + VACUUM_MIN_FREE_PAGES : 0;
+            } catch (const std::runtime_error& e) {
+                // A page that cannot be read (or written back) stays put
+                std::cerr << "Vacuum step failed: " << e.what() << std::endl;
+                retry_free = free_count + VACUUM_MIN_FREE_PAGES;
+            }
+        }
+        lock.lock();
+    }
+}
+
+ScrubReport DatabaseEngine::scrub() {
+    ScrubReport report;
+    if (db_fd < 0) {
+        return report;
+    }
+
+    uint64_t total_pages;
+    {
+        std::lock_guard<std::mutex> lock(header_mutex);
+        total_pages = header.total_pages;
+    }
+    struct stat file_stat;
+    if (::fstat(db_fd, &file_stat) != 0) {
+        std::cerr << "Failed to stat " << db_filename << ": " << strerror(errno) << std::endl;
+        return report;
+    }
+    uint64_t file_pages = file_stat.st_size / PAGE_SIZE;
+
+    Page page;
+    for (uint64_t page_id = 0; page_id < total_pages; page_id++) {
+        // A compressed page need not reach into the data file. A failed
+        // read of any other is a page the file no longer holds (cut by a
+        // concurrent vacuum), not corruption.
+        bool compressed = page_store.is_compressed(page_id);
+        if (!compressed && page_id >= file_pages) {
+            continue;
+        }
+        bool read = read_page_image(page_id, page);
+        if (!read && !compressed) {
+            continue;
+        }
+        report.pages_checked++;
+        if (read && page.verify_checksum()) {
+            continue;
+        }
+
+        // The first read may have caught a write-back halfway
+        if (!read_page_image(page_id, page) || !page.verify_checksum()) {
+            checksum_failures++;
+            std::cerr << "Checksum mismatch on page " << page_id << std::endl;
+            report.corrupt_pages.push_back(page_id);
+        }
+    }
+    return report;
+}
+
+void DatabaseEngine::start_checkpointer() {
+    stop_checkpointer = false;
+    checkpoint_thread = std::thread(&DatabaseEngine::checkpoint_worker, this);
+}
+
+void DatabaseEngine::stop_checkpoint_thread() {
+    {
+        std::lock_guard<std::mutex> lock(checkpoint_thread_mutex);
+        stop_checkpointer = true;
+    }
+    checkpoint_cv.notify_one();
+    if (checkpoint_thread.joinable()) {
+        checkpoint_thread.join();
+    }
+}
+
+void DatabaseEngine::checkpoint_worker() {
+    std::unique_lock<std::mutex> lock(checkpoint_thread_mutex);
+    while (!stop_checkpointer) {
+        checkpoint_cv.wait_for(lock, std::chrono::milliseconds(CHECKPOINT_INTERVAL_MS), [this] {
+            return stop_checkpointer || wal.get_log_size() >= WAL_CHECKPOINT_BYTES;
+        });
+        if (stop_checkpointer) {
+            break;
+        }
+
+        lock.unlock();
+        checkpoint();
+        lock.lock();
+    }
 }
 
 uint64_t DatabaseEngine::get_next_user_id() {
-    std::lock_guard<std::mutex> lock(file_mutex);
+    std::lock_guard<std::mutex> lock(header_mutex);
     return ++header.last_user_id;
 }
 
 uint64_t DatabaseEngine::get_next_meeting_id() {
-    std::lock_guard<std::mutex> lock(file_mutex);
+    std::lock_guard<std::mutex> lock(header_mutex);
     return ++header.last_meeting_id;
 }
 
 uint64_t DatabaseEngine::get_next_message_id() {
-    std::lock_guard<std::mutex> lock(file_mutex);
+    std::lock_guard<std::mutex> lock(header_mutex);
     return ++header.last_message_id;
 }
 
 uint64_t DatabaseEngine::get_next_file_id() {
-    std::lock_guard<std::mutex> lock(file_mutex);
+    std::lock_guard<std::mutex> lock(header_mutex);
     return ++header.last_file_id;
 }
 
 uint64_t DatabaseEngine::get_next_whiteboard_id() {
-    std::lock_guard<std::mutex> lock(file_mutex);
+    std::lock_guard<std::mutex> lock(header_mutex);
     return ++header.last_whiteboard_id;
-}
\ No newline at end of file
+}
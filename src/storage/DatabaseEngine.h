@@ -2,51 +2,280 @@
 #define DATABASE_ENGINE_H
 
 #include "Page.h"
+#include "AsyncPageIO.h"
+#include "BufferPool.h"
+#include "CompressedPageStore.h"
+#include "PageAllocator.h"
+#include "WriteAheadLog.h"
+#include <atomic>
 #include <fstream>
 #include <string>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
 #include <unordered_map>
+#include <vector>
+
+// Checkpoint when the WAL grows past this size, or at least this often
+const uint64_t WAL_CHECKPOINT_BYTES = 32 * 1024 * 1024;
+const uint32_t CHECKPOINT_INTERVAL_MS = 30000;
+
+// Online vacuum: every VACUUM_INTERVAL_MS the vacuum thread moves live
+// pages out of the last VACUUM_STEP_PAGES of the file into free space
+// further up, once at least VACUUM_MIN_FREE_PAGES (and a tenth of the file)
+// are free. The freed tail is cut off the file at the next checkpoint.
+const uint64_t VACUUM_STEP_PAGES = 256;
+const uint64_t VACUUM_MIN_FREE_PAGES = 1024;
+const uint32_t VACUUM_INTERVAL_MS = 1000;
+
+// The pages a vacuum step wants to move, with their types
+struct RelocationSet {
+    std::unordered_map<uint64_t, PageType> pages;
+    uint32_t types = 0;  // Bit per PageType present
+
+    bool contains(uint64_t page_id) const { return pages.count(page_id) != 0; }
+    bool has_type(PageType type) const { return (types >> type) & 1; }
+};
+
+// Registered by each structure that owns pages. Called during a vacuum step
+// to move the pages of the set it owns, with relocate_pages, and repoint
+// whatever refers to them. Pages it does not know stay where they are.
+using PageRelocator = std::function<void(const RelocationSet&)>;
+
+// Fixes up a page's contents as it is copied to new_page_id
+using PageRewrite = std::function<void(uint64_t new_page_id, Page& page)>;
+
+// Result of DatabaseEngine::scrub
+struct ScrubReport {
+    uint64_t pages_checked = 0;
+    std::vector<uint64_t> corrupt_pages;
+};
+
+// How pages move between the buffer pool and the data file
+enum PageIOBackend {
+    PAGE_IO_STREAM,  // std::fstream seek + read/write, serialized by file_mutex
+    PAGE_IO_PREAD,   // pread/pwrite on a raw descriptor, no lock needed
+    PAGE_IO_DIRECT,  // pread/pwrite with O_DIRECT, bypassing the OS page cache
+    PAGE_IO_MMAP     // Reads copied out of a shared mapping of the file, writes
+                     // with pwrite; opened read-only, pages are used in place
+};
+
+// A pool this large (256 MB) holds the working set itself, so PAGE_IO_PREAD
+// turns into PAGE_IO_DIRECT instead of caching every page twice
+const size_t DIRECT_IO_MIN_FRAMES = 65536;
 
 class DatabaseEngine {
 private:
     std::string db_filename;
-    std::fstream db_file;
+    PageIOBackend io_backend;
+    int db_fd;                // Open while the database is; used by every backend
+    std::fstream db_file;     // PAGE_IO_STREAM only
+    bool read_only;
+
+    // PAGE_IO_MMAP: the whole pages of the file, PROT_READ. Misses copy
+    // under map_mutex shared; growing the mapping (which may move it)
+    // takes it exclusively.
+    uint8_t* map_base;
+    size_t map_size;
+    std::shared_mutex map_mutex;
     DatabaseHeader header;
-    std::mutex file_mutex;  // Thread-safe file operations
-    
-    // Page cache (LRU cache can be added later)
-    std::unordered_map<uint64_t, Page> page_cache;
-    const size_t MAX_CACHE_SIZE = 100;
-    
+    std::mutex header_mutex;  // Guards header fields and the allocator
+    std::mutex file_mutex;    // Serializes seek + read/write on db_file
+
+    // Prefetch reads and, with O_DIRECT, batched write-back on db_fd
+    // through io_uring. Not used by PAGE_IO_STREAM, whose writes sit in the
+    // stream buffer; without a ring every backend stays synchronous.
+    AsyncPageIO async_io;
+
+    // With page_compression, leaf, heap and overflow pages are written back
+    // LZ4-compressed beside the data file; compressed pages written earlier
+    // are read either way
+    CompressedPageStore page_store;
+    bool page_compression;
+
+    // Free-space bitmap, cached whole; not loaded on a read-only open
+    PageAllocator allocator;
+
+    // Page cache with CLOCK replacement
+    BufferPool buffer_pool;
+
+    // Redo log: page writes are logged and cached, data file updated lazily
+    WriteAheadLog wal;
+
+    // Writers hold this shared; a checkpoint takes it exclusively
+    std::shared_mutex checkpoint_mutex;
+
+    // Background checkpointer
+    std::thread checkpoint_thread;
+    std::mutex checkpoint_thread_mutex;
+    std::condition_variable checkpoint_cv;
+    bool stop_checkpointer;
+
+    // Vacuum: one step at a time, the relocators registered by owner
+    std::mutex vacuum_mutex;
+    std::vector<std::pair<const void*, PageRelocator>> relocators;
+    const RelocationSet* vacuum_set;  // Set of the running step, else null
+    uint64_t vacuum_boundary;         // Pages move below this id
+    std::vector<std::pair<uint64_t, uint64_t>> relocated_runs;
+
+    std::thread vacuum_thread;
+    std::mutex vacuum_thread_mutex;
+    std::condition_variable vacuum_cv;
+    bool stop_vacuum;
+
+    // Set once an fsync of the data file fails; the log is not reset again
+    std::atomic<bool> data_sync_failed;
+
+    std::atomic<uint64_t> checksum_failures;
+
+    // Opens db_fd (and db_file for the stream backend). Falls back to
+    // buffered I/O where the filesystem refuses O_DIRECT.
+    bool open_data_file(bool truncate);
+    void close_data_file();
+
+    // Extend the mapping to cover at least size bytes, as far as the file
+    // now reaches. False when the file is still shorter.
+    bool grow_mapping(size_t size);
+
+    // Raw page I/O on the data file. read_page_from_disk also verifies the
+    // checksum, failing (and counting) on a mismatch; read_page_image only
+    // reads. total_pages counts pages the allocator has reserved but nobody
+    // has written yet, which the file may not reach: those read as zeros.
+    bool read_page_from_disk(uint64_t page_id, Page& page);
+    bool read_page_image(uint64_t page_id, Page& page);
+    bool is_unwritten(uint64_t page_id);
+    bool write_page_to_disk(uint64_t page_id, const Page& page);
+    bool write_compressed(uint64_t page_id, const uint8_t* image);
+    void release_data_slot(uint64_t page_id);
+    void write_pages_to_disk(const BufferPool::PageBatch& pages);  // Throws on failure
+    bool sync_db_file();
+
+    // Log the current header as a page-0 image, behind any bitmap pages
+    // changed since the last one. Caller holds checkpoint_mutex; the
+    // _locked form also header_mutex.
+    uint64_t log_header();
+    uint64_t log_header_locked();
+    void log_allocation_bitmap();
+
+    // Load the bitmap on a read-write open, building it from the free
+    // list of an older file
+    bool load_allocator();
+
+    void start_checkpointer();
+    void stop_checkpoint_thread();
+    void checkpoint_worker();
+
+    void stop_vacuum_thread();
+    void vacuum_worker();
+
+    // After a checkpoint: cut the file down to header.total_pages
+    void truncate_data_file();
+
 public:
-    DatabaseEngine(const std::string& filename);
+    DatabaseEngine(const std::string& filename,
+                   size_t buffer_pool_frames = DEFAULT_BUFFER_POOL_FRAMES,
+                   PageIOBackend backend = PAGE_IO_PREAD);
     ~DatabaseEngine();
-    
-    // Initialize or open database
+
+    // Compress cold pages as they are written back. Set before
+    // initialize() or open().
+    void set_page_compression(bool enabled) { page_compression = enabled; }
+
+    // Initialize or open database (open replays the WAL after a crash).
+    // A read-only open is for a database no process is writing: it refuses
+    // a file with unreplayed log records, and every write fails. With
+    // PAGE_IO_MMAP its pages are then pinned in place, without a copy.
     bool initialize();
-    bool open();
+    bool open(bool read_only = false);
     void close();
-    
-    // Page management
+
+    // Page management. allocate_page returns 0 on a read-only database.
+    // Allocations are logged before they return; frees are batched into
+    // the next commit. A crash can leak pages, never hand one out twice.
     uint64_t allocate_page();
     void free_page(uint64_t page_id);
+
+    // count contiguous pages (fewer than BITMAP_PAGE_BITS) for large
+    // blobs; returns the first, or 0 on failure
+    uint64_t allocate_pages(uint64_t count);
+
+    // Release pages [first_page, first_page + count) at once
+    void free_pages(uint64_t first_page, uint64_t count);
     Page read_page(uint64_t page_id);
     void write_page(uint64_t page_id, const Page& page);
-    
-    // Header management
-    DatabaseHeader& get_header() { return header; }
-    void write_header();
-    
+
+    // Pin a page in the buffer pool (or the read-only mapping) and read it
+    // in place (no copy). Throws std::runtime_error if the page cannot be
+    // read.
+    PageHandle pin_page(uint64_t page_id);
+
+    // Start reading pages into the buffer pool without waiting, so later
+    // pins find them cached. Does nothing without io_uring.
+    void prefetch_pages(const std::vector<uint64_t>& page_ids);
+
+    // Header management. Fields change only through update_header, under
+    // the lock the checkpointer serializes the header with. write_header is
+    // the commit point: it returns once everything logged so far is durable
+    // (concurrent callers share a sync). False once the log has failed;
+    // nothing after that is committed.
+    const DatabaseHeader& get_header() const { return header; }
+    void update_header(const std::function<void(DatabaseHeader&)>& update);
+    bool write_header();
+
+    // Write dirty pages back to the data file and truncate the WAL
+    void checkpoint();
+
+    // Relocators are called with the owner's own locks free; remove_relocator
+    // waits for a running step, so an owner calls it before going away
+    void add_relocator(const void* owner, PageRelocator relocator);
+    void remove_relocator(const void* owner);
+
+    // From a relocator: copy [first_page, first_page + count), all in the
+    // step's set, to free pages further up, passing each copy through
+    // rewrite. Returns the new first page, or 0 when there is no room. The
+    // old pages are freed when the step ends, so the caller has until then
+    // to repoint every reference, and must keep the pages from changing
+    // while they move.
+    uint64_t relocate_pages(uint64_t first_page, uint64_t count = 1, const PageRewrite& rewrite = PageRewrite());
+
+    // One vacuum step over the last max_pages of the file, then the free
+    // tail is dropped from the allocator. Returns the pages moved plus the
+    // pages dropped; 0 when there was nothing to do.
+    uint64_t vacuum_step(uint64_t max_pages = VACUUM_STEP_PAGES);
+
+    // Steps until nothing moves, then checkpoints so the file shrinks.
+    // Returns the number of pages cut off the file.
+    uint64_t vacuum();
+
+    // Background vacuum, stopped by close()
+    void start_vacuum();
+
+    // Verify the checksum of every page in the data file (and the
+    // compressed ones beside it), bypassing the buffer pool. Pages past the
+    // end of the file (allocated, never yet written back) are skipped.
+    // Safe alongside writers: a page that fails is read once more before
+    // it is reported.
+    ScrubReport scrub();
+
     // Auto-increment ID generators
     uint64_t get_next_user_id();
     uint64_t get_next_meeting_id();
     uint64_t get_next_message_id();
     uint64_t get_next_file_id();
     uint64_t get_next_whiteboard_id();
-    
+
     // Utility
-    bool is_open() const { return db_file.is_open(); }
+    bool is_open() const { return db_fd >= 0; }
+    bool is_read_only() const { return read_only; }
+    PageIOBackend get_io_backend() const { return io_backend; }
+    bool uses_async_io() const { return async_io.uses_io_uring(); }
     uint64_t get_total_pages() const { return header.total_pages; }
+    uint64_t get_free_page_count();
+    BufferPoolStats get_buffer_pool_stats() const { return buffer_pool.get_stats(); }
+    uint64_t get_checksum_failures() const { return checksum_failures.load(); }
+    uint64_t get_compressed_page_count() { return page_store.get_compressed_count(); }
 };
 
-#endif // DATABASE_ENGINE_H
\ No newline at end of file
+#endif // DATABASE_ENGINE_H
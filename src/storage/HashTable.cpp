@@ -1,12 +1,197 @@
 #include "HashTable.h"
 #include <iostream>
 #include <cstring>
+#include <cstddef>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Bitmask of the entries among 16 tags that equal tag
+static uint32_t match_tags(const uint8_t* tags, uint8_t tag) {
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(static_cast<char>(tag))));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 16; i++) {
+        if (tags[i] == tag) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+size_t HashBucket::encoded_size() const {
+    size_t size = HASH_SLOTS_OFFSET + entries.size() * HASH_SLOT_SIZE;
+    for (const auto& entry : entries) {
+        size += entry.key.size();
+    }
+    return size;
+}
+
+void HashBucket::serialize(uint8_t* buffer) const {
+    uint16_t count = entries.size();
+    uint16_t key_start = PAGE_DATA_SIZE;
+    
+    memset(buffer, 0, HASH_SLOTS_OFFSET);
+    buffer[0] = HASH_BUCKET_FORMAT;
+    memcpy(buffer + 1, &count, sizeof(count));
+    memcpy(buffer + 3, &overflow_page, sizeof(overflow_page));
+    
+    for (uint16_t i = 0; i < count; i++) {
+        const HashEntry& entry = entries[i];
+        uint8_t key_length = entry.key.size();
+        key_start -= key_length;
+        memcpy(buffer + key_start, entry.key.data(), key_length);
+        
+        buffer[HASH_BUCKET_HEADER_SIZE + i] = entry.tag;
+        uint8_t* slot = buffer + HASH_SLOTS_OFFSET + i * HASH_SLOT_SIZE;
+        memcpy(slot, &entry.value_page, sizeof(entry.value_page));
+        memcpy(slot + 8, &entry.value_offset, sizeof(entry.value_offset));
+        memcpy(slot + 10, &entry.value_size, sizeof(entry.value_size));
+        memcpy(slot + 12, &key_start, sizeof(key_start));
+        slot[14] = key_length;
+    }
+    memcpy(buffer + 11, &key_start, sizeof(key_start));
+}
+
+void HashBucket::deserialize(const uint8_t* buffer) {
+    entries.clear();
+    uint16_t count;
+    
+    if (buffer[0] != HASH_BUCKET_FORMAT) {
+        memcpy(&count, buffer, sizeof(count));
+        memcpy(&overflow_page, buffer + 2, sizeof(overflow_page));
+        count = std::min(count, MAX_ENTRIES_PER_BUCKET);
+        
+        entries.resize(count);
+        for (uint16_t i = 0; i < count; i++) {
+            LegacyHashEntry legacy;
+            memcpy(&legacy, buffer + LEGACY_BUCKET_HEADER_SIZE + i * sizeof(LegacyHashEntry), sizeof(legacy));
+            legacy.key[sizeof(legacy.key) - 1] = '\0';
+            entries[i].key = legacy.key;
+            entries[i].tag = hash_tag(legacy.hash_value);
+            entries[i].value_page = legacy.value_page;
+            entries[i].value_offset = legacy.value_offset;
+            entries[i].value_size = legacy.value_size;
+        }
+        return;
+    }
+    
+    memcpy(&count, buffer + 1, sizeof(count));
+    memcpy(&overflow_page, buffer + 3, sizeof(overflow_page));
+    count = std::min(count, HASH_BUCKET_SLOTS);
+    
+    entries.resize(count);
+    for (uint16_t i = 0; i < count; i++) {
+        HashEntry& entry = entries[i];
+        const uint8_t* slot = buffer + HASH_SLOTS_OFFSET + i * HASH_SLOT_SIZE;
+        uint16_t key_offset;
+        entry.tag = buffer[HASH_BUCKET_HEADER_SIZE + i];
+        memcpy(&entry.value_page, slot, sizeof(entry.value_page));
+        memcpy(&entry.value_offset, slot + 8, sizeof(entry.value_offset));
+        memcpy(&entry.value_size, slot + 10, sizeof(entry.value_size));
+        memcpy(&key_offset, slot + 12, sizeof(key_offset));
+        entry.key.assign(reinterpret_cast<const char*>(buffer) + key_offset, slot[14]);
+    }
+}
+
+int HashBucket::probe(const uint8_t* buffer, uint8_t tag, const std::string& key) {
+    uint16_t count;
+    
+    if (buffer[0] != HASH_BUCKET_FORMAT) {
+        memcpy(&count, buffer, sizeof(count));
+        count = std::min(count, MAX_ENTRIES_PER_BUCKET);
+        for (uint16_t i = 0; i < count; i++) {
+            const uint8_t* entry = buffer + LEGACY_BUCKET_HEADER_SIZE + i * sizeof(LegacyHashEntry);
+            uint64_t hash_value;
+            memcpy(&hash_value, entry, sizeof(hash_value));
+            const char* stored = reinterpret_cast<const char*>(entry + offsetof(LegacyHashEntry, key));
+            if (hash_tag(hash_value) == tag && strncmp(stored, key.c_str(), sizeof(LegacyHashEntry::key)) == 0) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    
+    memcpy(&count, buffer + 1, sizeof(count));
+    count = std::min(count, HASH_BUCKET_SLOTS);
+    const uint8_t* tags = buffer + HASH_BUCKET_HEADER_SIZE;
+    
+    for (uint16_t group = 0; group < count; group += 16) {
+        uint32_t mask = match_tags(tags + group, tag);
+        if (count - group < 16) {
+            mask &= (1u << (count - group)) - 1;
+        }
+        
+        // Only entries whose tag matched get their key compared
+        while (mask != 0) {
+            int i = group + __builtin_ctz(mask);
+            const uint8_t* slot = buffer + HASH_SLOTS_OFFSET + i * HASH_SLOT_SIZE;
+            uint16_t key_offset;
+            memcpy(&key_offset, slot + 12, sizeof(key_offset));
+            if (slot[14] == key.size() && memcmp(buffer + key_offset, key.data(), key.size()) == 0) {
+                return i;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return -1;
+}
+
+uint64_t HashBucket::next_page(const uint8_t* buffer) {
+    uint64_t overflow_page;
+    memcpy(&overflow_page, buffer + (buffer[0] == HASH_BUCKET_FORMAT ? 3 : 2), sizeof(overflow_page));
+    return overflow_page;
+}
+
+bool HashBucket::page_has_room(const uint8_t* buffer, size_t key_length) {
+    if (buffer[0] != HASH_BUCKET_FORMAT) {
+        return true;  // Even a full legacy page has room once re-encoded
+    }
+    
+    uint16_t count, key_start;
+    memcpy(&count, buffer + 1, sizeof(count));
+    memcpy(&key_start, buffer + 11, sizeof(key_start));
+    size_t slots_end = HASH_SLOTS_OFFSET + (count + 1) * HASH_SLOT_SIZE;
+    return count < HASH_BUCKET_SLOTS && slots_end + key_length <= key_start;
+}
+
+RecordLocation HashBucket::value_at(const uint8_t* buffer, int index) {
+    RecordLocation loc;
+    const uint8_t* value;
+    if (buffer[0] != HASH_BUCKET_FORMAT) {
+        value = buffer + LEGACY_BUCKET_HEADER_SIZE + index * sizeof(LegacyHashEntry) +
+                offsetof(LegacyHashEntry, value_page);
+        memcpy(&loc.page_id, value, sizeof(loc.page_id));
+        memcpy(&loc.offset, value + offsetof(LegacyHashEntry, value_offset) - offsetof(LegacyHashEntry, value_page),
+               sizeof(loc.offset));
+        memcpy(&loc.size, value + offsetof(LegacyHashEntry, value_size) - offsetof(LegacyHashEntry, value_page),
+               sizeof(loc.size));
+        return loc;
+    }
+    
+    value = buffer + HASH_SLOTS_OFFSET + index * HASH_SLOT_SIZE;
+    memcpy(&loc.page_id, value, sizeof(loc.page_id));
+    memcpy(&loc.offset, value + 8, sizeof(loc.offset));
+    memcpy(&loc.size, value + 10, sizeof(loc.size));
+    return loc;
+}
 
 HashTable::HashTable(DatabaseEngine* engine) 
-    : db_engine(engine), header_page_id(0) {
+    : db_engine(engine), header_page_id(0), level(0), split_pointer(0) {
+    db_engine->add_relocator(this, [this](const RelocationSet& set) { relocate(set); });
+}
+
+HashTable::~HashTable() {
+    db_engine->remove_relocator(this);
 }
 
 void HashTable::initialize() {
+    std::unique_lock<std::shared_mutex> lock(table_mutex);
+    
     // Allocate header page
     header_page_id = db_engine->allocate_page();
     
@@ -21,22 +206,40 @@ void HashTable::initialize() {
         HashBucket bucket;
         save_bucket(header.bucket_pages[i], bucket);
     }
+    bucket_pages.assign(header.bucket_pages, header.bucket_pages + header.bucket_count);
+    update_split_state();
     
     // Save header
-    Page header_page;
-    header_page.header.type = HASH_BUCKET;  // Special type
-    header.serialize(header_page.data);
-    db_engine->write_page(header_page_id, header_page);
+    save_header();
     
     std::cout << "Hash table initialized with " << header.bucket_count 
               << " buckets at page " << header_page_id << std::endl;
 }
 
 void HashTable::load(uint64_t header_page) {
+    std::unique_lock<std::shared_mutex> lock(table_mutex);
     header_page_id = header_page;
     
-    Page page = db_engine->read_page(header_page_id);
-    header.deserialize(page.data);
+    {
+        PageHandle page = db_engine->pin_page(header_page_id);
+        header.deserialize(page->data);
+    }
+    
+    // Gather the bucket directory
+    header.bucket_count = std::min(header.bucket_count, HASH_MAX_BUCKETS);
+    bucket_pages.assign(header.bucket_pages, header.bucket_pages + DEFAULT_BUCKET_COUNT);
+    for (uint64_t directory_page : header.directory_pages) {
+        PageHandle page = db_engine->pin_page(directory_page);
+        const uint64_t* entries = reinterpret_cast<const uint64_t*>(page->data);
+        bucket_pages.insert(bucket_pages.end(), entries, entries + HASH_DIRECTORY_ENTRIES);
+    }
+    if (bucket_pages.size() < header.bucket_count) {
+        std::cerr << "Hash table directory is missing buckets, using "
+                  << bucket_pages.size() << std::endl;
+        header.bucket_count = bucket_pages.size();
+    }
+    bucket_pages.resize(header.bucket_count);
+    update_split_state();
     
     std::cout << "Hash table loaded from page " << header_page_id << std::endl;
 }
@@ -52,13 +255,20 @@ uint64_t HashTable::hash_string(const std::string& str) {
 }
 
 uint32_t HashTable::get_bucket_index(uint64_t hash_value) {
-    return hash_value % header.bucket_count;
+    // Buckets already split this round are addressed with the next round's
+    // modulus
+    uint64_t round_size = static_cast<uint64_t>(DEFAULT_BUCKET_COUNT) << level;
+    uint64_t index = hash_value % round_size;
+    if (index < split_pointer) {
+        index = hash_value % (round_size * 2);
+    }
+    return index;
 }
 
 HashBucket HashTable::load_bucket(uint64_t page_id) {
-    Page page = db_engine->read_page(page_id);
+    PageHandle page = db_engine->pin_page(page_id);
     HashBucket bucket;
-    bucket.deserialize(page.data);
+    bucket.deserialize(page->data);
     return bucket;
 }
 
@@ -70,90 +280,100 @@ void HashTable::save_bucket(uint64_t page_id, const HashBucket& bucket) {
 }
 
 bool HashTable::insert(const std::string& key, const RecordLocation& record) {
-    if (key.length() >= 128) {
+    if (key.length() > HASH_MAX_KEY_LENGTH) {
         std::cerr << "Key too long (max 127 chars)" << std::endl;
         return false;
     }
     
+    std::unique_lock<std::shared_mutex> lock(table_mutex);
     uint64_t hash_value = hash_string(key);
+    uint8_t tag = hash_tag(hash_value);
     uint32_t bucket_idx = get_bucket_index(hash_value);
-    uint64_t bucket_page = header.bucket_pages[bucket_idx];
+    uint64_t bucket_page = bucket_pages[bucket_idx];
     
-    // Check if key already exists and find insertion point
+    // Walk the whole chain for an existing key (removes can leave room in
+    // an earlier page than the one holding it), remembering the first page
+    // with space
     uint64_t current_page = bucket_page;
+    uint64_t last_page = 0;
+    uint64_t target_page = 0;
     while (current_page != 0) {
-        HashBucket bucket = load_bucket(current_page);
-        
-        // Check for existing key
-        for (uint16_t i = 0; i < bucket.entry_count; i++) {
-            if (bucket.entries[i].hash_value == hash_value &&
-                strcmp(bucket.entries[i].key, key.c_str()) == 0) {
-                // Update existing entry
-                bucket.entries[i].value_page = record.page_id;
-                bucket.entries[i].value_offset = record.offset;
-                bucket.entries[i].value_size = record.size;
-                save_bucket(current_page, bucket);
-                return true;
-            }
+        int index;
+        bool has_room;
+        uint64_t next;
+        {
+            PageHandle page = db_engine->pin_page(current_page);
+            index = HashBucket::probe(page->data, tag, key);
+            has_room = HashBucket::page_has_room(page->data, key.size());
+            next = HashBucket::next_page(page->data);
         }
         
-        // Check if bucket has space
-        if (bucket.entry_count < MAX_ENTRIES_PER_BUCKET) {
-            // Insert new entry
-            HashEntry& entry = bucket.entries[bucket.entry_count];
-            entry.hash_value = hash_value;
-            strcpy(entry.key, key.c_str());
-            entry.key_length = key.length();
-            entry.value_page = record.page_id;
-            entry.value_offset = record.offset;
-            entry.value_size = record.size;
-            bucket.entry_count++;
-            
+        if (index >= 0) {
+            // Update existing entry
+            HashBucket bucket = load_bucket(current_page);
+            bucket.entries[index].value_page = record.page_id;
+            bucket.entries[index].value_offset = record.offset;
+            bucket.entries[index].value_size = record.size;
             save_bucket(current_page, bucket);
             return true;
         }
         
-        // Check overflow
-        if (bucket.overflow_page == 0) {
-            // Create overflow page
-            uint64_t overflow_page = db_engine->allocate_page();
-            bucket.overflow_page = overflow_page;
-            save_bucket(current_page, bucket);
-            
-            // Initialize overflow bucket
-            HashBucket overflow_bucket;
-            save_bucket(overflow_page, overflow_bucket);
+        if (target_page == 0 && has_room) {
+            target_page = current_page;
         }
-        
-        current_page = bucket.overflow_page;
+        last_page = current_page;
+        current_page = next;
     }
     
-    return false;
+    HashBucket target_bucket;
+    if (target_page != 0) {
+        target_bucket = load_bucket(target_page);
+    } else {
+        // Create overflow page
+        target_page = db_engine->allocate_page();
+        HashBucket last_bucket = load_bucket(last_page);
+        last_bucket.overflow_page = target_page;
+        save_bucket(last_page, last_bucket);
+    }
+    
+    // Insert new entry
+    HashEntry entry;
+    entry.key = key;
+    entry.tag = tag;
+    entry.value_page = record.page_id;
+    entry.value_offset = record.offset;
+    entry.value_size = record.size;
+    target_bucket.entries.push_back(entry);
+    
+    save_bucket(target_page, target_bucket);
+    
+    // Spilling past a bucket's first page grows the table by one
+    if (target_page != bucket_page) {
+        split_next_bucket();
+    }
+    return true;
 }
 
 RecordLocation HashTable::search(const std::string& key, bool& found) {
+    std::shared_lock<std::shared_mutex> lock(table_mutex);
     uint64_t hash_value = hash_string(key);
+    uint8_t tag = hash_tag(hash_value);
     uint32_t bucket_idx = get_bucket_index(hash_value);
-    uint64_t bucket_page = header.bucket_pages[bucket_idx];
+    uint64_t bucket_page = bucket_pages[bucket_idx];
     
+    // Probe each page in place; nothing is decoded
     uint64_t current_page = bucket_page;
     while (current_page != 0) {
-        HashBucket bucket = load_bucket(current_page);
+        PageHandle page = db_engine->pin_page(current_page);
         
-        for (uint16_t i = 0; i < bucket.entry_count; i++) {
-            if (bucket.entries[i].hash_value == hash_value &&
-                strcmp(bucket.entries[i].key, key.c_str()) == 0) {
-                // Found!
-                found = true;
-                return RecordLocation(
-                    bucket.entries[i].value_page,
-                    bucket.entries[i].value_offset,
-                    bucket.entries[i].value_size
-                );
-            }
+        int index = HashBucket::probe(page->data, tag, key);
+        if (index >= 0) {
+            // Found!
+            found = true;
+            return HashBucket::value_at(page->data, index);
         }
         
-        current_page = bucket.overflow_page;
+        current_page = HashBucket::next_page(page->data);
     }
     
     found = false;
@@ -161,45 +381,48 @@ RecordLocation HashTable::search(const std::string& key, bool& found) {
 }
 
 bool HashTable::remove(const std::string& key) {
+    std::unique_lock<std::shared_mutex> lock(table_mutex);
     uint64_t hash_value = hash_string(key);
+    uint8_t tag = hash_tag(hash_value);
     uint32_t bucket_idx = get_bucket_index(hash_value);
-    uint64_t bucket_page = header.bucket_pages[bucket_idx];
+    uint64_t bucket_page = bucket_pages[bucket_idx];
     
     uint64_t current_page = bucket_page;
     while (current_page != 0) {
-        HashBucket bucket = load_bucket(current_page);
+        int index;
+        uint64_t next;
+        {
+            PageHandle page = db_engine->pin_page(current_page);
+            index = HashBucket::probe(page->data, tag, key);
+            next = HashBucket::next_page(page->data);
+        }
         
-        for (uint16_t i = 0; i < bucket.entry_count; i++) {
-            if (bucket.entries[i].hash_value == hash_value &&
-                strcmp(bucket.entries[i].key, key.c_str()) == 0) {
-                // Found - remove by shifting
-                for (uint16_t j = i; j < bucket.entry_count - 1; j++) {
-                    bucket.entries[j] = bucket.entries[j + 1];
-                }
-                bucket.entry_count--;
-                
-                save_bucket(current_page, bucket);
-                return true;
-            }
+        if (index >= 0) {
+            // Found - rewrite the page without it
+            HashBucket bucket = load_bucket(current_page);
+            bucket.entries.erase(bucket.entries.begin() + index);
+            save_bucket(current_page, bucket);
+            return true;
         }
         
-        current_page = bucket.overflow_page;
+        current_page = next;
     }
     
     return false;
 }
 
 std::vector<std::string> HashTable::get_all_keys() {
+    std::shared_lock<std::shared_mutex> lock(table_mutex);
     std::vector<std::string> keys;
     
     for (uint32_t i = 0; i < header.bucket_count; i++) {
-        uint64_t current_page = header.bucket_pages[i];
+        uint64_t current_page = bucket_pages[i];
         
         while (current_page != 0) {
             HashBucket bucket = load_bucket(current_page);
             
-            for (uint16_t j = 0; j < bucket.entry_count; j++) {
-                keys.push_back(std::string(bucket.entries[j].key));
+            for (const auto& entry : bucket.entries) {
+                keys.push_back(entry.key);
             }
             
             current_page = bucket.overflow_page;
@@ -207,4 +430,165 @@ std::vector<std::string> HashTable::get_all_keys() {
     }
     
     return keys;
-}
\ No newline at end of file
+}
+
+void HashTable::update_split_state() {
+    level = 0;
+    while ((static_cast<uint64_t>(DEFAULT_BUCKET_COUNT) << (level + 1)) <= header.bucket_count) {
+        level++;
+    }
+    split_pointer = header.bucket_count - (DEFAULT_BUCKET_COUNT << level);
+}
+
+void HashTable::save_header() {
+    Page header_page;
+    header_page.header.type = HASH_BUCKET;  // Special type
+    header.serialize(header_page.data);
+    db_engine->write_page(header_page_id, header_page);
+}
+
+void HashTable::save_directory_page(uint32_t directory_index) {
+    Page page;
+    page.header.type = HASH_BUCKET;
+    size_t first = DEFAULT_BUCKET_COUNT + directory_index * HASH_DIRECTORY_ENTRIES;
+    size_t count = std::min<size_t>(HASH_DIRECTORY_ENTRIES, bucket_pages.size() - first);
+    memcpy(page.data, bucket_pages.data() + first, count * sizeof(uint64_t));
+    db_engine->write_page(header.directory_pages[directory_index], page);
+}
+
+void HashTable::write_chain(std::vector<uint64_t> pages, const std::vector<HashEntry>& entries) {
+    // Packs entries into the chain starting at pages[0], adding overflow
+    // pages as needed and freeing the ones left over
+    std::vector<HashBucket> buckets(1);
+    for (const auto& entry : entries) {
+        if (!buckets.back().has_room(entry.key.size())) {
+            buckets.emplace_back();
+        }
+        buckets.back().entries.push_back(entry);
+    }
+    while (pages.size() < buckets.size()) {
+        pages.push_back(db_engine->allocate_page());
+    }
+    
+    for (size_t i = 0; i < buckets.size(); i++) {
+        buckets[i].overflow_page = i + 1 < buckets.size() ? pages[i + 1] : 0;
+        save_bucket(pages[i], buckets[i]);
+    }
+    
+    for (size_t i = buckets.size(); i < pages.size(); i++) {
+        db_engine->free_page(pages[i]);
+    }
+}
+
+void HashTable::split_next_bucket() {
+    if (header.bucket_count >= HASH_MAX_BUCKETS) {
+        return;  // Directory is full; chains just grow from here
+    }
+    
+    uint64_t round_size = static_cast<uint64_t>(DEFAULT_BUCKET_COUNT) << level;
+    uint32_t source = split_pointer;
+    
+    // Entries that rehash under the next round's modulus move to the new
+    // bucket at source + round_size
+    std::vector<uint64_t> chain;
+    std::vector<HashEntry> staying, moving;
+    for (uint64_t page = bucket_pages[source]; page != 0; ) {
+        HashBucket bucket = load_bucket(page);
+        chain.push_back(page);
+        for (auto& entry : bucket.entries) {
+            if (hash_string(entry.key) % (round_size * 2) == source) {
+                staying.push_back(std::move(entry));
+            } else {
+                moving.push_back(std::move(entry));
+            }
+        }
+        page = bucket.overflow_page;
+    }
+    
+    // Fill the new bucket before it becomes reachable, then publish it
+    uint64_t new_page = db_engine->allocate_page();
+    write_chain({new_page}, moving);
+    
+    bucket_pages.push_back(new_page);
+    header.bucket_count++;
+    if (bucket_pages.size() > DEFAULT_BUCKET_COUNT) {
+        uint32_t directory_index = (bucket_pages.size() - DEFAULT_BUCKET_COUNT - 1) / HASH_DIRECTORY_ENTRIES;
+        if (directory_index >= header.directory_pages.size()) {
+            header.directory_pages.push_back(db_engine->allocate_page());
+        }
+        save_directory_page(directory_index);
+    }
+    save_header();
+    update_split_state();
+    
+    write_chain(chain, staying);
+}
+
+void HashTable::relocate(const RelocationSet& set) {
+    if (!set.has_type(HASH_BUCKET)) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(table_mutex);
+    if (header_page_id == 0) {
+        return;
+    }
+    
+    // Directory pages first, so the bucket lists below go to their new home
+    bool header_changed = false;
+    for (uint64_t& directory_page : header.directory_pages) {
+        if (set.contains(directory_page)) {
+            uint64_t moved = db_engine->relocate_pages(directory_page);
+            if (moved != 0) {
+                directory_page = moved;
+                header_changed = true;
+            }
+        }
+    }
+    
+    std::vector<bool> directory_changed(header.directory_pages.size(), false);
+    for (uint32_t i = 0; i < bucket_pages.size(); i++) {
+        if (set.contains(bucket_pages[i])) {
+            uint64_t moved = db_engine->relocate_pages(bucket_pages[i]);
+            if (moved != 0) {
+                bucket_pages[i] = moved;
+                if (i < DEFAULT_BUCKET_COUNT) {
+                    header.bucket_pages[i] = moved;
+                    header_changed = true;
+                } else {
+                    directory_changed[(i - DEFAULT_BUCKET_COUNT) / HASH_DIRECTORY_ENTRIES] = true;
+                }
+            }
+        }
+        
+        // Overflow pages are repointed from the page before them
+        uint64_t prev_page = bucket_pages[i];
+        uint64_t current_page = load_bucket(prev_page).overflow_page;
+        while (current_page != 0) {
+            uint64_t next;
+            {
+                PageHandle page = db_engine->pin_page(current_page);
+                next = HashBucket::next_page(page->data);
+            }
+            if (set.contains(current_page)) {
+                uint64_t moved = db_engine->relocate_pages(current_page);
+                if (moved != 0) {
+                    HashBucket prev = load_bucket(prev_page);
+                    prev.overflow_page = moved;
+                    save_bucket(prev_page, prev);
+                    current_page = moved;
+                }
+            }
+            prev_page = current_page;
+            current_page = next;
+        }
+    }
+    
+    for (uint32_t i = 0; i < directory_changed.size(); i++) {
+        if (directory_changed[i]) {
+            save_directory_page(i);
+        }
+    }
+    if (header_changed) {
+        save_header();
+    }
+}
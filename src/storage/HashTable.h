@@ -3,62 +3,105 @@
 
 #include "DatabaseEngine.h"
 #include "BTree.h"
+#include <algorithm>
+#include <shared_mutex>
 #include <string>
 #include <vector>
 
 // Hash table configuration
 const uint32_t DEFAULT_BUCKET_COUNT = 256;
-// Calculate a safe number of entries that fit in a page. With PAGE_DATA_SIZE
-// of 4032 bytes and HashEntry size around 152 bytes, 24 entries per bucket is
-// a safe choice to avoid overflowing the page when serializing.
+const size_t HASH_MAX_KEY_LENGTH = 127;
+
+// Compact bucket page layout (inside Page::data):
+//   [format u8][entry_count u16][overflow_page u64][key_start u16][unused 3]
+//   [tags: HASH_BUCKET_SLOTS bytes][slot 0][slot 1]...  free  ...[key 1][key 0]
+// Entry i has a one-byte tag (0x80 | top 7 hash bits) at tags[i] and a
+// fixed-size slot; its key bytes live in a variable-length area growing
+// down from the end of the page. A lookup compares 16 tags per SSE2
+// instruction and only looks at the keys of matching entries, straight out
+// of the pinned page.
+const uint8_t HASH_BUCKET_FORMAT = 0xB5;  // Legacy pages start with a count <= 24
+const uint16_t HASH_BUCKET_SLOTS = 128;
+const size_t HASH_BUCKET_HEADER_SIZE = 16;
+const size_t HASH_SLOT_SIZE = sizeof(uint64_t) + 3 * sizeof(uint16_t) + 1;
+const size_t HASH_SLOTS_OFFSET = HASH_BUCKET_HEADER_SIZE + HASH_BUCKET_SLOTS;
+
+// Pages written before the compact format hold up to 24 fixed entries of
+// this layout after [entry_count u16][overflow_page u64]. They are still
+// read, and are rewritten in the compact format the first time they change.
 const uint16_t MAX_ENTRIES_PER_BUCKET = 24;
+const size_t LEGACY_BUCKET_HEADER_SIZE = sizeof(uint16_t) + sizeof(uint64_t);
 
-// Hash entry
-struct HashEntry {
+struct LegacyHashEntry {
     uint64_t hash_value;
-    char key[128];          // Max key length
+    char key[128];
     uint16_t key_length;
+    uint64_t value_page;
+    uint16_t value_offset;
+    uint16_t value_size;
+};
+
+inline uint8_t hash_tag(uint64_t hash_value) {
+    return 0x80 | static_cast<uint8_t>(hash_value >> 57);
+}
+
+// Hash entry
+struct HashEntry {
+    std::string key;
+    uint8_t tag;
     uint64_t value_page;    // Page containing actual value
     uint16_t value_offset;
     uint16_t value_size;
     
-    HashEntry() : hash_value(0), key_length(0), value_page(0), 
-                  value_offset(0), value_size(0) {
-        memset(key, 0, sizeof(key));
-    }
+    HashEntry() : tag(0), value_page(0), value_offset(0), value_size(0) {}
 };
 
 // Hash bucket node (stored in page data)
 struct HashBucket {
-    uint16_t entry_count;
     uint64_t overflow_page;  // Next bucket page if overflow
-    HashEntry entries[MAX_ENTRIES_PER_BUCKET];
+    std::vector<HashEntry> entries;
     
-    HashBucket() : entry_count(0), overflow_page(0) {}
+    HashBucket() : overflow_page(0) {}
     
-    void serialize(uint8_t* buffer) const {
-        size_t offset = 0;
-        memcpy(buffer + offset, &entry_count, sizeof(entry_count)); 
-        offset += sizeof(entry_count);
-        memcpy(buffer + offset, &overflow_page, sizeof(overflow_page)); 
-        offset += sizeof(overflow_page);
-        memcpy(buffer + offset, entries, sizeof(entries));
+    size_t encoded_size() const;
+    bool has_room(size_t key_length) const {
+        return entries.size() < HASH_BUCKET_SLOTS &&
+               encoded_size() + HASH_SLOT_SIZE + key_length <= PAGE_DATA_SIZE;
     }
     
-    void deserialize(const uint8_t* buffer) {
-        size_t offset = 0;
-        memcpy(&entry_count, buffer + offset, sizeof(entry_count)); 
-        offset += sizeof(entry_count);
-        memcpy(&overflow_page, buffer + offset, sizeof(overflow_page)); 
-        offset += sizeof(overflow_page);
-        memcpy(entries, buffer + offset, sizeof(entries));
-    }
+    // Always writes the compact format; reads either
+    void serialize(uint8_t* buffer) const;
+    void deserialize(const uint8_t* buffer);
+    
+    // Work on a page without decoding it: index of key or -1, the next
+    // page in the chain, and whether one more key of key_length fits
+    static int probe(const uint8_t* buffer, uint8_t tag, const std::string& key);
+    static uint64_t next_page(const uint8_t* buffer);
+    static bool page_has_room(const uint8_t* buffer, size_t key_length);
+    static RecordLocation value_at(const uint8_t* buffer, int index);
 };
 
+// Linear hashing: the table starts with DEFAULT_BUCKET_COUNT buckets and
+// grows one bucket at a time. Whenever an insert spills into an overflow
+// page, the bucket at the split pointer is split (in round-robin order, not
+// necessarily the one that overflowed) and its entries are shared with a
+// new bucket. bucket_count alone determines the level and split pointer.
+//
+// The first DEFAULT_BUCKET_COUNT bucket pages are kept in the header as
+// before; the rest are listed in directory pages named by the header.
+//
+// Lookups share table_mutex; changes, and the vacuum moving the table's
+// pages, hold it exclusively. The header page never moves.
+const uint32_t HASH_DIRECTORY_ENTRIES = PAGE_DATA_SIZE / sizeof(uint64_t);
+const uint32_t HASH_MAX_DIRECTORY_PAGES =
+    (PAGE_DATA_SIZE - 2 * sizeof(uint32_t) - DEFAULT_BUCKET_COUNT * sizeof(uint64_t)) / sizeof(uint64_t);
+const uint32_t HASH_MAX_BUCKETS = DEFAULT_BUCKET_COUNT + HASH_MAX_DIRECTORY_PAGES * HASH_DIRECTORY_ENTRIES;
+
 // Hash table header (stored in first page)
 struct HashTableHeader {
     uint32_t bucket_count;
     uint64_t bucket_pages[DEFAULT_BUCKET_COUNT];
+    std::vector<uint64_t> directory_pages;  // Buckets past the first ones
     
     HashTableHeader() : bucket_count(DEFAULT_BUCKET_COUNT) {
         for (uint32_t i = 0; i < DEFAULT_BUCKET_COUNT; i++) {
@@ -71,6 +114,13 @@ struct HashTableHeader {
         memcpy(buffer + offset, &bucket_count, sizeof(bucket_count)); 
         offset += sizeof(bucket_count);
         memcpy(buffer + offset, bucket_pages, sizeof(bucket_pages));
+        offset += sizeof(bucket_pages);
+        uint32_t directory_count = directory_pages.size();
+        memcpy(buffer + offset, &directory_count, sizeof(directory_count));
+        offset += sizeof(directory_count);
+        if (directory_count > 0) {
+            memcpy(buffer + offset, directory_pages.data(), directory_count * sizeof(uint64_t));
+        }
     }
     
     void deserialize(const uint8_t* buffer) {
@@ -78,6 +128,16 @@ struct HashTableHeader {
         memcpy(&bucket_count, buffer + offset, sizeof(bucket_count)); 
         offset += sizeof(bucket_count);
         memcpy(bucket_pages, buffer + offset, sizeof(bucket_pages));
+        offset += sizeof(bucket_pages);
+        // Tables written before linear hashing have zeros here
+        uint32_t directory_count;
+        memcpy(&directory_count, buffer + offset, sizeof(directory_count));
+        offset += sizeof(directory_count);
+        directory_count = std::min(directory_count, HASH_MAX_DIRECTORY_PAGES);
+        directory_pages.resize(directory_count);
+        if (directory_count > 0) {
+            memcpy(directory_pages.data(), buffer + offset, directory_count * sizeof(uint64_t));
+        }
     }
 };
 
@@ -86,6 +146,10 @@ private:
     DatabaseEngine* db_engine;
     uint64_t header_page_id;
     HashTableHeader header;
+    std::vector<uint64_t> bucket_pages;  // Every bucket's first page
+    uint32_t level;                      // Round: DEFAULT_BUCKET_COUNT << level buckets
+    uint32_t split_pointer;              // Next bucket to split this round
+    std::shared_mutex table_mutex;
     
     // Hash functions
     uint64_t hash_string(const std::string& str);
@@ -95,8 +159,19 @@ private:
     HashBucket load_bucket(uint64_t page_id);
     void save_bucket(uint64_t page_id, const HashBucket& bucket);
     
+    // Linear hashing
+    void update_split_state();
+    void save_header();
+    void save_directory_page(uint32_t directory_index);
+    void write_chain(std::vector<uint64_t> pages, const std::vector<HashEntry>& entries);
+    void split_next_bucket();
+    
+    // Vacuum relocator: moves directory, bucket and overflow pages in set
+    void relocate(const RelocationSet& set);
+    
 public:
     HashTable(DatabaseEngine* engine);
+    ~HashTable();
     
     // Initialize new hash table
     void initialize();
@@ -112,6 +187,7 @@ public:
     // Utility
     std::vector<std::string> get_all_keys();
     
+    uint32_t get_bucket_count() const { return header.bucket_count; }
     uint64_t get_header_page_id() const { return header_page_id; }
 };
 
@@ -0,0 +1,252 @@
+#include "Lz4.h"
+#include <cstring>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+
+size_t lz4_compress(const uint8_t* input, size_t size, uint8_t* output, size_t capacity) {
+    int written = LZ4_compress_default(reinterpret_cast<const char*>(input), reinterpret_cast<char*>(output),
+                                       static_cast<int>(size), static_cast<int>(capacity));
+    return written > 0 ? static_cast<size_t>(written) : 0;
+}
+
+bool lz4_decompress(const uint8_t* input, size_t size, uint8_t* output, size_t output_size) {
+    int read = LZ4_decompress_safe(reinterpret_cast<const char*>(input), reinterpret_cast<char*>(output),
+                                   static_cast<int>(size), static_cast<int>(output_size));
+    return read >= 0 && static_cast<size_t>(read) == output_size;
+}
+
+#else
+
+namespace {
+
+// Format limits: a match is at least 4 bytes, the last 5 bytes are always
+// literals and no match starts within the last 12
+const size_t LZ4_MIN_MATCH = 4;
+const size_t LZ4_LAST_LITERALS = 5;
+const size_t LZ4_MATCH_START_LIMIT = 12;
+const size_t LZ4_MAX_OFFSET = 65535;
+const int LZ4_HASH_BITS = 12;
+const int LZ4_SKIP_TRIGGER = 6;
+const size_t LZ4_FAST_COPY = 16;
+
+uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint64_t read64(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Bytes from a and b that are equal, stopping at limit (a + n < limit)
+size_t common_length(const uint8_t* a, const uint8_t* b, const uint8_t* limit) {
+    const uint8_t* start = a;
+    while (a + sizeof(uint64_t) <= limit) {
+        uint64_t diff = read64(a) ^ read64(b);
+        if (diff != 0) {
+            return a - start + __builtin_ctzll(diff) / 8;  // Little-endian
+        }
+        a += sizeof(uint64_t);
+        b += sizeof(uint64_t);
+    }
+    while (a < limit && *a == *b) {
+        a++;
+        b++;
+    }
+    return a - start;
+}
+
+uint32_t hash_sequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Length fields past 15 continue in bytes of 255 and a final remainder
+size_t length_bytes(size_t length) {
+    return length < 15 ? 0 : (length - 15) / 255 + 1;
+}
+
+uint8_t* write_length(uint8_t* out, size_t length) {
+    length -= 15;
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = static_cast<uint8_t>(length);
+    return out;
+}
+
+// One sequence: literals, then (unless this is the last) a match. Returns
+// the new end of output, or null when it would overflow capacity.
+uint8_t* write_sequence(uint8_t* out, const uint8_t* out_end, const uint8_t* literals, size_t literal_length,
+                        size_t offset, size_t match_length) {
+    bool last = match_length == 0;
+    size_t match_code = last ? 0 : match_length - LZ4_MIN_MATCH;
+    size_t needed = 1 + length_bytes(literal_length) + literal_length + (last ? 0 : 2 + length_bytes(match_code));
+    if (needed > static_cast<size_t>(out_end - out)) {
+        return nullptr;
+    }
+
+    uint8_t* token = out++;
+    *token = static_cast<uint8_t>((literal_length < 15 ? literal_length : 15) << 4);
+    if (literal_length >= 15) {
+        out = write_length(out, literal_length);
+    }
+    if (literal_length > 0) {
+        memcpy(out, literals, literal_length);
+    }
+    out += literal_length;
+    if (last) {
+        return out;
+    }
+
+    *out++ = static_cast<uint8_t>(offset);
+    *out++ = static_cast<uint8_t>(offset >> 8);
+    *token |= static_cast<uint8_t>(match_code < 15 ? match_code : 15);
+    if (match_code >= 15) {
+        out = write_length(out, match_code);
+    }
+    return out;
+}
+
+bool read_length(const uint8_t*& in, const uint8_t* in_end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (in >= in_end) {
+            return false;
+        }
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+}
+
+size_t lz4_compress(const uint8_t* input, size_t size, uint8_t* output, size_t capacity) {
+    uint8_t* out = output;
+    const uint8_t* out_end = output + capacity;
+    size_t anchor = 0;
+
+    if (size > LZ4_MATCH_START_LIMIT) {
+        // Last position (+1, 0 = none) each 4-byte sequence was seen at
+        uint32_t table[1 << LZ4_HASH_BITS] = {};
+        const size_t match_start_end = size - LZ4_MATCH_START_LIMIT;
+        const size_t match_end = size - LZ4_LAST_LITERALS;
+
+        size_t pos = 0;
+        size_t misses = 0;
+        while (pos < match_start_end) {
+            uint32_t sequence = read32(input + pos);
+            uint32_t& slot = table[hash_sequence(sequence)];
+            size_t candidate = slot;
+            slot = static_cast<uint32_t>(pos + 1);
+            if (candidate == 0 || pos - (candidate - 1) > LZ4_MAX_OFFSET || read32(input + candidate - 1) != sequence) {
+                // Stride further the longer nothing matches
+                pos += 1 + (misses++ >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+            size_t ref = candidate - 1;
+
+            size_t length = LZ4_MIN_MATCH +
+                            common_length(input + pos + LZ4_MIN_MATCH, input + ref + LZ4_MIN_MATCH, input + match_end);
+            // Grow the match backwards into the pending literals
+            while (pos > anchor && ref > 0 && input[pos - 1] == input[ref - 1]) {
+                pos--;
+                ref--;
+                length++;
+            }
+
+            out = write_sequence(out, out_end, input + anchor, pos - anchor, pos - ref, length);
+            if (out == nullptr) {
+                return 0;
+            }
+            pos += length;
+            anchor = pos;
+            if (pos - 2 < match_start_end) {
+                table[hash_sequence(read32(input + pos - 2))] = static_cast<uint32_t>(pos - 2 + 1);
+            }
+        }
+    }
+
+    out = write_sequence(out, out_end, input + anchor, size - anchor, 0, 0);
+    return out == nullptr ? 0 : static_cast<size_t>(out - output);
+}
+
+bool lz4_decompress(const uint8_t* input, size_t size, uint8_t* output, size_t output_size) {
+    const uint8_t* in = input;
+    const uint8_t* in_end = input + size;
+    size_t out = 0;
+
+    while (in < in_end) {
+        uint8_t token = *in++;
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(in, in_end, literal_length)) {
+            return false;
+        }
+        if (literal_length > static_cast<size_t>(in_end - in) || literal_length > output_size - out) {
+            return false;
+        }
+        if (literal_length <= LZ4_FAST_COPY && in_end - in >= static_cast<ptrdiff_t>(LZ4_FAST_COPY) &&
+            output_size - out >= LZ4_FAST_COPY) {
+            // Short runs copy a fixed block; bytes past the run are rewritten
+            memcpy(output + out, in, LZ4_FAST_COPY);
+        } else if (literal_length > 0) {
+            memcpy(output + out, in, literal_length);
+        }
+        in += literal_length;
+        out += literal_length;
+        if (in == in_end) {
+            break;  // The last sequence has no match
+        }
+
+        if (in_end - in < 2) {
+            return false;
+        }
+        size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+        in += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(in, in_end, match_length)) {
+            return false;
+        }
+        match_length += LZ4_MIN_MATCH;
+        if (offset == 0 || offset > out || match_length > output_size - out) {
+            return false;
+        }
+
+        // A match may overlap the bytes it produces: copy in steps no
+        // longer than the offset
+        const uint8_t* from = output + out - offset;
+        uint8_t* to = output + out;
+        if (offset >= sizeof(uint64_t) && output_size - out >= match_length + sizeof(uint64_t)) {
+            for (size_t i = 0; i < match_length; i += sizeof(uint64_t)) {
+                memcpy(to + i, from + i, sizeof(uint64_t));
+            }
+        } else if (offset == 1) {
+            memset(to, *from, match_length);
+        } else if (offset >= match_length) {
+            memcpy(to, from, match_length);
+        } else if (offset >= sizeof(uint64_t)) {
+            size_t i = 0;
+            for (; i + sizeof(uint64_t) <= match_length; i += sizeof(uint64_t)) {
+                memcpy(to + i, from + i, sizeof(uint64_t));
+            }
+            for (; i < match_length; i++) {
+                to[i] = from[i];
+            }
+        } else {
+            for (size_t i = 0; i < match_length; i++) {
+                to[i] = from[i];
+            }
+        }
+        out += match_length;
+    }
+    return out == output_size;
+}
+
+#endif
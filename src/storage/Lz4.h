@@ -0,0 +1,18 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <cstddef>
+#include <cstdint>
+
+// LZ4 block format. Uses liblz4 when the build found it (HAVE_LZ4), else
+// the small greedy compressor in Lz4.cpp; both read each other's output.
+
+// Compress size bytes into output. Returns the compressed size, or 0 when
+// it would not fit in capacity.
+size_t lz4_compress(const uint8_t* input, size_t size, uint8_t* output, size_t capacity);
+
+// Decompress a block that must expand to exactly output_size bytes. False
+// on malformed input, which is never read or written out of bounds.
+bool lz4_decompress(const uint8_t* input, size_t size, uint8_t* output, size_t output_size);
+
+#endif // LZ4_H
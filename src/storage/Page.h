@@ -1,6 +1,8 @@
 #ifndef PAGE_H
 #define PAGE_H
 
+#include "Checksum.h"
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <vector>
@@ -9,26 +11,41 @@ const uint32_t PAGE_SIZE = 4096;
 const uint32_t PAGE_HEADER_SIZE = 64;
 const uint32_t PAGE_DATA_SIZE = PAGE_SIZE - PAGE_HEADER_SIZE;
 
+// Version 2: records use the compact encoding in utils/RecordCodec.h
+const uint32_t DB_FORMAT_VERSION = 2;
+
 // Page types
 enum PageType : uint8_t {
     FREE_PAGE = 0,
     BTREE_INTERNAL = 1,
     BTREE_LEAF = 2,
     HASH_BUCKET = 3,
-    DATA_OVERFLOW = 4
+    DATA_OVERFLOW = 4,
+    RECORD_HEAP = 5,
+    FREE_SPACE_MAP = 6,
+    ALLOCATION_BITMAP = 7
 };
 
+// How a page's checksum was computed. Pages written before CRC32C hold a
+// byte sum of the data and are still accepted until they are rewritten.
+const uint8_t PAGE_CHECKSUM_BYTE_SUM = 0;
+const uint8_t PAGE_CHECKSUM_CRC32C = 1;
+
 // Page header structure (64 bytes)
 struct PageHeader {
     PageType type;              // 1 byte
-    uint8_t reserved1[7];       // 7 bytes padding
-    uint64_t next_free_page;    // 8 bytes - for free list
+    uint8_t checksum_kind;      // 1 byte - PAGE_CHECKSUM_*
+    uint8_t reserved1[6];       // 6 bytes padding
+    uint64_t next_free_page;    // 8 bytes - free list / next bitmap page
     uint32_t checksum;          // 4 bytes
-    uint8_t reserved2[44];      
+    uint8_t reserved2[4];       // 4 bytes padding
+    uint64_t page_lsn;          // 8 bytes - WAL record that last wrote this page
+    uint8_t reserved3[32];      
     
-    PageHeader() : type(FREE_PAGE), next_free_page(0), checksum(0) {
+    PageHeader() : type(FREE_PAGE), checksum_kind(PAGE_CHECKSUM_BYTE_SUM), next_free_page(0), checksum(0), page_lsn(0) {
         memset(reserved1, 0, sizeof(reserved1));
         memset(reserved2, 0, sizeof(reserved2));
+        memset(reserved3, 0, sizeof(reserved3));
     }
 };
 
@@ -42,7 +59,14 @@ public:
         memset(data, 0, PAGE_DATA_SIZE);
     }
     
+    // CRC32C over the header fields before the checksum and the data.
+    // page_lsn is left out: the WAL stamps it after the checksum is set.
     uint32_t calculate_checksum() const {
+        uint32_t crc = crc32c(&header, offsetof(PageHeader, checksum));
+        return crc32c(data, PAGE_DATA_SIZE, crc);
+    }
+    
+    uint32_t calculate_byte_sum() const {
         uint32_t sum = 0;
         for (size_t i = 0; i < PAGE_DATA_SIZE; i++) {
             sum += data[i];
@@ -51,11 +75,16 @@ public:
     }
     
     void update_checksum() {
+        header.checksum_kind = PAGE_CHECKSUM_CRC32C;
         header.checksum = calculate_checksum();
     }
     
+    // A page that was never written (all zeros) passes as a byte sum
     bool verify_checksum() const {
-        return header.checksum == calculate_checksum();
+        if (header.checksum_kind == PAGE_CHECKSUM_CRC32C) {
+            return header.checksum == calculate_checksum();
+        }
+        return header.checksum_kind == PAGE_CHECKSUM_BYTE_SUM && header.checksum == calculate_byte_sum();
     }
     
     void serialize(uint8_t* buffer) const {
@@ -86,9 +115,9 @@ struct DatabaseHeader {
     uint64_t login_hash_page;
     uint64_t meeting_code_hash_page;
     uint64_t file_dedup_hash_page;
-    uint64_t chat_search_hash_page;
+    uint64_t chat_search_hash_page;     // Keyword -> latest message only; superseded
     
-    // Free list management
+    // Free list of older files; replaced by the allocation bitmap on open
     uint64_t free_list_head;
     
     // Auto-increment counters
@@ -98,10 +127,25 @@ struct DatabaseHeader {
     uint64_t last_file_id;
     uint64_t last_whiteboard_id;
     
+    // Record heap free-space map directory
+    uint64_t record_heap_fsm_page;
+    
+    // Secondary indexes
+    uint64_t messages_meeting_index_root;   // (meeting_id, timestamp, message_id)
+    uint64_t meetings_creator_index_root;   // (creator_id, meeting_id)
+    uint64_t files_meeting_index_root;      // (meeting_id, file_id)
+    uint64_t whiteboard_meeting_index_root; // (meeting_id, timestamp, element_id)
+    
+    // Keyword -> posting list of (meeting_id, message_id)
+    uint64_t chat_postings_hash_page;
+    
+    // First page of the free-space bitmap chain (0 = not built yet)
+    uint64_t allocation_bitmap_page;
+    
     DatabaseHeader() {
         magic[0] = 'M'; magic[1] = 'T'; 
         magic[2] = 'D'; magic[3] = 'B';
-        version = 1;
+        version = DB_FORMAT_VERSION;
         page_size = PAGE_SIZE;
         total_pages = 1;  // Start with header page
         
@@ -123,6 +167,14 @@ struct DatabaseHeader {
         last_message_id = 0;
         last_file_id = 0;
         last_whiteboard_id = 0;
+        
+        record_heap_fsm_page = 0;
+        messages_meeting_index_root = 0;
+        meetings_creator_index_root = 0;
+        files_meeting_index_root = 0;
+        whiteboard_meeting_index_root = 0;
+        chat_postings_hash_page = 0;
+        allocation_bitmap_page = 0;
     }
     
     // Serialize to page data
@@ -151,6 +203,14 @@ struct DatabaseHeader {
         memcpy(buffer + offset, &last_message_id, sizeof(last_message_id)); offset += sizeof(last_message_id);
         memcpy(buffer + offset, &last_file_id, sizeof(last_file_id)); offset += sizeof(last_file_id);
         memcpy(buffer + offset, &last_whiteboard_id, sizeof(last_whiteboard_id)); offset += sizeof(last_whiteboard_id);
+        
+        memcpy(buffer + offset, &record_heap_fsm_page, sizeof(record_heap_fsm_page)); offset += sizeof(record_heap_fsm_page);
+        memcpy(buffer + offset, &messages_meeting_index_root, sizeof(messages_meeting_index_root)); offset += sizeof(messages_meeting_index_root);
+        memcpy(buffer + offset, &meetings_creator_index_root, sizeof(meetings_creator_index_root)); offset += sizeof(meetings_creator_index_root);
+        memcpy(buffer + offset, &files_meeting_index_root, sizeof(files_meeting_index_root)); offset += sizeof(files_meeting_index_root);
+        memcpy(buffer + offset, &whiteboard_meeting_index_root, sizeof(whiteboard_meeting_index_root)); offset += sizeof(whiteboard_meeting_index_root);
+        memcpy(buffer + offset, &chat_postings_hash_page, sizeof(chat_postings_hash_page)); offset += sizeof(chat_postings_hash_page);
+        memcpy(buffer + offset, &allocation_bitmap_page, sizeof(allocation_bitmap_page)); offset += sizeof(allocation_bitmap_page);
     }
     
     // Deserialize from page data
@@ -179,6 +239,14 @@ struct DatabaseHeader {
         memcpy(&last_message_id, buffer + offset, sizeof(last_message_id)); offset += sizeof(last_message_id);
         memcpy(&last_file_id, buffer + offset, sizeof(last_file_id)); offset += sizeof(last_file_id);
         memcpy(&last_whiteboard_id, buffer + offset, sizeof(last_whiteboard_id)); offset += sizeof(last_whiteboard_id);
+        
+        memcpy(&record_heap_fsm_page, buffer + offset, sizeof(record_heap_fsm_page)); offset += sizeof(record_heap_fsm_page);
+        memcpy(&messages_meeting_index_root, buffer + offset, sizeof(messages_meeting_index_root)); offset += sizeof(messages_meeting_index_root);
+        memcpy(&meetings_creator_index_root, buffer + offset, sizeof(meetings_creator_index_root)); offset += sizeof(meetings_creator_index_root);
+        memcpy(&files_meeting_index_root, buffer + offset, sizeof(files_meeting_index_root)); offset += sizeof(files_meeting_index_root);
+        memcpy(&whiteboard_meeting_index_root, buffer + offset, sizeof(whiteboard_meeting_index_root)); offset += sizeof(whiteboard_meeting_index_root);
+        memcpy(&chat_postings_hash_page, buffer + offset, sizeof(chat_postings_hash_page)); offset += sizeof(chat_postings_hash_page);
+        memcpy(&allocation_bitmap_page, buffer + offset, sizeof(allocation_bitmap_page)); offset += sizeof(allocation_bitmap_page);
     }
 };
 
@@ -0,0 +1,319 @@
+#include "PageAllocator.h"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+const uint64_t BITMAP_PAGE_WORDS = BITMAP_PAGE_BITS / 64;
+
+}
+
+PageAllocator::PageAllocator() : page_count(0), free_count(0), search_word(0) {
+}
+
+bool PageAllocator::is_free(uint64_t page_id) const {
+    return (free_bits[page_id / 64] >> (page_id % 64)) & 1;
+}
+
+void PageAllocator::set_free(uint64_t page_id, bool free) {
+    uint64_t mask = 1ULL << (page_id % 64);
+    if (free) {
+        free_bits[page_id / 64] |= mask;
+    } else {
+        free_bits[page_id / 64] &= ~mask;
+    }
+    dirty[page_id / BITMAP_PAGE_BITS] = true;
+}
+
+void PageAllocator::add_bitmap_page() {
+    // The first page past the covered range holds the bitmap for the new
+    // range; the previous bitmap page gets a link to it
+    if (!dirty.empty()) {
+        dirty.back() = true;
+    }
+    bitmap_pages.push_back(page_count);
+    dirty.push_back(true);
+    free_bits.resize(free_bits.size() + BITMAP_PAGE_WORDS, 0);
+    page_count++;
+}
+
+void PageAllocator::extend(uint64_t count) {
+    while (count > 0) {
+        if (page_count == bitmap_pages.size() * BITMAP_PAGE_BITS) {
+            add_bitmap_page();
+            continue;
+        }
+        set_free(page_count, true);
+        page_count++;
+        free_count++;
+        count--;
+    }
+}
+
+uint64_t PageAllocator::trailing_free_start() const {
+    uint64_t page_id = page_count;
+    while (page_id > 0 && is_free(page_id - 1)) {
+        page_id--;
+    }
+    return page_id;
+}
+
+void PageAllocator::create(uint64_t total_pages, const std::vector<uint64_t>& free_list) {
+    // The bitmap pages go after the existing pages and must cover
+    // themselves too
+    uint64_t bitmap_count = 1;
+    while (bitmap_count * BITMAP_PAGE_BITS < total_pages + bitmap_count) {
+        bitmap_count++;
+    }
+
+    page_count = total_pages + bitmap_count;
+    free_bits.assign(bitmap_count * BITMAP_PAGE_WORDS, 0);
+    dirty.assign(bitmap_count, true);
+    bitmap_pages.clear();
+    for (uint64_t i = 0; i < bitmap_count; i++) {
+        bitmap_pages.push_back(total_pages + i);
+    }
+    reserved.clear();
+    free_count = 0;
+    search_word = 0;
+
+    for (uint64_t page_id : free_list) {
+        if (page_id != 0 && page_id < total_pages && !is_free(page_id)) {
+            set_free(page_id, true);
+            free_count++;
+        }
+    }
+}
+
+bool PageAllocator::load(uint64_t first_page, uint64_t total_pages, const PageReader& read_page) {
+    free_bits.clear();
+    bitmap_pages.clear();
+    dirty.clear();
+    reserved.clear();
+    page_count = total_pages;
+    free_count = 0;
+    search_word = 0;
+
+    // A chain longer than the file needs ends in a page appended by an
+    // extension whose header never reached the log; it is rebuilt in place
+    uint64_t page_id = first_page;
+    while (bitmap_pages.size() * BITMAP_PAGE_BITS < total_pages) {
+        Page page;
+        if (page_id == 0 || page_id >= total_pages || !read_page(page_id, page) ||
+            page.header.type != ALLOCATION_BITMAP || !page.verify_checksum()) {
+            std::cerr << "Allocation bitmap page " << page_id << " is damaged" << std::endl;
+            return false;
+        }
+
+        size_t base = free_bits.size();
+        free_bits.resize(base + BITMAP_PAGE_WORDS);
+        memcpy(&free_bits[base], page.data, PAGE_DATA_SIZE);
+        bitmap_pages.push_back(page_id);
+        dirty.push_back(false);
+        page_id = page.header.next_free_page;
+    }
+
+    // Likewise, bits for pages past the end of the file are dropped
+    for (uint64_t id = total_pages; id < free_bits.size() * 64; id++) {
+        if (is_free(id)) {
+            set_free(id, false);
+        }
+    }
+    for (uint64_t word : free_bits) {
+        free_count += __builtin_popcountll(word);
+    }
+    return true;
+}
+
+uint64_t PageAllocator::allocate() {
+    if (reserved.empty()) {
+        // Refill with the next free pages after the last refill, then with
+        // new pages at the end of the file
+        size_t words = free_bits.size();
+        size_t start = search_word;
+        for (size_t scanned = 0; scanned < words && reserved.size() < ALLOCATION_BATCH; scanned++) {
+            size_t word = (start + scanned) % words;
+            uint64_t bits = free_bits[word];
+            while (bits != 0 && reserved.size() < ALLOCATION_BATCH) {
+                reserved.push_back(word * 64 + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+            search_word = word;
+        }
+        if (reserved.size() < ALLOCATION_BATCH) {
+            uint64_t first_new = page_count;
+            extend(ALLOCATION_BATCH - reserved.size());
+            for (uint64_t page_id = first_new; page_id < page_count; page_id++) {
+                if (is_free(page_id)) {
+                    reserved.push_back(page_id);
+                }
+            }
+        }
+
+        for (uint64_t page_id : reserved) {
+            set_free(page_id, false);
+        }
+        free_count -= reserved.size();
+
+        // Handed out lowest first
+        std::sort(reserved.rbegin(), reserved.rend());
+    }
+
+    uint64_t page_id = reserved.back();
+    reserved.pop_back();
+    return page_id;
+}
+
+void PageAllocator::take_run(uint64_t first_page, uint64_t count) {
+    for (uint64_t page_id = first_page; page_id < first_page + count; page_id++) {
+        set_free(page_id, false);
+    }
+    free_count -= count;
+}
+
+uint64_t PageAllocator::find_free_run(uint64_t count, uint64_t limit) const {
+    // First fit, a word at a time where a word is all free or all taken
+    uint64_t run_start = 0;
+    uint64_t run_length = 0;
+    for (uint64_t page_id = 0; page_id < limit && run_length < count;) {
+        uint64_t word = free_bits[page_id / 64];
+        if (page_id % 64 == 0 && page_id + 64 <= limit && (word == 0 || word == ~0ULL)) {
+            if (word == 0) {
+                run_length = 0;
+            } else {
+                run_start = run_length == 0 ? page_id : run_start;
+                run_length += 64;
+            }
+            page_id += 64;
+            continue;
+        }
+
+        if (is_free(page_id)) {
+            run_start = run_length == 0 ? page_id : run_start;
+            run_length++;
+        } else {
+            run_length = 0;
+        }
+        page_id++;
+    }
+    return run_length >= count ? run_start : 0;
+}
+
+uint64_t PageAllocator::allocate_run(uint64_t count) {
+    if (count == 0 || count >= BITMAP_PAGE_BITS) {
+        std::cerr << "Cannot allocate a run of " << count << " pages" << std::endl;
+        return 0;
+    }
+
+    // Without a free run, extend the free tail of the file; a bitmap page
+    // added on the way splits the run, so the loop then starts over past it
+    uint64_t run_start = find_free_run(count, page_count);
+    if (run_start == 0) {
+        while (true) {
+            run_start = trailing_free_start();
+            if (page_count - run_start >= count) {
+                break;
+            }
+            extend(count - (page_count - run_start));
+        }
+    }
+
+    take_run(run_start, count);
+    return run_start;
+}
+
+uint64_t PageAllocator::allocate_run_below(uint64_t count, uint64_t limit) {
+    uint64_t run_start = count == 0 ? 0 : find_free_run(count, std::min(limit, page_count));
+    if (run_start != 0) {
+        take_run(run_start, count);
+    }
+    return run_start;
+}
+
+void PageAllocator::free_run(uint64_t first_page, uint64_t count) {
+    for (uint64_t page_id = first_page; page_id < first_page + count; page_id++) {
+        if (page_id == 0 || page_id >= page_count || is_free(page_id) ||
+            std::find(bitmap_pages.begin(), bitmap_pages.end(), page_id) != bitmap_pages.end()) {
+            std::cerr << "Ignoring free of page " << page_id << ": not an allocated page" << std::endl;
+            continue;
+        }
+        set_free(page_id, true);
+        free_count++;
+    }
+
+    // Reuse freed space before anything further along
+    search_word = std::min<size_t>(search_word, first_page / 64);
+}
+
+void PageAllocator::release_reserved() {
+    for (uint64_t page_id : reserved) {
+        set_free(page_id, true);
+    }
+    free_count += reserved.size();
+    if (!reserved.empty()) {
+        search_word = std::min<size_t>(search_word, reserved.back() / 64);
+    }
+    reserved.clear();
+}
+
+std::vector<uint64_t> PageAllocator::allocated_pages(uint64_t first_page) const {
+    std::vector<uint64_t> pages;
+    for (uint64_t page_id = std::max<uint64_t>(first_page, 1); page_id < page_count; page_id++) {
+        if (!is_free(page_id) &&
+            std::find(bitmap_pages.begin(), bitmap_pages.end(), page_id) == bitmap_pages.end()) {
+            pages.push_back(page_id);
+        }
+    }
+    return pages;
+}
+
+uint64_t PageAllocator::truncate() {
+    release_reserved();
+    uint64_t old_count = page_count;
+
+    while (true) {
+        uint64_t end = trailing_free_start();
+        for (uint64_t page_id = end; page_id < page_count; page_id++) {
+            set_free(page_id, false);
+            free_count--;
+        }
+        page_count = end;
+
+        // An appended bitmap page left last covers nothing but itself
+        size_t last = bitmap_pages.size() - 1;
+        if (last > 0 && bitmap_pages[last] == last * BITMAP_PAGE_BITS && page_count == bitmap_pages[last] + 1) {
+            bitmap_pages.pop_back();
+            dirty.pop_back();
+            dirty.back() = true;  // Its link goes
+            free_bits.resize(free_bits.size() - BITMAP_PAGE_WORDS);
+            page_count--;
+            continue;
+        }
+        break;
+    }
+
+    if (search_word >= free_bits.size()) {
+        search_word = 0;
+    }
+    return old_count - page_count;
+}
+
+bool PageAllocator::has_dirty() const {
+    return std::find(dirty.begin(), dirty.end(), true) != dirty.end();
+}
+
+void PageAllocator::flush(const PageLogger& log_page) {
+    for (size_t i = 0; i < bitmap_pages.size(); i++) {
+        if (!dirty[i]) {
+            continue;
+        }
+
+        Page page;
+        page.header.type = ALLOCATION_BITMAP;
+        page.header.next_free_page = i + 1 < bitmap_pages.size() ? bitmap_pages[i + 1] : 0;
+        memcpy(page.data, &free_bits[i * BITMAP_PAGE_WORDS], PAGE_DATA_SIZE);
+        page.update_checksum();
+        log_page(bitmap_pages[i], page);
+        dirty[i] = false;
+    }
+}
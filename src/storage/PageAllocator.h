@@ -0,0 +1,104 @@
+#ifndef PAGE_ALLOCATOR_H
+#define PAGE_ALLOCATOR_H
+
+#include "Page.h"
+#include <functional>
+#include <vector>
+
+// One bit per page in each bitmap page's data area (set = free). Bitmap
+// page k covers pages [k * BITMAP_PAGE_BITS, (k + 1) * BITMAP_PAGE_BITS);
+// bitmap pages are chained through header.next_free_page.
+const uint64_t BITMAP_PAGE_BITS = PAGE_DATA_SIZE * 8;
+
+// Pages a single-page allocation takes out of the logged bitmap at once.
+// A crash leaks at most this many, never hands one out twice.
+const uint64_t ALLOCATION_BATCH = 64;
+
+// Free-space bitmap for the data file, cached whole in memory (4 KB per
+// 126 MB of file). Changes are made in memory and mark their bitmap page
+// dirty; the owner logs the dirty images through flush() in batches.
+//
+// An allocation must reach the log before any page that points at it, so
+// the owner flushes right after allocating. Frees may wait for the next
+// flush: until then the page merely stays allocated on disk.
+//
+// Not thread-safe; DatabaseEngine calls it under header_mutex.
+class PageAllocator {
+public:
+    using PageReader = std::function<bool(uint64_t page_id, Page& page)>;
+    using PageLogger = std::function<void(uint64_t page_id, const Page& page)>;
+
+private:
+    std::vector<uint64_t> free_bits;     // Covers every bitmap page's range
+    std::vector<uint64_t> bitmap_pages;  // Ids in chain order
+    std::vector<bool> dirty;             // Per bitmap page: not logged yet
+    std::vector<uint64_t> reserved;      // Allocated on disk, not handed out
+    uint64_t page_count;                 // The header's total_pages
+    uint64_t free_count;
+    size_t search_word;                  // Where single allocations scan from
+
+    bool is_free(uint64_t page_id) const;
+    void set_free(uint64_t page_id, bool free);
+
+    // Add count free pages at the end of the file, inserting a bitmap page
+    // whenever the file reaches past the covered range
+    void extend(uint64_t count);
+    void add_bitmap_page();
+
+    // Start of the free run at the end of the file (page_count if none)
+    uint64_t trailing_free_start() const;
+
+    // First fit for count free pages ending at or before limit; 0 if none
+    uint64_t find_free_run(uint64_t count, uint64_t limit) const;
+    void take_run(uint64_t first_page, uint64_t count);
+
+public:
+    PageAllocator();
+
+    // Bitmap for a file of total_pages pages where only free_list is free
+    // (a new database, or one still using the old free list). Every bitmap
+    // page comes out dirty.
+    void create(uint64_t total_pages, const std::vector<uint64_t>& free_list);
+
+    // Read the chain starting at first_page. False if it is damaged.
+    bool load(uint64_t first_page, uint64_t total_pages, const PageReader& read_page);
+
+    // One page, from the reserve, or after refilling it
+    uint64_t allocate();
+
+    // count contiguous pages (at most BITMAP_PAGE_BITS - 1); returns the
+    // first, or 0 when count is out of range
+    uint64_t allocate_run(uint64_t count);
+
+    // count contiguous pages that all lie before limit, for moving pages
+    // toward the front of the file; 0 when there is no such run
+    uint64_t allocate_run_below(uint64_t count, uint64_t limit);
+
+    // Pages [first_page, first_page + count). Pages that are not allocated
+    // (already free, out of range, or bitmap pages) are reported and skipped.
+    void free_run(uint64_t first_page, uint64_t count);
+
+    // Give unused reserved pages back
+    void release_reserved();
+
+    // Allocated pages from first_page to the end of the file, bitmap pages
+    // left out
+    std::vector<uint64_t> allocated_pages(uint64_t first_page) const;
+
+    // Give the reserve back, then cut the free pages (and any appended
+    // bitmap page left covering only itself) off the end of the file.
+    // Returns how many pages went.
+    uint64_t truncate();
+
+    // Log every dirty bitmap page
+    bool has_dirty() const;
+    void flush(const PageLogger& log_page);
+
+    uint64_t first_bitmap_page() const { return bitmap_pages.empty() ? 0 : bitmap_pages[0]; }
+    uint64_t get_page_count() const { return page_count; }
+
+    // Free pages, counting the reserve as allocated
+    uint64_t get_free_count() const { return free_count; }
+};
+
+#endif // PAGE_ALLOCATOR_H
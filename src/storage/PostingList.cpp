@@ -0,0 +1,209 @@
+#include "PostingList.h"
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+
+static void write_varint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static bool read_varint(const uint8_t*& pos, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+        uint8_t byte = *pos++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void encode_posting(std::vector<uint8_t>& out, uint64_t last_doc, const Posting& posting) {
+    int64_t delta = static_cast<int64_t>(posting.doc_id - last_doc);
+    write_varint(out, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+    write_varint(out, posting.group_id);
+}
+
+PostingIndex::PostingIndex(RecordHeap* heap, HashTable* table)
+    : record_heap(heap), term_table(table) {
+}
+
+bool PostingIndex::read_block(const RecordLocation& loc, std::vector<Posting>& out, RecordLocation& previous) {
+    RecordView view;
+    if (!record_heap->read(loc, view) || view.size < POSTING_BLOCK_HEADER_SIZE ||
+        view.data[0] != POSTING_BLOCK_FORMAT) {
+        return false;
+    }
+
+    uint16_t count;
+    previous = RecordLocation();
+    memcpy(&previous.page_id, view.data + 1, sizeof(previous.page_id));
+    memcpy(&previous.offset, view.data + 9, sizeof(previous.offset));
+    memcpy(&count, view.data + 11, sizeof(count));
+
+    const uint8_t* pos = view.data + POSTING_BLOCK_HEADER_SIZE;
+    const uint8_t* end = view.data + view.size;
+    uint64_t doc = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        uint64_t delta, group;
+        if (!read_varint(pos, end, delta) || !read_varint(pos, end, group)) {
+            return false;
+        }
+        doc += static_cast<uint64_t>(static_cast<int64_t>(delta >> 1) ^ -static_cast<int64_t>(delta & 1));
+        out.emplace_back(group, doc);
+    }
+    return true;
+}
+
+bool PostingIndex::append(const std::string& term, const Posting& posting) {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+
+    // Entries of the old single-message keyword map have no size and are
+    // not blocks; a list simply starts over
+    bool found;
+    RecordLocation tail = term_table->search(term, found);
+    bool has_tail = found && tail.size != 0;
+
+    if (has_tail) {
+        std::vector<uint8_t> block;
+        {
+            RecordView view;
+            if (record_heap->read(tail, view) && view.size >= POSTING_BLOCK_HEADER_SIZE &&
+                view.data[0] == POSTING_BLOCK_FORMAT) {
+                block.assign(view.data, view.data + view.size);
+            }
+        }
+
+        if (!block.empty()) {
+            uint16_t count;
+            uint64_t last_doc;
+            memcpy(&count, block.data() + 11, sizeof(count));
+            memcpy(&last_doc, block.data() + 13, sizeof(last_doc));
+
+            std::vector<uint8_t> encoded;
+            encode_posting(encoded, last_doc, posting);
+            if (block.size() + encoded.size() <= POSTING_BLOCK_SIZE && count < UINT16_MAX) {
+                // Room left in the newest block: extend it in place
+                block.insert(block.end(), encoded.begin(), encoded.end());
+                count++;
+                memcpy(block.data() + 11, &count, sizeof(count));
+                memcpy(block.data() + 13, &posting.doc_id, sizeof(posting.doc_id));
+                return record_heap->update(tail, block.data(), block.size());
+            }
+        } else {
+            has_tail = false;
+        }
+    }
+
+    // Start a new block in front of the current one
+    std::vector<uint8_t> block(POSTING_BLOCK_HEADER_SIZE, 0);
+    uint16_t count = 1;
+    block[0] = POSTING_BLOCK_FORMAT;
+    if (has_tail) {
+        memcpy(block.data() + 1, &tail.page_id, sizeof(tail.page_id));
+        memcpy(block.data() + 9, &tail.offset, sizeof(tail.offset));
+    }
+    memcpy(block.data() + 11, &count, sizeof(count));
+    memcpy(block.data() + 13, &posting.doc_id, sizeof(posting.doc_id));
+    encode_posting(block, 0, posting);
+
+    RecordLocation loc = record_heap->insert(block.data(), block.size());
+    if (loc.page_id == 0) {
+        std::cerr << "Failed to store posting block for '" << term << "'" << std::endl;
+        return false;
+    }
+    return term_table->insert(term, loc);
+}
+
+std::vector<uint64_t> PostingIndex::lookup(const std::string& term, uint64_t group_id) {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+
+    std::vector<uint64_t> docs;
+    bool found;
+    RecordLocation loc = term_table->search(term, found);
+    if (!found || loc.size == 0) {
+        return docs;
+    }
+
+    // Blocks are reached newest first; keep each one's postings apart and
+    // emit them oldest first
+    std::vector<std::vector<Posting>> blocks;
+    while (loc.page_id != 0) {
+        RecordLocation previous;
+        blocks.emplace_back();
+        if (!read_block(loc, blocks.back(), previous)) {
+            std::cerr << "Corrupt posting block for '" << term << "'" << std::endl;
+            break;
+        }
+        loc = previous;
+    }
+
+    for (auto block = blocks.rbegin(); block != blocks.rend(); ++block) {
+        for (const auto& posting : *block) {
+            if (group_id == 0 || posting.group_id == group_id) {
+                docs.push_back(posting.doc_id);
+            }
+        }
+    }
+
+    // Documents indexed out of order or twice still come back sorted once
+    if (!std::is_sorted(docs.begin(), docs.end())) {
+        std::sort(docs.begin(), docs.end());
+    }
+    docs.erase(std::unique(docs.begin(), docs.end()), docs.end());
+    return docs;
+}
+
+std::vector<uint64_t> PostingIndex::intersect(std::vector<std::vector<uint64_t>> lists) {
+    if (lists.empty()) {
+        return {};
+    }
+
+    std::sort(lists.begin(), lists.end(),
+              [](const std::vector<uint64_t>& a, const std::vector<uint64_t>& b) { return a.size() < b.size(); });
+
+    std::vector<uint64_t> result = std::move(lists[0]);
+    for (size_t i = 1; i < lists.size() && !result.empty(); i++) {
+        const std::vector<uint64_t>& other = lists[i];
+        std::vector<uint64_t> matched;
+        size_t pos = 0;
+
+        for (uint64_t doc : result) {
+            // Gallop: double the stride until passing doc, then binary
+            // search the last stride
+            size_t bound = 1;
+            while (pos + bound < other.size() && other[pos + bound] < doc) {
+                bound *= 2;
+            }
+            size_t last = std::min(pos + bound + 1, other.size());
+            pos = std::lower_bound(other.begin() + pos + bound / 2, other.begin() + last, doc) - other.begin();
+
+            if (pos == other.size()) {
+                break;
+            }
+            if (other[pos] == doc) {
+                matched.push_back(doc);
+            }
+        }
+        result = std::move(matched);
+    }
+
+    return result;
+}
+
+std::vector<uint64_t> PostingIndex::unite(const std::vector<std::vector<uint64_t>>& lists) {
+    std::vector<uint64_t> result;
+    for (const auto& list : lists) {
+        std::vector<uint64_t> merged;
+        merged.reserve(result.size() + list.size());
+        std::set_union(result.begin(), result.end(), list.begin(), list.end(), std::back_inserter(merged));
+        result = std::move(merged);
+    }
+    return result;
+}
@@ -0,0 +1,62 @@
+#ifndef POSTING_LIST_H
+#define POSTING_LIST_H
+
+#include "RecordHeap.h"
+#include "HashTable.h"
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// Inverted index: term -> posting list of (group_id, doc_id), e.g. keyword
+// -> (meeting_id, message_id). A list is a chain of append-only blocks in
+// the record heap. The hash table maps each term to its newest block and
+// every block points back at the one before it.
+//
+// Block layout (one heap record):
+//   [format u8][previous block page u64][previous block slot u16]
+//   [count u16][last doc_id u64]
+//   then per posting [varint zigzag(doc_id - previous doc_id)][varint group_id]
+// Doc ids mostly grow, so a posting usually takes two or three bytes. Once
+// a block is full it is never rewritten; new postings start a block in
+// front of it.
+const uint8_t POSTING_BLOCK_FORMAT = 1;
+const size_t POSTING_BLOCK_HEADER_SIZE = 1 + sizeof(uint64_t) + 2 * sizeof(uint16_t) + sizeof(uint64_t);
+const size_t POSTING_BLOCK_SIZE = 512;
+
+struct Posting {
+    uint64_t group_id;
+    uint64_t doc_id;
+
+    Posting() : group_id(0), doc_id(0) {}
+    Posting(uint64_t group, uint64_t doc) : group_id(group), doc_id(doc) {}
+};
+
+class PostingIndex {
+private:
+    RecordHeap* record_heap;
+    HashTable* term_table;
+
+    // Appends take it exclusively; lookups share it
+    std::shared_mutex index_mutex;
+
+    // Decodes a block's postings onto out; previous gets the block before
+    // it (page_id 0 for the oldest)
+    bool read_block(const RecordLocation& loc, std::vector<Posting>& out, RecordLocation& previous);
+
+public:
+    PostingIndex(RecordHeap* heap, HashTable* table);
+
+    bool append(const std::string& term, const Posting& posting);
+
+    // Doc ids of a term in ascending order. A non-zero group_id keeps only
+    // that group's postings, without touching the documents.
+    std::vector<uint64_t> lookup(const std::string& term, uint64_t group_id = 0);
+
+    // AND / OR of ascending doc id lists. intersect walks the lists from
+    // the shortest and gallops through the longer ones, so its cost follows
+    // the shortest list rather than the longest.
+    static std::vector<uint64_t> intersect(std::vector<std::vector<uint64_t>> lists);
+    static std::vector<uint64_t> unite(const std::vector<std::vector<uint64_t>>& lists);
+};
+
+#endif // POSTING_LIST_H
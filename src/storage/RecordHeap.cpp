@@ -0,0 +1,590 @@
+#include "RecordHeap.h"
+#include <iostream>
+#include <cstring>
+
+namespace {
+
+HeapPageHeader get_heap_header(const Page& page) {
+    HeapPageHeader header;
+    memcpy(&header, page.data, sizeof(header));
+    return header;
+}
+
+void put_heap_header(Page& page, const HeapPageHeader& header) {
+    memcpy(page.data, &header, sizeof(header));
+}
+
+HeapSlot get_slot(const Page& page, uint16_t slot) {
+    HeapSlot entry;
+    memcpy(&entry, page.data + HEAP_PAGE_HEADER_SIZE + slot * HEAP_SLOT_SIZE, sizeof(entry));
+    return entry;
+}
+
+void put_slot(Page& page, uint16_t slot, const HeapSlot& entry) {
+    memcpy(page.data + HEAP_PAGE_HEADER_SIZE + slot * HEAP_SLOT_SIZE, &entry, sizeof(entry));
+}
+
+uint16_t slot_length(const HeapSlot& entry) {
+    return entry.length & ~HEAP_FORWARD_FLAG;
+}
+
+uint16_t slot_directory_end(const HeapPageHeader& header) {
+    return HEAP_PAGE_HEADER_SIZE + header.slot_count * HEAP_SLOT_SIZE;
+}
+
+void init_heap_page(Page& page) {
+    page = Page();
+    page.header.type = RECORD_HEAP;
+
+    HeapPageHeader header;
+    header.slot_count = 0;
+    header.free_end = PAGE_DATA_SIZE;
+    header.live_bytes = 0;
+    header.reserved = 0;
+    put_heap_header(page, header);
+}
+
+// Free bytes once the page is compacted
+uint16_t heap_free_space(const Page& page) {
+    HeapPageHeader header = get_heap_header(page);
+    return PAGE_DATA_SIZE - slot_directory_end(header) - header.live_bytes;
+}
+
+// Slide every live record to the end of the page, closing the holes left
+// by deleted or resized records
+void compact_heap_page(Page& page) {
+    HeapPageHeader header = get_heap_header(page);
+    uint8_t records[PAGE_DATA_SIZE];
+    uint16_t end = PAGE_DATA_SIZE;
+
+    for (uint16_t i = 0; i < header.slot_count; i++) {
+        HeapSlot entry = get_slot(page, i);
+        if (entry.offset == 0) {
+            continue;
+        }
+        uint16_t length = slot_length(entry);
+        end -= length;
+        memcpy(records + end, page.data + entry.offset, length);
+        entry.offset = end;
+        put_slot(page, i, entry);
+    }
+
+    memcpy(page.data + end, records + end, PAGE_DATA_SIZE - end);
+    header.free_end = end;
+    put_heap_header(page, header);
+}
+
+// Copy bytes into the record area. Caller has checked heap_free_space.
+uint16_t place_record(Page& page, const uint8_t* data, uint16_t size) {
+    HeapPageHeader header = get_heap_header(page);
+    if (header.free_end - slot_directory_end(header) < size) {
+        compact_heap_page(page);
+        header = get_heap_header(page);
+    }
+
+    header.free_end -= size;
+    memcpy(page.data + header.free_end, data, size);
+    header.live_bytes += size;
+    put_heap_header(page, header);
+    return header.free_end;
+}
+
+// Returns the slot used, or -1 if the page is too full
+int heap_page_insert(Page& page, const uint8_t* data, uint16_t size, uint16_t flags) {
+    HeapPageHeader header = get_heap_header(page);
+
+    // Reuse an empty slot before growing the directory
+    uint16_t slot = header.slot_count;
+    for (uint16_t i = 0; i < header.slot_count; i++) {
+        if (get_slot(page, i).offset == 0) {
+            slot = i;
+            break;
+        }
+    }
+
+    bool new_slot = (slot == header.slot_count);
+    uint16_t needed = size + (new_slot ? HEAP_SLOT_SIZE : 0);
+    if (heap_free_space(page) < needed) {
+        return -1;
+    }
+
+    if (new_slot) {
+        // The directory must not grow into record bytes
+        if (header.free_end - slot_directory_end(header) < needed) {
+            compact_heap_page(page);
+            header = get_heap_header(page);
+        }
+        header.slot_count++;
+        put_heap_header(page, header);
+        put_slot(page, slot, HeapSlot{0, 0});
+    }
+
+    uint16_t offset = place_record(page, data, size);
+    put_slot(page, slot, HeapSlot{offset, static_cast<uint16_t>(size | flags)});
+    return slot;
+}
+
+// Replace a live slot's contents, in place when it does not grow
+bool heap_page_replace(Page& page, uint16_t slot, const uint8_t* data, uint16_t size, uint16_t flags) {
+    HeapPageHeader header = get_heap_header(page);
+    HeapSlot entry = get_slot(page, slot);
+    uint16_t old_length = slot_length(entry);
+
+    if (size <= old_length) {
+        memcpy(page.data + entry.offset, data, size);
+        header.live_bytes -= old_length - size;
+        put_heap_header(page, header);
+        put_slot(page, slot, HeapSlot{entry.offset, static_cast<uint16_t>(size | flags)});
+        return true;
+    }
+
+    if (heap_free_space(page) + old_length < size) {
+        return false;
+    }
+
+    // Drop the old bytes so compaction can reclaim them
+    header.live_bytes -= old_length;
+    put_heap_header(page, header);
+    put_slot(page, slot, HeapSlot{0, 0});
+
+    uint16_t offset = place_record(page, data, size);
+    put_slot(page, slot, HeapSlot{offset, static_cast<uint16_t>(size | flags)});
+    return true;
+}
+
+void heap_page_erase(Page& page, uint16_t slot) {
+    HeapPageHeader header = get_heap_header(page);
+    header.live_bytes -= slot_length(get_slot(page, slot));
+    put_slot(page, slot, HeapSlot{0, 0});
+
+    // Trailing empty slots can go; earlier ones must keep their numbers
+    while (header.slot_count > 0 && get_slot(page, header.slot_count - 1).offset == 0) {
+        header.slot_count--;
+    }
+    put_heap_header(page, header);
+}
+
+bool lookup_slot(const Page& page, uint16_t slot, HeapSlot& out) {
+    if (page.header.type != RECORD_HEAP) {
+        return false;
+    }
+    HeapPageHeader header = get_heap_header(page);
+    if (slot >= header.slot_count) {
+        return false;
+    }
+    out = get_slot(page, slot);
+    return out.offset != 0;
+}
+
+void encode_forward(uint8_t* stub, uint64_t page_id, uint16_t slot) {
+    memcpy(stub, &page_id, sizeof(page_id));
+    memcpy(stub + sizeof(page_id), &slot, sizeof(slot));
+}
+
+void decode_forward(const uint8_t* stub, uint64_t& page_id, uint16_t& slot) {
+    memcpy(&page_id, stub, sizeof(page_id));
+    memcpy(&slot, stub + sizeof(page_id), sizeof(slot));
+}
+
+}
+
+RecordHeap::RecordHeap(DatabaseEngine* engine)
+    : db_engine(engine), fsm_directory_page_id(0), fsm_pages(FSM_DIRECTORY_ENTRIES, 0) {
+    db_engine->add_relocator(this, [this](const RelocationSet& set) { relocate(set); });
+}
+
+RecordHeap::~RecordHeap() {
+    db_engine->remove_relocator(this);
+    if (db_engine->is_open()) {
+        flush();
+    }
+}
+
+void RecordHeap::initialize() {
+    std::unique_lock<std::shared_mutex> lock(heap_mutex);
+
+    fsm_directory_page_id = db_engine->allocate_page();
+    fsm_pages.assign(FSM_DIRECTORY_ENTRIES, 0);
+    page_space.clear();
+    space_index.clear();
+    pending_fsm.clear();
+
+    Page directory;
+    directory.header.type = FREE_SPACE_MAP;
+    db_engine->write_page(fsm_directory_page_id, directory);
+
+    std::cout << "Record heap initialized with free-space map at page "
+              << fsm_directory_page_id << std::endl;
+}
+
+void RecordHeap::load(uint64_t fsm_directory_page) {
+    std::unique_lock<std::shared_mutex> lock(heap_mutex);
+
+    fsm_directory_page_id = fsm_directory_page;
+    page_space.clear();
+    space_index.clear();
+    pending_fsm.clear();
+
+    {
+        PageHandle directory = db_engine->pin_page(fsm_directory_page_id);
+        memcpy(fsm_pages.data(), directory->data, FSM_DIRECTORY_ENTRIES * sizeof(uint64_t));
+    }
+
+    for (uint32_t i = 0; i < FSM_DIRECTORY_ENTRIES; i++) {
+        if (fsm_pages[i] == 0) {
+            continue;
+        }
+
+        PageHandle fsm_page = db_engine->pin_page(fsm_pages[i]);
+        uint64_t first_page = static_cast<uint64_t>(i) * FSM_ENTRIES_PER_PAGE;
+        for (uint32_t j = 0; j < FSM_ENTRIES_PER_PAGE; j++) {
+            uint8_t space_class = fsm_page->data[j];
+            if (space_class != 0) {
+                page_space[first_page + j] = space_class;
+                space_index.insert({space_class, first_page + j});
+            }
+        }
+    }
+}
+
+void RecordHeap::set_page_space(uint64_t page_id, uint8_t space_class) {
+    auto it = page_space.find(page_id);
+    uint8_t old_class = (it == page_space.end()) ? 0 : it->second;
+    if (old_class == space_class) {
+        return;
+    }
+
+    if (old_class != 0) {
+        space_index.erase({old_class, page_id});
+    }
+    if (space_class != 0) {
+        page_space[page_id] = space_class;
+        space_index.insert({space_class, page_id});
+    } else {
+        page_space.erase(it);
+    }
+
+    pending_fsm[page_id] = space_class;
+}
+
+void RecordHeap::note_page_space(uint64_t page_id, const Page& page) {
+    set_page_space(page_id, heap_free_space(page) / FSM_SPACE_UNIT);
+}
+
+uint64_t RecordHeap::find_page_with_space(uint16_t needed) {
+    // Best fit: the fullest page that still has room
+    uint8_t space_class = (needed + FSM_SPACE_UNIT - 1) / FSM_SPACE_UNIT;
+    auto it = space_index.lower_bound({space_class, 0});
+    return (it == space_index.end()) ? 0 : it->second;
+}
+
+RecordLocation RecordHeap::insert_locked(const uint8_t* data, uint16_t size) {
+    if (size > HEAP_MAX_RECORD_SIZE) {
+        std::cerr << "Record too large for a heap page: " << size << " bytes" << std::endl;
+        return RecordLocation();
+    }
+
+    uint16_t needed = size + HEAP_SLOT_SIZE;
+    uint64_t page_id;
+    while ((page_id = find_page_with_space(needed)) != 0) {
+        Page page = db_engine->read_page(page_id);
+        if (page.header.type != RECORD_HEAP) {
+            // Stale entry: the page was freed and reused after the map was written
+            set_page_space(page_id, 0);
+            continue;
+        }
+
+        int slot = heap_page_insert(page, data, size, 0);
+        note_page_space(page_id, page);
+        if (slot >= 0) {
+            db_engine->write_page(page_id, page);
+            return RecordLocation(page_id, slot, size);
+        }
+    }
+
+    // No page has room: start a new one
+    page_id = db_engine->allocate_page();
+    Page page;
+    init_heap_page(page);
+    int slot = heap_page_insert(page, data, size, 0);
+    db_engine->write_page(page_id, page);
+    note_page_space(page_id, page);
+
+    return RecordLocation(page_id, slot, size);
+}
+
+void RecordHeap::remove_slot(uint64_t page_id, Page& page, uint16_t slot) {
+    heap_page_erase(page, slot);
+
+    if (get_heap_header(page).slot_count == 0) {
+        set_page_space(page_id, 0);
+        db_engine->free_page(page_id);
+    } else {
+        db_engine->write_page(page_id, page);
+        note_page_space(page_id, page);
+    }
+}
+
+RecordLocation RecordHeap::insert(const uint8_t* data, uint16_t size) {
+    std::unique_lock<std::shared_mutex> lock(heap_mutex);
+
+    RecordLocation loc = insert_locked(data, size);
+    if (pending_fsm.size() >= FSM_FLUSH_THRESHOLD) {
+        flush_locked();
+    }
+    return loc;
+}
+
+bool RecordHeap::read(const RecordLocation& loc, RecordView& out) {
+    // Never hold one page latch while taking another
+    out.page.release();
+    out.data = nullptr;
+    out.size = 0;
+    out.page = db_engine->pin_page(loc.page_id);
+
+    if (out.page->header.type != RECORD_HEAP) {
+        // Records written before the heap existed own their page
+        if (loc.offset + loc.size > PAGE_DATA_SIZE) {
+            out.page.release();
+            return false;
+        }
+        out.data = out.page->data + loc.offset;
+        out.size = loc.size;
+        return true;
+    }
+
+    HeapSlot entry;
+    if (!lookup_slot(*out.page, loc.offset, entry)) {
+        out.page.release();
+        return false;
+    }
+    if ((entry.length & HEAP_FORWARD_FLAG) == 0) {
+        out.data = out.page->data + entry.offset;
+        out.size = entry.length;
+        return true;
+    }
+
+    // Forwarded record: follow the stub under the heap lock so the record
+    // cannot move again between the two pages. The page latch is dropped
+    // first, since writers take heap_mutex before page latches.
+    out.page.release();
+    std::shared_lock<std::shared_mutex> lock(heap_mutex);
+
+    out.page = db_engine->pin_page(loc.page_id);
+    if (!lookup_slot(*out.page, loc.offset, entry)) {
+        out.page.release();
+        return false;
+    }
+    if ((entry.length & HEAP_FORWARD_FLAG) == 0) {
+        out.data = out.page->data + entry.offset;
+        out.size = entry.length;
+        return true;
+    }
+
+    uint64_t target_page;
+    uint16_t target_slot;
+    decode_forward(out.page->data + entry.offset, target_page, target_slot);
+
+    out.page.release();
+    out.page = db_engine->pin_page(target_page);
+    if (!lookup_slot(*out.page, target_slot, entry) || (entry.length & HEAP_FORWARD_FLAG) != 0) {
+        out.page.release();
+        return false;
+    }
+    out.data = out.page->data + entry.offset;
+    out.size = entry.length;
+    return true;
+}
+
+bool RecordHeap::update(const RecordLocation& loc, const uint8_t* data, uint16_t size) {
+    std::unique_lock<std::shared_mutex> lock(heap_mutex);
+
+    Page page = db_engine->read_page(loc.page_id);
+    if (page.header.type != RECORD_HEAP) {
+        // A page from before the heap holds one record at offset 0. It
+        // becomes a heap page with the new record in slot 0, which is the
+        // same location, so index entries stay valid and the record is free
+        // to change size.
+        if (loc.offset != 0 || size > HEAP_MAX_RECORD_SIZE) {
+            return false;
+        }
+        init_heap_page(page);
+        heap_page_insert(page, data, size, 0);
+        db_engine->write_page(loc.page_id, page);
+        note_page_space(loc.page_id, page);
+        return true;
+    }
+
+    HeapSlot entry;
+    if (!lookup_slot(page, loc.offset, entry) || size > HEAP_MAX_RECORD_SIZE) {
+        return false;
+    }
+
+    uint8_t stub[HEAP_FORWARD_STUB_SIZE];
+
+    if (entry.length & HEAP_FORWARD_FLAG) {
+        uint64_t target_page;
+        uint16_t target_slot;
+        decode_forward(page.data + entry.offset, target_page, target_slot);
+
+        Page target = db_engine->read_page(target_page);
+        HeapSlot target_entry;
+        if (!lookup_slot(target, target_slot, target_entry)) {
+            return false;
+        }
+        if (heap_page_replace(target, target_slot, data, size, 0)) {
+            db_engine->write_page(target_page, target);
+            note_page_space(target_page, target);
+        } else {
+            // Outgrew its second home too: move again and repoint the stub
+            RecordLocation moved = insert_locked(data, size);
+            if (moved.page_id == 0) {
+                return false;
+            }
+
+            target = db_engine->read_page(target_page);
+            remove_slot(target_page, target, target_slot);
+
+            page = db_engine->read_page(loc.page_id);
+            encode_forward(stub, moved.page_id, moved.offset);
+            heap_page_replace(page, loc.offset, stub, HEAP_FORWARD_STUB_SIZE, HEAP_FORWARD_FLAG);
+            db_engine->write_page(loc.page_id, page);
+            note_page_space(loc.page_id, page);
+        }
+    } else if (heap_page_replace(page, loc.offset, data, size, 0)) {
+        db_engine->write_page(loc.page_id, page);
+        note_page_space(loc.page_id, page);
+    } else {
+        // No room left in this page: move the record and leave a stub
+        RecordLocation moved = insert_locked(data, size);
+        if (moved.page_id == 0) {
+            return false;
+        }
+
+        page = db_engine->read_page(loc.page_id);
+        encode_forward(stub, moved.page_id, moved.offset);
+        if (!heap_page_replace(page, loc.offset, stub, HEAP_FORWARD_STUB_SIZE, HEAP_FORWARD_FLAG)) {
+            // Old record was shorter than a stub on a full page
+            Page moved_page = db_engine->read_page(moved.page_id);
+            remove_slot(moved.page_id, moved_page, moved.offset);
+            return false;
+        }
+        db_engine->write_page(loc.page_id, page);
+        note_page_space(loc.page_id, page);
+    }
+
+    if (pending_fsm.size() >= FSM_FLUSH_THRESHOLD) {
+        flush_locked();
+    }
+    return true;
+}
+
+bool RecordHeap::remove(const RecordLocation& loc) {
+    std::unique_lock<std::shared_mutex> lock(heap_mutex);
+
+    Page page = db_engine->read_page(loc.page_id);
+    if (page.header.type != RECORD_HEAP) {
+        // Records written before the heap existed own their page
+        db_engine->free_page(loc.page_id);
+        return true;
+    }
+
+    HeapSlot entry;
+    if (!lookup_slot(page, loc.offset, entry)) {
+        return false;
+    }
+
+    if (entry.length & HEAP_FORWARD_FLAG) {
+        uint64_t target_page;
+        uint16_t target_slot;
+        decode_forward(page.data + entry.offset, target_page, target_slot);
+
+        Page target = db_engine->read_page(target_page);
+        HeapSlot target_entry;
+        if (lookup_slot(target, target_slot, target_entry)) {
+            remove_slot(target_page, target, target_slot);
+        }
+
+        // The target may have shared this page
+        page = db_engine->read_page(loc.page_id);
+    }
+
+    remove_slot(loc.page_id, page, loc.offset);
+
+    if (pending_fsm.size() >= FSM_FLUSH_THRESHOLD) {
+        flush_locked();
+    }
+    return true;
+}
+
+void RecordHeap::flush() {
+    std::unique_lock<std::shared_mutex> lock(heap_mutex);
+    flush_locked();
+}
+
+void RecordHeap::flush_locked() {
+    if (fsm_directory_page_id == 0) {
+        return;
+    }
+
+    bool directory_changed = false;
+    auto it = pending_fsm.begin();
+    while (it != pending_fsm.end()) {
+        uint64_t fsm_index = it->first / FSM_ENTRIES_PER_PAGE;
+        if (fsm_index >= FSM_DIRECTORY_ENTRIES) {
+            // Past the directory's reach; such pages are only found in memory
+            ++it;
+            continue;
+        }
+
+        Page fsm_page;
+        if (fsm_pages[fsm_index] == 0) {
+            fsm_pages[fsm_index] = db_engine->allocate_page();
+            directory_changed = true;
+        } else {
+            fsm_page = db_engine->read_page(fsm_pages[fsm_index]);
+        }
+        fsm_page.header.type = FREE_SPACE_MAP;
+
+        // Apply every pending entry that falls in this FSM page
+        uint64_t first_page = fsm_index * FSM_ENTRIES_PER_PAGE;
+        while (it != pending_fsm.end() && it->first < first_page + FSM_ENTRIES_PER_PAGE) {
+            fsm_page.data[it->first - first_page] = it->second;
+            ++it;
+        }
+        db_engine->write_page(fsm_pages[fsm_index], fsm_page);
+    }
+    pending_fsm.clear();
+
+    if (directory_changed) {
+        write_directory();
+    }
+}
+
+void RecordHeap::write_directory() {
+    Page directory;
+    directory.header.type = FREE_SPACE_MAP;
+    memcpy(directory.data, fsm_pages.data(), FSM_DIRECTORY_ENTRIES * sizeof(uint64_t));
+    db_engine->write_page(fsm_directory_page_id, directory);
+}
+
+void RecordHeap::relocate(const RelocationSet& set) {
+    if (!set.has_type(FREE_SPACE_MAP)) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(heap_mutex);
+
+    bool directory_changed = false;
+    for (uint64_t& fsm_page : fsm_pages) {
+        if (fsm_page != 0 && set.contains(fsm_page)) {
+            uint64_t moved = db_engine->relocate_pages(fsm_page);
+            if (moved != 0) {
+                fsm_page = moved;
+                directory_changed = true;
+            }
+        }
+    }
+    if (directory_changed) {
+        write_directory();
+    }
+}
@@ -0,0 +1,134 @@
+#ifndef RECORD_HEAP_H
+#define RECORD_HEAP_H
+
+#include "DatabaseEngine.h"
+#include "BTree.h"
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+// Slotted heap page layout (inside Page::data):
+//   [HeapPageHeader][slot 0][slot 1]...  free  ...[record N]...[record 0]
+// The slot directory grows up from the front, record bytes grow down from
+// the end. A record is addressed by (page_id, slot), so records can move
+// inside their page during compaction without their location changing.
+struct HeapPageHeader {
+    uint16_t slot_count;
+    uint16_t free_end;      // first byte of the record area
+    uint16_t live_bytes;    // bytes held by live records
+    uint16_t reserved;
+};
+
+struct HeapSlot {
+    uint16_t offset;        // 0 = empty slot
+    uint16_t length;        // HEAP_FORWARD_FLAG set = forwarding stub
+};
+
+const uint16_t HEAP_PAGE_HEADER_SIZE = sizeof(HeapPageHeader);
+const uint16_t HEAP_SLOT_SIZE = sizeof(HeapSlot);
+const uint16_t HEAP_MAX_RECORD_SIZE = PAGE_DATA_SIZE - HEAP_PAGE_HEADER_SIZE - HEAP_SLOT_SIZE;
+
+// A record that outgrows its page moves elsewhere and leaves a stub holding
+// its new (page_id, slot), so index entries pointing at it stay valid
+const uint16_t HEAP_FORWARD_FLAG = 0x8000;
+const uint16_t HEAP_FORWARD_STUB_SIZE = sizeof(uint64_t) + sizeof(uint16_t);
+
+// Free-space map: one byte per page id holding free bytes / 16 (0 = not a
+// heap page or full). FSM pages are listed in a single directory page.
+const uint32_t FSM_ENTRIES_PER_PAGE = PAGE_DATA_SIZE;
+const uint32_t FSM_DIRECTORY_ENTRIES = PAGE_DATA_SIZE / sizeof(uint64_t);
+const uint32_t FSM_SPACE_UNIT = 16;
+
+// Free-space changes are buffered and written out in batches of this size.
+// The map is only a hint: a stale entry costs a wasted probe, never data.
+const size_t FSM_FLUSH_THRESHOLD = 64;
+
+// Pinned view of a record inside its heap page. data stays valid while the
+// view is alive; release it before updating the same record.
+struct RecordView {
+    PageHandle page;
+    const uint8_t* data = nullptr;
+    uint16_t size = 0;
+};
+
+// Heap file that packs variable-size records into shared slotted pages
+class RecordHeap {
+private:
+    DatabaseEngine* db_engine;
+    uint64_t fsm_directory_page_id;
+    std::vector<uint64_t> fsm_pages;    // directory contents, 0 = not allocated
+
+    // Exclusive for every mutation; forwarded reads take it shared so the
+    // stub and its target are read consistently
+    std::shared_mutex heap_mutex;
+
+    std::unordered_map<uint64_t, uint8_t> page_space;   // heap page -> space class
+    std::set<std::pair<uint8_t, uint64_t>> space_index; // best-fit lookup
+    std::map<uint64_t, uint8_t> pending_fsm;            // not yet written to FSM pages
+
+    void set_page_space(uint64_t page_id, uint8_t space_class);
+    void note_page_space(uint64_t page_id, const Page& page);
+    uint64_t find_page_with_space(uint16_t needed);
+
+    RecordLocation insert_locked(const uint8_t* data, uint16_t size);
+    void remove_slot(uint64_t page_id, Page& page, uint16_t slot);
+    void flush_locked();
+    void write_directory();
+
+    // Vacuum relocator: moves FSM pages. Heap pages stay put, since index
+    // entries address records by (page_id, slot); so does the directory.
+    void relocate(const RelocationSet& set);
+
+public:
+    RecordHeap(DatabaseEngine* engine);
+    ~RecordHeap();
+
+    // Create an empty free-space map directory
+    void initialize();
+
+    // Load the free-space map from its directory page
+    void load(uint64_t fsm_directory_page);
+
+    // Core operations. insert returns page_id 0 on failure. For heap pages
+    // loc.offset is the slot number; for pages written before the heap
+    // existed it is the byte offset of a record that owns the whole page
+    // (updating such a record turns its page into a heap page).
+    RecordLocation insert(const uint8_t* data, uint16_t size);
+    bool read(const RecordLocation& loc, RecordView& out);
+    bool update(const RecordLocation& loc, const uint8_t* data, uint16_t size);
+    bool remove(const RecordLocation& loc);
+
+    // Write buffered free-space changes to the FSM pages
+    void flush();
+
+    // Re-encode records of type T still in their version-1 fixed layout.
+    // Records are rewritten in place, so index entries stay valid.
+    template <typename T>
+    size_t reencode_legacy(const std::vector<RecordLocation>& locations) {
+        size_t migrated = 0;
+        for (const auto& loc : locations) {
+            T record;
+            {
+                RecordView view;
+                if (!read(loc, view) || view.size != T::legacy_size()) {
+                    continue;
+                }
+                record.deserialize_legacy(view.data);
+            }
+
+            std::vector<uint8_t> buffer;
+            record.encode(buffer);
+            if (update(loc, buffer.data(), buffer.size())) {
+                migrated++;
+            }
+        }
+        return migrated;
+    }
+
+    uint64_t get_fsm_page_id() const { return fsm_directory_page_id; }
+};
+
+#endif // RECORD_HEAP_H
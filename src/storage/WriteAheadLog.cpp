@@ -0,0 +1,254 @@
+#include "WriteAheadLog.h"
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+bool write_fully(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+size_t read_fully(int fd, uint8_t* data, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t got = ::read(fd, data + total, size - total);
+        if (got <= 0) {
+            break;
+        }
+        total += got;
+    }
+    return total;
+}
+
+}
+
+WriteAheadLog::WriteAheadLog(const std::string& filename)
+    : log_filename(filename), log_fd(-1), next_lsn(1), durable_lsn(0),
+      log_size(0), failed(false), flush_requested(false), stop_flusher(false) {
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    close();
+}
+
+bool WriteAheadLog::open(bool truncate) {
+    int flags = O_RDWR | O_CREAT;
+    if (truncate) {
+        flags |= O_TRUNC;
+    }
+
+    log_fd = ::open(log_filename.c_str(), flags, 0644);
+    if (log_fd < 0) {
+        std::cerr << "Failed to open write-ahead log: " << log_filename << std::endl;
+        return false;
+    }
+
+    log_size = ::lseek(log_fd, 0, SEEK_END);
+    failed = false;
+    stop_flusher = false;
+    flusher_thread = std::thread(&WriteAheadLog::flusher_worker, this);
+    return true;
+}
+
+void WriteAheadLog::close() {
+    if (log_fd < 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        stop_flusher = true;
+    }
+    flush_cv.notify_one();
+    if (flusher_thread.joinable()) {
+        flusher_thread.join();
+    }
+
+    ::close(log_fd);
+    log_fd = -1;
+}
+
+uint32_t WriteAheadLog::record_checksum(const WALRecordHeader& header, const uint8_t* image) {
+    WALRecordHeader unsummed = header;
+    unsummed.checksum = 0;
+
+    uint32_t hash = 2166136261u;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&unsummed);
+    for (size_t i = 0; i < sizeof(unsummed); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        hash = (hash ^ image[i]) * 16777619u;
+    }
+    return hash;
+}
+
+size_t WriteAheadLog::replay(const std::function<void(uint64_t page_id, const Page& page)>& apply) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+
+    ::lseek(log_fd, 0, SEEK_SET);
+
+    std::vector<uint8_t> record(WAL_RECORD_SIZE);
+    size_t applied = 0;
+
+    while (read_fully(log_fd, record.data(), WAL_RECORD_SIZE) == WAL_RECORD_SIZE) {
+        WALRecordHeader header;
+        memcpy(&header, record.data(), sizeof(header));
+        const uint8_t* image = record.data() + sizeof(header);
+
+        if (header.magic != WAL_RECORD_MAGIC ||
+            header.checksum != record_checksum(header, image)) {
+            break;  // Torn write at the tail of the log
+        }
+
+        Page page;
+        page.deserialize(image);
+        apply(header.page_id, page);
+
+        if (header.lsn >= next_lsn) {
+            next_lsn = header.lsn + 1;
+        }
+        applied++;
+    }
+
+    durable_lsn = next_lsn - 1;
+    ::lseek(log_fd, 0, SEEK_END);
+    return applied;
+}
+
+uint64_t WriteAheadLog::append(uint64_t page_id, Page& page) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+
+    WALRecordHeader header;
+    header.lsn = next_lsn++;
+    header.page_id = page_id;
+    page.header.page_lsn = header.lsn;
+    if (failed) {
+        return header.lsn;  // Never flushed; flush_to reports the failure
+    }
+
+    size_t offset = log_buffer.size();
+    log_buffer.resize(offset + WAL_RECORD_SIZE);
+    uint8_t* image = log_buffer.data() + offset + sizeof(header);
+    page.serialize(image);
+
+    header.checksum = record_checksum(header, image);
+    memcpy(log_buffer.data() + offset, &header, sizeof(header));
+
+    log_size += WAL_RECORD_SIZE;
+    return header.lsn;
+}
+
+bool WriteAheadLog::flush_to(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(log_mutex);
+
+    // Pages can carry LSNs from an earlier run; those are already on disk
+    if (lsn >= next_lsn) {
+        lsn = next_lsn - 1;
+    }
+    if (durable_lsn >= lsn || log_fd < 0) {
+        return true;
+    }
+
+    flush_requested = true;
+    flush_cv.notify_one();
+    durable_cv.wait(lock, [this, lsn] { return durable_lsn >= lsn || failed || stop_flusher; });
+    return durable_lsn >= lsn;
+}
+
+bool WriteAheadLog::flush_all() {
+    uint64_t last_lsn;
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        last_lsn = next_lsn - 1;
+    }
+    return flush_to(last_lsn);
+}
+
+void WriteAheadLog::flusher_worker() {
+    while (true) {
+        std::vector<uint8_t> batch;
+        uint64_t batch_lsn;
+
+        {
+            std::unique_lock<std::mutex> lock(log_mutex);
+            flush_cv.wait_for(lock, std::chrono::milliseconds(WAL_FLUSH_INTERVAL_MS), [this] {
+                return stop_flusher || (flush_requested && !log_buffer.empty());
+            });
+
+            flush_requested = false;
+            if (log_buffer.empty()) {
+                if (stop_flusher) {
+                    break;
+                }
+                continue;
+            }
+
+            // Take the whole buffer; appenders keep going into a fresh one
+            batch.swap(log_buffer);
+            batch_lsn = next_lsn - 1;
+        }
+
+        bool written = write_fully(log_fd, batch.data(), batch.size()) && ::fsync(log_fd) == 0;
+
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            if (written) {
+                durable_lsn = batch_lsn;
+            } else {
+                failed = true;
+                log_buffer.clear();
+            }
+        }
+        durable_cv.notify_all();
+
+        if (!written) {
+            std::cerr << "Error writing write-ahead log; no further commits are accepted" << std::endl;
+            break;
+        }
+    }
+
+    durable_cv.notify_all();
+}
+
+bool WriteAheadLog::reset() {
+    if (!flush_all()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(log_mutex);
+    if (::ftruncate(log_fd, 0) != 0 || ::fsync(log_fd) != 0) {
+        std::cerr << "Error truncating write-ahead log" << std::endl;
+        failed = true;
+        return false;
+    }
+    ::lseek(log_fd, 0, SEEK_SET);
+    log_size = 0;
+    return true;
+}
+
+uint64_t WriteAheadLog::get_log_size() {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    return log_size;
+}
+
+uint64_t WriteAheadLog::get_durable_lsn() {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    return durable_lsn;
+}
+
+bool WriteAheadLog::has_failed() {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    return failed;
+}
@@ -0,0 +1,89 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include "Page.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Group commit window: the flusher batches everything appended within this
+// interval (or since the last commit request) into a single fsync
+const uint32_t WAL_FLUSH_INTERVAL_MS = 10;
+
+const uint32_t WAL_RECORD_MAGIC = 0x524C4157;  // "WALR"
+
+// Log record header, followed by a full PAGE_SIZE page image
+struct WALRecordHeader {
+    uint32_t magic;
+    uint32_t checksum;      // FNV-1a over the header (checksum = 0) and image
+    uint64_t lsn;
+    uint64_t page_id;
+
+    WALRecordHeader() : magic(WAL_RECORD_MAGIC), checksum(0), lsn(0), page_id(0) {}
+};
+
+const size_t WAL_RECORD_SIZE = sizeof(WALRecordHeader) + PAGE_SIZE;
+
+// Append-only redo log of full page images. Every record gets a log
+// sequence number (LSN); a background flusher writes and fsyncs batches of
+// records so concurrent committers share one fsync (group commit).
+//
+// A failed write or fsync is final: the kernel may have dropped the dirty
+// log pages, so a retried fsync could report success for records that never
+// reached the disk. The log stops flushing and every later flush_to fails.
+class WriteAheadLog {
+private:
+    std::string log_filename;
+    int log_fd;
+
+    std::mutex log_mutex;
+    std::condition_variable flush_cv;    // wakes the flusher
+    std::condition_variable durable_cv;  // wakes committers waiting in flush_to
+    std::vector<uint8_t> log_buffer;     // records not yet handed to the flusher
+
+    uint64_t next_lsn;
+    uint64_t durable_lsn;     // every record <= durable_lsn is fsynced
+    uint64_t log_size;        // bytes appended since the last reset
+    bool failed;              // a write or fsync failed; nothing more becomes durable
+    bool flush_requested;
+    bool stop_flusher;
+    std::thread flusher_thread;
+
+    void flusher_worker();
+    static uint32_t record_checksum(const WALRecordHeader& header, const uint8_t* image);
+
+public:
+    WriteAheadLog(const std::string& filename);
+    ~WriteAheadLog();
+
+    // Open (optionally truncating) the log file and start the flusher
+    bool open(bool truncate);
+    void close();
+    bool is_open() const { return log_fd >= 0; }
+
+    // Crash recovery: hand every intact record to apply in LSN order,
+    // stopping at the first torn or corrupt record. Call right after open().
+    size_t replay(const std::function<void(uint64_t page_id, const Page& page)>& apply);
+
+    // Append a page image, stamping page.header.page_lsn. Returns the LSN.
+    uint64_t append(uint64_t page_id, Page& page);
+
+    // Block until every record up to lsn is durable (group commit). Returns
+    // false if the log failed before getting there.
+    bool flush_to(uint64_t lsn);
+    bool flush_all();
+
+    // Discard the log once a checkpoint has made the data file current.
+    // Caller must guarantee no concurrent appends. False (and the log is
+    // kept) if it could not be flushed or truncated.
+    bool reset();
+
+    uint64_t get_log_size();
+    uint64_t get_durable_lsn();
+    bool has_failed();
+};
+
+#endif // WRITE_AHEAD_LOG_H
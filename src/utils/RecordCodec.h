@@ -0,0 +1,163 @@
+#ifndef RECORD_CODEC_H
+#define RECORD_CODEC_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Compact record format (database version 2):
+//   [format byte][u16 presence mask][present fields, in declaration order]
+// Unsigned integers are LEB128 varints, signed ones are zigzag-encoded
+// first, strings are a varint length followed by the bytes (no NUL).
+// A field equal to its default (0 / empty) is left out and its mask bit
+// cleared, so optional fields cost nothing when unused.
+const uint8_t RECORD_FORMAT_COMPACT = 2;
+const size_t RECORD_CODEC_MAX_FIELDS = 16;
+
+class RecordWriter {
+private:
+    std::vector<uint8_t>& out;
+    size_t start;
+    uint16_t mask;
+    size_t field;
+
+    bool next_present(bool present) {
+        if (present) {
+            mask |= static_cast<uint16_t>(1u << field);
+        }
+        field++;
+        return present;
+    }
+
+    void write_varint(uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+public:
+    explicit RecordWriter(std::vector<uint8_t>& buffer)
+        : out(buffer), start(buffer.size()), mask(0), field(0) {
+        out.push_back(RECORD_FORMAT_COMPACT);
+        out.push_back(0);
+        out.push_back(0);
+    }
+
+    void put_uint(uint64_t value) {
+        if (next_present(value != 0)) {
+            write_varint(value);
+        }
+    }
+
+    void put_int(int64_t value) {
+        if (next_present(value != 0)) {
+            write_varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+        }
+    }
+
+    // Fixed char arrays: stops at the first NUL or at capacity
+    void put_string(const char* value, size_t capacity) {
+        size_t length = strnlen(value, capacity);
+        if (next_present(length != 0)) {
+            write_varint(length);
+            out.insert(out.end(), value, value + length);
+        }
+    }
+
+    // Patch in the presence mask. Readers tell version-1 records apart by
+    // their fixed size, so an encoding of exactly legacy_size is padded.
+    void finish(size_t legacy_size) {
+        memcpy(out.data() + start + 1, &mask, sizeof(mask));
+        if (out.size() - start == legacy_size) {
+            out.push_back(0);
+        }
+    }
+};
+
+// Decodes straight from the caller's buffer (typically a pinned page).
+// Any truncation or out-of-range value clears ok(); absent fields read as 0.
+class RecordReader {
+private:
+    const uint8_t* pos;
+    const uint8_t* end;
+    uint16_t mask;
+    size_t field;
+    bool valid;
+
+    bool next_present() {
+        return valid && (mask & (1u << field++)) != 0;
+    }
+
+    bool read_varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= end) {
+                break;
+            }
+            uint8_t byte = *pos++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        valid = false;
+        return false;
+    }
+
+public:
+    RecordReader(const uint8_t* data, size_t size)
+        : pos(data), end(data + size), mask(0), field(0),
+          valid(size >= 3 && data[0] == RECORD_FORMAT_COMPACT) {
+        if (valid) {
+            memcpy(&mask, data + 1, sizeof(mask));
+            pos += 3;
+        }
+    }
+
+    bool ok() const { return valid; }
+
+    template <typename T>
+    void get_uint(T& value) {
+        value = 0;
+        uint64_t raw;
+        if (next_present() && read_varint(raw)) {
+            value = static_cast<T>(raw);
+            if (static_cast<uint64_t>(value) != raw) {
+                valid = false;
+            }
+        }
+    }
+
+    template <typename T>
+    void get_int(T& value) {
+        value = 0;
+        uint64_t raw;
+        if (next_present() && read_varint(raw)) {
+            int64_t decoded = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+            value = static_cast<T>(decoded);
+            if (static_cast<int64_t>(value) != decoded) {
+                valid = false;
+            }
+        }
+    }
+
+    // Copies only the stored bytes plus a terminating NUL
+    void get_string(char* value, size_t capacity) {
+        value[0] = '\0';
+        uint64_t length;
+        if (!next_present() || !read_varint(length)) {
+            return;
+        }
+        if (length >= capacity || length > static_cast<uint64_t>(end - pos)) {
+            valid = false;
+            return;
+        }
+        memcpy(value, pos, length);
+        value[length] = '\0';
+        pos += length;
+    }
+};
+
+#endif // RECORD_CODEC_H
@@ -0,0 +1,210 @@
+// Crash recovery of the storage engine. Each case writes pages in a child
+// process that exits without closing the database, then reopens the file
+// here and checks the images the log brought back.
+// Usage: test_storage
+#include "DatabaseEngine.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+static const std::string path = "test_storage.db";
+
+// Few frames, so most of the written pages are evicted before the crash
+static const size_t POOL_FRAMES = 16;
+static const size_t PAGES = 200;
+
+static int failures = 0;
+
+static void check(bool condition, const std::string &what)
+{
+    if (!condition)
+    {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+static void reset_file()
+{
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    std::remove((path + ".pagemap").c_str());
+    std::remove((path + ".extents").c_str());
+}
+
+static off_t file_size(const std::string &name)
+{
+    struct stat st;
+    return ::stat(name.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+static Page make_page(uint64_t page_id, int round)
+{
+    Page page;
+    page.header.type = RECORD_HEAP;
+    for (size_t i = 0; i < PAGE_DATA_SIZE; i++)
+    {
+        page.data[i] = static_cast<uint8_t>(page_id * 31 + i * 7 + round);
+    }
+    return page;
+}
+
+static int crash_ids_fd = -1;
+
+// Called by a child with the database still open: hands the page ids it
+// wrote back to the parent and exits without closing anything
+static void crash(const std::vector<uint64_t> &page_ids)
+{
+    size_t bytes = page_ids.size() * sizeof(uint64_t);
+    _exit(::write(crash_ids_fd, page_ids.data(), bytes) == static_cast<ssize_t>(bytes) ? 0 : 4);
+}
+
+// Run body, which ends in crash(), in a child; true when it got there
+static bool crash_after(void (*body)(std::vector<uint64_t> &), std::vector<uint64_t> &page_ids)
+{
+    int ids[2];
+    if (::pipe(ids) != 0)
+    {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        ::close(ids[0]);
+        crash_ids_fd = ids[1];
+        body(page_ids);
+        _exit(5);
+    }
+    ::close(ids[1]);
+
+    std::vector<uint64_t> written;
+    uint64_t page_id;
+    while (::read(ids[0], &page_id, sizeof(page_id)) == static_cast<ssize_t>(sizeof(page_id)))
+    {
+        written.push_back(page_id);
+    }
+    ::close(ids[0]);
+    page_ids = written;
+
+    int status = 0;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Point every descriptor of the data file at /dev/full, so writes to it
+// fail with ENOSPC while the log keeps working
+static void fill_data_file()
+{
+    struct stat data;
+    int full = ::open("/dev/full", O_WRONLY);
+    if (::stat(path.c_str(), &data) != 0 || full < 0)
+    {
+        _exit(3);
+    }
+    for (int fd = 0; fd < 1024; fd++)
+    {
+        struct stat st;
+        if (fd != full && ::fstat(fd, &st) == 0 && st.st_dev == data.st_dev && st.st_ino == data.st_ino)
+        {
+            ::dup2(full, fd);
+        }
+    }
+    ::close(full);
+}
+
+static void write_first_round(std::vector<uint64_t> &page_ids)
+{
+    DatabaseEngine db(path, POOL_FRAMES);
+    if (!db.initialize())
+    {
+        _exit(1);
+    }
+    for (size_t i = 0; i < PAGES; i++)
+    {
+        uint64_t page_id = db.allocate_page();
+        db.write_page(page_id, make_page(page_id, 1));
+        page_ids.push_back(page_id);
+    }
+    if (!db.write_header())
+    {
+        _exit(2);
+    }
+    crash(page_ids);
+}
+
+static void write_second_round_to_full_disk(std::vector<uint64_t> &page_ids)
+{
+    DatabaseEngine db(path, POOL_FRAMES);
+    if (!db.open())
+    {
+        _exit(1);
+    }
+    for (uint64_t page_id : page_ids)
+    {
+        db.write_page(page_id, make_page(page_id, 2));
+    }
+    if (!db.write_header())
+    {
+        _exit(2);
+    }
+
+    // Every write-back of this checkpoint fails; it must keep the log
+    fill_data_file();
+    db.checkpoint();
+    crash(page_ids);
+}
+
+// Reopen after a crash and compare every page with the given round
+static void check_recovered(const std::vector<uint64_t> &page_ids, int round, const std::string &what)
+{
+    check(file_size(path + ".wal") > 0, what + ": the log was kept");
+
+    DatabaseEngine db(path, POOL_FRAMES);
+    if (!db.open())
+    {
+        check(false, what + ": reopen");
+        return;
+    }
+    check(file_size(path + ".wal") == 0, what + ": recovery resets the log");
+
+    size_t wrong = 0;
+    for (uint64_t page_id : page_ids)
+    {
+        Page expected = make_page(page_id, round);
+        PageHandle handle = db.pin_page(page_id);
+        if (handle.page().header.type != RECORD_HEAP ||
+            memcmp(handle.page().data, expected.data, PAGE_DATA_SIZE) != 0)
+        {
+            wrong++;
+        }
+    }
+    check(wrong == 0, what + ": " + std::to_string(wrong) + " of " + std::to_string(page_ids.size()) +
+                          " pages differ after recovery");
+    db.close();
+}
+
+int main()
+{
+    reset_file();
+
+    std::vector<uint64_t> page_ids;
+    check(crash_after(write_first_round, page_ids), "writing before the crash");
+    check_recovered(page_ids, 1, "crash before a checkpoint");
+
+    check(crash_after(write_second_round_to_full_disk, page_ids), "writing to a full disk");
+    check_recovered(page_ids, 2, "checkpoint failing to write back");
+
+    reset_file();
+    if (failures > 0)
+    {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All storage tests passed" << std::endl;
+    return 0;
+}